@@ -138,29 +138,12 @@ local function fill_set_ann(set, ann_key)
   end
 end
 
--- This function takes all inputs, applies PCA transformation and returns the final
--- PCA matrix as rspamd_tensor
-local function learn_pca(inputs, max_inputs)
-  local scatter_matrix = rspamd_tensor.scatter_matrix(rspamd_tensor.fromtable(inputs))
-  local eigenvals = scatter_matrix:eigen()
-  -- scatter matrix is not filled with eigenvectors
-  lua_util.debugm(N, 'eigenvalues: %s', eigenvals)
-  local w = rspamd_tensor.new(2, max_inputs, #scatter_matrix[1])
-  for i=1,max_inputs do
-    w[i] = scatter_matrix[#scatter_matrix - i + 1]
-  end
-
-  lua_util.debugm(N, 'pca matrix: %s', w)
-
-  return w
-end
-
 -- This function computes optimal threshold using ROC for the given set of inputs.
 -- Returns a threshold that minimizes:
 --        alpha * (false_positive_rate)  +  beta * (false_negative_rate)
 --        Where alpha is cost of false positive result
 --              beta is cost of false negative result
-local function get_roc_thresholds(ann, inputs, outputs, alpha, beta)
+local function get_roc_thresholds(ann, inputs, outputs, alpha, beta, pca)
 
   -- Sorts list x and list y based on the values in list x.
   local sort_relative = function(x, y)
@@ -190,9 +173,9 @@ local function get_roc_thresholds(ann, inputs, outputs, alpha, beta)
 
   local function get_scores(nn, input_vectors)
     local scores = {}
-    for i=1,#inputs do
-      local score = nn:apply1(input_vectors[i], nn.pca)[1]
-      scores[#scores+1] = score
+    -- Inputs are processed in a single batch
+    for i,out in ipairs(nn:apply_batch(input_vectors, pca)) do
+      scores[i] = out[1]
     end
 
     return scores
@@ -473,103 +456,81 @@ local function spawn_train(params)
       --rspamd_logger.debugm(N, rspamd_config, 'ham vector: %s', debug_vec(e))
     end
 
-    -- Called in child process
-    local function train()
-      local log_thresh = params.rule.train.max_iterations / 10
-      local seen_nan = false
-
-      local function train_cb(iter, train_cost, value_cost)
-        if (iter * (params.rule.train.max_iterations / log_thresh)) % (params.rule.train.max_iterations) == 0 then
-          if train_cost ~= train_cost and not seen_nan then
-            -- We have nan :( try to log lot's of stuff to dig into a problem
-            seen_nan = true
-            rspamd_logger.errx(rspamd_config, 'ANN %s:%s: train error: observed nan in error cost!; value cost = %s',
-                params.rule.prefix, params.set.name,
-                value_cost)
-            for i,e in ipairs(inputs) do
-              lua_util.debugm(N, rspamd_config, 'train vector %s -> %s',
-                  debug_vec(e), outputs[i][1])
-            end
-          end
+    local log_thresh = params.rule.train.max_iterations / 10
+    local seen_nan = false
 
-          rspamd_logger.infox(rspamd_config,
-              "ANN %s:%s: learned from %s redis key in %s iterations, error: %s, value cost: %s",
+    local function log_train_cost(iter, train_cost, value_cost)
+      if (iter * (params.rule.train.max_iterations / log_thresh)) % (params.rule.train.max_iterations) == 0 then
+        if train_cost ~= train_cost and not seen_nan then
+          -- We have nan :( try to log lot's of stuff to dig into a problem
+          seen_nan = true
+          rspamd_logger.errx(rspamd_config, 'ANN %s:%s: train error: observed nan in error cost!; value cost = %s',
               params.rule.prefix, params.set.name,
-              params.ann_key,
-              iter,
-              train_cost,
               value_cost)
+          for i,e in ipairs(inputs) do
+            lua_util.debugm(N, rspamd_config, 'train vector %s -> %s',
+                debug_vec(e), outputs[i][1])
+          end
         end
-      end
-
-      lua_util.debugm(N, rspamd_config, "subprocess to learn ANN %s:%s has been started",
-          params.rule.prefix, params.set.name)
 
-      local pca
-      if params.rule.max_inputs then
-        -- Train PCA in the main process, presumably it is not that long
-        lua_util.debugm(N, rspamd_config, "start PCA train for ANN %s:%s",
-            params.rule.prefix, params.set.name)
-        pca = learn_pca(inputs, params.rule.max_inputs)
+        rspamd_logger.infox(rspamd_config,
+            "ANN %s:%s: learned from %s redis key in %s iterations, error: %s, value cost: %s",
+            params.rule.prefix, params.set.name,
+            params.ann_key,
+            iter,
+            train_cost,
+            value_cost)
       end
+    end
 
-      lua_util.debugm(N, rspamd_config, "start neural train for ANN %s:%s",
-          params.rule.prefix, params.set.name)
-      local ret,err = pcall(train_ann.train1, train_ann,
-          inputs, outputs, {
-            lr = params.rule.train.learning_rate,
-            max_epoch = params.rule.train.max_iterations,
-            cb = train_cb,
-            pca = pca
-          })
-
-      if not ret then
-        rspamd_logger.errx(rspamd_config, "cannot train ann %s:%s: %s",
-            params.rule.prefix, params.set.name, err)
+    -- Called when the training thread has finished, serialises the trained ANN
+    local function finish_train(trained_ann, costs, pca)
+      for iter,cost in ipairs(costs) do
+        log_train_cost(iter, cost[1], cost[2])
+      end
 
+      if seen_nan then
         return nil
-      else
-        lua_util.debugm(N, rspamd_config, "finished neural train for ANN %s:%s",
-            params.rule.prefix, params.set.name)
       end
 
+      lua_util.debugm(N, rspamd_config, "finished neural train for ANN %s:%s",
+          params.rule.prefix, params.set.name)
+
       local roc_thresholds = {}
       if params.rule.roc_enabled then
-        local spam_threshold = get_roc_thresholds(train_ann,
+        local spam_threshold = get_roc_thresholds(trained_ann,
                                                   inputs,
                                                   outputs,
                                                   1 - params.rule.roc_misclassification_cost,
-                                                  params.rule.roc_misclassification_cost)
-        local ham_threshold = get_roc_thresholds(train_ann,
+                                                  params.rule.roc_misclassification_cost,
+                                                  pca)
+        local ham_threshold = get_roc_thresholds(trained_ann,
                                                   inputs,
                                                   outputs,
                                                   params.rule.roc_misclassification_cost,
-                                                  1 - params.rule.roc_misclassification_cost)
+                                                  1 - params.rule.roc_misclassification_cost,
+                                                  pca)
         roc_thresholds = {spam_threshold, ham_threshold}
 
         rspamd_logger.messagex("ROC thresholds: (spam_threshold: %s, ham_threshold: %s)",
                                 roc_thresholds[1], roc_thresholds[2])
       end
 
-      if not seen_nan then
-        -- Convert to strings as ucl cannot rspamd_text properly
-        local pca_data
-        if pca then
-          pca_data = tostring(pca:save())
-        end
-        local out = {
-          ann_data = tostring(train_ann:save()),
-          pca_data = pca_data,
-          roc_thresholds = roc_thresholds,
-        }
-
-        local final_data = ucl.to_format(out, 'msgpack')
-        lua_util.debugm(N, rspamd_config, "subprocess for ANN %s:%s returned %s bytes",
-            params.rule.prefix, params.set.name, #final_data)
-        return final_data
-      else
-        return nil
+      -- Convert to strings as ucl cannot rspamd_text properly
+      local pca_data
+      if pca then
+        pca_data = tostring(pca:save())
       end
+      local out = {
+        ann_data = tostring(trained_ann:save()),
+        pca_data = pca_data,
+        roc_thresholds = roc_thresholds,
+      }
+
+      local final_data = ucl.to_format(out, 'msgpack')
+      lua_util.debugm(N, rspamd_config, "training for ANN %s:%s returned %s bytes",
+          params.rule.prefix, params.set.name, #final_data)
+      return final_data
     end
 
     params.set.learning_spawned = true
@@ -627,11 +588,11 @@ local function spawn_train(params)
         end
 
 
-        -- Deserialise ANN from the child process
-        ann_trained = rspamd_kann.load(parsed.ann_data)
+        -- Deserialise ANN from the training result
+        local trained_ann = rspamd_kann.load(parsed.ann_data)
         local version = (params.set.ann.version or 0) + 1
         params.set.ann.version = version
-        params.set.ann.ann = ann_trained
+        params.set.ann.ann = trained_ann
         params.set.ann.symbols = params.set.symbols
         params.set.ann.redis_key = new_ann_key(params.rule, params.set, version)
 
@@ -672,11 +633,37 @@ local function spawn_train(params)
       fill_set_ann(params.set, params.ann_key)
     end
 
-    params.worker:spawn_process{
-      func = train,
-      on_complete = ann_trained,
-      proctitle = string.format("ANN train for %s/%s", params.rule.prefix, params.set.name),
-    }
+    lua_util.debugm(N, rspamd_config, "start neural train for ANN %s:%s",
+        params.rule.prefix, params.set.name)
+    -- Training itself is done in a separate thread, the worker is not blocked
+    local ret,err = pcall(train_ann.train_async, train_ann,
+        inputs, outputs, {
+          lr = params.rule.train.learning_rate,
+          max_epoch = params.rule.train.max_iterations,
+          threads = params.rule.train.learn_threads,
+          ev_base = params.ev_base,
+          -- PCA is learned in the training thread as well
+          learn_pca = params.rule.max_inputs and true or false,
+        },
+        function(train_err, _, trained_ann, costs, pca)
+          if train_err then
+            ann_trained(train_err)
+            return
+          end
+
+          local final_data = finish_train(trained_ann, costs, pca)
+
+          if final_data then
+            ann_trained(nil, final_data)
+          else
+            ann_trained('observed nan in error cost')
+          end
+        end)
+
+    if not ret then
+      ann_trained(err)
+      return
+    end
     -- Spawn learn and register lock extension
     params.set.learning_spawned = true
     register_lock_extender(params.rule, params.set, params.ev_base, params.ann_key)
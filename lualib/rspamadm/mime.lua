@@ -512,8 +512,9 @@ local function stat_handler(opts)
       local bt = task:get_stat_tokens()
       out_elts[fname] = bt
       process_func = function(e)
-        return string.format('%s (%d): "%s"+"%s", [%s]', e.data, e.win, e.t1 or "",
-            e.t2 or "", table.concat(fun.totable(
+        -- Tokens are merged and sorted by data, count is the number of occurrences
+        return string.format('%s (%d) x%d: "%s"+"%s", [%s]', e.data, e.win, e.count,
+            e.t1 or "", e.t2 or "", table.concat(fun.totable(
                 fun.map(function(k) return k end, e.flags)), ","))
       end
     elseif opts.fuzzy then
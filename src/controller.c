@@ -25,6 +25,7 @@
 #include "libstat/stat_api.h"
 #include "rspamd.h"
 #include "libserver/worker_util.h"
+#include "libserver/composites/composites.h"
 #include "worker_private.h"
 #include "lua/lua_common.h"
 #include "cryptobox.h"
@@ -33,6 +34,7 @@
 #include "unix-std.h"
 #include "utlist.h"
 #include "libmime/lang_detection.h"
+#include "libserver/latency_hist.h"
 #include <math.h>
 
 /* 60 seconds for worker's IO */
@@ -67,6 +69,9 @@
 #define PATH_PLUGINS "/plugins"
 #define PATH_PING "/ping"
 
+/* Rows returned by /history when no pagination is requested */
+#define CONTROLLER_HISTORY_DEFAULT_LIMIT 1000
+
 #define msg_err_session(...) rspamd_default_log_function(G_LOG_LEVEL_CRITICAL, \
         session->pool->tag.tagname, session->pool->tag.uid, \
         RSPAMD_LOG_FUNC, \
@@ -1391,117 +1396,217 @@ rspamd_controller_handle_graph (
 }
 
 static void
-rspamd_controller_handle_legacy_history (
-		struct rspamd_controller_session *session,
-		struct rspamd_controller_worker_ctx *ctx,
-		struct rspamd_http_connection_entry *conn_ent,
-		struct rspamd_http_message *msg)
+rspamd_controller_history_row (struct roll_history *history,
+		const struct roll_history_row *row, gpointer ud)
 {
-	struct roll_history_row *row, *copied_rows;
-	guint i, rows_proc, row_num;
+	ucl_object_t *top = ud, *obj, *syms_obj, *cur;
+	const gchar *name;
 	struct tm tm;
-	gchar timebuf[32], **syms;
-	ucl_object_t *top, *obj;
+	gchar timebuf[32];
+	guint j;
 
-	top = ucl_object_typed_new (UCL_ARRAY);
+	rspamd_localtime (row->timestamp, &tm);
+	strftime (timebuf, sizeof (timebuf) - 1, "%Y-%m-%d %H:%M:%S", &tm);
+	obj = ucl_object_typed_new (UCL_OBJECT);
+	ucl_object_insert_key (obj, ucl_object_fromstring (
+			timebuf),		  "time", 0, false);
+	ucl_object_insert_key (obj, ucl_object_fromint (
+			row->timestamp), "unix_time", 0, false);
+	ucl_object_insert_key (obj, ucl_object_fromstring (
+			row->message_id), "id",	  0, false);
+	ucl_object_insert_key (obj, ucl_object_fromstring (row->from_addr),
+			"ip", 0, false);
+	ucl_object_insert_key (obj,
+			ucl_object_fromstring (rspamd_action_to_str (
+					row->action)), "action", 0, false);
 
-	/* Set lock on history */
-	copied_rows = g_malloc (sizeof (*copied_rows) * ctx->srv->history->nrows);
-	memcpy (copied_rows, ctx->srv->history->rows,
-			sizeof (*copied_rows) * ctx->srv->history->nrows);
+	if (!isnan (row->score)) {
+		ucl_object_insert_key (obj, ucl_object_fromdouble (
+				row->score),		  "score",			0, false);
+	}
+	else {
+		ucl_object_insert_key (obj,
+				ucl_object_fromdouble (0.0), "score", 0, false);
+	}
 
-	/* Go through all rows */
-	row_num = ctx->srv->history->cur_row;
+	if (!isnan (row->required_score)) {
+		ucl_object_insert_key (obj,
+				ucl_object_fromdouble (
+						row->required_score), "required_score", 0, false);
+	}
+	else {
+		ucl_object_insert_key (obj,
+				ucl_object_fromdouble (0.0), "required_score", 0, false);
+	}
+
+	syms_obj = ucl_object_typed_new (UCL_OBJECT);
+	ucl_object_reserve (syms_obj, row->nsymbols);
+
+	for (j = 0; j < row->nsymbols; j++) {
+		name = rspamd_roll_history_symbol_name (history, row->symbols[j]);
 
-	for (i = 0, rows_proc = 0; i < ctx->srv->history->nrows; i++, row_num++) {
-		if (row_num == ctx->srv->history->nrows) {
-			row_num = 0;
+		if (name == NULL) {
+			continue;
 		}
-		row = &copied_rows[row_num];
-		/* Get only completed rows */
-		if (row->completed) {
-			rspamd_localtime (row->timestamp, &tm);
-			strftime (timebuf, sizeof (timebuf) - 1, "%Y-%m-%d %H:%M:%S", &tm);
-			obj = ucl_object_typed_new (UCL_OBJECT);
-			ucl_object_insert_key (obj, ucl_object_fromstring (
-					timebuf),		  "time", 0, false);
-			ucl_object_insert_key (obj, ucl_object_fromint (
-					row->timestamp), "unix_time", 0, false);
-			ucl_object_insert_key (obj, ucl_object_fromstring (
-					row->message_id), "id",	  0, false);
-			ucl_object_insert_key (obj, ucl_object_fromstring (row->from_addr),
-					"ip", 0, false);
-			ucl_object_insert_key (obj,
-					ucl_object_fromstring (rspamd_action_to_str (
-							row->action)), "action", 0, false);
-
-			if (!isnan (row->score)) {
-				ucl_object_insert_key (obj, ucl_object_fromdouble (
-						row->score),		  "score",			0, false);
-			}
-			else {
-				ucl_object_insert_key (obj,
-						ucl_object_fromdouble (0.0), "score", 0, false);
-			}
 
-			if (!isnan (row->required_score)) {
-				ucl_object_insert_key (obj,
-						ucl_object_fromdouble (
-								row->required_score), "required_score", 0, false);
-			}
-			else {
-				ucl_object_insert_key (obj,
-						ucl_object_fromdouble (0.0), "required_score", 0, false);
-			}
+		cur = ucl_object_typed_new (UCL_OBJECT);
+		ucl_object_insert_key (cur, ucl_object_fromdouble (0.0),
+				"score", 0, false);
+		ucl_object_insert_key (syms_obj, cur, name, 0, true);
+	}
 
-			syms = g_strsplit_set (row->symbols, ", ", -1);
+	ucl_object_insert_key (obj, syms_obj, "symbols", 0, false);
+	ucl_object_insert_key (obj, ucl_object_fromint (row->len),
+			"size", 0, false);
+	ucl_object_insert_key (obj,
+			ucl_object_fromdouble (row->scan_time),
+			"scan_time", 0, false);
 
-			if (syms) {
-				guint nelts = g_strv_length (syms);
-				ucl_object_t *syms_obj = ucl_object_typed_new (UCL_OBJECT);
-				ucl_object_reserve (syms_obj, nelts);
+	if (row->user[0] != '\0') {
+		ucl_object_insert_key (obj, ucl_object_fromstring (row->user),
+				"user", 0, false);
+	}
+	if (row->from_addr[0] != '\0') {
+		ucl_object_insert_key (obj, ucl_object_fromstring (
+				row->from_addr), "from", 0, false);
+	}
 
-				for (guint j = 0; j < nelts; j++) {
-					g_strstrip (syms[j]);
+	ucl_array_append (top, obj);
+}
 
-					if (strlen (syms[j]) == 0) {
-						/* Empty garbage */
-						continue;
-					}
+/*
+ * Fills history query from request arguments, returns TRUE if any filter
+ * (not just pagination) has been specified
+ */
+static gboolean
+rspamd_controller_history_query (struct rspamd_controller_session *session,
+		struct rspamd_http_message *msg,
+		struct roll_history_query *query)
+{
+	GHashTable *params;
+	rspamd_ftok_t srch, *found;
+	glong from = 0, to = -1;
+	gboolean filtered = FALSE;
+	gint action;
 
-					ucl_object_t *cur = ucl_object_typed_new (UCL_OBJECT);
+	rspamd_roll_history_query_init (query);
+	query->limit = CONTROLLER_HISTORY_DEFAULT_LIMIT;
+	params = rspamd_http_message_parse_query (msg);
 
-					ucl_object_insert_key (cur, ucl_object_fromdouble (0.0),
-							"score", 0, false);
-					ucl_object_insert_key (syms_obj, cur, syms[j], 0, true);
-				}
+	if (params == NULL) {
+		return FALSE;
+	}
 
-				ucl_object_insert_key (obj, syms_obj, "symbols", 0, false);
-				g_strfreev (syms);
-			}
+	/* Pagination is the same as for the lua history handler */
+	RSPAMD_FTOK_ASSIGN (&srch, "from");
+	found = g_hash_table_lookup (params, &srch);
 
-			ucl_object_insert_key (obj, ucl_object_fromint (row->len),
-					"size", 0, false);
-			ucl_object_insert_key (obj,
-					ucl_object_fromdouble (row->scan_time),
-					"scan_time", 0, false);
+	if (found && rspamd_strtol (found->begin, found->len, &from) && from > 0) {
+		query->offset = from;
+	}
 
-			if (row->user[0] != '\0') {
-				ucl_object_insert_key (obj, ucl_object_fromstring (row->user),
-						"user", 0, false);
-			}
-			if (row->from_addr[0] != '\0') {
-				ucl_object_insert_key (obj, ucl_object_fromstring (
-						row->from_addr), "from", 0, false);
-			}
-			ucl_array_append (top, obj);
-			rows_proc++;
+	RSPAMD_FTOK_ASSIGN (&srch, "to");
+	found = g_hash_table_lookup (params, &srch);
+
+	if (found && rspamd_strtol (found->begin, found->len, &to) && to >= from) {
+		query->limit = to - from + 1;
+	}
+
+	RSPAMD_FTOK_ASSIGN (&srch, "since");
+	found = g_hash_table_lookup (params, &srch);
+
+	if (found) {
+		query->since = g_ascii_strtod (
+				rspamd_mempool_ftokdup (session->pool, found), NULL);
+		filtered = TRUE;
+	}
+
+	RSPAMD_FTOK_ASSIGN (&srch, "until");
+	found = g_hash_table_lookup (params, &srch);
+
+	if (found) {
+		query->until = g_ascii_strtod (
+				rspamd_mempool_ftokdup (session->pool, found), NULL);
+		filtered = TRUE;
+	}
+
+	RSPAMD_FTOK_ASSIGN (&srch, "min_score");
+	found = g_hash_table_lookup (params, &srch);
+
+	if (found) {
+		query->min_score = g_ascii_strtod (
+				rspamd_mempool_ftokdup (session->pool, found), NULL);
+		filtered = TRUE;
+	}
+
+	RSPAMD_FTOK_ASSIGN (&srch, "max_score");
+	found = g_hash_table_lookup (params, &srch);
+
+	if (found) {
+		query->max_score = g_ascii_strtod (
+				rspamd_mempool_ftokdup (session->pool, found), NULL);
+		filtered = TRUE;
+	}
+
+	RSPAMD_FTOK_ASSIGN (&srch, "action");
+	found = g_hash_table_lookup (params, &srch);
+
+	if (found) {
+		if (rspamd_action_from_str (rspamd_mempool_ftokdup (session->pool, found),
+				&action)) {
+			query->action = action;
 		}
+		else {
+			/* Unknown action matches nothing */
+			query->action = G_MAXINT;
+		}
+
+		filtered = TRUE;
+	}
+
+	RSPAMD_FTOK_ASSIGN (&srch, "symbol");
+	found = g_hash_table_lookup (params, &srch);
+
+	if (found) {
+		query->symbol = rspamd_mempool_ftokdup (session->pool, found);
+		filtered = TRUE;
+	}
+
+	g_hash_table_unref (params);
+
+	return filtered;
+}
+
+static void
+rspamd_controller_handle_legacy_history (
+		struct rspamd_controller_session *session,
+		struct rspamd_controller_worker_ctx *ctx,
+		struct rspamd_http_connection_entry *conn_ent,
+		struct rspamd_http_message *msg)
+{
+	struct roll_history_query query;
+	ucl_object_t *top, *rows;
+	gboolean filtered;
+	guint total;
+
+	filtered = rspamd_controller_history_query (session, msg, &query);
+	rows = ucl_object_typed_new (UCL_ARRAY);
+	total = rspamd_roll_history_query (ctx->srv->history, &query,
+			rspamd_controller_history_row, rows);
+
+	if (filtered) {
+		top = ucl_object_typed_new (UCL_OBJECT);
+		ucl_object_insert_key (top, ucl_object_fromint (total),
+				"total", 0, false);
+		ucl_object_insert_key (top, rows, "rows", 0, false);
+	}
+	else {
+		/* WebUI expects a plain array from this backend */
+		top = rows;
 	}
 
 	rspamd_controller_send_ucl (conn_ent, top);
 	ucl_object_unref (top);
-	g_free (copied_rows);
 }
 
 static gboolean
@@ -1568,10 +1673,10 @@ rspamd_controller_handle_lua_history (lua_State *L,
 
 				ptask = lua_newuserdata (L, sizeof (*ptask));
 				*ptask = task;
-				rspamd_lua_setclass (L, "rspamd{task}", -1);
+				rspamd_lua_setclass (L, rspamd_task_classname, -1);
 				pconn_ent = lua_newuserdata (L, sizeof (*pconn_ent));
 				*pconn_ent = conn_ent;
-				rspamd_lua_setclass (L, "rspamd{csession}", -1);
+				rspamd_lua_setclass (L, rspamd_csession_classname, -1);
 				lua_pushinteger (L, from);
 				lua_pushinteger (L, to);
 				lua_pushboolean (L, reset);
@@ -1673,11 +1778,14 @@ rspamd_controller_handle_ready (struct rspamd_http_connection_entry *conn_ent,
  * History command handler:
  * request: /history
  * headers: Password
+ * query: from, to (row numbers), since, until (unix time), min_score,
+ *        max_score, action, symbol
  * reply: json [
  *      { label: "Foo", data: 11 },
  *      { label: "Bar", data: 20 },
  *      {...}
  * ]
+ * or { total: 100, rows: [...] } if any filter has been specified
  */
 static int
 rspamd_controller_handle_history (struct rspamd_http_connection_entry *conn_ent,
@@ -1766,8 +1874,7 @@ rspamd_controller_handle_history_reset (struct rspamd_http_connection_entry *con
 {
 	struct rspamd_controller_session *session = conn_ent->ud;
 	struct rspamd_controller_worker_ctx *ctx;
-	struct roll_history_row *row;
-	guint completed_rows, i, t;
+	guint completed_rows;
 	lua_State *L;
 
 	ctx = session->ctx;
@@ -1778,22 +1885,7 @@ rspamd_controller_handle_history_reset (struct rspamd_http_connection_entry *con
 	}
 
 	if (!ctx->srv->history->disabled) {
-		/* Clean from start to the current row */
-		completed_rows = g_atomic_int_get (&ctx->srv->history->cur_row);
-
-		completed_rows = MIN (completed_rows, ctx->srv->history->nrows - 1);
-
-		for (i = 0; i <= completed_rows; i ++) {
-			t = g_atomic_int_get (&ctx->srv->history->cur_row);
-
-			/* We somehow come to the race condition */
-			if (i > t) {
-				break;
-			}
-
-			row = &ctx->srv->history->rows[i];
-			memset (row, 0, sizeof (*row));
-		}
+		completed_rows = rspamd_roll_history_reset (ctx->srv->history);
 
 		msg_info_session ("<%s> cleared %d entries from history",
 				rspamd_inet_address_to_string (session->from_addr),
@@ -1928,11 +2020,11 @@ rspamd_controller_handle_lua (struct rspamd_http_connection_entry *conn_ent,
 	}
 
 	ptask = lua_newuserdata (L, sizeof (*ptask));
-	rspamd_lua_setclass (L, "rspamd{task}", -1);
+	rspamd_lua_setclass (L, rspamd_task_classname, -1);
 	*ptask = task;
 
 	pconn = lua_newuserdata (L, sizeof (*pconn));
-	rspamd_lua_setclass (L, "rspamd{csession}", -1);
+	rspamd_lua_setclass (L, rspamd_csession_classname, -1);
 	*pconn = conn_ent;
 
 	if (lua_pcall (L, 2, 0, 0) != 0) {
@@ -2644,6 +2736,86 @@ rspamd_controller_stat_cleanup_task (void *ud)
 	ucl_object_unref (cbdata->top);
 }
 
+static const struct {
+	gdouble q;
+	const gchar *name;
+} controller_latency_quantiles[] = {
+	{0.5, "p50"},
+	{0.9, "p90"},
+	{0.99, "p99"},
+	{0.999, "p999"},
+};
+
+/* Merges histograms of all workers for each stage */
+static void
+rspamd_controller_latency_merge (struct rspamd_latency_stat *st,
+		struct rspamd_latency_hist *merged)
+{
+	guint i, j;
+
+	memset (merged, 0, sizeof (*merged) * RSPAMD_LATENCY_STAGE_MAX);
+
+	for (i = 0; i < RSPAMD_LATENCY_MAX_SLOTS; i ++) {
+		if (st->slots[i].pid == 0) {
+			continue;
+		}
+
+		for (j = 0; j < RSPAMD_LATENCY_STAGE_MAX; j ++) {
+			rspamd_latency_hist_merge (&merged[j], &st->slots[i].stages[j]);
+		}
+	}
+}
+
+static ucl_object_t *
+rspamd_controller_latency_ucl (struct rspamd_latency_stat *st)
+{
+	struct rspamd_latency_hist merged[RSPAMD_LATENCY_STAGE_MAX];
+	ucl_object_t *top, *elt;
+	guint i, j;
+
+	top = ucl_object_typed_new (UCL_OBJECT);
+	rspamd_controller_latency_merge (st, merged);
+
+	for (i = 0; i < RSPAMD_LATENCY_STAGE_MAX; i ++) {
+		if (merged[i].count == 0) {
+			continue;
+		}
+
+		elt = ucl_object_typed_new (UCL_OBJECT);
+		ucl_object_insert_key (elt, ucl_object_fromint (merged[i].count),
+				"count", 0, false);
+		ucl_object_insert_key (elt,
+				ucl_object_fromdouble (merged[i].sum_us / 1e6 / merged[i].count),
+				"avg", 0, false);
+
+		for (j = 0; j < G_N_ELEMENTS (controller_latency_quantiles); j ++) {
+			ucl_object_insert_key (elt,
+					ucl_object_fromdouble (rspamd_latency_hist_quantile (&merged[i],
+							controller_latency_quantiles[j].q)),
+					controller_latency_quantiles[j].name, 0, false);
+		}
+
+		ucl_object_insert_key (top, elt, rspamd_latency_stage_name (i), 0, false);
+	}
+
+	return top;
+}
+
+/* Resets counters shared by /stat and /metrics */
+static void
+rspamd_controller_stat_reset (struct rspamd_stat *stat)
+{
+	stat->messages_scanned = 0;
+	stat->messages_learned = 0;
+	stat->connections_count = 0;
+	stat->control_connections_count = 0;
+	stat->dns_cache_hits = 0;
+	stat->dns_cache_misses = 0;
+	stat->dns_coalesced = 0;
+	rspamd_latency_stat_reset (stat->latency);
+	rspamd_mempool_stat_reset ();
+}
+
 /*
  * Stat command handler:
  * request: /stat (/resetstat)
@@ -2766,13 +2938,28 @@ rspamd_controller_handle_stat_common (
 			mem_st.oversized_chunks), "chunks_oversized", 0, false);
 	ucl_object_insert_key (top,
 			ucl_object_fromint (mem_st.fragmented_size), "fragmented", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (mem_st.cache_hits), "chunks_reused", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (mem_st.cache_misses), "chunks_not_reused", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (mem_st.cache_trimmed), "chunks_trimmed", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (mem_st.cached_bytes), "cached_bytes", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (stat->dns_cache_hits), "dns_cache_hits", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (stat->dns_cache_misses), "dns_cache_misses", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (stat->dns_coalesced), "dns_coalesced", 0, false);
+
+	if (stat->latency) {
+		ucl_object_insert_key (top,
+				rspamd_controller_latency_ucl (stat->latency), "latency", 0, false);
+	}
 
 	if (do_reset) {
-		session->ctx->srv->stat->messages_scanned = 0;
-		session->ctx->srv->stat->messages_learned = 0;
-		session->ctx->srv->stat->connections_count = 0;
-		session->ctx->srv->stat->control_connections_count = 0;
-		rspamd_mempool_stat_reset ();
+		rspamd_controller_stat_reset (session->ctx->srv->stat);
 	}
 
 	fuzzy_stat_command (task);
@@ -2815,6 +3002,99 @@ rspamd_controller_handle_statreset (
 	return rspamd_controller_handle_stat_common (conn_ent, msg, TRUE);
 }
 
+/*
+ * Exports per worker latency histograms; buckets are exported with the
+ * power of two resolution, while quantiles use all sub-buckets
+ */
+static void
+rspamd_controller_metrics_add_latency (rspamd_fstring_t **output,
+									   struct rspamd_latency_stat *st)
+{
+	struct rspamd_latency_hist merged[RSPAMD_LATENCY_STAGE_MAX];
+	struct rspamd_latency_slot *slot;
+	const gchar *stage_name;
+	guint64 cum;
+	guint i, j, k;
+
+	rspamd_printf_fstring (output, "# HELP rspamd_task_stage_duration_seconds "
+			"Duration of tasks processing stages.\n");
+	rspamd_printf_fstring (output, "# TYPE rspamd_task_stage_duration_seconds histogram\n");
+
+	for (i = 0; i < RSPAMD_LATENCY_MAX_SLOTS; i ++) {
+		slot = &st->slots[i];
+
+		if (slot->pid == 0) {
+			continue;
+		}
+
+		for (j = 0; j < RSPAMD_LATENCY_STAGE_MAX; j ++) {
+			struct rspamd_latency_hist hist;
+
+			memset (&hist, 0, sizeof (hist));
+			rspamd_latency_hist_merge (&hist, &slot->stages[j]);
+
+			if (hist.count == 0) {
+				continue;
+			}
+
+			stage_name = rspamd_latency_stage_name (j);
+			cum = 0;
+
+			/*
+			 * The last bucket holds overflows, so it is exported as +Inf only.
+			 * Counters are loaded one by one while workers update them, so
+			 * +Inf and count are the sum of buckets to keep them consistent.
+			 */
+			for (k = 0; k < RSPAMD_LATENCY_BUCKETS - 1; k ++) {
+				cum += hist.buckets[k];
+
+				if (k % RSPAMD_LATENCY_SUB_BUCKETS == RSPAMD_LATENCY_SUB_BUCKETS - 1) {
+					rspamd_printf_fstring (output,
+							"rspamd_task_stage_duration_seconds_bucket{worker=\"%s\","
+							"index=\"%ud\",stage=\"%s\",le=\"%.6f\"} %uL\n",
+							slot->type, slot->index, stage_name,
+							rspamd_latency_bucket_upper (k), cum);
+				}
+			}
+
+			cum += hist.buckets[RSPAMD_LATENCY_BUCKETS - 1];
+			rspamd_printf_fstring (output,
+					"rspamd_task_stage_duration_seconds_bucket{worker=\"%s\","
+					"index=\"%ud\",stage=\"%s\",le=\"+Inf\"} %uL\n",
+					slot->type, slot->index, stage_name, cum);
+			rspamd_printf_fstring (output,
+					"rspamd_task_stage_duration_seconds_sum{worker=\"%s\","
+					"index=\"%ud\",stage=\"%s\"} %.6f\n",
+					slot->type, slot->index, stage_name, hist.sum_us / 1e6);
+			rspamd_printf_fstring (output,
+					"rspamd_task_stage_duration_seconds_count{worker=\"%s\","
+					"index=\"%ud\",stage=\"%s\"} %uL\n",
+					slot->type, slot->index, stage_name, cum);
+		}
+	}
+
+	rspamd_controller_latency_merge (st, merged);
+	rspamd_printf_fstring (output, "# HELP rspamd_task_stage_duration_quantile_seconds "
+			"Estimated quantiles of tasks processing stages duration for all workers.\n");
+	rspamd_printf_fstring (output, "# TYPE rspamd_task_stage_duration_quantile_seconds gauge\n");
+
+	for (j = 0; j < RSPAMD_LATENCY_STAGE_MAX; j ++) {
+		if (merged[j].count == 0) {
+			continue;
+		}
+
+		for (k = 0; k < G_N_ELEMENTS (controller_latency_quantiles); k ++) {
+			rspamd_printf_fstring (output,
+					"rspamd_task_stage_duration_quantile_seconds{stage=\"%s\","
+					"quantile=\"%.3f\"} %.6f\n",
+					rspamd_latency_stage_name (j),
+					controller_latency_quantiles[k].q,
+					rspamd_latency_hist_quantile (&merged[j],
+							controller_latency_quantiles[k].q));
+		}
+	}
+}
+
 static inline void
 rspamd_controller_metrics_add_integer (rspamd_fstring_t **output,
 									   const ucl_object_t *top,
@@ -2946,6 +3226,41 @@ rspamd_controller_metrics_fin_task (void *ud) {
 			"gauge",
 			"Memory pools: fragmented memory waste.",
 			"fragmented");
+	rspamd_controller_metrics_add_integer(&output, top,
+			"rspamd_chunks_reused",
+			"counter",
+			"Memory pools: chunks reused from the per-worker cache.",
+			"chunks_reused");
+	rspamd_controller_metrics_add_integer(&output, top,
+			"rspamd_chunks_not_reused",
+			"counter",
+			"Memory pools: chunks allocated as the per-worker cache had no suitable chunk.",
+			"chunks_not_reused");
+	rspamd_controller_metrics_add_integer(&output, top,
+			"rspamd_chunks_trimmed",
+			"counter",
+			"Memory pools: cached chunks released on idle.",
+			"chunks_trimmed");
+	rspamd_controller_metrics_add_integer(&output, top,
+			"rspamd_cached_bytes",
+			"gauge",
+			"Memory pools: bytes kept in per-worker chunks caches.",
+			"cached_bytes");
+	rspamd_controller_metrics_add_integer(&output, top,
+			"rspamd_dns_cache_hits",
+			"counter",
+			"DNS: replies served from the per-worker answers cache.",
+			"dns_cache_hits");
+	rspamd_controller_metrics_add_integer(&output, top,
+			"rspamd_dns_cache_misses",
+			"counter",
+			"DNS: requests sent to upstream resolvers.",
+			"dns_cache_misses");
+	rspamd_controller_metrics_add_integer(&output, top,
+			"rspamd_dns_coalesced",
+			"counter",
+			"DNS: requests joined to an identical request in flight.",
+			"dns_coalesced");
 
 	rspamd_printf_fstring (&output, "# HELP rspamd_learns_total Total learns.\n");
 	rspamd_printf_fstring (&output, "# TYPE rspamd_learns_total counter\n");
@@ -3081,6 +3396,11 @@ rspamd_controller_metrics_fin_task (void *ud) {
 		}
 	}
 
+	if (cbdata->ctx->worker->srv->stat->latency) {
+		rspamd_controller_metrics_add_latency (&output,
+				cbdata->ctx->worker->srv->stat->latency);
+	}
+
 	rspamd_printf_fstring (&output, "# EOF\n");
 
 	rspamd_controller_send_openmetrics (conn_ent, output);
@@ -3201,13 +3521,23 @@ rspamd_controller_handle_metrics_common (
 			mem_st.oversized_chunks), "chunks_oversized", 0, false);
 	ucl_object_insert_key (top,
 			ucl_object_fromint (mem_st.fragmented_size), "fragmented", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (mem_st.cache_hits), "chunks_reused", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (mem_st.cache_misses), "chunks_not_reused", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (mem_st.cache_trimmed), "chunks_trimmed", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (mem_st.cached_bytes), "cached_bytes", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (stat->dns_cache_hits), "dns_cache_hits", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (stat->dns_cache_misses), "dns_cache_misses", 0, false);
+	ucl_object_insert_key (top,
+			ucl_object_fromint (stat->dns_coalesced), "dns_coalesced", 0, false);
 
 	if (do_reset) {
-		session->ctx->srv->stat->messages_scanned = 0;
-		session->ctx->srv->stat->messages_learned = 0;
-		session->ctx->srv->stat->connections_count = 0;
-		session->ctx->srv->stat->control_connections_count = 0;
-		rspamd_mempool_stat_reset ();
+		rspamd_controller_stat_reset (session->ctx->srv->stat);
 	}
 
 	fuzzy_stat_command (task);
@@ -3260,6 +3590,8 @@ rspamd_controller_handle_counters (
 
 	if (cache != NULL) {
 		top = rspamd_symcache_counters (cache);
+		rspamd_composites_manager_counters (session->ctx->cfg->composites_manager,
+				top);
 		rspamd_controller_send_ucl (conn_ent, top);
 		ucl_object_unref (top);
 	}
@@ -3554,12 +3886,12 @@ rspamd_controller_handle_lua_plugin (struct rspamd_http_connection_entry *conn_e
 
 	/* Task */
 	ptask = lua_newuserdata (L, sizeof (*ptask));
-	rspamd_lua_setclass (L, "rspamd{task}", -1);
+	rspamd_lua_setclass (L, rspamd_task_classname, -1);
 	*ptask = task;
 
 	/* Connection */
 	pconn = lua_newuserdata (L, sizeof (*pconn));
-	rspamd_lua_setclass (L, "rspamd{csession}", -1);
+	rspamd_lua_setclass (L, rspamd_csession_classname, -1);
 	*pconn = conn_ent;
 
 	/* Query arguments */
@@ -3832,14 +4164,14 @@ static const struct luaL_reg lua_csessionlib_m[] = {
 static void
 luaopen_controller (lua_State * L)
 {
-	rspamd_lua_new_class (L, "rspamd{csession}", lua_csessionlib_m);
+	rspamd_lua_new_class (L, rspamd_csession_classname, lua_csessionlib_m);
 	lua_pop (L, 1);
 }
 
 struct rspamd_http_connection_entry *
 lua_check_controller_entry (lua_State * L, gint pos)
 {
-	void *ud = rspamd_lua_check_udata (L, pos, "rspamd{csession}");
+	void *ud = rspamd_lua_check_udata (L, pos, rspamd_csession_classname);
 	luaL_argcheck (L, ud != NULL, pos, "'csession' expected");
 	return ud ? *((struct rspamd_http_connection_entry **)ud) : NULL;
 }
@@ -3854,7 +4186,7 @@ lua_csession_get_ev_base (lua_State *L)
 	if (c) {
 		s = c->ud;
 		pbase = lua_newuserdata (L, sizeof (struct ev_loop *));
-		rspamd_lua_setclass (L, "rspamd{ev_base}", -1);
+		rspamd_lua_setclass (L, rspamd_ev_base_classname, -1);
 		*pbase = s->ctx->event_loop;
 	}
 	else {
@@ -3874,7 +4206,7 @@ lua_csession_get_cfg (lua_State *L)
 	if (c) {
 		s = c->ud;
 		pcfg = lua_newuserdata (L, sizeof (gpointer));
-		rspamd_lua_setclass (L, "rspamd{config}", -1);
+		rspamd_lua_setclass (L, rspamd_config_classname, -1);
 		*pcfg = s->ctx->cfg;
 	}
 	else {
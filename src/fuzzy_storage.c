@@ -48,6 +48,10 @@
 #define DEFAULT_MAX_BUCKETS 2000
 #define DEFAULT_BUCKET_TTL 3600
 #define DEFAULT_BUCKET_MASK 24
+#define DEFAULT_RECV_BATCH 16
+#define DEFAULT_HOT_CACHE_TTL 10
+/* Linux UIO_MAXIOV */
+#define MAX_RECV_BATCH 1024
 /* Update stats on keys each 1 hour */
 #define KEY_STAT_INTERVAL 3600.0
 
@@ -80,6 +84,10 @@ struct fuzzy_global_stat {
 	guint64 invalid_requests;
 	/**< amount of delayed hashes found				*/
 	guint64 delayed_hashes;
+	/**< check results served from the hot cache		*/
+	guint64 hot_cache_hits;
+	/**< check results not found in the hot cache		*/
+	guint64 hot_cache_misses;
 };
 
 struct fuzzy_key_stat {
@@ -156,6 +164,15 @@ struct rspamd_fuzzy_storage_ctx {
 	/* Used to send data between workers */
 	gint peer_fd;
 
+	/* Number of datagrams to receive (and to reply) per syscall */
+	guint recv_batch;
+	struct fuzzy_io_batch *io_batch;
+
+	/* Recent check results */
+	guint hot_cache_size;
+	guint hot_cache_ttl;
+	rspamd_lru_hash_t *hot_cache;
+
 	/* Ratelimits */
 	guint leaky_bucket_ttl;
 	guint leaky_bucket_mask;
@@ -193,6 +210,7 @@ struct fuzzy_session {
 
 	enum rspamd_fuzzy_epoch epoch;
 	enum fuzzy_cmd_type cmd_type;
+	gboolean from_hot_cache;
 	gint fd;
 	ev_tstamp timestamp;
 	struct ev_io io;
@@ -200,6 +218,14 @@ struct fuzzy_session {
 	struct fuzzy_key *key;
 	struct rspamd_fuzzy_cmd_extension *extensions;
 	guchar nm[rspamd_cryptobox_MAX_NMBYTES];
+	/* Batched requests: sub-sessions for commands and the packed reply */
+	GPtrArray *batch_cmds;
+	guchar *batch_reply;
+	gsize batch_reply_len;
+	guint batch_pending;
+	/* For a command from a batch: the batch session and position in it */
+	struct fuzzy_session *batch;
+	guint batch_idx;
 };
 
 struct fuzzy_peer_request {
@@ -207,6 +233,47 @@ struct fuzzy_peer_request {
 	struct fuzzy_peer_cmd cmd;
 };
 
+#define FUZZY_INPUT_BUFLEN RSPAMD_FUZZY_BATCH_MAX_LEN
+
+union sa_union {
+	struct sockaddr sa;
+	struct sockaddr_in s4;
+	struct sockaddr_in6 s6;
+	struct sockaddr_un su;
+	struct sockaddr_storage ss;
+};
+
+#ifdef HAVE_RECVMMSG
+#define MSG_FIELD(msg, field) msg.msg_hdr.field
+typedef struct mmsghdr fuzzy_msghdr_t;
+#else
+#define MSG_FIELD(msg, field) msg.field
+typedef struct msghdr fuzzy_msghdr_t;
+#endif
+
+/*
+ * Per worker buffers used to receive datagrams and to send replies in batches:
+ * replies produced synchronously while processing a received batch are
+ * collected and written by a single sendmmsg call
+ */
+struct fuzzy_io_batch {
+	guint nelts;
+	/* Receive part */
+	fuzzy_msghdr_t *in_msgs;
+	struct iovec *in_iovs;
+	union sa_union *in_addrs;
+	guint8 (*in_bufs)[FUZZY_INPUT_BUFLEN];
+	/* Reply part */
+	gboolean collecting;
+	gint fd;
+	guint nreplies;
+	struct fuzzy_session **out_sessions;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr *out_msgs;
+	struct iovec *out_iovs;
+#endif
+};
+
 KHASH_INIT(fuzzy_key_flag_stat, int, struct fuzzy_key_stat, 1, kh_int_hash_func,
 	kh_int_hash_equal);
 struct fuzzy_key {
@@ -217,6 +284,12 @@ struct fuzzy_key {
 	khash_t(fuzzy_key_ids_set) *forbidden_ids;
 };
 
+/* Key for the hot cache: digest plus hash of shingles (if any) */
+struct fuzzy_hot_key {
+	guchar digest[rspamd_cryptobox_HASHBYTES];
+	guint64 sgl_hash;
+};
+
 struct rspamd_updates_cbdata {
 	GArray *updates_pending;
 	struct rspamd_fuzzy_storage_ctx *ctx;
@@ -226,6 +299,7 @@ struct rspamd_updates_cbdata {
 
 
 static void rspamd_fuzzy_write_reply (struct fuzzy_session *session);
+static void fuzzy_session_destroy (gpointer d);
 static gboolean rspamd_fuzzy_process_updates_queue (struct rspamd_fuzzy_storage_ctx *ctx,
 													const gchar *source, gboolean final);
 static gboolean rspamd_fuzzy_check_client (struct rspamd_fuzzy_storage_ctx *ctx,
@@ -532,6 +606,74 @@ fuzzy_update_version_callback (guint64 ver, void *ud)
 {
 }
 
+static guint
+fuzzy_hot_key_hash (gconstpointer p)
+{
+	const struct fuzzy_hot_key *k = p;
+	guint64 h;
+
+	/* Digest is a cryptographic hash, so its prefix is good enough */
+	memcpy (&h, k->digest, sizeof (h));
+
+	return (guint)(h ^ k->sgl_hash);
+}
+
+static gboolean
+fuzzy_hot_key_equal (gconstpointer a, gconstpointer b)
+{
+	return memcmp (a, b, sizeof (struct fuzzy_hot_key)) == 0;
+}
+
+static void
+rspamd_fuzzy_hot_cache_init (struct rspamd_fuzzy_storage_ctx *ctx)
+{
+	ctx->hot_cache = rspamd_lru_hash_new_full (ctx->hot_cache_size,
+			g_free, g_free, fuzzy_hot_key_hash, fuzzy_hot_key_equal);
+}
+
+static void
+rspamd_fuzzy_hot_key_init (struct fuzzy_session *session,
+		struct fuzzy_hot_key *k)
+{
+	memset (k, 0, sizeof (*k));
+	memcpy (k->digest, session->cmd.basic.digest, sizeof (k->digest));
+
+	if (session->cmd_type == CMD_SHINGLE ||
+			session->cmd_type == CMD_ENCRYPTED_SHINGLE) {
+		k->sgl_hash = rspamd_cryptobox_fast_hash (&session->cmd.sgl,
+				sizeof (session->cmd.sgl), rspamd_hash_seed ());
+	}
+}
+
+static void
+rspamd_fuzzy_hot_cache_insert (struct fuzzy_session *session,
+		const struct rspamd_fuzzy_reply *result)
+{
+	struct rspamd_fuzzy_storage_ctx *ctx = session->ctx;
+	struct fuzzy_hot_key *k;
+	struct rspamd_fuzzy_reply *cached;
+
+	k = g_malloc (sizeof (*k));
+	rspamd_fuzzy_hot_key_init (session, k);
+	cached = g_malloc (sizeof (*cached));
+	memcpy (cached, result, sizeof (*cached));
+	rspamd_lru_hash_insert (ctx->hot_cache, k, cached,
+			(time_t)session->timestamp, ctx->hot_cache_ttl);
+}
+
+/*
+ * Drops all cached check results: used when a batch of writes has been
+ * applied, as new shingles could change results for other digests as well
+ */
+static void
+rspamd_fuzzy_hot_cache_flush (struct rspamd_fuzzy_storage_ctx *ctx)
+{
+	if (ctx->hot_cache && rspamd_lru_hash_size (ctx->hot_cache) > 0) {
+		rspamd_lru_hash_destroy (ctx->hot_cache);
+		rspamd_fuzzy_hot_cache_init (ctx);
+	}
+}
+
 static void
 rspamd_fuzzy_updates_cb (gboolean success,
 						 guint nadded,
@@ -550,6 +692,17 @@ rspamd_fuzzy_updates_cb (gboolean success,
 	if (success) {
 		rspamd_fuzzy_backend_count(ctx->backend, fuzzy_count_callback, ctx);
 
+		for (guint i = 0; i < cbdata->updates_pending->len; i ++) {
+			struct fuzzy_peer_cmd *io_cmd = &g_array_index (cbdata->updates_pending,
+					struct fuzzy_peer_cmd, i);
+
+			/* Refreshes do not change check results */
+			if (io_cmd->cmd.normal.cmd != FUZZY_REFRESH) {
+				rspamd_fuzzy_hot_cache_flush (ctx);
+				break;
+			}
+		}
+
 		msg_info ("successfully updated fuzzy storage %s: %d updates in queue; "
 				  "%d pending currently; "
 				  "%d added; %d deleted; %d extended; %d duplicates",
@@ -660,13 +813,18 @@ rspamd_fuzzy_reply_io (EV_P_ ev_io *w, int revents)
 	REF_RELEASE (session);
 }
 
-static void
-rspamd_fuzzy_write_reply (struct fuzzy_session *session)
+static gconstpointer
+rspamd_fuzzy_reply_data (struct fuzzy_session *session, gsize *plen)
 {
-	gssize r;
 	gsize len;
 	gconstpointer data;
 
+	if (session->batch_reply) {
+		*plen = session->batch_reply_len;
+
+		return session->batch_reply;
+	}
+
 	if (session->cmd_type == CMD_ENCRYPTED_NORMAL ||
 				session->cmd_type == CMD_ENCRYPTED_SHINGLE) {
 		/* Encrypted reply */
@@ -690,6 +848,151 @@ rspamd_fuzzy_write_reply (struct fuzzy_session *session)
 		}
 	}
 
+	*plen = len;
+
+	return data;
+}
+
+/*
+ * Queues reply to be sent at the end of the current receive batch,
+ * returns FALSE if the reply should be sent immediately
+ */
+static gboolean
+rspamd_fuzzy_batch_reply (struct fuzzy_session *session)
+{
+#ifdef HAVE_SENDMMSG
+	struct fuzzy_io_batch *batch = session->ctx->io_batch;
+	struct mmsghdr *msg;
+	socklen_t slen;
+	gsize len;
+
+	if (batch == NULL || !batch->collecting || batch->fd != session->fd ||
+			batch->nreplies >= batch->nelts || session->addr == NULL) {
+		return FALSE;
+	}
+
+	msg = &batch->out_msgs[batch->nreplies];
+	memset (msg, 0, sizeof (*msg));
+	batch->out_iovs[batch->nreplies].iov_base =
+			(void *)rspamd_fuzzy_reply_data (session, &len);
+	batch->out_iovs[batch->nreplies].iov_len = len;
+	msg->msg_hdr.msg_iov = &batch->out_iovs[batch->nreplies];
+	msg->msg_hdr.msg_iovlen = 1;
+	msg->msg_hdr.msg_name = rspamd_inet_address_get_sa (session->addr, &slen);
+	msg->msg_hdr.msg_namelen = slen;
+	REF_RETAIN (session);
+	batch->out_sessions[batch->nreplies ++] = session;
+
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+static void
+rspamd_fuzzy_flush_replies (struct rspamd_fuzzy_storage_ctx *ctx)
+{
+	struct fuzzy_io_batch *batch = ctx->io_batch;
+	guint i, sent = 0;
+
+	batch->collecting = FALSE;
+
+#ifdef HAVE_SENDMMSG
+	while (sent < batch->nreplies) {
+		gint r = sendmmsg (batch->fd, &batch->out_msgs[sent],
+				batch->nreplies - sent, 0);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			/* Remaining replies are sent one by one (or delayed) */
+			break;
+		}
+
+		sent += r;
+	}
+#endif
+
+	for (i = 0; i < batch->nreplies; i ++) {
+		if (i >= sent) {
+			rspamd_fuzzy_write_reply (batch->out_sessions[i]);
+		}
+
+		REF_RELEASE (batch->out_sessions[i]);
+	}
+
+	batch->nreplies = 0;
+}
+
+/*
+ * Encrypts (if needed) and sends the packed reply for a batched request
+ */
+static void
+rspamd_fuzzy_batch_send_reply (struct fuzzy_session *session)
+{
+	struct rspamd_fuzzy_encrypted_rep_hdr *hdr;
+	gsize hdr_len = 0;
+
+	if (session->cmd_type == CMD_ENCRYPTED_NORMAL) {
+		hdr = (struct rspamd_fuzzy_encrypted_rep_hdr *)session->batch_reply;
+		hdr_len = sizeof (*hdr);
+		ottery_rand_bytes (hdr->nonce, sizeof (hdr->nonce));
+		rspamd_cryptobox_encrypt_nm_inplace (session->batch_reply + hdr_len,
+				session->batch_reply_len - hdr_len,
+				hdr->nonce,
+				session->nm,
+				hdr->mac,
+				RSPAMD_CRYPTOBOX_MODE_25519);
+	}
+
+	rspamd_fuzzy_write_reply (session);
+}
+
+/*
+ * Stores reply for a command from a batch, the batch reply is sent when
+ * all its commands are replied
+ */
+static void
+rspamd_fuzzy_batch_collect_reply (struct fuzzy_session *session)
+{
+	struct fuzzy_session *parent = session->batch;
+	struct rspamd_fuzzy_reply *reps;
+	gsize hdr_len = sizeof (struct rspamd_fuzzy_batch_reply_hdr);
+
+	if (parent->cmd_type == CMD_ENCRYPTED_NORMAL) {
+		hdr_len += sizeof (struct rspamd_fuzzy_encrypted_rep_hdr);
+	}
+
+	reps = (struct rspamd_fuzzy_reply *)(parent->batch_reply + hdr_len);
+	memcpy (&reps[session->batch_idx], &session->reply.rep, sizeof (*reps));
+	session->batch = NULL;
+
+	if (--parent->batch_pending == 0) {
+		rspamd_fuzzy_batch_send_reply (parent);
+	}
+
+	REF_RELEASE (parent);
+}
+
+static void
+rspamd_fuzzy_write_reply (struct fuzzy_session *session)
+{
+	gssize r;
+	gsize len;
+	gconstpointer data;
+
+	if (session->batch) {
+		rspamd_fuzzy_batch_collect_reply (session);
+		return;
+	}
+
+	if (rspamd_fuzzy_batch_reply (session)) {
+		return;
+	}
+
+	data = rspamd_fuzzy_reply_data (session, &len);
 	r = rspamd_inet_address_sendto (session->fd, data, len, 0,
 			session->addr);
 
@@ -909,12 +1212,15 @@ rspamd_fuzzy_make_reply (struct rspamd_fuzzy_cmd *cmd,
 					session->timestamp);
 			}
 
-			rspamd_cryptobox_encrypt_nm_inplace ((guchar *)&session->reply.rep,
-					len,
-					session->reply.hdr.nonce,
-					session->nm,
-					session->reply.hdr.mac,
-					RSPAMD_CRYPTOBOX_MODE_25519);
+			if (session->batch == NULL) {
+				rspamd_cryptobox_encrypt_nm_inplace ((guchar *)&session->reply.rep,
+						len,
+						session->reply.hdr.nonce,
+						session->nm,
+						session->reply.hdr.mac,
+						RSPAMD_CRYPTOBOX_MODE_25519);
+			}
+			/* Otherwise the whole batch reply is encrypted at once */
 		}
 		else if (default_disabled) {
 			/* Hash is from a forbidden flag by default, and there is no encryption override */
@@ -1001,7 +1307,8 @@ rspamd_fuzzy_extensions_tolua (lua_State *L,
 }
 
 static void
-rspamd_fuzzy_check_callback (struct rspamd_fuzzy_reply *result, void *ud)
+rspamd_fuzzy_check_callback (gboolean success,
+		struct rspamd_fuzzy_reply *result, void *ud)
 {
 	struct fuzzy_session *session = ud;
 	gboolean is_shingle = FALSE, __attribute__ ((unused)) encrypted = FALSE;
@@ -1032,6 +1339,11 @@ rspamd_fuzzy_check_callback (struct rspamd_fuzzy_reply *result, void *ud)
 		break;
 	}
 
+	/* Cache raw backend results, errors are never cached */
+	if (session->ctx->hot_cache && !session->from_hot_cache && success) {
+		rspamd_fuzzy_hot_cache_insert (session, result);
+	}
+
 	if (session->ctx->lua_post_handler_cbref != -1) {
 		/* Start lua post handler */
 		lua_State *L = session->ctx->cfg->lua_state;
@@ -1119,8 +1431,12 @@ rspamd_fuzzy_check_callback (struct rspamd_fuzzy_reply *result, void *ud)
 		}
 	}
 
-	/* Refresh hash if found with strong confidence */
-	if (result->v1.prob > 0.9 && !session->ctx->read_only) {
+	/*
+	 * Refresh hash if found with strong confidence, results from the hot
+	 * cache have been refreshed when they were cached
+	 */
+	if (result->v1.prob > 0.9 && !session->ctx->read_only &&
+			!session->from_hot_cache) {
 		struct fuzzy_peer_cmd up_cmd;
 		struct fuzzy_peer_request *up_req;
 
@@ -1174,6 +1490,31 @@ rspamd_fuzzy_check_callback (struct rspamd_fuzzy_reply *result, void *ud)
 	REF_RELEASE (session);
 }
 
+static void rspamd_fuzzy_process_command (struct fuzzy_session *session);
+
+static void
+rspamd_fuzzy_process_batch (struct fuzzy_session *session)
+{
+	struct fuzzy_session *sub;
+	guint i;
+
+	/* Commands can be replied synchronously, so link all of them first */
+	session->batch_pending = session->batch_cmds->len;
+
+	PTR_ARRAY_FOREACH (session->batch_cmds, i, sub) {
+		REF_RETAIN (session);
+		sub->batch = session;
+	}
+
+	PTR_ARRAY_FOREACH (session->batch_cmds, i, sub) {
+		rspamd_fuzzy_process_command (sub);
+		REF_RELEASE (sub);
+	}
+
+	g_ptr_array_free (session->batch_cmds, TRUE);
+	session->batch_cmds = NULL;
+}
+
 static void
 rspamd_fuzzy_process_command (struct fuzzy_session *session)
 {
@@ -1189,6 +1530,11 @@ rspamd_fuzzy_process_command (struct fuzzy_session *session)
 	gsize up_len = 0;
 	gint send_flags = 0;
 
+	if (session->batch_cmds) {
+		rspamd_fuzzy_process_batch (session);
+		return;
+	}
+
 	cmd = &session->cmd.basic;
 
 	switch (session->cmd_type) {
@@ -1322,9 +1668,35 @@ rspamd_fuzzy_process_command (struct fuzzy_session *session)
 		}
 
 		if (can_continue) {
+			struct rspamd_fuzzy_reply *cached = NULL;
+
+			if (session->ctx->hot_cache) {
+				struct fuzzy_hot_key hk;
+
+				rspamd_fuzzy_hot_key_init (session, &hk);
+				cached = rspamd_lru_hash_lookup (session->ctx->hot_cache, &hk,
+						(time_t)session->timestamp);
+
+				if (cached) {
+					session->ctx->stat.hot_cache_hits ++;
+				}
+				else {
+					session->ctx->stat.hot_cache_misses ++;
+				}
+			}
+
 			REF_RETAIN (session);
-			rspamd_fuzzy_backend_check (session->ctx->backend, cmd,
-					rspamd_fuzzy_check_callback, session);
+
+			if (cached) {
+				/* Callback can modify result, so use a copy */
+				memcpy (&result, cached, sizeof (result));
+				session->from_hot_cache = TRUE;
+				rspamd_fuzzy_check_callback (TRUE, &result, session);
+			}
+			else {
+				rspamd_fuzzy_backend_check (session->ctx->backend, cmd,
+						rspamd_fuzzy_check_callback, session);
+			}
 		}
 		else {
 			result.v1.value = 403;
@@ -1356,6 +1728,13 @@ rspamd_fuzzy_process_command (struct fuzzy_session *session)
 				}
 			}
 
+			if (session->ctx->hot_cache) {
+				struct fuzzy_hot_key hk;
+
+				rspamd_fuzzy_hot_key_init (session, &hk);
+				rspamd_lru_hash_remove (session->ctx->hot_cache, &hk);
+			}
+
 			if (session->ctx->weak_ids && kh_get(fuzzy_key_ids_set, session->ctx->weak_ids, cmd->flag) != kh_end(session->ctx->weak_ids)) {
 				/* Flag command as weak */
 				cmd->version |= RSPAMD_FUZZY_FLAG_WEAK;
@@ -1636,39 +2015,10 @@ rspamd_fuzzy_extensions_from_wire (struct fuzzy_session *s, guchar *buf, gsize b
 }
 
 static gboolean
-rspamd_fuzzy_cmd_from_wire (guchar *buf, guint buflen, struct fuzzy_session *s)
+rspamd_fuzzy_cmd_parse (guchar *buf, guint buflen, struct fuzzy_session *s,
+		gboolean encrypted)
 {
 	enum rspamd_fuzzy_epoch epoch;
-	gboolean encrypted = FALSE;
-
-	if (buflen < sizeof (struct rspamd_fuzzy_cmd)) {
-		msg_debug ("truncated fuzzy command of size %d received", buflen);
-		return FALSE;
-	}
-
-	/* Now check encryption */
-
-	if (buflen >= sizeof (struct rspamd_fuzzy_encrypted_cmd)) {
-		if (memcmp (buf, fuzzy_encrypted_magic, sizeof (fuzzy_encrypted_magic)) == 0) {
-			/* Encrypted command */
-			encrypted = TRUE;
-		}
-	}
-
-	if (encrypted) {
-		/* Decrypt first */
-		if (!rspamd_fuzzy_decrypt_command (s, buf, buflen)) {
-			return FALSE;
-		}
-		else {
-			/*
-			 * Advance buffer to skip encrypted header.
-			 * Note that after rspamd_fuzzy_decrypt_command buf is unencrypted
-			 */
-			buf += sizeof (struct rspamd_fuzzy_encrypted_req_hdr);
-			buflen -= sizeof (struct rspamd_fuzzy_encrypted_req_hdr);
-		}
-	}
 
 	/* Fill the normal command */
 	if (buflen < sizeof (s->cmd.basic)) {
@@ -1732,6 +2082,146 @@ rspamd_fuzzy_cmd_from_wire (guchar *buf, guint buflen, struct fuzzy_session *s)
 }
 
 
+static gboolean
+rspamd_fuzzy_batch_from_wire (guchar *buf, guint buflen, struct fuzzy_session *s,
+		gboolean encrypted)
+{
+	struct rspamd_fuzzy_batch_hdr bhdr;
+	struct rspamd_fuzzy_batch_reply_hdr *rhdr;
+	struct fuzzy_session *sub;
+	guint16 cmdlen;
+	gsize hdr_len = 0;
+	guint i;
+
+	memcpy (&bhdr, buf, sizeof (bhdr));
+	buf += sizeof (bhdr);
+	buflen -= sizeof (bhdr);
+
+	if (bhdr.ncmds == 0 || bhdr.ncmds > RSPAMD_FUZZY_BATCH_MAX_CMDS) {
+		msg_debug ("invalid number of commands in a batch: %d", (gint)bhdr.ncmds);
+		return FALSE;
+	}
+
+	s->batch_cmds = g_ptr_array_sized_new (bhdr.ncmds);
+
+	for (i = 0; i < bhdr.ncmds; i ++) {
+		if (buflen < sizeof (cmdlen)) {
+			msg_debug ("truncated batch of size %d received", buflen);
+			goto err;
+		}
+
+		memcpy (&cmdlen, buf, sizeof (cmdlen));
+		buf += sizeof (cmdlen);
+		buflen -= sizeof (cmdlen);
+
+		if (cmdlen > buflen) {
+			msg_debug ("truncated command in a batch of size %d received", buflen);
+			goto err;
+		}
+
+		/* Each command is processed as a separate session */
+		sub = g_malloc0 (sizeof (*sub));
+		REF_INIT_RETAIN (sub, fuzzy_session_destroy);
+		sub->worker = s->worker;
+		sub->fd = s->fd;
+		sub->ctx = s->ctx;
+		sub->timestamp = s->timestamp;
+		sub->key = s->key;
+		sub->batch_idx = i;
+		memcpy (sub->nm, s->nm, sizeof (sub->nm));
+
+		if (s->addr) {
+			sub->addr = rspamd_inet_address_copy (s->addr, NULL);
+		}
+
+		s->worker->nconns ++;
+		g_ptr_array_add (s->batch_cmds, sub);
+
+		if (!rspamd_fuzzy_cmd_parse (buf, cmdlen, sub, encrypted)) {
+			goto err;
+		}
+
+		sub->epoch = RSPAMD_FUZZY_EPOCH12;
+		buf += cmdlen;
+		buflen -= cmdlen;
+	}
+
+	if (buflen > 0) {
+		msg_debug ("garbage after batch of size %d received", buflen);
+		goto err;
+	}
+
+	msg_debug ("got batch of %d commands", (gint)bhdr.ncmds);
+
+	s->epoch = RSPAMD_FUZZY_EPOCH12;
+	s->cmd_type = encrypted ? CMD_ENCRYPTED_NORMAL : CMD_NORMAL;
+
+	if (encrypted) {
+		hdr_len = sizeof (struct rspamd_fuzzy_encrypted_rep_hdr);
+	}
+
+	s->batch_reply_len = hdr_len + sizeof (*rhdr) +
+			bhdr.ncmds * sizeof (struct rspamd_fuzzy_reply);
+	s->batch_reply = g_malloc0 (s->batch_reply_len);
+	rhdr = (struct rspamd_fuzzy_batch_reply_hdr *)(s->batch_reply + hdr_len);
+	rhdr->version = RSPAMD_FUZZY_BATCH_VERSION;
+	rhdr->nreplies = bhdr.ncmds;
+
+	return TRUE;
+
+err:
+	PTR_ARRAY_FOREACH (s->batch_cmds, i, sub) {
+		REF_RELEASE (sub);
+	}
+
+	g_ptr_array_free (s->batch_cmds, TRUE);
+	s->batch_cmds = NULL;
+
+	return FALSE;
+}
+
+static gboolean
+rspamd_fuzzy_cmd_from_wire (guchar *buf, guint buflen, struct fuzzy_session *s)
+{
+	gboolean encrypted = FALSE;
+
+	if (buflen < sizeof (struct rspamd_fuzzy_cmd)) {
+		msg_debug ("truncated fuzzy command of size %d received", buflen);
+		return FALSE;
+	}
+
+	/* Now check encryption */
+
+	if (buflen >= sizeof (struct rspamd_fuzzy_encrypted_cmd)) {
+		if (memcmp (buf, fuzzy_encrypted_magic, sizeof (fuzzy_encrypted_magic)) == 0) {
+			/* Encrypted command */
+			encrypted = TRUE;
+		}
+	}
+
+	if (encrypted) {
+		/* Decrypt first */
+		if (!rspamd_fuzzy_decrypt_command (s, buf, buflen)) {
+			return FALSE;
+		}
+		else {
+			/*
+			 * Advance buffer to skip encrypted header.
+			 * Note that after rspamd_fuzzy_decrypt_command buf is unencrypted
+			 */
+			buf += sizeof (struct rspamd_fuzzy_encrypted_req_hdr);
+			buflen -= sizeof (struct rspamd_fuzzy_encrypted_req_hdr);
+		}
+	}
+
+	if (buflen >= sizeof (struct rspamd_fuzzy_batch_hdr) &&
+			(buf[0] & RSPAMD_FUZZY_VERSION_MASK) == RSPAMD_FUZZY_BATCH_VERSION) {
+		return rspamd_fuzzy_batch_from_wire (buf, buflen, s, encrypted);
+	}
+
+	return rspamd_fuzzy_cmd_parse (buf, buflen, s, encrypted);
+}
+
 static void
 fuzzy_session_destroy (gpointer d)
 {
@@ -1749,23 +2239,13 @@ fuzzy_session_destroy (gpointer d)
 		g_free (session->extensions);
 	}
 
+	if (session->batch_reply) {
+		g_free (session->batch_reply);
+	}
+
 	g_free (session);
 }
 
-#define FUZZY_INPUT_BUFLEN 1024
-#ifdef HAVE_RECVMMSG
-#define MSGVEC_LEN 16
-#else
-#define MSGVEC_LEN 1
-#endif
-
-union sa_union {
-	struct sockaddr sa;
-	struct sockaddr_in s4;
-	struct sockaddr_in6 s6;
-	struct sockaddr_un su;
-	struct sockaddr_storage ss;
-};
 /*
  * Accept new connection and construct task
  */
@@ -1775,29 +2255,25 @@ accept_fuzzy_socket (EV_P_ ev_io *w, int revents)
 	struct rspamd_worker *worker = (struct rspamd_worker *)w->data;
 	struct rspamd_fuzzy_storage_ctx *ctx;
 	struct fuzzy_session *session;
+	struct fuzzy_io_batch *batch;
 	gssize r, msg_len;
 	guint64 *nerrors;
-	struct iovec iovs[MSGVEC_LEN];
-	guint8 bufs[MSGVEC_LEN][FUZZY_INPUT_BUFLEN];
-	union sa_union peer_sa[MSGVEC_LEN];
-	socklen_t salen = sizeof (peer_sa[0]);
-#ifdef HAVE_RECVMMSG
-#define MSG_FIELD(msg, field) msg.msg_hdr.field
-	struct mmsghdr msg[MSGVEC_LEN];
-#else
-#define MSG_FIELD(msg, field) msg.field
-	struct msghdr msg[MSGVEC_LEN];
-#endif
+	fuzzy_msghdr_t *msg;
+	struct iovec *iovs;
+	socklen_t salen = sizeof (union sa_union);
 
-	memset (msg, 0, sizeof (*msg) * MSGVEC_LEN);
 	ctx = (struct rspamd_fuzzy_storage_ctx *)worker->ctx;
+	batch = ctx->io_batch;
+	msg = batch->in_msgs;
+	iovs = batch->in_iovs;
+	memset (msg, 0, sizeof (*msg) * batch->nelts);
 
 	/* Prepare messages to receive */
-	for (int i = 0; i < MSGVEC_LEN; i ++) {
+	for (guint i = 0; i < batch->nelts; i ++) {
 		/* Prepare msghdr structs */
-		iovs[i].iov_base = bufs[i];
-		iovs[i].iov_len = sizeof (bufs[i]);
-		MSG_FIELD(msg[i], msg_name) = (void *)&peer_sa[i];
+		iovs[i].iov_base = batch->in_bufs[i];
+		iovs[i].iov_len = sizeof (batch->in_bufs[i]);
+		MSG_FIELD(msg[i], msg_name) = (void *)&batch->in_addrs[i];
 		MSG_FIELD(msg[i], msg_namelen) = salen;
 		MSG_FIELD(msg[i], msg_iov) = &iovs[i];
 		MSG_FIELD(msg[i], msg_iovlen) = 1;
@@ -1808,7 +2284,7 @@ accept_fuzzy_socket (EV_P_ ev_io *w, int revents)
 		ev_now_update_if_cheap (ctx->event_loop);
 		for (;;) {
 #ifdef HAVE_RECVMMSG
-			r = recvmmsg (w->fd, msg, MSGVEC_LEN, 0, NULL);
+			r = recvmmsg (w->fd, msg, batch->nelts, 0, NULL);
 #else
 			r = recvmsg (w->fd, msg, 0);
 #endif
@@ -1833,6 +2309,9 @@ accept_fuzzy_socket (EV_P_ ev_io *w, int revents)
 			r = 1; /* Assume that we have received a single message */
 #endif
 
+			batch->collecting = TRUE;
+			batch->fd = w->fd;
+
 			for (int i = 0; i < r; i ++) {
 				rspamd_inet_addr_t *client_addr;
 
@@ -1892,6 +2371,8 @@ accept_fuzzy_socket (EV_P_ ev_io *w, int revents)
 
 				REF_RELEASE (session);
 			}
+
+			rspamd_fuzzy_flush_replies (ctx);
 #ifdef HAVE_RECVMMSG
 			/* Stop reading as we are using recvmmsg instead of recvmsg */
 			break;
@@ -2171,6 +2652,33 @@ rspamd_fuzzy_stat_to_ucl (struct rspamd_fuzzy_storage_ctx *ctx, gboolean ip_stat
 			0,
 			false);
 
+	if (ctx->hot_cache) {
+		guint64 hot_total = ctx->stat.hot_cache_hits +
+				ctx->stat.hot_cache_misses;
+
+		ucl_object_insert_key (obj,
+				ucl_object_fromint (ctx->stat.hot_cache_hits),
+				"hot_cache_hits",
+				0,
+				false);
+		ucl_object_insert_key (obj,
+				ucl_object_fromint (ctx->stat.hot_cache_misses),
+				"hot_cache_misses",
+				0,
+				false);
+		ucl_object_insert_key (obj,
+				ucl_object_fromdouble (hot_total > 0 ?
+						(gdouble)ctx->stat.hot_cache_hits / hot_total : 0.0),
+				"hot_cache_ratio",
+				0,
+				false);
+		ucl_object_insert_key (obj,
+				ucl_object_fromint (rspamd_lru_hash_size (ctx->hot_cache)),
+				"hot_cache_size",
+				0,
+				false);
+	}
+
 	if (ctx->errors_ips && ip_stat) {
 		i = 0;
 
@@ -2345,7 +2853,7 @@ static int
 lua_fuzzy_add_pre_handler (lua_State *L)
 {
 	struct rspamd_worker *wrk, **pwrk = (struct rspamd_worker **)
-			rspamd_lua_check_udata (L, 1, "rspamd{worker}");
+			rspamd_lua_check_udata (L, 1, rspamd_worker_classname);
 	struct rspamd_fuzzy_storage_ctx *ctx;
 
 	if (!pwrk) {
@@ -2376,7 +2884,7 @@ static int
 lua_fuzzy_add_post_handler (lua_State *L)
 {
 	struct rspamd_worker *wrk, **pwrk = (struct rspamd_worker **)
-			rspamd_lua_check_udata (L, 1, "rspamd{worker}");
+			rspamd_lua_check_udata (L, 1, rspamd_worker_classname);
 	struct rspamd_fuzzy_storage_ctx *ctx;
 
 	if (!pwrk) {
@@ -2407,7 +2915,7 @@ static int
 lua_fuzzy_add_blacklist_handler (lua_State *L)
 {
 	struct rspamd_worker *wrk, **pwrk = (struct rspamd_worker **)
-		rspamd_lua_check_udata (L, 1, "rspamd{worker}");
+		rspamd_lua_check_udata (L, 1, rspamd_worker_classname);
 	struct rspamd_fuzzy_storage_ctx *ctx;
 
 	if (!pwrk) {
@@ -2698,6 +3206,8 @@ init_fuzzy (struct rspamd_config *cfg)
 	ctx->leaky_bucket_burst = NAN;
 	ctx->leaky_bucket_rate = NAN;
 	ctx->delay = NAN;
+	ctx->recv_batch = DEFAULT_RECV_BATCH;
+	ctx->hot_cache_ttl = DEFAULT_HOT_CACHE_TTL;
 	ctx->default_forbidden_ids = kh_init(fuzzy_key_ids_set);
 	ctx->weak_ids = kh_init(fuzzy_key_ids_set);
 
@@ -2797,6 +3307,35 @@ init_fuzzy (struct rspamd_config *cfg)
 			RSPAMD_CL_FLAG_UINT,
 			"Size of keypairs cache, default: "
 					G_STRINGIFY (DEFAULT_KEYPAIR_CACHE_SIZE));
+	rspamd_rcl_register_worker_option (cfg,
+			type,
+			"recv_batch",
+			rspamd_rcl_parse_struct_integer,
+			ctx,
+			G_STRUCT_OFFSET (struct rspamd_fuzzy_storage_ctx,
+					recv_batch),
+			RSPAMD_CL_FLAG_UINT,
+			"Number of datagrams received and replied per system call, default: "
+					G_STRINGIFY (DEFAULT_RECV_BATCH));
+	rspamd_rcl_register_worker_option (cfg,
+			type,
+			"hot_cache_size",
+			rspamd_rcl_parse_struct_integer,
+			ctx,
+			G_STRUCT_OFFSET (struct rspamd_fuzzy_storage_ctx,
+					hot_cache_size),
+			RSPAMD_CL_FLAG_UINT,
+			"Number of recent check results cached in memory, default: 0 (disabled)");
+	rspamd_rcl_register_worker_option (cfg,
+			type,
+			"hot_cache_ttl",
+			rspamd_rcl_parse_struct_time,
+			ctx,
+			G_STRUCT_OFFSET (struct rspamd_fuzzy_storage_ctx,
+					hot_cache_ttl),
+			RSPAMD_CL_FLAG_TIME_UINT_32,
+			"Time to keep check results in the hot cache, default: "
+					G_STRINGIFY (DEFAULT_HOT_CACHE_TTL) " seconds");
 
 	rspamd_rcl_register_worker_option (cfg,
 			type,
@@ -2941,6 +3480,42 @@ rspamd_fuzzy_peer_io (EV_P_ ev_io *w, int revents)
 	}
 }
 
+static struct fuzzy_io_batch *
+rspamd_fuzzy_io_batch_new (guint nelts)
+{
+	struct fuzzy_io_batch *batch;
+
+	batch = g_malloc0 (sizeof (*batch));
+	batch->nelts = nelts;
+	batch->fd = -1;
+	batch->in_msgs = g_malloc0 (sizeof (*batch->in_msgs) * nelts);
+	batch->in_iovs = g_malloc0 (sizeof (*batch->in_iovs) * nelts);
+	batch->in_addrs = g_malloc0 (sizeof (*batch->in_addrs) * nelts);
+	batch->in_bufs = g_malloc (sizeof (*batch->in_bufs) * nelts);
+	batch->out_sessions = g_malloc0 (sizeof (*batch->out_sessions) * nelts);
+#ifdef HAVE_SENDMMSG
+	batch->out_msgs = g_malloc0 (sizeof (*batch->out_msgs) * nelts);
+	batch->out_iovs = g_malloc0 (sizeof (*batch->out_iovs) * nelts);
+#endif
+
+	return batch;
+}
+
+static void
+rspamd_fuzzy_io_batch_free (struct fuzzy_io_batch *batch)
+{
+	g_free (batch->in_msgs);
+	g_free (batch->in_iovs);
+	g_free (batch->in_addrs);
+	g_free (batch->in_bufs);
+	g_free (batch->out_sessions);
+#ifdef HAVE_SENDMMSG
+	g_free (batch->out_msgs);
+	g_free (batch->out_iovs);
+#endif
+	g_free (batch);
+}
+
 static void
 fuzzy_peer_rep (struct rspamd_worker *worker,
 		struct rspamd_srv_reply *rep, gint rep_fd,
@@ -3032,6 +3607,24 @@ start_fuzzy (struct rspamd_worker *worker)
 	ctx->http_ctx = rspamd_http_context_create (ctx->cfg, ctx->event_loop,
 			ctx->cfg->ups_ctx);
 
+#ifdef HAVE_RECVMMSG
+	if (ctx->recv_batch == 0) {
+		ctx->recv_batch = 1;
+	}
+	else if (ctx->recv_batch > MAX_RECV_BATCH) {
+		msg_warn_config ("recv_batch %ud is too large, use %d",
+				ctx->recv_batch, MAX_RECV_BATCH);
+		ctx->recv_batch = MAX_RECV_BATCH;
+	}
+#else
+	ctx->recv_batch = 1;
+#endif
+	ctx->io_batch = rspamd_fuzzy_io_batch_new (ctx->recv_batch);
+
+	if (ctx->hot_cache_size > 0 && ctx->hot_cache_ttl > 0) {
+		rspamd_fuzzy_hot_cache_init (ctx);
+	}
+
 	if (ctx->keypair_cache_size > 0) {
 		/* Create keypairs cache */
 		ctx->keypair_cache = rspamd_keypair_cache_new (ctx->keypair_cache_size);
@@ -3203,17 +3796,17 @@ start_fuzzy (struct rspamd_worker *worker)
 			.name = "add_fuzzy_pre_handler",
 			.func = lua_fuzzy_add_pre_handler,
 	};
-	rspamd_lua_add_metamethod (ctx->cfg->lua_state, "rspamd{worker}", &fuzzy_lua_reg);
+	rspamd_lua_add_metamethod (ctx->cfg->lua_state, rspamd_worker_classname, &fuzzy_lua_reg);
 	fuzzy_lua_reg = (luaL_Reg){
 			.name = "add_fuzzy_post_handler",
 			.func = lua_fuzzy_add_post_handler,
 	};
-	rspamd_lua_add_metamethod (ctx->cfg->lua_state, "rspamd{worker}", &fuzzy_lua_reg);
+	rspamd_lua_add_metamethod (ctx->cfg->lua_state, rspamd_worker_classname, &fuzzy_lua_reg);
 	fuzzy_lua_reg = (luaL_Reg){
 		.name = "add_fuzzy_blacklist_handler",
 		.func = lua_fuzzy_add_blacklist_handler,
 	};
-	rspamd_lua_add_metamethod (ctx->cfg->lua_state, "rspamd{worker}", &fuzzy_lua_reg);
+	rspamd_lua_add_metamethod (ctx->cfg->lua_state, rspamd_worker_classname, &fuzzy_lua_reg);
 
 	rspamd_lua_run_postloads (ctx->cfg->lua_state, ctx->cfg, ctx->event_loop,
 			worker);
@@ -3252,6 +3845,13 @@ start_fuzzy (struct rspamd_worker *worker)
 		rspamd_keypair_cache_destroy (ctx->keypair_cache);
 	}
 
+	rspamd_fuzzy_io_batch_free (ctx->io_batch);
+	ctx->io_batch = NULL;
+
+	if (ctx->hot_cache) {
+		rspamd_lru_hash_destroy (ctx->hot_cache);
+	}
+
 	if (ctx->ratelimit_buckets) {
 		/* Try the best to save ratelimits from the proper worker */
 		if ((!ctx->dedicated_update_worker && worker->index == 0) ||
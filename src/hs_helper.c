@@ -237,6 +237,47 @@ rspamd_hs_helper_cleanup_dir (struct hs_helper_ctx *ctx, gboolean forced)
 		ret = FALSE;
 	}
 
+	globfree (&globbuf);
+
+	/* Compilation locks of regexp maps left by dead processes */
+	memset (&globbuf, 0, sizeof (globbuf));
+	rspamd_snprintf (pattern, len, "%s%c%s", ctx->hs_dir, G_DIR_SEPARATOR, "*.lock");
+	if ((rc = glob (pattern, 0, NULL, &globbuf)) == 0) {
+		for (i = 0; i < globbuf.gl_pathc; i++) {
+			gchar pidbuf[32];
+			gulong ul;
+			gint fd, r;
+
+			fd = open (globbuf.gl_pathv[i], O_RDONLY);
+
+			if (fd == -1) {
+				continue;
+			}
+
+			r = read (fd, pidbuf, sizeof (pidbuf) - 1);
+			close (fd);
+
+			if (r > 0 && rspamd_strtoul (pidbuf, r, &ul) &&
+					kill ((pid_t)ul, 0) == -1 && errno == ESRCH) {
+				if (unlink (globbuf.gl_pathv[i]) == -1) {
+					msg_err ("cannot unlink %s: %s", globbuf.gl_pathv[i],
+							strerror (errno));
+					ret = FALSE;
+				}
+				else {
+					msg_notice ("successfully removed stale hyperscan lock file: %s; "
+								"pid of the lock owner: %P",
+							globbuf.gl_pathv[i],
+							(pid_t)ul);
+				}
+			}
+		}
+	}
+	else if (rc != GLOB_NOMATCH) {
+		msg_err ("glob %s failed: %s", pattern, strerror (errno));
+		ret = FALSE;
+	}
+
 	globfree (&globbuf);
 	g_free (pattern);
 
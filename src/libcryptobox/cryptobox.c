@@ -25,6 +25,7 @@
 #include "chacha20/chacha.h"
 #include "catena/catena.h"
 #include "base64/base64.h"
+#include "multihash/multihash.h"
 #include "ottery.h"
 #include "printf.h"
 #define XXH_INLINE_ALL
@@ -303,6 +304,7 @@ rspamd_cryptobox_init (void)
 
 	ctx->chacha20_impl = chacha_load ();
 	ctx->base64_impl = base64_load ();
+	ctx->multihash_impl = multihash_load ();
 #if defined(HAVE_USABLE_OPENSSL) && (OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER))
 	/* Needed for old openssl api, not sure about LibreSSL */
 	ERR_load_EC_strings ();
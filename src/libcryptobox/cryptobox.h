@@ -76,6 +76,7 @@ struct rspamd_cryptobox_library_ctx {
 	gchar *cpu_extensions;
 	const gchar *chacha20_impl;
 	const gchar *base64_impl;
+	const gchar *multihash_impl;
 	unsigned long cpu_config;
 };
 
@@ -411,6 +412,21 @@ guint64 rspamd_cryptobox_fast_hash_specific (
 		const void *data,
 		gsize len, guint64 seed);
 
+/**
+ * Calculates hashes of the same data with multiple seeds, uses platform
+ * optimized code for xxhash64 and xxhash3 based types
+ * @param type hash type
+ * @param data input
+ * @param len length of input
+ * @param seeds array of `nseeds` seeds
+ * @param out array of `nseeds` output hashes
+ * @param nseeds number of seeds
+ */
+void rspamd_cryptobox_fast_hash_multi (
+		enum rspamd_cryptobox_fast_hash_type type,
+		const void *data, gsize len,
+		const guint64 *seeds, guint64 *out, gsize nseeds);
+
 /**
  * Decode base64 using platform optimized code
  * @param in
@@ -0,0 +1,74 @@
+/*-
+ * Copyright 2023 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "cryptobox.h"
+#include "xxhash.h"
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+#ifndef __SSE2__
+#define __SSE2__
+#endif
+#ifndef __SSE__
+#define __SSE__
+#endif
+#ifndef __SSE4_2__
+#define __SSE4_2__
+#endif
+#ifndef __SSE4_1__
+#define __SSE4_1__
+#endif
+#ifndef __SSSE3__
+#define __SSSE3__
+#endif
+#ifndef __AVX__
+#define __AVX__
+#endif
+#ifndef __AVX2__
+#define __AVX2__
+#endif
+
+#include <immintrin.h>
+
+#define MH_VEC __m256i
+#define MH_LANES 4
+#define MH_TARGET __attribute__((__target__("avx2")))
+#define MH_EXT(name) name##_avx2
+#define MH_SET1(x) _mm256_set1_epi64x ((long long)(x))
+#define MH_LOADU(p) _mm256_loadu_si256 ((const __m256i *)(p))
+#define MH_STOREU(p, v) _mm256_storeu_si256 ((__m256i *)(p), (v))
+#define MH_ADD(a, b) _mm256_add_epi64 ((a), (b))
+#define MH_SUB(a, b) _mm256_sub_epi64 ((a), (b))
+#define MH_XOR(a, b) _mm256_xor_si256 ((a), (b))
+#define MH_OR(a, b) _mm256_or_si256 ((a), (b))
+#define MH_AND(a, b) _mm256_and_si256 ((a), (b))
+#define MH_SLLI(a, n) _mm256_slli_epi64 ((a), (n))
+#define MH_SRLI(a, n) _mm256_srli_epi64 ((a), (n))
+#define MH_MUL32(a, b) _mm256_mul_epu32 ((a), (b))
+#define MH_SHUF8(a, m) _mm256_shuffle_epi8 ((a), (m))
+#define MH_SET_SHUF_MASK(lo, hi) _mm256_set_epi64x ((long long)(hi), \
+		(long long)(lo), (long long)(hi), (long long)(lo))
+
+#include "kernel.inc"
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+#endif
@@ -0,0 +1,116 @@
+/*-
+ * Copyright 2023 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "cryptobox.h"
+#include "multihash.h"
+#include "platform_config.h"
+#include "xxhash.h"
+
+extern unsigned cpu_config;
+
+typedef void (*multihash_func_t) (const void *data, gsize len,
+		const guint64 *seeds, guint64 *out, gsize nseeds);
+
+typedef struct multihash_impl {
+	unsigned short enabled;
+	unsigned int cpu_flags;
+	const char *desc;
+	multihash_func_t xxh64;
+	multihash_func_t xxh3;
+} multihash_impl_t;
+
+#define MULTIHASH_DECLARE(ext) \
+    void multihash_xxh64_##ext(const void *data, gsize len, \
+		const guint64 *seeds, guint64 *out, gsize nseeds); \
+    void multihash_xxh3_##ext(const void *data, gsize len, \
+		const guint64 *seeds, guint64 *out, gsize nseeds);
+#define MULTIHASH_IMPL(cpuflags, desc, ext) \
+    {0, (cpuflags), desc, multihash_xxh64_##ext, multihash_xxh3_##ext}
+
+MULTIHASH_DECLARE(ref);
+#define MULTIHASH_REF MULTIHASH_IMPL(0, "ref", ref)
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+# if defined(HAVE_SSE42)
+MULTIHASH_DECLARE(sse42);
+#  define MULTIHASH_SSE42 MULTIHASH_IMPL(CPUID_SSE42, "sse42", sse42)
+# endif
+#endif
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+# if defined(HAVE_AVX2)
+MULTIHASH_DECLARE(avx2);
+#  define MULTIHASH_AVX2 MULTIHASH_IMPL(CPUID_AVX2, "avx2", avx2)
+# endif
+#endif
+
+static multihash_impl_t multihash_list[] = {
+		MULTIHASH_REF,
+#ifdef MULTIHASH_SSE42
+		MULTIHASH_SSE42,
+#endif
+#ifdef MULTIHASH_AVX2
+		MULTIHASH_AVX2,
+#endif
+};
+
+static const multihash_impl_t *multihash_opt = &multihash_list[0];
+
+const char *
+multihash_load (void)
+{
+	guint i;
+
+	/* Enable reference */
+	multihash_list[0].enabled = true;
+
+	if (cpu_config != 0) {
+		for (i = 1; i < G_N_ELEMENTS (multihash_list); i++) {
+			if (multihash_list[i].cpu_flags & cpu_config) {
+				multihash_list[i].enabled = true;
+				multihash_opt = &multihash_list[i];
+			}
+		}
+	}
+
+	return multihash_opt->desc;
+}
+
+void
+rspamd_cryptobox_fast_hash_multi (enum rspamd_cryptobox_fast_hash_type type,
+		const void *data, gsize len,
+		const guint64 *seeds, guint64 *out, gsize nseeds)
+{
+	gsize i;
+
+	switch (type) {
+	case RSPAMD_CRYPTOBOX_XXHASH64:
+		multihash_opt->xxh64 (data, len, seeds, out, nseeds);
+		break;
+	case RSPAMD_CRYPTOBOX_XXHASH3:
+	case RSPAMD_CRYPTOBOX_HASHFAST:
+	case RSPAMD_CRYPTOBOX_HASHFAST_INDEPENDENT:
+		multihash_opt->xxh3 (data, len, seeds, out, nseeds);
+		break;
+	default:
+		for (i = 0; i < nseeds; i ++) {
+			out[i] = rspamd_cryptobox_fast_hash_specific (type, data, len,
+					seeds[i]);
+		}
+		break;
+	}
+}
@@ -0,0 +1,40 @@
+/*-
+ * Copyright 2023 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "xxhash.h"
+
+void
+multihash_xxh64_ref (const void *data, gsize len,
+		const guint64 *seeds, guint64 *out, gsize nseeds)
+{
+	gsize i;
+
+	for (i = 0; i < nseeds; i ++) {
+		out[i] = XXH64 (data, len, seeds[i]);
+	}
+}
+
+void
+multihash_xxh3_ref (const void *data, gsize len,
+		const guint64 *seeds, guint64 *out, gsize nseeds)
+{
+	gsize i;
+
+	for (i = 0; i < nseeds; i ++) {
+		out[i] = XXH3_64bits_withSeed (data, len, seeds[i]);
+	}
+}
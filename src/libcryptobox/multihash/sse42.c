@@ -0,0 +1,67 @@
+/*-
+ * Copyright 2023 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include "cryptobox.h"
+#include "xxhash.h"
+
+#ifdef RSPAMD_HAS_TARGET_ATTR
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#endif
+#ifndef __SSE2__
+#define __SSE2__
+#endif
+#ifndef __SSE__
+#define __SSE__
+#endif
+#ifndef __SSE4_2__
+#define __SSE4_2__
+#endif
+#ifndef __SSE4_1__
+#define __SSE4_1__
+#endif
+#ifndef __SSSE3__
+#define __SSSE3__
+#endif
+#include <xmmintrin.h>
+#include <nmmintrin.h>
+
+#define MH_VEC __m128i
+#define MH_LANES 2
+#define MH_TARGET __attribute__((__target__("sse4.2")))
+#define MH_EXT(name) name##_sse42
+#define MH_SET1(x) _mm_set1_epi64x ((long long)(x))
+#define MH_LOADU(p) _mm_loadu_si128 ((const __m128i *)(p))
+#define MH_STOREU(p, v) _mm_storeu_si128 ((__m128i *)(p), (v))
+#define MH_ADD(a, b) _mm_add_epi64 ((a), (b))
+#define MH_SUB(a, b) _mm_sub_epi64 ((a), (b))
+#define MH_XOR(a, b) _mm_xor_si128 ((a), (b))
+#define MH_OR(a, b) _mm_or_si128 ((a), (b))
+#define MH_AND(a, b) _mm_and_si128 ((a), (b))
+#define MH_SLLI(a, n) _mm_slli_epi64 ((a), (n))
+#define MH_SRLI(a, n) _mm_srli_epi64 ((a), (n))
+#define MH_MUL32(a, b) _mm_mul_epu32 ((a), (b))
+#define MH_SHUF8(a, m) _mm_shuffle_epi8 ((a), (m))
+#define MH_SET_SHUF_MASK(lo, hi) _mm_set_epi64x ((long long)(hi), (long long)(lo))
+
+#include "kernel.inc"
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+#endif
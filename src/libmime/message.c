@@ -978,10 +978,10 @@ rspamd_message_from_data (struct rspamd_task *task, const guchar *start,
 			struct rspamd_task **ptask;
 
 			pmime = lua_newuserdata (L, sizeof (struct rspamd_mime_part *));
-			rspamd_lua_setclass (L, "rspamd{mimepart}", -1);
+			rspamd_lua_setclass (L, rspamd_mimepart_classname, -1);
 			*pmime = part;
 			ptask = lua_newuserdata (L, sizeof (struct rspamd_task *));
-			rspamd_lua_setclass (L, "rspamd{task}", -1);
+			rspamd_lua_setclass (L, rspamd_task_classname, -1);
 			*ptask = task;
 
 			if (lua_pcall (L, 2, 2, 0) != 0) {
@@ -1340,10 +1340,10 @@ rspamd_message_process (struct rspamd_task *task)
 			gint err_idx = lua_gettop (L);
 			lua_pushvalue (L, magic_func_pos);
 			pmime = lua_newuserdata (L, sizeof (struct rspamd_mime_part *));
-			rspamd_lua_setclass (L, "rspamd{mimepart}", -1);
+			rspamd_lua_setclass (L, rspamd_mimepart_classname, -1);
 			*pmime = part;
 			ptask = lua_newuserdata (L, sizeof (struct rspamd_task *));
-			rspamd_lua_setclass (L, "rspamd{task}", -1);
+			rspamd_lua_setclass (L, rspamd_task_classname, -1);
 			*ptask = task;
 
 			if (lua_pcall (L, 2, 2, err_idx) != 0) {
@@ -1412,10 +1412,10 @@ rspamd_message_process (struct rspamd_task *task)
 			gint err_idx = lua_gettop (L);
 			lua_pushvalue (L, content_func_pos);
 			pmime = lua_newuserdata (L, sizeof (struct rspamd_mime_part *));
-			rspamd_lua_setclass (L, "rspamd{mimepart}", -1);
+			rspamd_lua_setclass (L, rspamd_mimepart_classname, -1);
 			*pmime = part;
 			ptask = lua_newuserdata (L, sizeof (struct rspamd_task *));
-			rspamd_lua_setclass (L, "rspamd{task}", -1);
+			rspamd_lua_setclass (L, rspamd_task_classname, -1);
 			*ptask = task;
 
 			if (lua_pcall (L, 2, 0, err_idx) != 0) {
@@ -1732,6 +1732,13 @@ rspamd_rcl_config_init (struct rspamd_config *cfg, GHashTable *skip_sections)
 				G_STRUCT_OFFSET (struct rspamd_config, cache_reload_time),
 				RSPAMD_CL_FLAG_TIME_FLOAT,
 				"How often cache reload should be performed");
+		rspamd_rcl_add_default_handler (sub,
+				"cache_adaptive_order",
+				rspamd_rcl_parse_struct_boolean,
+				G_STRUCT_OFFSET (struct rspamd_config, cache_adaptive_order),
+				0,
+				"Order filters to reach the reject score as early as possible "
+				"using measured hit rates, scores and execution times");
 		/* Old DNS configuration */
 		rspamd_rcl_add_default_handler (sub,
 				"dns_nameserver",
@@ -1967,6 +1974,12 @@ rspamd_rcl_config_init (struct rspamd_config *cfg, GHashTable *skip_sections)
 				G_STRUCT_OFFSET (struct rspamd_config, vectorized_hyperscan),
 				0,
 				"Use hyperscan in vectorized mode (obsoleted, do not use)");
+		rspamd_rcl_add_default_handler (sub,
+				"batch_hyperscan",
+				rspamd_rcl_parse_struct_boolean,
+				G_STRUCT_OFFSET (struct rspamd_config, batch_hyperscan),
+				0,
+				"Scan each regexp class with hyperscan once per task, even when a pcre only regexp is requested first");
 		rspamd_rcl_add_default_handler (sub,
 				"cores_dir",
 				rspamd_rcl_parse_struct_string,
@@ -3912,7 +3925,7 @@ rspamd_config_read (struct rspamd_config *cfg,
 
 				pcfg = lua_newuserdata (L, sizeof (*pcfg));
 				*pcfg = cfg;
-				rspamd_lua_setclass (L, "rspamd{config}", -1);
+				rspamd_lua_setclass (L, rspamd_config_classname, -1);
 
 				if (lua_pcall (L, 1, 0, err_idx) != 0) {
 					msg_err_config ("cannot call lua init_debug_logging script: %s",
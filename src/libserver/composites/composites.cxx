@@ -85,11 +85,14 @@ struct composites_data {
 	ankerl::unordered_dense::map<std::string_view,
 			std::vector<symbol_remove_data>> symbols_to_remove;
 	std::vector<bool> checked;
+	/* Composites that have at least one of their symbols in the result */
+	std::vector<bool> candidates;
 
 	explicit composites_data(struct rspamd_task *task, struct rspamd_scan_result *mres) :
 			task(task), composite(nullptr), metric_res(mres) {
-		checked.resize(rspamd_composites_manager_nelts(task->cfg->composites_manager) * 2,
-				false);
+		auto nelts = rspamd_composites_manager_nelts(task->cfg->composites_manager);
+		checked.resize(nelts * 2, false);
+		candidates.resize(nelts, false);
 	}
 };
 
@@ -824,9 +827,22 @@ composites_foreach_callback(gpointer key, gpointer value, void *data)
 				return;
 			}
 
+			if (comp->skippable && !cd->candidates[comp->id]) {
+				/* None of the composite symbols are found, so it cannot match */
+				msg_debug_composites ("%s: skip composite %s as no symbols are matched",
+						cd->metric_res->name,
+						cd->composite->sym.c_str());
+				cd->checked[comp->id * 2] = true;
+				cd->checked[comp->id * 2 + 1] = false;
+				comp->st->skipped++;
+
+				return;
+			}
+
 			msg_debug_composites ("%s: start processing composite %s",
 					cd->metric_res->name,
 					cd->composite->sym.c_str());
+			comp->st->evaluated++;
 
 			rc = rspamd_process_expression(comp->expr, RSPAMD_EXPRESSION_FLAG_NOOPT,
 					cd);
@@ -943,6 +959,22 @@ remove_symbols(const composites_data &cd, const std::vector<symbol_remove_data>
 	}
 }
 
+static void
+composites_candidates_callback(gpointer key, gpointer value, void *data)
+{
+	auto *cd = (struct composites_data *) data;
+	auto *cm = COMPOSITE_MANAGER_FROM_PTR(cd->task->cfg->composites_manager);
+	const auto *ids = cm->find_by_atom((const gchar *) key);
+
+	if (ids) {
+		for (auto id : *ids) {
+			if (id < (int) cd->candidates.size()) {
+				cd->candidates[id] = true;
+			}
+		}
+	}
+}
+
 static void
 composites_metric_callback(struct rspamd_task *task)
 {
@@ -954,6 +986,10 @@ composites_metric_callback(struct rspamd_task *task)
 	DL_FOREACH (task->result, mres) {
 		auto &cd = comp_data_vec.emplace_back(task, mres);
 
+		/* Select composites that can be matched by the symbols found */
+		rspamd_task_symbol_result_foreach(task, mres,
+				composites_candidates_callback, &cd);
+
 		/* Process metric result */
 		rspamd_symcache_composites_foreach(task,
 				task->cfg->cache,
@@ -57,6 +57,14 @@ void* rspamd_composites_manager_add_from_ucl_silent(void *,  const char *, const
 void* rspamd_composites_manager_add_from_string(void *, const char *, const char *);
 void* rspamd_composites_manager_add_from_string_silent(void *, const char *, const char *);
 
+/**
+ * Adds evaluated/skipped counters to the composites entries of the symcache
+ * counters array
+ * @param cm composites manager
+ * @param top array returned by `rspamd_symcache_counters`
+ */
+void rspamd_composites_manager_counters(void *cm, ucl_object_t *top);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -38,6 +38,14 @@ enum class rspamd_composite_policy {
 	RSPAMD_COMPOSITE_POLICY_UNKNOWN
 };
 
+/**
+ * Evaluation counters, live in shared memory
+ */
+struct rspamd_composite_stat {
+	guint64 evaluated;
+	guint64 skipped;
+};
+
 /**
  * Static composites structure
  */
@@ -47,6 +55,9 @@ struct rspamd_composite {
 	struct rspamd_expression *expr;
 	gint id;
 	rspamd_composite_policy policy;
+	/* Composite cannot match unless one of its indexed symbols is found */
+	bool skippable;
+	struct rspamd_composite_stat *st;
 };
 
 #define COMPOSITE_MANAGER_FROM_PTR(ptr) (reinterpret_cast<rspamd::composites::composites_manager *>(ptr))
@@ -73,6 +84,26 @@ public:
 
 	auto add_composite(std::string_view, const ucl_object_t *, bool silent_duplicate) -> rspamd_composite *;
 	auto add_composite(std::string_view name, std::string_view expression, bool silent_duplicate, double score = NAN) -> rspamd_composite *;
+
+	/*
+	 * Returns ids of the composites that might be matched when the specified
+	 * symbol is found in the scan result
+	 */
+	auto find_by_atom(std::string_view sym) -> const std::vector<int> * {
+		if (atoms_index_dirty) {
+			build_atoms_index();
+		}
+
+		auto found = atoms_index.find(sym);
+
+		if (found != atoms_index.end()) {
+			return &found->second;
+		}
+
+		return nullptr;
+	}
+
+	auto counters(ucl_object_t *top) const -> void;
 private:
 	~composites_manager() = default;
 	static void composites_manager_dtor(void *ptr) {
@@ -87,8 +118,12 @@ private:
 		composite->id = all_composites.size() - 1;
 		composite->str_expr = composite_expression;
 		composite->sym = composite_name;
+		composite->skippable = false;
+		composite->st = rspamd_mempool_alloc0_shared_type(cfg->cfg_pool,
+				struct rspamd_composite_stat);
 
 		composites[composite->sym] = composite;
+		atoms_index_dirty = true;
 
 		return composite;
 	}
@@ -97,7 +132,13 @@ private:
 			std::shared_ptr<rspamd_composite>, rspamd::smart_str_hash, rspamd::smart_str_equal> composites;
 	/* Store all composites here, even if we have duplicates */
 	std::vector<std::shared_ptr<rspamd_composite>> all_composites;
+	/* Symbol name -> ids of composites that depend on it */
+	ankerl::unordered_dense::map<std::string,
+			std::vector<int>, rspamd::smart_str_hash, rspamd::smart_str_equal> atoms_index;
+	bool atoms_index_dirty = true;
 	struct rspamd_config *cfg;
+
+	auto build_atoms_index() -> void;
 };
 
 }
@@ -17,6 +17,7 @@
 #include <memory>
 #include <vector>
 #include <cmath>
+#include <algorithm>
 #include "contrib/ankerl/unordered_dense.h"
 
 #include "composites.h"
@@ -24,6 +25,7 @@
 #include "libserver/cfg_file.h"
 #include "libserver/logger.h"
 #include "libserver/maps/map.h"
+#include "libutil/str_util.h"
 #include "libutil/cxx/util.hxx"
 
 namespace rspamd::composites {
@@ -190,6 +192,148 @@ composites_manager::add_composite(std::string_view composite_name,
 	return new_composite(composite_name, expr, composite_expression).get();
 }
 
+auto
+composites_manager::build_atoms_index() -> void
+{
+	enum class visit_state : std::uint8_t {
+		unvisited = 0,
+		in_progress,
+		done,
+	};
+	struct atoms_cbdata {
+		std::vector<std::string> atoms;
+		bool always_check = false;
+	};
+
+	auto nelts = all_composites.size();
+	std::vector<atoms_cbdata> direct(nelts);
+
+	for (const auto &comp : all_composites) {
+		auto &cbd = direct[comp->id];
+
+		rspamd_expression_atom_foreach(comp->expr, [](const rspamd_ftok_t *tok, gpointer ud) {
+			auto *cbd = reinterpret_cast<atoms_cbdata *>(ud);
+			auto atom = std::string_view{tok->begin, tok->len};
+
+			/* Normalise atom the same way as the composite atoms parser does */
+			auto norm_start = std::find_if(atom.begin(), atom.end(),
+					[](char c) { return g_ascii_isalnum(c); });
+			atom = atom.substr(norm_start - atom.begin());
+			atom = atom.substr(0, rspamd_memcspn(atom.data(), "[; \t()><!|&\n", atom.size()));
+
+			if (atom.empty() || atom.substr(0, 2) == "g:" ||
+				atom.substr(0, 3) == "g+:" || atom.substr(0, 3) == "g-:") {
+				/* Groups are not indexed */
+				cbd->always_check = true;
+			}
+			else {
+				cbd->atoms.emplace_back(atom);
+			}
+		}, &cbd);
+
+		/*
+		 * If an expression is true when no atoms match (e.g. `!A`), then
+		 * it must be evaluated for each task
+		 */
+		auto empty_res = rspamd_process_expression_closure(comp->expr,
+				[](gpointer ud, rspamd_expression_atom_t *atom) -> gdouble { return 0.0; },
+				RSPAMD_EXPRESSION_FLAG_NOOPT, nullptr, nullptr);
+
+		if (empty_res != 0) {
+			cbd.always_check = true;
+		}
+	}
+
+	/* Composites that depend on other composites inherit their symbols */
+	std::vector<visit_state> states(nelts, visit_state::unvisited);
+	std::vector<ankerl::unordered_dense::set<std::string>> triggers(nelts);
+
+	auto resolve_triggers = [&](auto &&self, int id) -> void {
+		states[id] = visit_state::in_progress;
+
+		for (const auto &atom : direct[id].atoms) {
+			triggers[id].insert(atom);
+
+			const auto *dep = find(atom);
+
+			if (dep == nullptr) {
+				continue;
+			}
+
+			if (states[dep->id] == visit_state::in_progress) {
+				/* Cyclic dependency, do not try to be smart */
+				direct[id].always_check = true;
+				continue;
+			}
+
+			if (states[dep->id] == visit_state::unvisited) {
+				self(self, dep->id);
+			}
+
+			if (direct[dep->id].always_check) {
+				direct[id].always_check = true;
+			}
+
+			triggers[id].insert(triggers[dep->id].begin(), triggers[dep->id].end());
+		}
+
+		states[id] = visit_state::done;
+	};
+
+	atoms_index.clear();
+
+	for (const auto &comp : all_composites) {
+		if (states[comp->id] == visit_state::unvisited) {
+			resolve_triggers(resolve_triggers, comp->id);
+		}
+	}
+
+	auto nskippable = 0;
+
+	for (const auto &comp : all_composites) {
+		comp->skippable = !direct[comp->id].always_check;
+
+		if (comp->skippable) {
+			nskippable++;
+
+			for (const auto &sym : triggers[comp->id]) {
+				atoms_index[sym].push_back(comp->id);
+			}
+		}
+	}
+
+	msg_debug_config("indexed %d composites by %d symbols, %d composites are always checked",
+			nskippable, (int) atoms_index.size(), (int) nelts - nskippable);
+
+	atoms_index_dirty = false;
+}
+
+auto
+composites_manager::counters(ucl_object_t *top) const -> void
+{
+	ucl_object_iter_t it = nullptr;
+	const ucl_object_t *cur;
+
+	while ((cur = ucl_object_iterate(top, &it, true)) != nullptr) {
+		const auto *sym = ucl_object_lookup(cur, "symbol");
+
+		if (sym == nullptr || ucl_object_type(sym) != UCL_STRING) {
+			continue;
+		}
+
+		const auto *comp = find(ucl_object_tostring(sym));
+
+		if (comp != nullptr) {
+			auto *obj = const_cast<ucl_object_t *>(cur);
+
+			ucl_object_insert_key(obj, ucl_object_fromint(comp->st->evaluated),
+					"evaluated", 0, false);
+			ucl_object_insert_key(obj, ucl_object_fromint(comp->st->skipped),
+					"skipped", 0, false);
+		}
+	}
+}
+
 struct map_cbdata {
 	composites_manager *cm;
 	struct rspamd_config *cfg;
@@ -288,6 +432,12 @@ rspamd_composites_manager_nelts(void *ptr)
 	return COMPOSITE_MANAGER_FROM_PTR(ptr)->size();
 }
 
+void
+rspamd_composites_manager_counters(void *cm, ucl_object_t *top)
+{
+	COMPOSITE_MANAGER_FROM_PTR(cm)->counters(top);
+}
+
 void*
 rspamd_composites_manager_add_from_ucl(void *cm, const char *sym, const ucl_object_t *obj)
 {
@@ -29,6 +29,13 @@
 
 static const gchar *M = "rspamd dns";
 
+/* Server stat is shared between workers */
+#ifdef HAVE_ATOMIC_BUILTINS
+#define RSPAMD_DNS_STAT_INC(field) __atomic_add_fetch (&(field), 1, __ATOMIC_RELEASE)
+#else
+#define RSPAMD_DNS_STAT_INC(field) ((field) ++)
+#endif
+
 static struct rdns_upstream_elt* rspamd_dns_select_upstream (const char *name,
 		size_t len, void *ups_data);
 static struct rdns_upstream_elt* rspamd_dns_select_upstream_retransmit (
@@ -62,12 +69,43 @@ struct rspamd_dns_request_ud {
 	struct rdns_reply *reply;
 };
 
+/* Used as a key for failures and answers caches and for requests in flight */
 struct rspamd_dns_fail_cache_entry {
 	const char *name;
 	gint32 namelen;
 	enum rdns_request_type type;
 };
 
+/* Entry of the answers cache, the request owns its reply */
+struct rspamd_dns_cached_reply {
+	struct rdns_request *req;
+	ev_tstamp stored;
+};
+
+struct rspamd_dns_cached_delayed_cbdata;
+
+/* Single upstream request shared by all tasks asking the same question */
+struct rspamd_dns_inflight {
+	struct rspamd_dns_fail_cache_entry key;
+	struct rspamd_dns_resolver *resolver;
+	struct rdns_request *req;
+	struct rspamd_dns_cached_delayed_cbdata *waiters;
+};
+
+struct rspamd_dns_cached_delayed_cbdata {
+	struct rspamd_task *task;
+	dns_callback_type cb;
+	gpointer ud;
+	ev_timer tm;
+	struct rdns_request *req;
+	struct rdns_reply *reply;
+	enum dns_rcode rcode;
+	gint32 ttl_elapsed; /* seconds the cached reply has been stored */
+	struct rspamd_symcache_dynamic_item *item;
+	struct rspamd_dns_inflight *inflight;
+	struct rspamd_dns_cached_delayed_cbdata *prev, *next;
+};
+
 static const gint8 ascii_dns_table[128]={
 		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
 		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -144,6 +182,126 @@ rspamd_dns_fin_cb (gpointer arg)
 	}
 }
 
+static struct rspamd_dns_fail_cache_entry *
+rspamd_dns_cache_key_new (const gchar *name, enum rdns_request_type type)
+{
+	struct rspamd_dns_fail_cache_entry *nentry;
+	gchar *target;
+	gsize namelen;
+
+	/* Allocate in a single entry to allow further free in a single call */
+	namelen = strlen (name);
+	nentry = g_malloc (sizeof (*nentry) + namelen + 1);
+	target = ((gchar *)nentry) + sizeof (*nentry);
+	rspamd_strlcpy (target, name, namelen + 1);
+	nentry->type = type;
+	nentry->name = target;
+	nentry->namelen = namelen;
+
+	return nentry;
+}
+
+static guint
+rspamd_dns_reply_cache_ttl (struct rspamd_dns_resolver *resolver,
+		struct rdns_reply *reply)
+{
+	struct rdns_reply_entry *elt;
+	gint32 ttl = -1;
+
+	if (reply->code == RDNS_RC_NOERROR && reply->entries != NULL) {
+		DL_FOREACH (reply->entries, elt) {
+			if (ttl == -1 || elt->ttl < ttl) {
+				ttl = elt->ttl;
+			}
+		}
+	}
+	else if (reply->code == RDNS_RC_NOERROR || reply->code == RDNS_RC_NXDOMAIN) {
+		/* No records, we have no SOA here, so use a fixed value */
+		ttl = resolver->cache_negative_ttl;
+	}
+
+	if (ttl <= 0) {
+		return 0;
+	}
+
+	return MIN ((guint)ttl, resolver->cache_max_ttl);
+}
+
+static void
+rspamd_dns_cached_reply_free (gpointer p)
+{
+	struct rspamd_dns_cached_reply *cached = (struct rspamd_dns_cached_reply *)p;
+
+	rdns_request_release (cached->req);
+	g_free (cached);
+}
+
+/*
+ * Cached replies are shared by all hits, so their TTLs are decreased only
+ * while a callback runs; returns the delta to restore them
+ */
+static gint32
+rspamd_dns_reply_age (struct rdns_reply *reply, gint32 elapsed)
+{
+	struct rdns_reply_entry *elt;
+
+	/* Never make a TTL negative, so it can be restored as is */
+	DL_FOREACH (reply->entries, elt) {
+		if (elt->ttl < elapsed) {
+			elapsed = MAX (elt->ttl, 0);
+		}
+	}
+
+	DL_FOREACH (reply->entries, elt) {
+		elt->ttl -= elapsed;
+	}
+
+	return elapsed;
+}
+
+static void
+rspamd_dns_reply_restore_age (struct rdns_reply *reply, gint32 elapsed)
+{
+	struct rdns_reply_entry *elt;
+
+	DL_FOREACH (reply->entries, elt) {
+		elt->ttl += elapsed;
+	}
+}
+
+/*
+ * Saves reply in the failures or answers cache, the request (that owns the
+ * reply) is retained by the cache
+ */
+static void
+rspamd_dns_maybe_cache_reply (struct rspamd_dns_resolver *resolver,
+		struct rdns_reply *reply, ev_tstamp now)
+{
+	const gchar *name = reply->request->requested_names[0].name;
+	enum rdns_request_type type = reply->request->requested_names[0].type;
+
+	if (reply->code == RDNS_RC_SERVFAIL && resolver->fails_cache) {
+		rspamd_lru_hash_insert (resolver->fails_cache,
+				rspamd_dns_cache_key_new (name, type),
+				rdns_request_retain (reply->request),
+				now, resolver->fails_cache_time);
+	}
+	else if (resolver->cache) {
+		guint ttl = rspamd_dns_reply_cache_ttl (resolver, reply);
+
+		if (ttl > 0) {
+			struct rspamd_dns_cached_reply *cached;
+
+			cached = g_malloc (sizeof (*cached));
+			cached->req = rdns_request_retain (reply->request);
+			cached->stored = ev_now (resolver->event_loop);
+			rspamd_lru_hash_insert (resolver->cache,
+					rspamd_dns_cache_key_new (name, type),
+					cached, now, ttl);
+		}
+	}
+}
+
 static void
 rspamd_dns_callback (struct rdns_reply *reply, gpointer ud)
 {
@@ -153,30 +311,9 @@ rspamd_dns_callback (struct rdns_reply *reply, gpointer ud)
 
 
 	if (reqdata->session) {
-		if (reply->code == RDNS_RC_SERVFAIL &&
-			reqdata->task &&
-			reqdata->task->resolver->fails_cache) {
-
-			/* Add to cache... */
-			const gchar *name = reqdata->req->requested_names[0].name;
-			gchar *target;
-			gsize namelen;
-			struct rspamd_dns_fail_cache_entry *nentry;
-
-			/* Allocate in a single entry to allow further free in a single call */
-			namelen = strlen (name);
-			nentry = g_malloc (sizeof (nentry) + namelen + 1);
-			target = ((gchar *)nentry) + sizeof (nentry);
-			rspamd_strlcpy (target, name, namelen + 1);
-			nentry->type = reqdata->req->requested_names[0].type;
-			nentry->name = target;
-			nentry->namelen = namelen;
-
-			/* Rdns request is retained there */
-			rspamd_lru_hash_insert (reqdata->task->resolver->fails_cache,
-					nentry, rdns_request_retain (reply->request),
-					reqdata->task->task_timestamp,
-					reqdata->task->resolver->fails_cache_time);
+		if (reqdata->task) {
+			rspamd_dns_maybe_cache_reply (reqdata->task->resolver, reply,
+					reqdata->task->task_timestamp);
 		}
 
 		/*
@@ -292,29 +429,160 @@ rspamd_dns_resolver_request (struct rspamd_dns_resolver *resolver,
 	return reqdata;
 }
 
-struct rspamd_dns_cached_delayed_cbdata {
-	struct rspamd_task *task;
-	dns_callback_type cb;
-	gpointer ud;
-	ev_timer tm;
-	struct rdns_request *req;
-};
+static void
+rspamd_dns_cached_fin_cb (gpointer arg)
+{
+	struct rspamd_dns_cached_delayed_cbdata *cbd =
+			(struct rspamd_dns_cached_delayed_cbdata *)arg;
+	struct rdns_request *req = cbd->req;
+	struct rdns_reply fake_reply;
+
+	ev_timer_stop (cbd->task->event_loop, &cbd->tm);
+
+	if (cbd->inflight) {
+		/* Session is terminated before the shared request has been completed */
+		req = cbd->inflight->req;
+		DL_DELETE (cbd->inflight->waiters, cbd);
+		cbd->inflight = NULL;
+		cbd->reply = NULL;
+		cbd->rcode = RDNS_RC_TIMEOUT;
+	}
+
+	if (cbd->item) {
+		rspamd_symcache_set_cur_item (cbd->task, cbd->item);
+	}
+
+	if (cbd->reply) {
+		if (cbd->ttl_elapsed > 0) {
+			gint32 age = rspamd_dns_reply_age (cbd->reply, cbd->ttl_elapsed);
+
+			cbd->cb (cbd->reply, cbd->ud);
+			rspamd_dns_reply_restore_age (cbd->reply, age);
+		}
+		else {
+			cbd->cb (cbd->reply, cbd->ud);
+		}
+	}
+	else {
+		memset (&fake_reply, 0, sizeof (fake_reply));
+		fake_reply.code = cbd->rcode;
+		fake_reply.request = req;
+		fake_reply.resolver = req->resolver;
+		fake_reply.requested_name = req->requested_names[0].name;
+		cbd->cb (&fake_reply, cbd->ud);
+	}
+
+	if (cbd->req) {
+		rdns_request_release (cbd->req);
+	}
+
+	if (cbd->item) {
+		rspamd_symcache_item_async_dec_check (cbd->task, cbd->item, M);
+	}
+}
 
 static void
-rspamd_fail_cache_cb (EV_P_ ev_timer *w, int revents)
+rspamd_dns_cached_timer_cb (EV_P_ ev_timer *w, int revents)
 {
 	struct rspamd_dns_cached_delayed_cbdata *cbd =
 			(struct rspamd_dns_cached_delayed_cbdata *)w->data;
-	struct rdns_reply fake_reply;
 
 	ev_timer_stop (EV_A_ w);
-	memset (&fake_reply, 0, sizeof (fake_reply));
-	fake_reply.code = RDNS_RC_SERVFAIL;
-	fake_reply.request = cbd->req;
-	fake_reply.resolver = cbd->req->resolver;
-	fake_reply.requested_name = cbd->req->requested_names[0].name;
-	cbd->cb (&fake_reply, cbd->ud);
-	rdns_request_release (cbd->req);
+	rspamd_session_remove_event (cbd->task->s, rspamd_dns_cached_fin_cb, cbd);
+}
+
+/*
+ * Registers a reply that is not tied to a specific rdns request of this task:
+ * it is either taken from caches or shared with another request in flight
+ */
+static struct rspamd_dns_cached_delayed_cbdata *
+rspamd_dns_cached_cbd_new (struct rspamd_task *task,
+						   dns_callback_type cb,
+						   gpointer ud)
+{
+	struct rspamd_dns_cached_delayed_cbdata *cbd;
+
+	cbd = rspamd_mempool_alloc0 (task->task_pool, sizeof (*cbd));
+	cbd->task = task;
+	cbd->cb = cb;
+	cbd->ud = ud;
+	ev_timer_init (&cbd->tm, rspamd_dns_cached_timer_cb, 0.0, 0.0);
+	cbd->tm.data = cbd;
+	cbd->item = rspamd_symcache_get_cur_item (task);
+
+	if (cbd->item) {
+		rspamd_symcache_item_async_inc (task, cbd->item, M);
+	}
+
+	rspamd_session_add_event (task->s, rspamd_dns_cached_fin_cb, cbd, M);
+
+	return cbd;
+}
+
+static void
+rspamd_dns_inflight_cb (struct rdns_reply *reply, gpointer ud)
+{
+	struct rspamd_dns_inflight *inflight = ud;
+	struct rspamd_dns_resolver *resolver = inflight->resolver;
+	struct rspamd_dns_cached_delayed_cbdata *cbd, *tmp;
+	GPtrArray *waiters;
+	guint i;
+
+	g_hash_table_remove (resolver->inflight, &inflight->key);
+	rspamd_dns_maybe_cache_reply (resolver, reply, ev_now (resolver->event_loop));
+
+	/* Detach all waiters first, as callbacks can start new requests */
+	waiters = g_ptr_array_new ();
+
+	DL_FOREACH_SAFE (inflight->waiters, cbd, tmp) {
+		cbd->inflight = NULL;
+		cbd->req = rdns_request_retain (reply->request);
+		cbd->reply = reply;
+		g_ptr_array_add (waiters, cbd);
+	}
+
+	inflight->waiters = NULL;
+
+	PTR_ARRAY_FOREACH (waiters, i, cbd) {
+		rspamd_session_remove_event (cbd->task->s, rspamd_dns_cached_fin_cb, cbd);
+	}
+
+	g_ptr_array_free (waiters, TRUE);
+	g_free (inflight);
+}
+
+static struct rspamd_dns_inflight *
+rspamd_dns_inflight_new (struct rspamd_dns_resolver *resolver,
+						 enum rdns_request_type type,
+						 const char *name)
+{
+	struct rspamd_dns_inflight *inflight;
+	struct rspamd_dns_request_ud *reqdata;
+	gsize namelen = strlen (name);
+	gchar *target;
+
+	inflight = g_malloc0 (sizeof (*inflight) + namelen + 1);
+	target = ((gchar *)inflight) + sizeof (*inflight);
+	rspamd_strlcpy (target, name, namelen + 1);
+	inflight->key.name = target;
+	inflight->key.namelen = namelen;
+	inflight->key.type = type;
+	inflight->resolver = resolver;
+
+	/* Not bound to any session: it lives until reply or timeout */
+	reqdata = rspamd_dns_resolver_request (resolver, NULL, NULL,
+			rspamd_dns_inflight_cb, inflight, type, name);
+
+	if (reqdata == NULL) {
+		g_free (inflight);
+
+		return NULL;
+	}
+
+	inflight->req = reqdata->req;
+	g_hash_table_insert (resolver->inflight, &inflight->key, inflight);
+
+	return inflight;
 }
 
 static gboolean
@@ -327,34 +595,91 @@ make_dns_request_task_common (struct rspamd_task *task,
 {
 	struct rspamd_dns_request_ud *reqdata;
 
+	struct rspamd_dns_resolver *resolver = task->resolver;
+	struct rspamd_stat *stat = NULL;
+
 	if (!forced && task->dns_requests >= task->cfg->dns_max_requests) {
 		return FALSE;
 	}
 
-	if (task->resolver->fails_cache) {
-		/* Search in failures cache */
+	if (task->worker && task->worker->srv) {
+		stat = task->worker->srv->stat;
+	}
+
+	if ((resolver->fails_cache || resolver->cache || resolver->inflight) &&
+			!rspamd_session_blocked (task->s)) {
 		struct rspamd_dns_fail_cache_entry search;
+		struct rspamd_dns_cached_delayed_cbdata *cbd;
+		struct rspamd_dns_inflight *inflight;
+		struct rspamd_dns_cached_reply *cached;
 		struct rdns_request *req;
 
 		search.name = name;
 		search.namelen = strlen (name);
 		search.type = type;
 
-		if ((req = rspamd_lru_hash_lookup (task->resolver->fails_cache,
+		if (resolver->fails_cache &&
+				(req = rspamd_lru_hash_lookup (resolver->fails_cache,
 				&search, task->task_timestamp)) != NULL) {
 			/*
 			 * We need to reply with SERVFAIL again to the API, so add a special
 			 * timer, uh-oh, and fire it
 			 */
-			struct rspamd_dns_cached_delayed_cbdata *cbd =
-					rspamd_mempool_alloc0 (task->task_pool, sizeof (*cbd));
-
-			ev_timer_init (&cbd->tm, rspamd_fail_cache_cb, 0.0, 0.0);
-			cbd->task = task;
-			cbd->cb = cb;
-			cbd->ud = ud;
+			cbd = rspamd_dns_cached_cbd_new (task, cb, ud);
 			cbd->req = rdns_request_retain (req);
-			cbd->tm.data = cbd;
+			cbd->rcode = RDNS_RC_SERVFAIL;
+			ev_timer_start (task->event_loop, &cbd->tm);
+
+			return TRUE;
+		}
+
+		if (resolver->cache &&
+				(cached = rspamd_lru_hash_lookup (resolver->cache,
+				&search, task->task_timestamp)) != NULL) {
+			/* Reply is served with TTLs decreased by its age */
+			ev_tstamp age = ev_now (task->event_loop) - cached->stored;
+
+			cbd = rspamd_dns_cached_cbd_new (task, cb, ud);
+			cbd->req = rdns_request_retain (cached->req);
+			cbd->reply = cached->req->reply;
+			cbd->ttl_elapsed = age > 0 ? (gint32)age : 0;
+			ev_timer_start (task->event_loop, &cbd->tm);
+
+			if (stat) {
+				RSPAMD_DNS_STAT_INC (stat->dns_cache_hits);
+			}
+
+			return TRUE;
+		}
+
+		if (resolver->inflight) {
+			inflight = g_hash_table_lookup (resolver->inflight, &search);
+
+			if (inflight == NULL) {
+				inflight = rspamd_dns_inflight_new (resolver, type, name);
+
+				if (inflight == NULL) {
+					return FALSE;
+				}
+
+				task->dns_requests ++;
+
+				if (stat) {
+					RSPAMD_DNS_STAT_INC (stat->dns_cache_misses);
+				}
+			}
+			else if (stat) {
+				RSPAMD_DNS_STAT_INC (stat->dns_coalesced);
+			}
+
+			cbd = rspamd_dns_cached_cbd_new (task, cb, ud);
+			cbd->inflight = inflight;
+			DL_APPEND (inflight->waiters, cbd);
+
+			if (!forced && task->dns_requests >= task->cfg->dns_max_requests) {
+				msg_info_task ("stop resolving on reaching %ud requests",
+						task->dns_requests);
+			}
 
 			return TRUE;
 		}
@@ -367,6 +692,10 @@ make_dns_request_task_common (struct rspamd_task *task,
 	if (reqdata) {
 		task->dns_requests ++;
 
+		if (stat) {
+			RSPAMD_DNS_STAT_INC (stat->dns_cache_misses);
+		}
+
 		reqdata->task = task;
 		reqdata->item = rspamd_symcache_get_cur_item (task);
 
@@ -809,8 +1138,10 @@ rspamd_dns_resolver_config_ucl (struct rspamd_config *cfg,
 								const ucl_object_t *dns_section)
 {
 	const ucl_object_t *fake_replies, *fails_cache_size, *fails_cache_time,
-		*hosts;
+		*hosts, *cache_size, *tmp;
 	static const ev_tstamp default_fails_cache_time = 10.0;
+	static const guint default_cache_max_ttl = 300,
+		default_cache_negative_ttl = 30;
 
 	/* Process fake replies */
 	fake_replies = ucl_object_lookup_any (dns_section, "fake_records",
@@ -868,6 +1199,36 @@ rspamd_dns_resolver_config_ucl (struct rspamd_config *cfg,
 				g_free, (GDestroyNotify)rdns_request_release,
 				rspamd_dns_fail_hash, rspamd_dns_fail_equal);
 	}
+
+	cache_size = ucl_object_lookup (dns_section, "cache_size");
+	if (cache_size && ucl_object_type (cache_size) == UCL_INT &&
+			ucl_object_toint (cache_size) > 0) {
+		dns_resolver->cache_max_ttl = default_cache_max_ttl;
+		dns_resolver->cache_negative_ttl = default_cache_negative_ttl;
+
+		tmp = ucl_object_lookup (dns_section, "cache_max_ttl");
+
+		if (tmp) {
+			dns_resolver->cache_max_ttl = ucl_object_todouble (tmp);
+		}
+
+		tmp = ucl_object_lookup (dns_section, "cache_negative_ttl");
+
+		if (tmp) {
+			dns_resolver->cache_negative_ttl = ucl_object_todouble (tmp);
+		}
+
+		dns_resolver->cache = rspamd_lru_hash_new_full (
+				ucl_object_toint (cache_size),
+				g_free, rspamd_dns_cached_reply_free,
+				rspamd_dns_fail_hash, rspamd_dns_fail_equal);
+	}
+
+	tmp = ucl_object_lookup (dns_section, "coalesce_requests");
+
+	if (tmp && ucl_object_type (tmp) == UCL_BOOLEAN) {
+		dns_resolver->coalesce_requests = ucl_object_toboolean (tmp);
+	}
 }
 
 struct rspamd_dns_resolver *
@@ -879,6 +1240,7 @@ rspamd_dns_resolver_init (rspamd_logger_t *logger,
 
 	dns_resolver = g_malloc0 (sizeof (struct rspamd_dns_resolver));
 	dns_resolver->event_loop = ev_base;
+	dns_resolver->coalesce_requests = TRUE;
 
 	if (cfg != NULL) {
 		dns_resolver->request_timeout = cfg->dns_timeout;
@@ -968,6 +1330,11 @@ rspamd_dns_resolver_init (rspamd_logger_t *logger,
 		}
 	}
 
+	if (dns_resolver->coalesce_requests) {
+		dns_resolver->inflight = g_hash_table_new (rspamd_dns_fail_hash,
+				rspamd_dns_fail_equal);
+	}
+
 	rdns_resolver_set_logger (dns_resolver->r, rspamd_rnds_log_bridge, logger);
 	rdns_resolver_init (dns_resolver->r);
 
@@ -990,6 +1357,14 @@ rspamd_dns_resolver_deinit (struct rspamd_dns_resolver *resolver)
 			rspamd_lru_hash_destroy (resolver->fails_cache);
 		}
 
+		if (resolver->cache) {
+			rspamd_lru_hash_destroy (resolver->cache);
+		}
+
+		if (resolver->inflight) {
+			g_hash_table_unref (resolver->inflight);
+		}
+
 		uidna_close (resolver->uidna);
 
 		g_free (resolver);
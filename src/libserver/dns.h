@@ -38,6 +38,13 @@ struct rspamd_dns_resolver {
 	rspamd_lru_hash_t *fails_cache;
 	void *uidna;
 	ev_tstamp fails_cache_time;
+	/* Answers cache */
+	rspamd_lru_hash_t *cache;
+	guint cache_max_ttl;
+	guint cache_negative_ttl;
+	/* Identical task requests in flight */
+	GHashTable *inflight;
+	gboolean coalesce_requests;
 	struct upstream_list *ups;
 	struct rspamd_config *cfg;
 	gdouble request_timeout;
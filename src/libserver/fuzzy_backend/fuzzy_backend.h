@@ -30,7 +30,9 @@ struct rspamd_config;
 /*
  * Callbacks for fuzzy methods
  */
-typedef void (*rspamd_fuzzy_check_cb) (struct rspamd_fuzzy_reply *rep, void *ud);
+typedef void (*rspamd_fuzzy_check_cb) (gboolean success,
+									   struct rspamd_fuzzy_reply *rep,
+									   void *ud);
 
 typedef void (*rspamd_fuzzy_update_cb) (gboolean success,
 										guint nadded,
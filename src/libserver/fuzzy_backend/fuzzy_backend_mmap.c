@@ -0,0 +1,1636 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rspamd.h"
+#include "fuzzy_backend.h"
+#include "fuzzy_backend_mmap.h"
+#include "cryptobox.h"
+#include "unix-std.h"
+
+/*
+ * Storage file consists of a header followed by two open addressing tables
+ * with linear probing:
+ * - digests: full digest -> value, flag and time of the last update
+ * - shingles: (shingle number, shingle value) -> digest key (the first
+ *   8 bytes of the digest)
+ *
+ * Only one process (the first fuzzy worker) modifies storage, all workers
+ * read it concurrently without locks: each slot is protected by a sequence
+ * counter that is odd while the slot is being written.
+ *
+ * Each update is also appended to `<file>.log` as an absolute state of the
+ * affected entries, so replaying the log after a crash is idempotent. The
+ * log is truncated once the mapping is synced to the disk. Expiry and
+ * compaction are done on the periodic sync, compaction (as well as growth)
+ * builds a new file, renames it over the old one and marks the old one as
+ * obsolete, so readers remap the storage on their next lookup. The new file
+ * is not synced synchronously: the old one is kept as `<file>.prev` until
+ * the next checkpoint and it is restored (and the log is replayed on it) if
+ * the new one might have not reached the disk.
+ */
+
+#define FUZZY_MMAP_MAGIC "rsfzmm01"
+#define FUZZY_MMAP_VERSION 1
+#define FUZZY_MMAP_MAX_SOURCES 32
+#define FUZZY_MMAP_SOURCE_LEN 64
+#define FUZZY_MMAP_DEFAULT_DIGESTS (1ULL << 16)
+#define FUZZY_MMAP_MIN_DIGESTS (1ULL << 4)
+/* Shingles table is sized relatively to the digests one */
+#define FUZZY_MMAP_SHINGLES_RATIO 32
+/* Maximum share of used (including deleted) slots */
+#define FUZZY_MMAP_MAX_LOAD 0.7
+/* Share of live slots after rebuild */
+#define FUZZY_MMAP_REBUILD_LOAD 0.35
+/* Checkpoint when log grows larger than this */
+#define FUZZY_MMAP_LOG_MAX (64 * 1024 * 1024)
+#define FUZZY_MMAP_READ_RETRIES 64
+
+static const guint64 rspamd_fuzzy_mmap_seed = 0xcafe1987ULL;
+
+enum rspamd_fuzzy_mmap_slot_state {
+	FUZZY_MMAP_SLOT_EMPTY = 0,
+	FUZZY_MMAP_SLOT_USED,
+	FUZZY_MMAP_SLOT_DELETED,
+};
+
+enum rspamd_fuzzy_mmap_log_op {
+	FUZZY_MMAP_OP_SET = 1,
+	FUZZY_MMAP_OP_DEL,
+	FUZZY_MMAP_OP_TOUCH,
+	FUZZY_MMAP_OP_VERSION,
+};
+
+struct rspamd_fuzzy_mmap_source {
+	gchar name[FUZZY_MMAP_SOURCE_LEN];
+	guint64 version;
+};
+
+struct rspamd_fuzzy_mmap_header {
+	gchar magic[8];
+	guint32 version;
+	guint32 obsolete;
+	guint64 digests_cap;
+	guint64 shingles_cap;
+	guint64 ndigests;
+	guint64 digests_used;
+	guint64 nshingles;
+	guint64 shingles_used;
+	struct rspamd_fuzzy_mmap_source sources[FUZZY_MMAP_MAX_SOURCES];
+};
+
+#define FUZZY_MMAP_HEADER_SIZE \
+	((sizeof (struct rspamd_fuzzy_mmap_header) + 63) & ~((gsize)63))
+
+struct rspamd_fuzzy_mmap_digest {
+	guint32 seq;
+	guint32 state;
+	gint32 value;
+	guint32 flag;
+	gint64 time;
+	guchar digest[rspamd_cryptobox_HASHBYTES];
+};
+
+struct rspamd_fuzzy_mmap_shingle {
+	guint32 seq;
+	guint32 state;
+	guint32 number;
+	guint32 reserved;
+	guint64 value;
+	guint64 digest_key;
+	gint64 time;
+};
+
+/*
+ * Log record, followed by `nshingles` guint64 values,
+ * for FUZZY_MMAP_OP_VERSION digest holds source name and ts holds version
+ */
+RSPAMD_PACKED(rspamd_fuzzy_mmap_log_rec) {
+	guint32 len;
+	guint32 cksum;
+	guint8 op;
+	guint8 flag;
+	guint8 nshingles;
+	guint8 reserved;
+	gint32 value;
+	gint64 ts;
+	guchar digest[rspamd_cryptobox_HASHBYTES];
+};
+
+struct rspamd_fuzzy_backend_mmap {
+	gchar *path;
+	gchar *log_path;
+	gchar *prev_path;
+	gchar id[MEMPOOL_UID_LEN];
+	rspamd_mempool_t *pool;
+	struct rspamd_fuzzy_mmap_header *hdr;
+	struct rspamd_fuzzy_mmap_digest *digests;
+	struct rspamd_fuzzy_mmap_shingle *shingles;
+	gsize map_len;
+	gint table_fd;
+	gint log_fd;
+	gsize log_len;
+	guint64 initial_digests;
+	gboolean sync_log;
+	gboolean writer;
+};
+
+#define msg_err_fuzzy_backend(...) rspamd_default_log_function (G_LOG_LEVEL_CRITICAL, \
+        backend->pool->tag.tagname, backend->pool->tag.uid, \
+        G_STRFUNC, \
+        __VA_ARGS__)
+#define msg_warn_fuzzy_backend(...)   rspamd_default_log_function (G_LOG_LEVEL_WARNING, \
+        backend->pool->tag.tagname, backend->pool->tag.uid, \
+        G_STRFUNC, \
+        __VA_ARGS__)
+#define msg_info_fuzzy_backend(...)   rspamd_default_log_function (G_LOG_LEVEL_INFO, \
+        backend->pool->tag.tagname, backend->pool->tag.uid, \
+        G_STRFUNC, \
+        __VA_ARGS__)
+#define msg_debug_fuzzy_backend(...)  rspamd_conditional_debug_fast (NULL, NULL, \
+       rspamd_fuzzy_mmap_log_id, backend->pool->tag.tagname, backend->pool->tag.uid, \
+        G_STRFUNC, \
+        __VA_ARGS__)
+
+INIT_LOG_MODULE(fuzzy_mmap)
+
+static GQuark
+rspamd_fuzzy_backend_mmap_quark (void)
+{
+	return g_quark_from_static_string ("fuzzy-backend-mmap");
+}
+
+static inline guint64
+rspamd_fuzzy_mmap_digest_key (const guchar *digest)
+{
+	guint64 k;
+
+	/* Distributed uniformly already */
+	memcpy (&k, digest, sizeof (k));
+
+	return k;
+}
+
+static inline guint64
+rspamd_fuzzy_mmap_shingle_key (guint64 value, guint32 number)
+{
+	guint64 h = value + number * 0x9E3779B97F4A7C15ULL;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static inline gsize
+rspamd_fuzzy_mmap_size (guint64 dcap, guint64 scap)
+{
+	return FUZZY_MMAP_HEADER_SIZE +
+			dcap * sizeof (struct rspamd_fuzzy_mmap_digest) +
+			scap * sizeof (struct rspamd_fuzzy_mmap_shingle);
+}
+
+static guint64
+rspamd_fuzzy_mmap_capacity (guint64 nelts, guint64 min)
+{
+	guint64 cap = min;
+
+	while (cap * FUZZY_MMAP_REBUILD_LOAD < nelts) {
+		cap <<= 1;
+	}
+
+	return cap;
+}
+
+static void
+rspamd_fuzzy_mmap_set_map (struct rspamd_fuzzy_backend_mmap *backend,
+		guchar *map, gsize len)
+{
+	backend->hdr = (struct rspamd_fuzzy_mmap_header *)map;
+	backend->digests = (struct rspamd_fuzzy_mmap_digest *)
+			(map + FUZZY_MMAP_HEADER_SIZE);
+	backend->shingles = (struct rspamd_fuzzy_mmap_shingle *)
+			(backend->digests + backend->hdr->digests_cap);
+	backend->map_len = len;
+}
+
+static gboolean
+rspamd_fuzzy_mmap_validate (struct rspamd_fuzzy_mmap_header *hdr, gsize len)
+{
+	if (len < FUZZY_MMAP_HEADER_SIZE ||
+			memcmp (hdr->magic, FUZZY_MMAP_MAGIC, sizeof (hdr->magic)) != 0 ||
+			hdr->version != FUZZY_MMAP_VERSION) {
+		return FALSE;
+	}
+
+	if (hdr->digests_cap == 0 || (hdr->digests_cap & (hdr->digests_cap - 1)) ||
+			hdr->shingles_cap == 0 || (hdr->shingles_cap & (hdr->shingles_cap - 1))) {
+		return FALSE;
+	}
+
+	return len == rspamd_fuzzy_mmap_size (hdr->digests_cap, hdr->shingles_cap);
+}
+
+/*
+ * Creates a new empty storage in `path`, returns mapping and its fd
+ */
+static guchar *
+rspamd_fuzzy_mmap_create (const gchar *path, guint64 dcap, guint64 scap,
+		gint *pfd, GError **err)
+{
+	struct rspamd_fuzzy_mmap_header *hdr;
+	guchar *map;
+	gsize len;
+	gint fd;
+
+	len = rspamd_fuzzy_mmap_size (dcap, scap);
+	fd = rspamd_file_xopen (path, O_RDWR | O_CREAT | O_TRUNC, 00644, FALSE);
+
+	if (fd == -1) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), errno,
+				"cannot create %s: %s", path, strerror (errno));
+		return NULL;
+	}
+
+	/*
+	 * Allocate blocks in advance: writing to a hole of a sparse mapping
+	 * raises SIGBUS when the file system is full
+	 */
+	if (rspamd_fallocate (fd, 0, len) == -1 || ftruncate (fd, len) == -1) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), errno,
+				"cannot allocate %s: %s", path, strerror (errno));
+		close (fd);
+		unlink (path);
+		return NULL;
+	}
+
+	map = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), errno,
+				"cannot mmap %s: %s", path, strerror (errno));
+		close (fd);
+		unlink (path);
+		return NULL;
+	}
+
+	hdr = (struct rspamd_fuzzy_mmap_header *)map;
+	memcpy (hdr->magic, FUZZY_MMAP_MAGIC, sizeof (hdr->magic));
+	hdr->version = FUZZY_MMAP_VERSION;
+	hdr->digests_cap = dcap;
+	hdr->shingles_cap = scap;
+	*pfd = fd;
+
+	return map;
+}
+
+static guchar *
+rspamd_fuzzy_mmap_open (const gchar *path, gsize *plen, gint *pfd,
+		GError **err)
+{
+	struct stat st;
+	guchar *map;
+	gint fd;
+
+	fd = rspamd_file_xopen (path, O_RDWR, 0, FALSE);
+
+	if (fd == -1) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), errno,
+				"cannot open %s: %s", path, strerror (errno));
+		return NULL;
+	}
+
+	if (fstat (fd, &st) == -1) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), errno,
+				"cannot stat %s: %s", path, strerror (errno));
+		close (fd);
+		return NULL;
+	}
+
+	if (st.st_size < (off_t)FUZZY_MMAP_HEADER_SIZE) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), EINVAL,
+				"%s is too short to be a fuzzy storage", path);
+		close (fd);
+		return NULL;
+	}
+
+	map = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), errno,
+				"cannot mmap %s: %s", path, strerror (errno));
+		close (fd);
+		return NULL;
+	}
+
+	if (!rspamd_fuzzy_mmap_validate ((struct rspamd_fuzzy_mmap_header *)map,
+			st.st_size)) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), EINVAL,
+				"%s is not a valid fuzzy storage", path);
+		munmap (map, st.st_size);
+		close (fd);
+		return NULL;
+	}
+
+	*plen = st.st_size;
+	*pfd = fd;
+
+	return map;
+}
+
+/*
+ * Readers: copy slot consistently with the concurrent writer
+ */
+static gboolean
+rspamd_fuzzy_mmap_read_digest (struct rspamd_fuzzy_mmap_digest *elt,
+		struct rspamd_fuzzy_mmap_digest *out)
+{
+	guint32 seq;
+	guint i;
+
+	for (i = 0; i < FUZZY_MMAP_READ_RETRIES; i ++) {
+		seq = g_atomic_int_get (&elt->seq);
+
+		if (seq & 1) {
+			continue;
+		}
+
+		memcpy (out, elt, sizeof (*out));
+
+		if (g_atomic_int_get (&elt->seq) == seq) {
+			return out->state == FUZZY_MMAP_SLOT_USED;
+		}
+	}
+
+	return FALSE;
+}
+
+static gboolean
+rspamd_fuzzy_mmap_read_shingle (struct rspamd_fuzzy_mmap_shingle *elt,
+		struct rspamd_fuzzy_mmap_shingle *out)
+{
+	guint32 seq;
+	guint i;
+
+	for (i = 0; i < FUZZY_MMAP_READ_RETRIES; i ++) {
+		seq = g_atomic_int_get (&elt->seq);
+
+		if (seq & 1) {
+			continue;
+		}
+
+		memcpy (out, elt, sizeof (*out));
+
+		if (g_atomic_int_get (&elt->seq) == seq) {
+			return out->state == FUZZY_MMAP_SLOT_USED;
+		}
+	}
+
+	return FALSE;
+}
+
+/*
+ * Returns position of the digest whose first `len` bytes are equal to
+ * `digest` or -1, `insert_pos` is set to the first free slot on the probe path
+ */
+static gint64
+rspamd_fuzzy_mmap_find_digest (struct rspamd_fuzzy_backend_mmap *backend,
+		const guchar *digest, gsize len, gint64 *insert_pos)
+{
+	struct rspamd_fuzzy_mmap_digest *elt;
+	guint64 mask, pos, i;
+	guint32 state;
+
+	mask = backend->hdr->digests_cap - 1;
+	pos = rspamd_fuzzy_mmap_digest_key (digest) & mask;
+
+	if (insert_pos) {
+		*insert_pos = -1;
+	}
+
+	for (i = 0; i <= mask; i ++, pos = (pos + 1) & mask) {
+		elt = &backend->digests[pos];
+		state = g_atomic_int_get (&elt->state);
+
+		if (state == FUZZY_MMAP_SLOT_EMPTY) {
+			if (insert_pos && *insert_pos == -1) {
+				*insert_pos = pos;
+			}
+
+			return -1;
+		}
+		else if (state == FUZZY_MMAP_SLOT_DELETED) {
+			if (insert_pos && *insert_pos == -1) {
+				*insert_pos = pos;
+			}
+		}
+		else if (memcmp (elt->digest, digest, len) == 0) {
+			return pos;
+		}
+	}
+
+	return -1;
+}
+
+static gint64
+rspamd_fuzzy_mmap_find_shingle (struct rspamd_fuzzy_backend_mmap *backend,
+		guint64 value, guint32 number, gint64 *insert_pos)
+{
+	struct rspamd_fuzzy_mmap_shingle *elt;
+	guint64 mask, pos, i;
+	guint32 state;
+
+	mask = backend->hdr->shingles_cap - 1;
+	pos = rspamd_fuzzy_mmap_shingle_key (value, number) & mask;
+
+	if (insert_pos) {
+		*insert_pos = -1;
+	}
+
+	for (i = 0; i <= mask; i ++, pos = (pos + 1) & mask) {
+		elt = &backend->shingles[pos];
+		state = g_atomic_int_get (&elt->state);
+
+		if (state == FUZZY_MMAP_SLOT_EMPTY) {
+			if (insert_pos && *insert_pos == -1) {
+				*insert_pos = pos;
+			}
+
+			return -1;
+		}
+		else if (state == FUZZY_MMAP_SLOT_DELETED) {
+			if (insert_pos && *insert_pos == -1) {
+				*insert_pos = pos;
+			}
+		}
+		else if (elt->value == value && elt->number == number) {
+			return pos;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Writer: seq is odd while the slot is being modified
+ */
+#define FUZZY_MMAP_WRITE_BEGIN(elt) g_atomic_int_inc (&(elt)->seq)
+#define FUZZY_MMAP_WRITE_END(elt) g_atomic_int_inc (&(elt)->seq)
+
+static void
+rspamd_fuzzy_mmap_insert_digest (struct rspamd_fuzzy_backend_mmap *backend,
+		gint64 pos, const struct rspamd_fuzzy_mmap_digest *src)
+{
+	struct rspamd_fuzzy_mmap_digest *elt = &backend->digests[pos];
+
+	if (elt->state == FUZZY_MMAP_SLOT_EMPTY) {
+		backend->hdr->digests_used ++;
+	}
+
+	FUZZY_MMAP_WRITE_BEGIN (elt);
+	memcpy (elt->digest, src->digest, sizeof (elt->digest));
+	elt->value = src->value;
+	elt->flag = src->flag;
+	elt->time = src->time;
+	g_atomic_int_set (&elt->state, FUZZY_MMAP_SLOT_USED);
+	FUZZY_MMAP_WRITE_END (elt);
+	backend->hdr->ndigests ++;
+}
+
+static void
+rspamd_fuzzy_mmap_insert_shingle (struct rspamd_fuzzy_backend_mmap *backend,
+		gint64 pos, const struct rspamd_fuzzy_mmap_shingle *src)
+{
+	struct rspamd_fuzzy_mmap_shingle *elt = &backend->shingles[pos];
+
+	if (elt->state == FUZZY_MMAP_SLOT_EMPTY) {
+		backend->hdr->shingles_used ++;
+	}
+
+	FUZZY_MMAP_WRITE_BEGIN (elt);
+	elt->value = src->value;
+	elt->number = src->number;
+	elt->digest_key = src->digest_key;
+	elt->time = src->time;
+	g_atomic_int_set (&elt->state, FUZZY_MMAP_SLOT_USED);
+	FUZZY_MMAP_WRITE_END (elt);
+	backend->hdr->nshingles ++;
+}
+
+static void
+rspamd_fuzzy_mmap_delete_digest (struct rspamd_fuzzy_backend_mmap *backend,
+		gint64 pos)
+{
+	struct rspamd_fuzzy_mmap_digest *elt = &backend->digests[pos];
+
+	FUZZY_MMAP_WRITE_BEGIN (elt);
+	g_atomic_int_set (&elt->state, FUZZY_MMAP_SLOT_DELETED);
+	FUZZY_MMAP_WRITE_END (elt);
+	backend->hdr->ndigests --;
+}
+
+static void
+rspamd_fuzzy_mmap_delete_shingle (struct rspamd_fuzzy_backend_mmap *backend,
+		gint64 pos)
+{
+	struct rspamd_fuzzy_mmap_shingle *elt = &backend->shingles[pos];
+
+	FUZZY_MMAP_WRITE_BEGIN (elt);
+	g_atomic_int_set (&elt->state, FUZZY_MMAP_SLOT_DELETED);
+	FUZZY_MMAP_WRITE_END (elt);
+	backend->hdr->nshingles --;
+}
+
+/*
+ * Builds a new storage with the specified capacity from the live entries,
+ * replaces the current file and tells readers to remap it
+ */
+static gboolean
+rspamd_fuzzy_mmap_rebuild (struct rspamd_fuzzy_backend_mmap *backend,
+		guint64 dcap, guint64 scap)
+{
+	struct rspamd_fuzzy_backend_mmap nbk;
+	struct rspamd_fuzzy_mmap_header *old_hdr = backend->hdr;
+	struct rspamd_fuzzy_mmap_digest *d;
+	struct rspamd_fuzzy_mmap_shingle *s;
+	GError *err = NULL;
+	gchar *tmpname;
+	guchar *map;
+	gint64 pos;
+	guint64 i;
+	gint fd;
+
+	tmpname = g_strdup_printf ("%s.new", backend->path);
+	map = rspamd_fuzzy_mmap_create (tmpname, dcap, scap, &fd, &err);
+
+	if (map == NULL) {
+		msg_err_fuzzy_backend ("cannot rebuild storage: %e", err);
+		g_error_free (err);
+		g_free (tmpname);
+
+		return FALSE;
+	}
+
+	memset (&nbk, 0, sizeof (nbk));
+	rspamd_fuzzy_mmap_set_map (&nbk, map, rspamd_fuzzy_mmap_size (dcap, scap));
+	memcpy (nbk.hdr->sources, old_hdr->sources, sizeof (old_hdr->sources));
+
+	for (i = 0; i < old_hdr->digests_cap; i ++) {
+		d = &backend->digests[i];
+
+		if (d->state == FUZZY_MMAP_SLOT_USED) {
+			rspamd_fuzzy_mmap_find_digest (&nbk, d->digest, sizeof (d->digest),
+					&pos);
+			rspamd_fuzzy_mmap_insert_digest (&nbk, pos, d);
+		}
+	}
+
+	for (i = 0; i < old_hdr->shingles_cap; i ++) {
+		s = &backend->shingles[i];
+
+		if (s->state == FUZZY_MMAP_SLOT_USED) {
+			rspamd_fuzzy_mmap_find_shingle (&nbk, s->value, s->number, &pos);
+			rspamd_fuzzy_mmap_insert_shingle (&nbk, pos, s);
+		}
+	}
+
+	/*
+	 * Do not wait for the disk here: the current file is kept until the next
+	 * checkpoint, it is linked only once, as it is the last synced one
+	 */
+	if (msync (map, nbk.map_len, MS_ASYNC) == -1 ||
+			(link (backend->path, backend->prev_path) == -1 && errno != EEXIST) ||
+			rename (tmpname, backend->path) == -1) {
+		msg_err_fuzzy_backend ("cannot replace storage %s: %s", backend->path,
+				strerror (errno));
+		munmap (map, nbk.map_len);
+		close (fd);
+		unlink (tmpname);
+		g_free (tmpname);
+
+		return FALSE;
+	}
+
+#ifdef HAVE_FLOCK
+	flock (fd, LOCK_SH);
+#endif
+
+	msg_info_fuzzy_backend ("rebuilt storage: %uL digests (%uL slots -> %uL), "
+			"%uL shingles (%uL slots -> %uL)",
+			nbk.hdr->ndigests, old_hdr->digests_cap, dcap,
+			nbk.hdr->nshingles, old_hdr->shingles_cap, scap);
+
+	g_atomic_int_set (&old_hdr->obsolete, 1);
+	munmap (old_hdr, backend->map_len);
+	close (backend->table_fd);
+	backend->table_fd = fd;
+	rspamd_fuzzy_mmap_set_map (backend, map, nbk.map_len);
+	g_free (tmpname);
+
+	return TRUE;
+}
+
+/*
+ * Grows storage if `ndigests` and `nshingles` more elements would exceed the
+ * maximum load
+ */
+static gboolean
+rspamd_fuzzy_mmap_reserve (struct rspamd_fuzzy_backend_mmap *backend,
+		guint64 ndigests, guint64 nshingles)
+{
+	struct rspamd_fuzzy_mmap_header *hdr = backend->hdr;
+
+	if (hdr->digests_used + ndigests <= hdr->digests_cap * FUZZY_MMAP_MAX_LOAD &&
+			hdr->shingles_used + nshingles <= hdr->shingles_cap * FUZZY_MMAP_MAX_LOAD) {
+		return TRUE;
+	}
+
+	return rspamd_fuzzy_mmap_rebuild (backend,
+			rspamd_fuzzy_mmap_capacity (hdr->ndigests + ndigests,
+					backend->initial_digests),
+			rspamd_fuzzy_mmap_capacity (hdr->nshingles + nshingles,
+					backend->initial_digests * FUZZY_MMAP_SHINGLES_RATIO));
+}
+
+static void
+rspamd_fuzzy_mmap_set_version (struct rspamd_fuzzy_backend_mmap *backend,
+		const gchar *src, guint64 version)
+{
+	struct rspamd_fuzzy_mmap_source *s;
+	guint i;
+
+	for (i = 0; i < FUZZY_MMAP_MAX_SOURCES; i ++) {
+		s = &backend->hdr->sources[i];
+
+		if (s->name[0] == '\0' || strcmp (s->name, src) == 0) {
+			rspamd_strlcpy (s->name, src, sizeof (s->name));
+			s->version = version;
+
+			return;
+		}
+	}
+
+	msg_warn_fuzzy_backend ("too many sources, cannot store version for %s", src);
+}
+
+static guint64
+rspamd_fuzzy_mmap_get_version (struct rspamd_fuzzy_backend_mmap *backend,
+		const gchar *src)
+{
+	struct rspamd_fuzzy_mmap_source *s;
+	guint i;
+
+	for (i = 0; i < FUZZY_MMAP_MAX_SOURCES; i ++) {
+		s = &backend->hdr->sources[i];
+
+		if (s->name[0] == '\0') {
+			break;
+		}
+
+		if (strncmp (s->name, src, sizeof (s->name) - 1) == 0) {
+			return s->version;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Applies a log record to the tables, records contain absolute values, so
+ * applying the same record twice is harmless
+ */
+static void
+rspamd_fuzzy_mmap_apply (struct rspamd_fuzzy_backend_mmap *backend,
+		const struct rspamd_fuzzy_mmap_log_rec *rec, const guint64 *shingles)
+{
+	struct rspamd_fuzzy_mmap_digest *d, nd;
+	struct rspamd_fuzzy_mmap_shingle *s, ns;
+	gchar src[FUZZY_MMAP_SOURCE_LEN];
+	guint64 key;
+	gint64 pos, ins;
+	guint i;
+
+	key = rspamd_fuzzy_mmap_digest_key (rec->digest);
+
+	switch (rec->op) {
+	case FUZZY_MMAP_OP_SET:
+		if (!rspamd_fuzzy_mmap_reserve (backend, 1, rec->nshingles)) {
+			msg_err_fuzzy_backend ("cannot add hash %*xs: storage is full",
+					(gint)sizeof (rec->digest), rec->digest);
+			return;
+		}
+
+		pos = rspamd_fuzzy_mmap_find_digest (backend, rec->digest,
+				sizeof (rec->digest), &ins);
+
+		if (pos >= 0) {
+			d = &backend->digests[pos];
+			FUZZY_MMAP_WRITE_BEGIN (d);
+			d->value = rec->value;
+			d->flag = rec->flag;
+			d->time = rec->ts;
+			FUZZY_MMAP_WRITE_END (d);
+		}
+		else {
+			memcpy (nd.digest, rec->digest, sizeof (nd.digest));
+			nd.value = rec->value;
+			nd.flag = rec->flag;
+			nd.time = rec->ts;
+			rspamd_fuzzy_mmap_insert_digest (backend, ins, &nd);
+		}
+
+		for (i = 0; i < rec->nshingles; i ++) {
+			pos = rspamd_fuzzy_mmap_find_shingle (backend, shingles[i], i, &ins);
+
+			if (pos >= 0) {
+				s = &backend->shingles[pos];
+				FUZZY_MMAP_WRITE_BEGIN (s);
+				s->digest_key = key;
+				s->time = rec->ts;
+				FUZZY_MMAP_WRITE_END (s);
+			}
+			else {
+				ns.value = shingles[i];
+				ns.number = i;
+				ns.digest_key = key;
+				ns.time = rec->ts;
+				rspamd_fuzzy_mmap_insert_shingle (backend, ins, &ns);
+			}
+		}
+		break;
+	case FUZZY_MMAP_OP_DEL:
+		pos = rspamd_fuzzy_mmap_find_digest (backend, rec->digest,
+				sizeof (rec->digest), NULL);
+
+		if (pos >= 0) {
+			rspamd_fuzzy_mmap_delete_digest (backend, pos);
+		}
+
+		for (i = 0; i < rec->nshingles; i ++) {
+			pos = rspamd_fuzzy_mmap_find_shingle (backend, shingles[i], i, NULL);
+
+			if (pos >= 0 && backend->shingles[pos].digest_key == key) {
+				rspamd_fuzzy_mmap_delete_shingle (backend, pos);
+			}
+		}
+		break;
+	case FUZZY_MMAP_OP_TOUCH:
+		pos = rspamd_fuzzy_mmap_find_digest (backend, rec->digest,
+				sizeof (rec->digest), NULL);
+
+		if (pos >= 0) {
+			d = &backend->digests[pos];
+			FUZZY_MMAP_WRITE_BEGIN (d);
+			d->time = rec->ts;
+			FUZZY_MMAP_WRITE_END (d);
+		}
+
+		for (i = 0; i < rec->nshingles; i ++) {
+			pos = rspamd_fuzzy_mmap_find_shingle (backend, shingles[i], i, NULL);
+
+			if (pos >= 0 && backend->shingles[pos].digest_key == key) {
+				s = &backend->shingles[pos];
+				FUZZY_MMAP_WRITE_BEGIN (s);
+				s->time = rec->ts;
+				FUZZY_MMAP_WRITE_END (s);
+			}
+		}
+		break;
+	case FUZZY_MMAP_OP_VERSION:
+		rspamd_strlcpy (src, (const gchar *)rec->digest, sizeof (src));
+		rspamd_fuzzy_mmap_set_version (backend, src, rec->ts);
+		break;
+	default:
+		break;
+	}
+}
+
+static guint32
+rspamd_fuzzy_mmap_log_cksum (const guchar *rec, gsize len)
+{
+	/* Skip len and cksum fields */
+	return (guint32)rspamd_cryptobox_fast_hash (rec + sizeof (guint32) * 2,
+			len - sizeof (guint32) * 2, rspamd_fuzzy_mmap_seed);
+}
+
+static void
+rspamd_fuzzy_mmap_log_add (GByteArray *log, guint8 op,
+		const struct rspamd_fuzzy_mmap_digest *d, const guint64 *shingles,
+		guint nshingles)
+{
+	struct rspamd_fuzzy_mmap_log_rec rec;
+	guint start = log->len;
+
+	memset (&rec, 0, sizeof (rec));
+	rec.len = sizeof (rec) + nshingles * sizeof (guint64);
+	rec.op = op;
+	rec.flag = d->flag;
+	rec.nshingles = nshingles;
+	rec.value = d->value;
+	rec.ts = d->time;
+	memcpy (rec.digest, d->digest, sizeof (rec.digest));
+
+	g_byte_array_append (log, (const guint8 *)&rec, sizeof (rec));
+
+	if (nshingles > 0) {
+		g_byte_array_append (log, (const guint8 *)shingles,
+				nshingles * sizeof (guint64));
+	}
+
+	rec.cksum = rspamd_fuzzy_mmap_log_cksum (log->data + start, rec.len);
+	memcpy (log->data + start + G_STRUCT_OFFSET (struct rspamd_fuzzy_mmap_log_rec,
+			cksum), &rec.cksum, sizeof (rec.cksum));
+}
+
+/*
+ * Replays log records, returns length of the valid prefix
+ */
+static gsize
+rspamd_fuzzy_mmap_replay (struct rspamd_fuzzy_backend_mmap *backend,
+		const guchar *p, gsize len)
+{
+	struct rspamd_fuzzy_mmap_log_rec rec;
+	guint64 shingles[RSPAMD_SHINGLE_SIZE];
+	gsize off = 0;
+
+	while (len - off >= sizeof (rec)) {
+		memcpy (&rec, p + off, sizeof (rec));
+
+		if ((rec.nshingles != 0 && rec.nshingles != RSPAMD_SHINGLE_SIZE) ||
+				rec.len != sizeof (rec) + rec.nshingles * sizeof (guint64) ||
+				rec.len > len - off ||
+				rec.cksum != rspamd_fuzzy_mmap_log_cksum (p + off, rec.len)) {
+			break;
+		}
+
+		memcpy (shingles, p + off + sizeof (rec),
+				rec.nshingles * sizeof (guint64));
+		rspamd_fuzzy_mmap_apply (backend, &rec, shingles);
+		off += rec.len;
+	}
+
+	return off;
+}
+
+/* Syncs the mapping and drops the log */
+static gboolean
+rspamd_fuzzy_mmap_checkpoint (struct rspamd_fuzzy_backend_mmap *backend)
+{
+	if (msync (backend->hdr, backend->map_len, MS_SYNC) == -1) {
+		msg_err_fuzzy_backend ("cannot sync %s: %s", backend->path,
+				strerror (errno));
+		return FALSE;
+	}
+
+	/* Storage after the last rebuild is on the disk now */
+	if (unlink (backend->prev_path) == -1 && errno != ENOENT) {
+		msg_err_fuzzy_backend ("cannot remove %s: %s", backend->prev_path,
+				strerror (errno));
+		return FALSE;
+	}
+
+	if (ftruncate (backend->log_fd, 0) == -1) {
+		msg_err_fuzzy_backend ("cannot truncate %s: %s", backend->log_path,
+				strerror (errno));
+		return FALSE;
+	}
+
+	backend->log_len = 0;
+
+	return TRUE;
+}
+
+static gboolean
+rspamd_fuzzy_mmap_log_write (struct rspamd_fuzzy_backend_mmap *backend,
+		GByteArray *log)
+{
+	gsize written = 0;
+	gssize r;
+
+	while (written < log->len) {
+		r = write (backend->log_fd, log->data + written, log->len - written);
+
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			msg_err_fuzzy_backend ("cannot write to %s: %s", backend->log_path,
+					strerror (errno));
+			goto err;
+		}
+
+		written += r;
+	}
+
+	if (backend->sync_log && fsync (backend->log_fd) == -1) {
+		msg_err_fuzzy_backend ("cannot sync %s: %s", backend->log_path,
+				strerror (errno));
+		goto err;
+	}
+
+	backend->log_len += log->len;
+
+	return TRUE;
+
+err:
+	/* Drop partial records, so they do not hide the following ones */
+	if (ftruncate (backend->log_fd, backend->log_len) == -1) {
+		msg_err_fuzzy_backend ("cannot truncate %s: %s", backend->log_path,
+				strerror (errno));
+	}
+
+	return FALSE;
+}
+
+/*
+ * Slots left odd by a writer that died in the middle of an update would be
+ * skipped by readers forever, so make them even again: their content is
+ * either restored from the log or has been deleted by expiry
+ */
+static void
+rspamd_fuzzy_mmap_reset_seqs (struct rspamd_fuzzy_backend_mmap *backend)
+{
+	guint64 i, nreset = 0;
+
+	for (i = 0; i < backend->hdr->digests_cap; i ++) {
+		if (backend->digests[i].seq & 1) {
+			backend->digests[i].seq ++;
+			nreset ++;
+		}
+	}
+
+	for (i = 0; i < backend->hdr->shingles_cap; i ++) {
+		if (backend->shingles[i].seq & 1) {
+			backend->shingles[i].seq ++;
+			nreset ++;
+		}
+	}
+
+	if (nreset > 0) {
+		msg_warn_fuzzy_backend ("reset %uL slots with incomplete writes in %s",
+				nreset, backend->path);
+	}
+}
+
+/*
+ * Replays log left by a process that has not finished cleanly
+ */
+static void
+rspamd_fuzzy_mmap_recover (struct rspamd_fuzzy_backend_mmap *backend)
+{
+	struct stat st;
+	guchar *log;
+	gsize valid;
+
+	rspamd_fuzzy_mmap_reset_seqs (backend);
+
+	if (fstat (backend->log_fd, &st) == -1 || st.st_size == 0) {
+		return;
+	}
+
+	log = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, backend->log_fd, 0);
+
+	if (log == MAP_FAILED) {
+		msg_err_fuzzy_backend ("cannot map %s: %s", backend->log_path,
+				strerror (errno));
+		return;
+	}
+
+	valid = rspamd_fuzzy_mmap_replay (backend, log, st.st_size);
+	munmap (log, st.st_size);
+
+	if (valid < (gsize)st.st_size) {
+		msg_warn_fuzzy_backend ("ignore %uz bytes of incomplete records in %s",
+				(gsize)st.st_size - valid, backend->log_path);
+	}
+
+	msg_info_fuzzy_backend ("replayed %uz bytes of updates from %s", valid,
+			backend->log_path);
+	rspamd_fuzzy_mmap_checkpoint (backend);
+}
+
+/* Readers: switch to the new file after compaction */
+static void
+rspamd_fuzzy_mmap_remap (struct rspamd_fuzzy_backend_mmap *backend)
+{
+	GError *err = NULL;
+	guchar *map;
+	gsize len;
+	gint fd;
+
+	map = rspamd_fuzzy_mmap_open (backend->path, &len, &fd, &err);
+
+	if (map == NULL) {
+		msg_err_fuzzy_backend ("cannot remap storage: %e", err);
+		g_error_free (err);
+
+		return;
+	}
+
+#ifdef HAVE_FLOCK
+	flock (fd, LOCK_SH);
+#endif
+
+	munmap (backend->hdr, backend->map_len);
+	close (backend->table_fd);
+	backend->table_fd = fd;
+	rspamd_fuzzy_mmap_set_map (backend, map, len);
+	msg_debug_fuzzy_backend ("remapped storage %s", backend->path);
+}
+
+static void
+rspamd_fuzzy_mmap_free (struct rspamd_fuzzy_backend_mmap *backend)
+{
+	if (backend->hdr) {
+		munmap (backend->hdr, backend->map_len);
+	}
+
+	if (backend->table_fd != -1) {
+		close (backend->table_fd);
+	}
+
+	if (backend->log_fd != -1) {
+		close (backend->log_fd);
+	}
+
+	g_free (backend->path);
+	g_free (backend->log_path);
+	g_free (backend->prev_path);
+	rspamd_mempool_delete (backend->pool);
+	g_free (backend);
+}
+
+void*
+rspamd_fuzzy_backend_init_mmap (struct rspamd_fuzzy_backend *bk,
+		const ucl_object_t *obj, struct rspamd_config *cfg, GError **err)
+{
+	struct rspamd_fuzzy_backend_mmap *backend;
+	const ucl_object_t *elt;
+	rspamd_cryptobox_hash_state_t st;
+	guchar hash_out[rspamd_cryptobox_HASHBYTES], *map;
+	gchar *tmpname;
+	gboolean exclusive = TRUE;
+	gsize len;
+	gint fd;
+
+	elt = ucl_object_lookup_any (obj, "hashfile", "hash_file", "file",
+			"database", NULL);
+
+	if (elt == NULL || ucl_object_type (elt) != UCL_STRING) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (),
+				EINVAL, "missing mmap storage path");
+		return NULL;
+	}
+
+	backend = g_malloc0 (sizeof (*backend));
+	backend->path = g_strdup (ucl_object_tostring (elt));
+	backend->log_path = g_strconcat (backend->path, ".log", NULL);
+	backend->prev_path = g_strconcat (backend->path, ".prev", NULL);
+	backend->pool = rspamd_mempool_new (rspamd_mempool_suggest_size (),
+			"fuzzy_backend", 0);
+	backend->table_fd = -1;
+	backend->initial_digests = FUZZY_MMAP_DEFAULT_DIGESTS;
+	backend->sync_log = TRUE;
+
+	rspamd_cryptobox_hash_init (&st, NULL, 0);
+	rspamd_cryptobox_hash_update (&st, backend->path, strlen (backend->path));
+	rspamd_cryptobox_hash_final (&st, hash_out);
+	rspamd_snprintf (backend->id, sizeof (backend->id), "%xs", hash_out);
+	memcpy (backend->pool->tag.uid, backend->id, sizeof (backend->pool->tag.uid));
+
+	elt = ucl_object_lookup (obj, "initial_size");
+
+	if (elt != NULL) {
+		/* Expected number of digests */
+		backend->initial_digests = rspamd_fuzzy_mmap_capacity (
+				ucl_object_toint (elt), FUZZY_MMAP_MIN_DIGESTS);
+	}
+
+	elt = ucl_object_lookup (obj, "sync_log");
+
+	if (elt != NULL) {
+		backend->sync_log = ucl_object_toboolean (elt);
+	}
+
+	backend->log_fd = rspamd_file_xopen (backend->log_path,
+			O_RDWR | O_CREAT | O_APPEND, 00644, FALSE);
+
+	if (backend->log_fd == -1) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), errno,
+				"cannot open %s: %s", backend->log_path, strerror (errno));
+		rspamd_fuzzy_mmap_free (backend);
+
+		return NULL;
+	}
+
+	/* Serialize opening between workers */
+	if (!rspamd_file_lock (backend->log_fd, FALSE)) {
+		g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), errno,
+				"cannot lock %s: %s", backend->log_path, strerror (errno));
+		rspamd_fuzzy_mmap_free (backend);
+
+		return NULL;
+	}
+
+	if (access (backend->path, F_OK) == -1 && errno == ENOENT) {
+		tmpname = g_strdup_printf ("%s.new", backend->path);
+		map = rspamd_fuzzy_mmap_create (tmpname, backend->initial_digests,
+				backend->initial_digests * FUZZY_MMAP_SHINGLES_RATIO, &fd, err);
+
+		if (map == NULL || rename (tmpname, backend->path) == -1) {
+			if (map != NULL) {
+				g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), errno,
+						"cannot rename %s: %s", tmpname, strerror (errno));
+				munmap (map, rspamd_fuzzy_mmap_size (backend->initial_digests,
+						backend->initial_digests * FUZZY_MMAP_SHINGLES_RATIO));
+				close (fd);
+				unlink (tmpname);
+			}
+
+			g_free (tmpname);
+			rspamd_file_unlock (backend->log_fd, FALSE);
+			rspamd_fuzzy_mmap_free (backend);
+
+			return NULL;
+		}
+
+		g_free (tmpname);
+		len = rspamd_fuzzy_mmap_size (backend->initial_digests,
+				backend->initial_digests * FUZZY_MMAP_SHINGLES_RATIO);
+	}
+	else {
+		map = rspamd_fuzzy_mmap_open (backend->path, &len, &fd, err);
+
+		if (map == NULL) {
+			rspamd_file_unlock (backend->log_fd, FALSE);
+			rspamd_fuzzy_mmap_free (backend);
+
+			return NULL;
+		}
+	}
+
+	backend->table_fd = fd;
+	rspamd_fuzzy_mmap_set_map (backend, map, len);
+
+#ifdef HAVE_FLOCK
+	/*
+	 * Every process keeps a shared lock on the storage, so the log is
+	 * replayed only if nobody else (e.g. the writer) uses it now
+	 */
+	exclusive = (flock (fd, LOCK_EX | LOCK_NB) == 0);
+#endif
+
+	if (exclusive && access (backend->prev_path, F_OK) != -1) {
+		/* The last rebuilt storage might be incomplete, log covers the old one */
+		msg_warn_fuzzy_backend ("restore %s from %s", backend->path,
+				backend->prev_path);
+		munmap (backend->hdr, backend->map_len);
+		close (fd);
+		backend->hdr = NULL;
+		backend->table_fd = -1;
+
+		if (rename (backend->prev_path, backend->path) == -1) {
+			g_set_error (err, rspamd_fuzzy_backend_mmap_quark (), errno,
+					"cannot rename %s: %s", backend->prev_path, strerror (errno));
+			rspamd_file_unlock (backend->log_fd, FALSE);
+			rspamd_fuzzy_mmap_free (backend);
+
+			return NULL;
+		}
+
+		map = rspamd_fuzzy_mmap_open (backend->path, &len, &fd, err);
+
+		if (map == NULL) {
+			rspamd_file_unlock (backend->log_fd, FALSE);
+			rspamd_fuzzy_mmap_free (backend);
+
+			return NULL;
+		}
+
+		backend->table_fd = fd;
+		rspamd_fuzzy_mmap_set_map (backend, map, len);
+#ifdef HAVE_FLOCK
+		flock (fd, LOCK_EX | LOCK_NB);
+#endif
+	}
+
+	if (exclusive) {
+		rspamd_fuzzy_mmap_recover (backend);
+	}
+
+	backend->log_len = lseek (backend->log_fd, 0, SEEK_END);
+
+#ifdef HAVE_FLOCK
+	flock (fd, LOCK_SH);
+#endif
+	rspamd_file_unlock (backend->log_fd, FALSE);
+
+	msg_info_fuzzy_backend ("opened storage %s: %uL digests, %uL shingles",
+			backend->path, backend->hdr->ndigests, backend->hdr->nshingles);
+
+	return backend;
+}
+
+static gint
+rspamd_fuzzy_mmap_key_cmp (const void *a, const void *b)
+{
+	guint64 k1 = *(const guint64 *)a, k2 = *(const guint64 *)b;
+
+	if (k1 < k2) {
+		return -1;
+	}
+	else if (k1 > k2) {
+		return 1;
+	}
+
+	return 0;
+}
+
+void
+rspamd_fuzzy_backend_check_mmap (struct rspamd_fuzzy_backend *bk,
+		const struct rspamd_fuzzy_cmd *cmd,
+		rspamd_fuzzy_check_cb cb, void *ud,
+		void *subr_ud)
+{
+	struct rspamd_fuzzy_backend_mmap *backend = subr_ud;
+	const struct rspamd_fuzzy_shingle_cmd *shcmd;
+	struct rspamd_fuzzy_mmap_digest d;
+	struct rspamd_fuzzy_mmap_shingle s;
+	struct rspamd_fuzzy_reply rep;
+	guint64 keys[RSPAMD_SHINGLE_SIZE], sel_key = 0;
+	guint i, nkeys = 0, cur_cnt, max_cnt = 0;
+	gint64 pos, now;
+	gdouble expire;
+	gboolean found = FALSE;
+
+	memset (&rep, 0, sizeof (rep));
+	memcpy (rep.digest, cmd->digest, sizeof (rep.digest));
+
+	if (G_UNLIKELY (g_atomic_int_get (&backend->hdr->obsolete))) {
+		rspamd_fuzzy_mmap_remap (backend);
+	}
+
+	now = time (NULL);
+	expire = rspamd_fuzzy_backend_get_expire (bk);
+
+	/* Try direct match first of all */
+	pos = rspamd_fuzzy_mmap_find_digest (backend, (const guchar *)cmd->digest,
+			sizeof (cmd->digest), NULL);
+
+	if (pos >= 0 && rspamd_fuzzy_mmap_read_digest (&backend->digests[pos], &d) &&
+			memcmp (d.digest, cmd->digest, sizeof (d.digest)) == 0) {
+		if (now - d.time > expire) {
+			msg_debug_fuzzy_backend ("requested hash has been expired");
+		}
+		else {
+			rep.v1.value = d.value;
+			rep.v1.prob = 1.0f;
+			rep.v1.flag = d.flag;
+			rep.ts = d.time;
+		}
+
+		found = TRUE;
+	}
+
+	if (!found && cmd->shingles_count > 0) {
+		shcmd = (const struct rspamd_fuzzy_shingle_cmd *)cmd;
+
+		for (i = 0; i < RSPAMD_SHINGLE_SIZE; i ++) {
+			pos = rspamd_fuzzy_mmap_find_shingle (backend, shcmd->sgl.hashes[i],
+					i, NULL);
+
+			if (pos >= 0 &&
+					rspamd_fuzzy_mmap_read_shingle (&backend->shingles[pos], &s) &&
+					s.value == shcmd->sgl.hashes[i] && s.number == i &&
+					now - s.time <= expire) {
+				keys[nkeys++] = s.digest_key;
+			}
+		}
+
+		qsort (keys, nkeys, sizeof (keys[0]), rspamd_fuzzy_mmap_key_cmp);
+
+		/* Select the most frequent digest */
+		for (i = 0, cur_cnt = 0; i < nkeys; i ++) {
+			if (i > 0 && keys[i] == keys[i - 1]) {
+				cur_cnt ++;
+			}
+			else {
+				cur_cnt = 1;
+			}
+
+			if (cur_cnt > max_cnt) {
+				max_cnt = cur_cnt;
+				sel_key = keys[i];
+			}
+		}
+
+		if (max_cnt > 0) {
+			rep.v1.prob = (gfloat)max_cnt / (gfloat)RSPAMD_SHINGLE_SIZE;
+
+			if (rep.v1.prob > 0.5f) {
+				msg_debug_fuzzy_backend ("found fuzzy hash with probability %.2f",
+						rep.v1.prob);
+				pos = rspamd_fuzzy_mmap_find_digest (backend,
+						(const guchar *)&sel_key, sizeof (sel_key), NULL);
+
+				if (pos >= 0 &&
+						rspamd_fuzzy_mmap_read_digest (&backend->digests[pos], &d) &&
+						rspamd_fuzzy_mmap_digest_key (d.digest) == sel_key &&
+						now - d.time <= expire) {
+					memcpy (rep.digest, d.digest, sizeof (rep.digest));
+					rep.v1.value = d.value;
+					rep.v1.flag = d.flag;
+					rep.ts = d.time;
+				}
+				else {
+					rep.v1.prob = 0.0f;
+				}
+			}
+			else {
+				/* Otherwise we assume that as error */
+				rep.v1.value = 0;
+			}
+		}
+	}
+
+	if (cb) {
+		cb (TRUE, &rep, ud);
+	}
+}
+
+struct rspamd_fuzzy_mmap_pending {
+	gint32 value;
+	guint32 flag;
+	gboolean deleted;
+};
+
+static guint
+rspamd_fuzzy_mmap_pending_hash (gconstpointer p)
+{
+	return (guint)rspamd_fuzzy_mmap_digest_key (p);
+}
+
+static gboolean
+rspamd_fuzzy_mmap_pending_equal (gconstpointer a, gconstpointer b)
+{
+	return memcmp (a, b, rspamd_cryptobox_HASHBYTES) == 0;
+}
+
+void
+rspamd_fuzzy_backend_update_mmap (struct rspamd_fuzzy_backend *bk,
+		GArray *updates, const gchar *src,
+		rspamd_fuzzy_update_cb cb, void *ud,
+		void *subr_ud)
+{
+	struct rspamd_fuzzy_backend_mmap *backend = subr_ud;
+	struct rspamd_fuzzy_mmap_digest d;
+	struct rspamd_fuzzy_mmap_pending *pending;
+	struct fuzzy_peer_cmd *io_cmd;
+	struct rspamd_fuzzy_cmd *cmd;
+	const guint64 *shingles;
+	GByteArray *log;
+	GHashTable *pending_tbl;
+	gboolean success = TRUE;
+	guint i, nshingles;
+	guint nupdates = 0, nadded = 0, ndeleted = 0, nextended = 0, nignored = 0;
+	gint64 pos, now;
+	guint8 op;
+
+	backend->writer = TRUE;
+
+	if (G_UNLIKELY (g_atomic_int_get (&backend->hdr->obsolete))) {
+		rspamd_fuzzy_mmap_remap (backend);
+	}
+
+	now = time (NULL);
+	log = g_byte_array_sized_new (updates->len *
+			sizeof (struct rspamd_fuzzy_mmap_log_rec));
+	/* Results of the previous commands in this batch, not applied yet */
+	pending_tbl = g_hash_table_new_full (rspamd_fuzzy_mmap_pending_hash,
+			rspamd_fuzzy_mmap_pending_equal, g_free, g_free);
+
+	for (i = 0; i < updates->len; i ++) {
+		io_cmd = &g_array_index (updates, struct fuzzy_peer_cmd, i);
+
+		if (io_cmd->is_shingle) {
+			cmd = &io_cmd->cmd.shingle.basic;
+			shingles = io_cmd->cmd.shingle.sgl.hashes;
+			nshingles = RSPAMD_SHINGLE_SIZE;
+		}
+		else {
+			cmd = &io_cmd->cmd.normal;
+			shingles = NULL;
+			nshingles = 0;
+		}
+
+		memcpy (d.digest, cmd->digest, sizeof (d.digest));
+		d.value = cmd->value;
+		d.flag = cmd->flag;
+		d.time = now;
+
+		pending = g_hash_table_lookup (pending_tbl, d.digest);
+
+		if (cmd->cmd == FUZZY_WRITE) {
+			/* Log the resulting value, not the increment */
+			if (pending) {
+				if (!pending->deleted && pending->flag == d.flag) {
+					d.value += pending->value;
+				}
+			}
+			else {
+				pos = rspamd_fuzzy_mmap_find_digest (backend, d.digest,
+						sizeof (d.digest), NULL);
+
+				if (pos >= 0 && backend->digests[pos].flag == d.flag) {
+					d.value += backend->digests[pos].value;
+				}
+			}
+
+			op = FUZZY_MMAP_OP_SET;
+			nadded ++;
+			nupdates ++;
+		}
+		else if (cmd->cmd == FUZZY_DEL) {
+			op = FUZZY_MMAP_OP_DEL;
+			ndeleted ++;
+			nupdates ++;
+		}
+		else if (cmd->cmd == FUZZY_REFRESH) {
+			op = FUZZY_MMAP_OP_TOUCH;
+			nextended ++;
+		}
+		else {
+			nignored ++;
+			continue;
+		}
+
+		if (op != FUZZY_MMAP_OP_TOUCH) {
+			if (pending == NULL) {
+				pending = g_malloc (sizeof (*pending));
+				g_hash_table_insert (pending_tbl,
+						g_memdup (d.digest, sizeof (d.digest)), pending);
+			}
+
+			pending->value = d.value;
+			pending->flag = d.flag;
+			pending->deleted = (op == FUZZY_MMAP_OP_DEL);
+		}
+
+		rspamd_fuzzy_mmap_log_add (log, op, &d, shingles, nshingles);
+	}
+
+	g_hash_table_unref (pending_tbl);
+
+	if (nupdates > 0) {
+		memset (&d, 0, sizeof (d));
+		rspamd_strlcpy ((gchar *)d.digest, src, FUZZY_MMAP_SOURCE_LEN);
+		d.time = rspamd_fuzzy_mmap_get_version (backend, src) + 1;
+		rspamd_fuzzy_mmap_log_add (log, FUZZY_MMAP_OP_VERSION, &d, NULL, 0);
+	}
+
+	if (log->len > 0) {
+		/* Changes are applied only when they are in the log already */
+		success = rspamd_fuzzy_mmap_log_write (backend, log);
+
+		if (success) {
+			rspamd_fuzzy_mmap_replay (backend, log->data, log->len);
+
+			if (backend->log_len > FUZZY_MMAP_LOG_MAX) {
+				rspamd_fuzzy_mmap_checkpoint (backend);
+			}
+		}
+	}
+
+	g_byte_array_free (log, TRUE);
+
+	if (cb) {
+		cb (success, nadded, ndeleted, nextended, nignored, ud);
+	}
+}
+
+void
+rspamd_fuzzy_backend_count_mmap (struct rspamd_fuzzy_backend *bk,
+		rspamd_fuzzy_count_cb cb, void *ud,
+		void *subr_ud)
+{
+	struct rspamd_fuzzy_backend_mmap *backend = subr_ud;
+
+	if (G_UNLIKELY (g_atomic_int_get (&backend->hdr->obsolete))) {
+		rspamd_fuzzy_mmap_remap (backend);
+	}
+
+	if (cb) {
+		cb (backend->hdr->ndigests, ud);
+	}
+}
+
+void
+rspamd_fuzzy_backend_version_mmap (struct rspamd_fuzzy_backend *bk,
+		const gchar *src,
+		rspamd_fuzzy_version_cb cb, void *ud,
+		void *subr_ud)
+{
+	struct rspamd_fuzzy_backend_mmap *backend = subr_ud;
+
+	if (G_UNLIKELY (g_atomic_int_get (&backend->hdr->obsolete))) {
+		rspamd_fuzzy_mmap_remap (backend);
+	}
+
+	if (cb) {
+		cb (rspamd_fuzzy_mmap_get_version (backend, src), ud);
+	}
+}
+
+const gchar*
+rspamd_fuzzy_backend_id_mmap (struct rspamd_fuzzy_backend *bk,
+		void *subr_ud)
+{
+	struct rspamd_fuzzy_backend_mmap *backend = subr_ud;
+
+	return backend->id;
+}
+
+/*
+ * Periodic maintenance in the writer: expire old entries, compact tables
+ * with too many deleted slots and sync the mapping
+ */
+void
+rspamd_fuzzy_backend_expire_mmap (struct rspamd_fuzzy_backend *bk,
+		void *subr_ud)
+{
+	struct rspamd_fuzzy_backend_mmap *backend = subr_ud;
+	struct rspamd_fuzzy_mmap_header *hdr;
+	guint64 i, ndigests = 0, nshingles = 0;
+	gdouble expire;
+	gint64 now;
+
+	backend->writer = TRUE;
+
+	if (G_UNLIKELY (g_atomic_int_get (&backend->hdr->obsolete))) {
+		rspamd_fuzzy_mmap_remap (backend);
+	}
+
+	hdr = backend->hdr;
+	now = time (NULL);
+	expire = rspamd_fuzzy_backend_get_expire (bk);
+
+	for (i = 0; i < hdr->digests_cap; i ++) {
+		if (backend->digests[i].state == FUZZY_MMAP_SLOT_USED &&
+				now - backend->digests[i].time > expire) {
+			rspamd_fuzzy_mmap_delete_digest (backend, i);
+			ndigests ++;
+		}
+	}
+
+	for (i = 0; i < hdr->shingles_cap; i ++) {
+		if (backend->shingles[i].state == FUZZY_MMAP_SLOT_USED &&
+				now - backend->shingles[i].time > expire) {
+			rspamd_fuzzy_mmap_delete_shingle (backend, i);
+			nshingles ++;
+		}
+	}
+
+	if (ndigests > 0 || nshingles > 0) {
+		msg_info_fuzzy_backend ("expired %uL digests and %uL shingles",
+				ndigests, nshingles);
+	}
+
+	/* Compact if deleted slots take more than a quarter of a table */
+	if ((hdr->digests_used - hdr->ndigests) > hdr->digests_cap / 4 ||
+			(hdr->shingles_used - hdr->nshingles) > hdr->shingles_cap / 4) {
+		rspamd_fuzzy_mmap_rebuild (backend,
+				rspamd_fuzzy_mmap_capacity (hdr->ndigests,
+						backend->initial_digests),
+				rspamd_fuzzy_mmap_capacity (hdr->nshingles,
+						backend->initial_digests * FUZZY_MMAP_SHINGLES_RATIO));
+	}
+
+	rspamd_fuzzy_mmap_checkpoint (backend);
+}
+
+void
+rspamd_fuzzy_backend_close_mmap (struct rspamd_fuzzy_backend *bk,
+		void *subr_ud)
+{
+	struct rspamd_fuzzy_backend_mmap *backend = subr_ud;
+
+	if (backend->writer) {
+		rspamd_fuzzy_mmap_checkpoint (backend);
+	}
+
+	rspamd_fuzzy_mmap_free (backend);
+}
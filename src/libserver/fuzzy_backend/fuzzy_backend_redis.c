@@ -26,6 +26,8 @@
 #include "contrib/hiredis/async.h"
 #include "lua/lua_common.h"
 
+#include <openssl/evp.h>
+
 #define REDIS_DEFAULT_PORT 6379
 #define REDIS_DEFAULT_OBJECT "fuzzy"
 #define REDIS_DEFAULT_TIMEOUT 2.0
@@ -59,9 +61,22 @@ struct rspamd_fuzzy_backend_redis {
 	gdouble timeout;
 	gint conf_ref;
 	bool terminated;
+	gchar check_sha[EVP_MAX_MD_SIZE * 2 + 1];
+	struct rspamd_fuzzy_redis_pipeline *check_pipeline;
 	ref_entry_t ref;
 };
 
+/* Connection shared by check sessions started in the same loop iteration */
+struct rspamd_fuzzy_redis_pipeline {
+	redisAsyncContext *ctx;
+	struct upstream *up;
+	guint iteration;
+	guint nsessions;
+	gboolean fatal;
+	/* Upstream failure is reported once for all queued checks */
+	gboolean upstream_failed;
+};
+
 enum rspamd_fuzzy_redis_command {
 	RSPAMD_FUZZY_REDIS_COMMAND_COUNT,
 	RSPAMD_FUZZY_REDIS_COMMAND_VERSION,
@@ -75,8 +90,8 @@ struct rspamd_fuzzy_redis_session {
 	ev_timer timeout;
 	const struct rspamd_fuzzy_cmd *cmd;
 	struct ev_loop *event_loop;
-	float prob;
-	gboolean shingles_checked;
+	struct rspamd_fuzzy_redis_pipeline *pipeline;
+	gboolean script_retried;
 
 	enum rspamd_fuzzy_redis_command command;
 	guint nargs;
@@ -97,9 +112,62 @@ struct rspamd_fuzzy_redis_session {
 	gchar **argv;
 	gsize *argv_lens;
 	struct upstream *up;
-	guchar found_digest[rspamd_cryptobox_HASHBYTES];
 };
 
+/*
+ * Checks a digest and, if it is not found, its shingles in a single call:
+ *
+ * KEYS[1]: prefix
+ * ARGV[1]: digest
+ * ARGV[2..]: shingles values (optional)
+ *
+ * Returns {nmatched, digest, value, flag, time}, where nmatched is -1 for the
+ * exact match and the number of matched shingles otherwise, or {0} if nothing
+ * has been found
+ */
+static const gchar rspamd_fuzzy_redis_check_script[] = ""
+		"local prefix, digest = KEYS[1], ARGV[1]\n"
+		"local nshingles = #ARGV - 1\n"
+		"local function get_hash(d)\n"
+		"  local h = redis.call('HMGET', prefix .. d, 'V', 'F', 'C')\n"
+		"  if h[1] and h[2] then return h end\n"
+		"  return nil\n"
+		"end\n"
+		"local h = get_hash(digest)\n"
+		"if h then return {-1, digest, h[1], h[2], h[3]} end\n"
+		"if nshingles > 0 then\n"
+		"  local keys = {}\n"
+		"  for i = 1, nshingles do\n"
+		"    keys[i] = string.format('%s_%d_%s', prefix, i - 1, ARGV[i + 1])\n"
+		"  end\n"
+		"  local res = redis.call('MGET', unpack(keys))\n"
+		"  local counts, sel, max_found = {}, nil, 0\n"
+		"  for i = 1, nshingles do\n"
+		"    local d = res[i]\n"
+		"    if d then\n"
+		"      local cnt = (counts[d] or 0) + 1\n"
+		"      counts[d] = cnt\n"
+		"      if cnt > max_found then max_found, sel = cnt, d end\n"
+		"    end\n"
+		"  end\n"
+		"  if max_found > nshingles / 2 then\n"
+		"    h = get_hash(sel)\n"
+		"    if h then return {max_found, sel, h[1], h[2], h[3]} end\n"
+		"  end\n"
+		"end\n"
+		"return {0}\n";
+
+static void
+rspamd_fuzzy_redis_script_sha (const gchar *script, gchar *out)
+{
+	guchar digest[EVP_MAX_MD_SIZE];
+	guint dlen = 0;
+
+	EVP_Digest (script, strlen (script), digest, &dlen, EVP_sha1 (), NULL);
+	rspamd_encode_hex_buf (digest, dlen, out, dlen * 2 + 1);
+	out[dlen * 2] = '\0';
+}
+
 static inline struct upstream_list *
 rspamd_redis_get_servers (struct rspamd_fuzzy_backend_redis *ctx,
 						  const gchar *what)
@@ -149,10 +217,36 @@ static void
 rspamd_fuzzy_redis_session_dtor (struct rspamd_fuzzy_redis_session *session,
 		gboolean is_fatal)
 {
+	struct rspamd_fuzzy_redis_pipeline *pipeline = session->pipeline;
 	redisAsyncContext *ac;
 
+	if (pipeline) {
+		session->ctx = NULL;
+		pipeline->fatal = pipeline->fatal || is_fatal;
 
-	if (session->ctx) {
+		if (is_fatal && session->backend->check_pipeline == pipeline) {
+			/* Do not add more commands to this connection */
+			session->backend->check_pipeline = NULL;
+		}
+
+		if (--pipeline->nsessions == 0) {
+			if (session->backend->check_pipeline == pipeline) {
+				session->backend->check_pipeline = NULL;
+			}
+
+			if (pipeline->ctx) {
+				ac = pipeline->ctx;
+				pipeline->ctx = NULL;
+				rspamd_redis_pool_release_connection (session->backend->pool,
+						ac,
+						pipeline->fatal ? RSPAMD_REDIS_RELEASE_FATAL : RSPAMD_REDIS_RELEASE_DEFAULT);
+			}
+
+			rspamd_upstream_unref (pipeline->up);
+			g_free (pipeline);
+		}
+	}
+	else if (session->ctx) {
 		ac = session->ctx;
 		session->ctx = NULL;
 		rspamd_redis_pool_release_connection (session->backend->pool,
@@ -284,6 +378,8 @@ rspamd_fuzzy_backend_init_redis (struct rspamd_fuzzy_backend *bk,
 
 	rspamd_cryptobox_hash_final (&st, id_hash);
 	backend->id = rspamd_encode_base32 (id_hash, sizeof (id_hash), RSPAMD_BASE32_DEFAULT);
+	rspamd_fuzzy_redis_script_sha (rspamd_fuzzy_redis_check_script,
+			backend->check_sha);
 
 	return backend;
 }
@@ -296,6 +392,16 @@ rspamd_fuzzy_redis_timeout (EV_P_ ev_timer *w, int revents)
 	redisAsyncContext *ac;
 	static char errstr[128];
 
+	if (session->pipeline && session->pipeline->ctx) {
+		/* Terminates all checks sharing this connection */
+		if (session->backend->check_pipeline == session->pipeline) {
+			session->backend->check_pipeline = NULL;
+		}
+
+		session->ctx = session->pipeline->ctx;
+		session->pipeline->ctx = NULL;
+	}
+
 	if (session->ctx) {
 		ac = session->ctx;
 		session->ctx = NULL;
@@ -310,33 +416,15 @@ rspamd_fuzzy_redis_timeout (EV_P_ ev_timer *w, int revents)
 	}
 }
 
-static void rspamd_fuzzy_redis_check_callback (redisAsyncContext *c, gpointer r,
-		gpointer priv);
-
-struct _rspamd_fuzzy_shingles_helper {
-	guchar digest[64];
-	guint found;
-};
-
-static gint
-rspamd_fuzzy_backend_redis_shingles_cmp (const void *a, const void *b)
-{
-	const struct _rspamd_fuzzy_shingles_helper *sha = a,
-			*shb = b;
-
-	return memcmp (sha->digest, shb->digest, sizeof (sha->digest));
-}
-
 static void
-rspamd_fuzzy_redis_shingles_callback (redisAsyncContext *c, gpointer r,
+rspamd_fuzzy_redis_check_callback (redisAsyncContext *c, gpointer r,
 		gpointer priv)
 {
 	struct rspamd_fuzzy_redis_session *session = priv;
 	redisReply *reply = r, *cur;
 	struct rspamd_fuzzy_reply rep;
-	GString *key;
-	struct _rspamd_fuzzy_shingles_helper *shingles, *prev = NULL, *sel = NULL;
-	guint i, found = 0, max_found = 0, cur_found = 0;
+	gint64 nmatched;
+	gboolean success = TRUE;
 
 	ev_timer_stop (session->event_loop, &session->timeout);
 	memset (&rep, 0, sizeof (rep));
@@ -344,275 +432,156 @@ rspamd_fuzzy_redis_shingles_callback (redisAsyncContext *c, gpointer r,
 	if (c->err == 0 && reply != NULL) {
 		rspamd_upstream_ok (session->up);
 
-		if (reply->type == REDIS_REPLY_ARRAY &&
-				reply->elements == RSPAMD_SHINGLE_SIZE) {
-			shingles = g_alloca (sizeof (struct _rspamd_fuzzy_shingles_helper) *
-					RSPAMD_SHINGLE_SIZE);
+		if (reply->type == REDIS_REPLY_ERROR && !session->script_retried &&
+				reply->len >= sizeof ("NOSCRIPT") - 1 &&
+				memcmp (reply->str, "NOSCRIPT", sizeof ("NOSCRIPT") - 1) == 0) {
+			/* Redis does not know our script yet, send its body */
+			session->script_retried = TRUE;
+			g_free (session->argv[0]);
+			g_free (session->argv[1]);
+			session->argv[0] = g_strdup ("EVAL");
+			session->argv_lens[0] = 4;
+			session->argv[1] = g_strdup (rspamd_fuzzy_redis_check_script);
+			session->argv_lens[1] = sizeof (rspamd_fuzzy_redis_check_script) - 1;
+
+			if (redisAsyncCommandArgv (c, rspamd_fuzzy_redis_check_callback,
+					session, session->nargs,
+					(const gchar **)session->argv,
+					session->argv_lens) == REDIS_OK) {
+				ev_timer_again (session->event_loop, &session->timeout);
+				/* Do not free session */
+				return;
+			}
+		}
 
-			for (i = 0; i < RSPAMD_SHINGLE_SIZE; i ++) {
-				cur = reply->element[i];
+		if (reply->type == REDIS_REPLY_ARRAY && reply->elements >= 1 &&
+				reply->element[0]->type == REDIS_REPLY_INTEGER) {
+			nmatched = reply->element[0]->integer;
+
+			if (nmatched != 0 && reply->elements >= 5) {
+				cur = reply->element[1];
 
 				if (cur->type == REDIS_REPLY_STRING) {
-					shingles[i].found = 1;
-					memcpy (shingles[i].digest, cur->str, MIN (64, cur->len));
-					found ++;
+					memcpy (rep.digest, cur->str, MIN (sizeof (rep.digest),
+							cur->len));
 				}
-				else {
-					memset (shingles[i].digest, 0, sizeof (shingles[i].digest));
-					shingles[i].found = 0;
+
+				cur = reply->element[2];
+
+				if (cur->type == REDIS_REPLY_STRING) {
+					rep.v1.value = strtoul (cur->str, NULL, 10);
 				}
-			}
 
-			if (found > RSPAMD_SHINGLE_SIZE / 2) {
-				/* Now sort to find the most frequent element */
-				qsort (shingles, RSPAMD_SHINGLE_SIZE,
-						sizeof (struct _rspamd_fuzzy_shingles_helper),
-						rspamd_fuzzy_backend_redis_shingles_cmp);
-
-				prev = &shingles[0];
-
-				for (i = 1; i < RSPAMD_SHINGLE_SIZE; i ++) {
-					if (!shingles[i].found) {
-						continue;
-					}
-
-					if (memcmp (shingles[i].digest, prev->digest, 64) == 0) {
-						cur_found ++;
-
-						if (cur_found > max_found) {
-							max_found = cur_found;
-							sel = &shingles[i];
-						}
-					}
-					else {
-						cur_found = 1;
-						prev = &shingles[i];
-					}
+				cur = reply->element[3];
+
+				if (cur->type == REDIS_REPLY_STRING) {
+					rep.v1.flag = strtoul (cur->str, NULL, 10);
 				}
 
-				if (max_found > RSPAMD_SHINGLE_SIZE / 2) {
-					session->prob = ((float)max_found) / RSPAMD_SHINGLE_SIZE;
-					rep.v1.prob = session->prob;
-
-					g_assert (sel != NULL);
-
-					/* Prepare new check command */
-					rspamd_fuzzy_redis_session_free_args (session);
-					session->nargs = 5;
-					session->argv = g_malloc (sizeof (gchar *) * session->nargs);
-					session->argv_lens = g_malloc (sizeof (gsize) * session->nargs);
-
-					key = g_string_new (session->backend->redis_object);
-					g_string_append_len (key, sel->digest, sizeof (sel->digest));
-					session->argv[0] = g_strdup ("HMGET");
-					session->argv_lens[0] = 5;
-					session->argv[1] = key->str;
-					session->argv_lens[1] = key->len;
-					session->argv[2] = g_strdup ("V");
-					session->argv_lens[2] = 1;
-					session->argv[3] = g_strdup ("F");
-					session->argv_lens[3] = 1;
-					session->argv[4] = g_strdup ("C");
-					session->argv_lens[4] = 1;
-					g_string_free (key, FALSE); /* Do not free underlying array */
-					memcpy (session->found_digest, sel->digest,
-							sizeof (session->cmd->digest));
-
-					g_assert (session->ctx != NULL);
-					if (redisAsyncCommandArgv (session->ctx,
-							rspamd_fuzzy_redis_check_callback,
-							session, session->nargs,
-							(const gchar **)session->argv,
-							session->argv_lens) != REDIS_OK) {
-
-						if (session->callback.cb_check) {
-							memset (&rep, 0, sizeof (rep));
-							session->callback.cb_check (&rep, session->cbdata);
-						}
-
-						rspamd_fuzzy_redis_session_dtor (session, TRUE);
-					}
-					else {
-						/* Add timeout */
-						session->timeout.data = session;
-						ev_now_update_if_cheap ((struct ev_loop *)session->event_loop);
-						ev_timer_init (&session->timeout,
-								rspamd_fuzzy_redis_timeout,
-								session->backend->timeout, 0.0);
-						ev_timer_start (session->event_loop, &session->timeout);
-					}
-
-					return;
+				cur = reply->element[4];
+
+				if (cur->type == REDIS_REPLY_STRING) {
+					rep.ts = strtoul (cur->str, NULL, 10);
+				}
+
+				if (nmatched < 0) {
+					rep.v1.prob = 1.0f;
+				}
+				else {
+					rep.v1.prob = ((float)nmatched) / RSPAMD_SHINGLE_SIZE;
 				}
 			}
 		}
-		else if (reply->type == REDIS_REPLY_ERROR) {
-			msg_err_redis_session ("fuzzy backend redis error: \"%s\"",
-					reply->str);
+		else {
+			if (reply->type == REDIS_REPLY_ERROR) {
+				msg_err_redis_session ("fuzzy backend redis error: \"%s\"",
+						reply->str);
+			}
+
+			success = FALSE;
 		}
 
 		if (session->callback.cb_check) {
-			session->callback.cb_check (&rep, session->cbdata);
+			session->callback.cb_check (success, &rep, session->cbdata);
 		}
 	}
 	else {
 		if (session->callback.cb_check) {
-			session->callback.cb_check (&rep, session->cbdata);
+			session->callback.cb_check (FALSE, &rep, session->cbdata);
 		}
 
 		if (c->errstr) {
-			msg_err_redis_session ("error getting shingles: %s", c->errstr);
-			rspamd_upstream_fail (session->up, FALSE,  c->errstr);
+			msg_err_redis_session ("error getting hashes on %s: %s",
+					rspamd_inet_address_to_string_pretty (rspamd_upstream_addr_cur (session->up)),
+					c->errstr);
+
+			if (session->pipeline == NULL ||
+					!session->pipeline->upstream_failed) {
+				rspamd_upstream_fail (session->up, FALSE, c->errstr);
+
+				if (session->pipeline) {
+					session->pipeline->upstream_failed = TRUE;
+				}
+			}
 		}
 	}
 
 	rspamd_fuzzy_redis_session_dtor (session, FALSE);
 }
 
-static void
-rspamd_fuzzy_backend_check_shingles (struct rspamd_fuzzy_redis_session *session)
+/*
+ * Checks issued within the same event loop iteration (e.g. all commands
+ * received by a single recvmmsg call) are pipelined over one connection
+ */
+static struct rspamd_fuzzy_redis_pipeline *
+rspamd_fuzzy_redis_get_pipeline (struct rspamd_fuzzy_backend_redis *backend,
+		struct ev_loop *event_loop)
 {
-	struct rspamd_fuzzy_reply rep;
-	const struct rspamd_fuzzy_shingle_cmd *shcmd;
-	GString *key;
-	guint i, init_len;
-
-	rspamd_fuzzy_redis_session_free_args (session);
-	/* First of all check digest */
-	session->nargs = RSPAMD_SHINGLE_SIZE + 1;
-	session->argv = g_malloc (sizeof (gchar *) * session->nargs);
-	session->argv_lens = g_malloc (sizeof (gsize) * session->nargs);
-	shcmd = (const struct rspamd_fuzzy_shingle_cmd *)session->cmd;
-
-	session->argv[0] = g_strdup ("MGET");
-	session->argv_lens[0] = 4;
-	init_len = strlen (session->backend->redis_object);
+	struct rspamd_fuzzy_redis_pipeline *pipeline = backend->check_pipeline;
+	struct upstream_list *ups;
+	struct upstream *up;
+	rspamd_inet_addr_t *addr;
 
-	for (i = 0; i < RSPAMD_SHINGLE_SIZE; i ++) {
+	if (pipeline != NULL && pipeline->ctx != NULL &&
+			pipeline->ctx->err == REDIS_OK &&
+			pipeline->iteration == ev_iteration (event_loop)) {
+		pipeline->nsessions ++;
 
-		key = g_string_sized_new (init_len + 2 + 2 + sizeof ("18446744073709551616"));
-		rspamd_printf_gstring (key, "%s_%d_%uL", session->backend->redis_object,
-				i, shcmd->sgl.hashes[i]);
-		session->argv[i + 1] = key->str;
-		session->argv_lens[i + 1] = key->len;
-		g_string_free (key, FALSE); /* Do not free underlying array */
+		return pipeline;
 	}
 
-	session->shingles_checked = TRUE;
-
-	g_assert (session->ctx != NULL);
-
-	if (redisAsyncCommandArgv (session->ctx, rspamd_fuzzy_redis_shingles_callback,
-			session, session->nargs,
-			(const gchar **)session->argv, session->argv_lens) != REDIS_OK) {
-		msg_err ("cannot execute redis command on %s: %s",
-				rspamd_inet_address_to_string_pretty (rspamd_upstream_addr_cur (session->up)),
-				session->ctx->errstr);
-
-		if (session->callback.cb_check) {
-			memset (&rep, 0, sizeof (rep));
-			session->callback.cb_check (&rep, session->cbdata);
-		}
+	ups = rspamd_redis_get_servers (backend, "read_servers");
 
-		rspamd_fuzzy_redis_session_dtor (session, TRUE);
-	}
-	else {
-		/* Add timeout */
-		session->timeout.data = session;
-		ev_now_update_if_cheap ((struct ev_loop *)session->event_loop);
-		ev_timer_init (&session->timeout,
-				rspamd_fuzzy_redis_timeout,
-				session->backend->timeout, 0.0);
-		ev_timer_start (session->event_loop, &session->timeout);
+	if (!ups) {
+		return NULL;
 	}
-}
 
-static void
-rspamd_fuzzy_redis_check_callback (redisAsyncContext *c, gpointer r,
-		gpointer priv)
-{
-	struct rspamd_fuzzy_redis_session *session = priv;
-	redisReply *reply = r, *cur;
-	struct rspamd_fuzzy_reply rep;
-	gulong value;
-	guint found_elts = 0;
-
-	ev_timer_stop (session->event_loop, &session->timeout);
-	memset (&rep, 0, sizeof (rep));
-
-	if (c->err == 0 && reply != NULL) {
-		rspamd_upstream_ok (session->up);
-
-		if (reply->type == REDIS_REPLY_ARRAY && reply->elements >= 2) {
-			cur = reply->element[0];
-
-			if (cur->type == REDIS_REPLY_STRING) {
-				value = strtoul (cur->str, NULL, 10);
-				rep.v1.value = value;
-				found_elts ++;
-			}
-
-			cur = reply->element[1];
-
-			if (cur->type == REDIS_REPLY_STRING) {
-				value = strtoul (cur->str, NULL, 10);
-				rep.v1.flag = value;
-				found_elts ++;
-			}
-
-			if (found_elts >= 2) {
-				rep.v1.prob = session->prob;
-				memcpy (rep.digest, session->found_digest, sizeof (rep.digest));
-			}
-
-			rep.ts = 0;
+	up = rspamd_upstream_get (ups,
+			RSPAMD_UPSTREAM_ROUND_ROBIN,
+			NULL,
+			0);
+	addr = rspamd_upstream_addr_next (up);
+	g_assert (addr != NULL);
 
-			if (reply->elements > 2) {
-				cur = reply->element[2];
+	pipeline = g_malloc0 (sizeof (*pipeline));
+	pipeline->ctx = rspamd_redis_pool_connect (backend->pool,
+			backend->dbname, backend->password,
+			rspamd_inet_address_to_string (addr),
+			rspamd_inet_address_get_port (addr));
 
-				if (cur->type == REDIS_REPLY_STRING) {
-					rep.ts = strtoul (cur->str, NULL, 10);
-				}
-			}
-		}
-		else if (reply->type == REDIS_REPLY_ERROR) {
-			msg_err_redis_session ("fuzzy backend redis error: \"%s\"",
-					reply->str);
-		}
+	if (pipeline->ctx == NULL) {
+		rspamd_upstream_fail (up, TRUE, strerror (errno));
+		g_free (pipeline);
 
-		if (found_elts < 2) {
-			if (session->cmd->shingles_count > 0 && !session->shingles_checked) {
-				/* We also need to check all shingles here */
-				rspamd_fuzzy_backend_check_shingles (session);
-				/* Do not free session */
-				return;
-			}
-			else {
-				if (session->callback.cb_check) {
-					session->callback.cb_check (&rep, session->cbdata);
-				}
-			}
-		}
-		else {
-			if (session->callback.cb_check) {
-				session->callback.cb_check (&rep, session->cbdata);
-			}
-		}
+		return NULL;
 	}
-	else {
-		if (session->callback.cb_check) {
-			session->callback.cb_check (&rep, session->cbdata);
-		}
 
-		if (c->errstr) {
-			msg_err_redis_session ("error getting hashes on %s: %s",
-					rspamd_inet_address_to_string_pretty (rspamd_upstream_addr_cur (session->up)),
-					c->errstr);
-			rspamd_upstream_fail (session->up, FALSE, c->errstr);
-		}
-	}
+	pipeline->up = rspamd_upstream_ref (up);
+	pipeline->iteration = ev_iteration (event_loop);
+	pipeline->nsessions = 1;
+	backend->check_pipeline = pipeline;
 
-	rspamd_fuzzy_redis_session_dtor (session, FALSE);
+	return pipeline;
 }
 
 void
@@ -623,19 +592,21 @@ rspamd_fuzzy_backend_check_redis (struct rspamd_fuzzy_backend *bk,
 {
 	struct rspamd_fuzzy_backend_redis *backend = subr_ud;
 	struct rspamd_fuzzy_redis_session *session;
-	struct upstream *up;
-	struct upstream_list *ups;
-	rspamd_inet_addr_t *addr;
+	struct rspamd_fuzzy_redis_pipeline *pipeline;
+	const struct rspamd_fuzzy_shingle_cmd *shcmd;
 	struct rspamd_fuzzy_reply rep;
 	GString *key;
+	guint i;
 
 	g_assert (backend != NULL);
 
-	ups = rspamd_redis_get_servers (backend, "read_servers");
-	if (!ups) {
+	pipeline = rspamd_fuzzy_redis_get_pipeline (backend,
+			rspamd_fuzzy_backend_event_base (bk));
+
+	if (!pipeline) {
 		if (cb) {
 			memset (&rep, 0, sizeof (rep));
-			cb (&rep, ud);
+			cb (FALSE, &rep, ud);
 		}
 
 		return;
@@ -649,72 +620,63 @@ rspamd_fuzzy_backend_check_redis (struct rspamd_fuzzy_backend *bk,
 	session->cbdata = ud;
 	session->command = RSPAMD_FUZZY_REDIS_COMMAND_CHECK;
 	session->cmd = cmd;
-	session->prob = 1.0;
-	memcpy (rep.digest, session->cmd->digest, sizeof (rep.digest));
-	memcpy (session->found_digest, session->cmd->digest, sizeof (rep.digest));
 	session->event_loop = rspamd_fuzzy_backend_event_base (bk);
+	session->pipeline = pipeline;
+	session->ctx = pipeline->ctx;
+	session->up = rspamd_upstream_ref (pipeline->up);
 
-	/* First of all check digest */
+	/* EVALSHA sha 1 prefix digest [shingles] */
 	session->nargs = 5;
+
+	if (cmd->shingles_count > 0) {
+		session->nargs += RSPAMD_SHINGLE_SIZE;
+	}
+
 	session->argv = g_malloc (sizeof (gchar *) * session->nargs);
 	session->argv_lens = g_malloc (sizeof (gsize) * session->nargs);
 
-	key = g_string_new (backend->redis_object);
-	g_string_append_len (key, cmd->digest, sizeof (cmd->digest));
-	session->argv[0] = g_strdup ("HMGET");
-	session->argv_lens[0] = 5;
-	session->argv[1] = key->str;
-	session->argv_lens[1] = key->len;
-	session->argv[2] = g_strdup ("V");
+	session->argv[0] = g_strdup ("EVALSHA");
+	session->argv_lens[0] = 7;
+	session->argv[1] = g_strdup (backend->check_sha);
+	session->argv_lens[1] = strlen (backend->check_sha);
+	session->argv[2] = g_strdup ("1");
 	session->argv_lens[2] = 1;
-	session->argv[3] = g_strdup ("F");
-	session->argv_lens[3] = 1;
-	session->argv[4] = g_strdup ("C");
-	session->argv_lens[4] = 1;
-	g_string_free (key, FALSE); /* Do not free underlying array */
-
-	up = rspamd_upstream_get (ups,
-			RSPAMD_UPSTREAM_ROUND_ROBIN,
-			NULL,
-			0);
-
-	session->up = rspamd_upstream_ref (up);
-	addr = rspamd_upstream_addr_next (up);
-	g_assert (addr != NULL);
-	session->ctx = rspamd_redis_pool_connect (backend->pool,
-			backend->dbname, backend->password,
-			rspamd_inet_address_to_string (addr),
-			rspamd_inet_address_get_port (addr));
+	session->argv[3] = g_strdup (backend->redis_object);
+	session->argv_lens[3] = strlen (backend->redis_object);
+	session->argv[4] = g_malloc (sizeof (cmd->digest));
+	memcpy (session->argv[4], cmd->digest, sizeof (cmd->digest));
+	session->argv_lens[4] = sizeof (cmd->digest);
+
+	if (cmd->shingles_count > 0) {
+		shcmd = (const struct rspamd_fuzzy_shingle_cmd *)cmd;
+
+		for (i = 0; i < RSPAMD_SHINGLE_SIZE; i ++) {
+			key = g_string_sized_new (sizeof ("18446744073709551616"));
+			rspamd_printf_gstring (key, "%uL", shcmd->sgl.hashes[i]);
+			session->argv[i + 5] = key->str;
+			session->argv_lens[i + 5] = key->len;
+			g_string_free (key, FALSE); /* Do not free underlying array */
+		}
+	}
 
-	if (session->ctx == NULL) {
-		rspamd_upstream_fail (up, TRUE, strerror (errno));
+	if (redisAsyncCommandArgv (session->ctx, rspamd_fuzzy_redis_check_callback,
+			session, session->nargs,
+			(const gchar **)session->argv, session->argv_lens) != REDIS_OK) {
 		rspamd_fuzzy_redis_session_dtor (session, TRUE);
 
 		if (cb) {
 			memset (&rep, 0, sizeof (rep));
-			cb (&rep, ud);
+			cb (FALSE, &rep, ud);
 		}
 	}
 	else {
-		if (redisAsyncCommandArgv (session->ctx, rspamd_fuzzy_redis_check_callback,
-				session, session->nargs,
-				(const gchar **)session->argv, session->argv_lens) != REDIS_OK) {
-			rspamd_fuzzy_redis_session_dtor (session, TRUE);
-
-			if (cb) {
-				memset (&rep, 0, sizeof (rep));
-				cb (&rep, ud);
-			}
-		}
-		else {
-			/* Add timeout */
-			session->timeout.data = session;
-			ev_now_update_if_cheap ((struct ev_loop *)session->event_loop);
-			ev_timer_init (&session->timeout,
-					rspamd_fuzzy_redis_timeout,
-					session->backend->timeout, 0.0);
-			ev_timer_start (session->event_loop, &session->timeout);
-		}
+		/* Add timeout */
+		session->timeout.data = session;
+		ev_now_update_if_cheap ((struct ev_loop *)session->event_loop);
+		ev_timer_init (&session->timeout,
+				rspamd_fuzzy_redis_timeout,
+				session->backend->timeout, session->backend->timeout);
+		ev_timer_start (session->event_loop, &session->timeout);
 	}
 }
 
@@ -1518,7 +1480,6 @@ rspamd_fuzzy_backend_update_redis (struct rspamd_fuzzy_backend *bk,
 	session->cbdata = ud;
 	session->command = RSPAMD_FUZZY_REDIS_COMMAND_UPDATES;
 	session->cmd = cmd;
-	session->prob = 1.0f;
 	session->event_loop = rspamd_fuzzy_backend_event_base (bk);
 
 	/* First of all check digest */
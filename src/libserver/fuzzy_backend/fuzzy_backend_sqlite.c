@@ -434,7 +434,7 @@ rspamd_fuzzy_backend_sqlite_open_db (const gchar *path, GError **err)
 	bk->pool = rspamd_mempool_new (rspamd_mempool_suggest_size (),
 			"fuzzy_backend", 0);
 	bk->db = rspamd_sqlite3_open_or_create (bk->pool, bk->path,
-			create_tables_sql, 1, err);
+			create_tables_sql, 1, 0, err);
 
 	if (bk->db == NULL) {
 		rspamd_fuzzy_backend_sqlite_close (bk);
@@ -497,7 +497,7 @@ rspamd_fuzzy_backend_sqlite_int64_cmp (const void *a, const void *b)
 
 struct rspamd_fuzzy_reply
 rspamd_fuzzy_backend_sqlite_check (struct rspamd_fuzzy_backend_sqlite *backend,
-		const struct rspamd_fuzzy_cmd *cmd, gint64 expire)
+		const struct rspamd_fuzzy_cmd *cmd, gint64 expire, gboolean *success)
 {
 	struct rspamd_fuzzy_reply rep;
 	const struct rspamd_fuzzy_shingle_cmd *shcmd;
@@ -508,6 +508,7 @@ rspamd_fuzzy_backend_sqlite_check (struct rspamd_fuzzy_backend_sqlite *backend,
 
 	memset (&rep, 0, sizeof (rep));
 	memcpy (rep.digest, cmd->digest, sizeof (rep.digest));
+	*success = (backend != NULL);
 
 	if (backend == NULL) {
 		return rep;
@@ -520,6 +521,10 @@ rspamd_fuzzy_backend_sqlite_check (struct rspamd_fuzzy_backend_sqlite *backend,
 			RSPAMD_FUZZY_BACKEND_CHECK,
 			cmd->digest);
 
+	if (rc != SQLITE_OK && rc != SQLITE_DONE) {
+		*success = FALSE;
+	}
+
 	if (rc == SQLITE_OK) {
 		timestamp = sqlite3_column_int64 (
 				prepared_stmts[RSPAMD_FUZZY_BACKEND_CHECK].stmt, 1);
@@ -552,6 +557,10 @@ rspamd_fuzzy_backend_sqlite_check (struct rspamd_fuzzy_backend_sqlite *backend,
 			}
 			else {
 				shingle_values[i] = -1;
+
+				if (rc != SQLITE_DONE) {
+					*success = FALSE;
+				}
 			}
 			msg_debug_fuzzy_backend ("looking for shingle %L -> %L: %d", i,
 					shcmd->sgl.hashes[i], rc);
@@ -39,12 +39,14 @@ struct rspamd_fuzzy_backend_sqlite *rspamd_fuzzy_backend_sqlite_open (const gcha
  * Check specified fuzzy in the backend
  * @param backend
  * @param cmd
+ * @param success set to FALSE if database could not be queried
  * @return reply with probability and weight
  */
 struct rspamd_fuzzy_reply rspamd_fuzzy_backend_sqlite_check (
 		struct rspamd_fuzzy_backend_sqlite *backend,
 		const struct rspamd_fuzzy_cmd *cmd,
-		gint64 expire);
+		gint64 expire,
+		gboolean *success);
 
 /**
  * Prepare storage for updates (by starting transaction)
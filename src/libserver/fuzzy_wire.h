@@ -16,6 +16,12 @@ extern "C" {
 #define RSPAMD_FUZZY_FLAG_WEAK (1u << 7u)
 /* Use lower 4 bits for the version */
 #define RSPAMD_FUZZY_VERSION_MASK 0x0fu
+/* Version used to mark batched requests and replies */
+#define RSPAMD_FUZZY_BATCH_VERSION 5
+/* Maximum size of a batched request */
+#define RSPAMD_FUZZY_BATCH_MAX_LEN 8192
+/* Maximum number of commands in a batched request, limited by the reply size */
+#define RSPAMD_FUZZY_BATCH_MAX_CMDS 64
 /* Commands for fuzzy storage */
 #define FUZZY_CHECK 0
 #define FUZZY_WRITE 1
@@ -32,6 +38,7 @@ extern "C" {
 enum rspamd_fuzzy_epoch {
 	RSPAMD_FUZZY_EPOCH10, /**< 1.0+ encryption */
 	RSPAMD_FUZZY_EPOCH11, /**< 1.7+ extended reply */
+	RSPAMD_FUZZY_EPOCH12, /**< 3.7+ batched commands */
 	RSPAMD_FUZZY_EPOCH_MAX
 };
 
@@ -92,6 +99,30 @@ RSPAMD_PACKED(rspamd_fuzzy_encrypted_reply) {
 	struct rspamd_fuzzy_reply rep;
 };
 
+/*
+ * Batched request: header followed by `ncmds` commands, each command is
+ * prefixed by its length (guint16) and has the same layout as a standalone
+ * unencrypted command (including shingles and extensions).
+ * If encrypted, the whole batch is prefixed by
+ * `rspamd_fuzzy_encrypted_req_hdr` and encrypted at once.
+ */
+RSPAMD_PACKED(rspamd_fuzzy_batch_hdr) {
+	guint8 version;
+	guint8 ncmds;
+	guint16 reserved;
+};
+
+/*
+ * Batched reply: header followed by `nreplies` of `rspamd_fuzzy_reply` in
+ * the order of commands in the request. If encrypted, it is prefixed by
+ * `rspamd_fuzzy_encrypted_rep_hdr` and encrypted at once.
+ */
+RSPAMD_PACKED(rspamd_fuzzy_batch_reply_hdr) {
+	guint8 version;
+	guint8 nreplies;
+	guint16 reserved;
+};
+
 static const guchar fuzzy_encrypted_magic[4] = {'r', 's', 'f', 'e'};
 
 enum rspamd_fuzzy_extension_type {
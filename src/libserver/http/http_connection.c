@@ -390,6 +390,19 @@ rspamd_http_on_headers_complete (http_parser * parser)
 			return -1;
 		}
 
+		if (conn->shmem_threshold > 0 &&
+				parser->content_length >= conn->shmem_threshold &&
+				!(msg->flags & (RSPAMD_HTTP_FLAG_SHMEM|RSPAMD_HTTP_FLAG_HAS_BODY))) {
+			/*
+			 * Large body: read it straight into a shared segment of the
+			 * final size, so it can be mapped by other processes without
+			 * copying
+			 */
+			msg->flags |= RSPAMD_HTTP_FLAG_SHMEM;
+			msg->body_buf.c.shared.name = NULL;
+			msg->body_buf.c.shared.shm_fd = -1;
+		}
+
 		if (!rspamd_http_message_set_body (msg, NULL, parser->content_length)) {
 			return -1;
 		}
@@ -2449,6 +2462,13 @@ rspamd_http_connection_set_max_size (struct rspamd_http_connection *conn,
 	conn->max_size = sz;
 }
 
+void
+rspamd_http_connection_set_shmem_threshold (struct rspamd_http_connection *conn,
+		gsize sz)
+{
+	conn->shmem_threshold = sz;
+}
+
 void
 rspamd_http_connection_set_key (struct rspamd_http_connection *conn,
 		struct rspamd_cryptobox_keypair *key)
@@ -120,6 +120,7 @@ struct rspamd_http_connection {
 	/* Used for keepalive */
 	struct rspamd_keepalive_hash_key *keepalive_hash_key;
 	gsize max_size;
+	gsize shmem_threshold;
 	unsigned opts;
 	enum rspamd_http_connection_type type;
 	gboolean finished;
@@ -309,6 +310,14 @@ void rspamd_http_connection_reset (struct rspamd_http_connection *conn);
 void rspamd_http_connection_set_max_size (struct rspamd_http_connection *conn,
 										  gsize sz);
 
+/**
+ * Sets the minimum Content-Length of a message body to be read directly into
+ * a shared memory segment instead of a heap buffer (0 to disable)
+ * @param sz
+ */
+void rspamd_http_connection_set_shmem_threshold (struct rspamd_http_connection *conn,
+												 gsize sz);
+
 void rspamd_http_connection_disable_encryption (struct rspamd_http_connection *conn);
 
 #ifdef  __cplusplus
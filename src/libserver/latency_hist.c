@@ -0,0 +1,283 @@
+/*-
+ * Copyright 2023 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "latency_hist.h"
+#include "rspamd.h"
+
+#include <math.h>
+#include <signal.h>
+
+static const gchar *latency_stage_names[RSPAMD_LATENCY_STAGE_MAX] = {
+	[RSPAMD_LATENCY_STAGE_READ_MESSAGE] = "read_message",
+	[RSPAMD_LATENCY_STAGE_PRE_FILTERS] = "pre_filters",
+	[RSPAMD_LATENCY_STAGE_FILTERS] = "filters",
+	[RSPAMD_LATENCY_STAGE_CLASSIFIERS] = "classifiers",
+	[RSPAMD_LATENCY_STAGE_COMPOSITES] = "composites",
+	[RSPAMD_LATENCY_STAGE_POST_FILTERS] = "post_filters",
+	[RSPAMD_LATENCY_STAGE_IDEMPOTENT] = "idempotent",
+	[RSPAMD_LATENCY_STAGE_TOTAL] = "total",
+};
+
+/* Slot of the current process, slots are claimed lazily on the first sample */
+static struct rspamd_latency_slot *local_slot = NULL;
+static pid_t local_slot_pid = 0;
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#define LATENCY_ADD(ptr, val) __atomic_fetch_add ((ptr), (val), __ATOMIC_RELAXED)
+#define LATENCY_LOAD(ptr) __atomic_load_n ((ptr), __ATOMIC_RELAXED)
+#define LATENCY_STORE(ptr, val) __atomic_store_n ((ptr), (val), __ATOMIC_RELAXED)
+#else
+#define LATENCY_ADD(ptr, val) (*(ptr) += (val))
+#define LATENCY_LOAD(ptr) (*(ptr))
+#define LATENCY_STORE(ptr, val) (*(ptr) = (val))
+#endif
+
+static inline gboolean
+rspamd_latency_slot_cas (struct rspamd_latency_slot *slot, pid_t old, pid_t new)
+{
+#ifdef HAVE_ATOMIC_BUILTINS
+	return __atomic_compare_exchange_n (&slot->pid, &old, new, FALSE,
+			__ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+#else
+	if (slot->pid == old) {
+		slot->pid = new;
+		return TRUE;
+	}
+
+	return FALSE;
+#endif
+}
+
+static inline gboolean
+rspamd_latency_pid_dead (pid_t pid)
+{
+	return pid != 0 && kill (pid, 0) == -1 && errno == ESRCH;
+}
+
+static void
+rspamd_latency_slot_clear (struct rspamd_latency_slot *slot)
+{
+	guint i, j;
+
+	for (i = 0; i < RSPAMD_LATENCY_STAGE_MAX; i ++) {
+		struct rspamd_latency_hist *hist = &slot->stages[i];
+
+		for (j = 0; j < RSPAMD_LATENCY_BUCKETS; j ++) {
+			LATENCY_STORE (&hist->buckets[j], 0);
+		}
+
+		LATENCY_STORE (&hist->count, 0);
+		LATENCY_STORE (&hist->sum_us, 0);
+	}
+}
+
+static struct rspamd_latency_slot *
+rspamd_latency_claim_slot (struct rspamd_latency_stat *st,
+						   struct rspamd_worker *worker)
+{
+	const gchar *type = g_quark_to_string (worker->type);
+	struct rspamd_latency_slot *slot;
+	pid_t owner;
+	guint i;
+
+	/*
+	 * Prefer the slot used by the previous incarnation of the same worker,
+	 * so counters stay monotonic for the same labels after respawn
+	 */
+	for (i = 0; i < RSPAMD_LATENCY_MAX_SLOTS; i ++) {
+		slot = &st->slots[i];
+		owner = LATENCY_LOAD (&slot->pid);
+
+		if (owner != 0 && slot->index == worker->index &&
+				strcmp (slot->type, type) == 0 &&
+				(owner == worker->pid || rspamd_latency_pid_dead (owner))) {
+			if (owner == worker->pid || rspamd_latency_slot_cas (slot, owner, worker->pid)) {
+				return slot;
+			}
+		}
+	}
+
+	/* Free slot */
+	for (i = 0; i < RSPAMD_LATENCY_MAX_SLOTS; i ++) {
+		slot = &st->slots[i];
+
+		if (rspamd_latency_slot_cas (slot, 0, worker->pid)) {
+			slot->index = worker->index;
+			rspamd_strlcpy (slot->type, type, sizeof (slot->type));
+
+			return slot;
+		}
+	}
+
+	/* Slot of some worker that has gone */
+	for (i = 0; i < RSPAMD_LATENCY_MAX_SLOTS; i ++) {
+		slot = &st->slots[i];
+		owner = LATENCY_LOAD (&slot->pid);
+
+		if (rspamd_latency_pid_dead (owner) &&
+				rspamd_latency_slot_cas (slot, owner, worker->pid)) {
+			rspamd_latency_slot_clear (slot);
+			slot->index = worker->index;
+			rspamd_strlcpy (slot->type, type, sizeof (slot->type));
+
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+static inline guint
+rspamd_latency_bucket_idx (guint64 us)
+{
+	guint e, idx;
+
+	if (us < RSPAMD_LATENCY_SUB_BUCKETS) {
+		return us;
+	}
+
+	/* Position of the highest bit */
+	e = 63 - __builtin_clzll (us);
+	idx = (e - RSPAMD_LATENCY_SUB_BITS + 1) * RSPAMD_LATENCY_SUB_BUCKETS +
+			((us >> (e - RSPAMD_LATENCY_SUB_BITS)) & (RSPAMD_LATENCY_SUB_BUCKETS - 1));
+
+	return MIN (idx, RSPAMD_LATENCY_BUCKETS - 1);
+}
+
+struct rspamd_latency_stat *
+rspamd_latency_stat_new (rspamd_mempool_t *pool)
+{
+	return rspamd_mempool_alloc0_shared (pool, sizeof (struct rspamd_latency_stat));
+}
+
+void
+rspamd_latency_stat_record (struct rspamd_latency_stat *st,
+							struct rspamd_worker *worker,
+							enum rspamd_latency_stage stage,
+							gdouble seconds)
+{
+	struct rspamd_latency_hist *hist;
+	guint64 us;
+
+	if (st == NULL || worker == NULL || stage >= RSPAMD_LATENCY_STAGE_MAX ||
+			isnan (seconds) || seconds < 0) {
+		return;
+	}
+
+	if (local_slot == NULL || local_slot_pid != worker->pid) {
+		local_slot = rspamd_latency_claim_slot (st, worker);
+		local_slot_pid = worker->pid;
+
+		if (local_slot == NULL) {
+			return;
+		}
+	}
+
+	us = seconds * 1e6;
+	hist = &local_slot->stages[stage];
+	LATENCY_ADD (&hist->buckets[rspamd_latency_bucket_idx (us)], 1);
+	LATENCY_ADD (&hist->sum_us, us);
+	LATENCY_ADD (&hist->count, 1);
+}
+
+void
+rspamd_latency_stat_reset (struct rspamd_latency_stat *st)
+{
+	guint i;
+
+	if (st == NULL) {
+		return;
+	}
+
+	for (i = 0; i < RSPAMD_LATENCY_MAX_SLOTS; i ++) {
+		rspamd_latency_slot_clear (&st->slots[i]);
+	}
+}
+
+void
+rspamd_latency_hist_merge (struct rspamd_latency_hist *dst,
+						   const struct rspamd_latency_hist *src)
+{
+	guint i;
+
+	for (i = 0; i < RSPAMD_LATENCY_BUCKETS; i ++) {
+		dst->buckets[i] += LATENCY_LOAD (&src->buckets[i]);
+	}
+
+	dst->count += LATENCY_LOAD (&src->count);
+	dst->sum_us += LATENCY_LOAD (&src->sum_us);
+}
+
+gdouble
+rspamd_latency_bucket_upper (guint idx)
+{
+	guint e, sub;
+
+	if (idx < RSPAMD_LATENCY_SUB_BUCKETS) {
+		return (idx + 1) / 1e6;
+	}
+
+	e = idx / RSPAMD_LATENCY_SUB_BUCKETS + RSPAMD_LATENCY_SUB_BITS - 1;
+	sub = idx % RSPAMD_LATENCY_SUB_BUCKETS;
+
+	return (gdouble)((guint64)(RSPAMD_LATENCY_SUB_BUCKETS + sub + 1) <<
+			(e - RSPAMD_LATENCY_SUB_BITS)) / 1e6;
+}
+
+gdouble
+rspamd_latency_hist_quantile (const struct rspamd_latency_hist *hist,
+							  gdouble q)
+{
+	guint64 total = 0, cum = 0, rank;
+	guint i;
+
+	for (i = 0; i < RSPAMD_LATENCY_BUCKETS; i ++) {
+		total += hist->buckets[i];
+	}
+
+	if (total == 0) {
+		return 0.0;
+	}
+
+	rank = ceil (q * (gdouble)total);
+
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	for (i = 0; i < RSPAMD_LATENCY_BUCKETS; i ++) {
+		cum += hist->buckets[i];
+
+		if (cum >= rank) {
+			/* Middle of the bucket */
+			gdouble lower = i > 0 ? rspamd_latency_bucket_upper (i - 1) : 0;
+
+			return (lower + rspamd_latency_bucket_upper (i)) / 2.0;
+		}
+	}
+
+	return rspamd_latency_bucket_upper (RSPAMD_LATENCY_BUCKETS - 1);
+}
+
+const gchar *
+rspamd_latency_stage_name (enum rspamd_latency_stage stage)
+{
+	if (stage < RSPAMD_LATENCY_STAGE_MAX) {
+		return latency_stage_names[stage];
+	}
+
+	return "unknown";
+}
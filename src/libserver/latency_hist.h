@@ -0,0 +1,121 @@
+/*-
+ * Copyright 2023 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RSPAMD_LATENCY_HIST_H
+#define RSPAMD_LATENCY_HIST_H
+
+#include "config.h"
+#include "mem_pool.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Latency histograms for tasks processing stages. Histograms live in the
+ * shared memory and each worker process owns a slot in it, so updates are
+ * just relaxed atomic increments without any locking.
+ *
+ * Buckets are logarithmic (HDR style): each power of two of microseconds is
+ * split into 4 linear sub-buckets, giving ~25% relative error for quantiles.
+ */
+
+enum rspamd_latency_stage {
+	RSPAMD_LATENCY_STAGE_READ_MESSAGE = 0,
+	RSPAMD_LATENCY_STAGE_PRE_FILTERS,
+	RSPAMD_LATENCY_STAGE_FILTERS,
+	RSPAMD_LATENCY_STAGE_CLASSIFIERS,
+	RSPAMD_LATENCY_STAGE_COMPOSITES,
+	RSPAMD_LATENCY_STAGE_POST_FILTERS,
+	RSPAMD_LATENCY_STAGE_IDEMPOTENT,
+	RSPAMD_LATENCY_STAGE_TOTAL,
+	RSPAMD_LATENCY_STAGE_MAX
+};
+
+#define RSPAMD_LATENCY_SUB_BITS 2
+#define RSPAMD_LATENCY_SUB_BUCKETS (1u << RSPAMD_LATENCY_SUB_BITS)
+/* Covers up to 2^29 microseconds, the last bucket is for overflows */
+#define RSPAMD_LATENCY_BUCKETS (28 * RSPAMD_LATENCY_SUB_BUCKETS)
+#define RSPAMD_LATENCY_MAX_SLOTS 64
+
+struct rspamd_latency_hist {
+	guint64 buckets[RSPAMD_LATENCY_BUCKETS];
+	guint64 count;
+	guint64 sum_us;
+};
+
+struct RSPAMD_ALIGNED(64) rspamd_latency_slot {
+	pid_t pid;
+	guint index;
+	gchar type[32];
+	struct rspamd_latency_hist stages[RSPAMD_LATENCY_STAGE_MAX];
+};
+
+struct rspamd_latency_stat {
+	struct rspamd_latency_slot slots[RSPAMD_LATENCY_MAX_SLOTS];
+};
+
+struct rspamd_worker;
+
+/**
+ * Allocates latency histograms in the shared memory
+ * @param pool shared pool (must be allocated before workers are forked)
+ */
+struct rspamd_latency_stat *rspamd_latency_stat_new (rspamd_mempool_t *pool);
+
+/**
+ * Records a sample for the specified stage in the worker's slot
+ * @param st latency stat (can be NULL, then nothing is recorded)
+ * @param worker current worker
+ * @param stage stage
+ * @param seconds duration of the stage
+ */
+void rspamd_latency_stat_record (struct rspamd_latency_stat *st,
+								 struct rspamd_worker *worker,
+								 enum rspamd_latency_stage stage,
+								 gdouble seconds);
+
+/**
+ * Resets all histograms
+ */
+void rspamd_latency_stat_reset (struct rspamd_latency_stat *st);
+
+/**
+ * Adds (atomically loaded) values of `src` to `dst`
+ */
+void rspamd_latency_hist_merge (struct rspamd_latency_hist *dst,
+								const struct rspamd_latency_hist *src);
+
+/**
+ * Returns the upper bound of a bucket in seconds
+ */
+gdouble rspamd_latency_bucket_upper (guint idx);
+
+/**
+ * Returns the estimated quantile `q` (0..1) of a histogram in seconds
+ */
+gdouble rspamd_latency_hist_quantile (const struct rspamd_latency_hist *hist,
+									  gdouble q);
+
+/**
+ * Returns the name of a stage
+ */
+const gchar *rspamd_latency_stage_name (enum rspamd_latency_stage stage);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -20,6 +20,7 @@
 #include "config.h"
 #include "map.h"
 #include "map_private.h"
+#include "map_helpers.h"
 #include "libserver/http/http_connection.h"
 #include "libserver/http/http_private.h"
 #include "rspamd.h"
@@ -761,6 +762,141 @@ rspamd_map_check_file_sig (const char *fname,
 	return ret;
 }
 
+gboolean
+rspamd_map_get_snapshot_path (struct rspamd_map *map, guint64 key,
+		gchar *buf, gsize buflen)
+{
+	struct rspamd_config *cfg = map->cfg;
+	rspamd_cryptobox_fast_hash_state_t hst;
+	const gchar *type;
+	guint64 map_id;
+
+	if (key == 0 || cfg->maps_cache_dir == NULL || cfg->maps_cache_dir[0] == '\0') {
+		return FALSE;
+	}
+
+	type = rspamd_map_helper_snapshot_type (map);
+
+	if (type == NULL) {
+		return FALSE;
+	}
+
+	/* Snapshots of the same map share prefix, so the outdated ones are found */
+	rspamd_cryptobox_fast_hash_init (&hst, rspamd_hash_seed ());
+	rspamd_cryptobox_fast_hash_update (&hst, type, strlen (type));
+	rspamd_cryptobox_fast_hash_update (&hst, map->name, strlen (map->name));
+	map_id = rspamd_cryptobox_fast_hash_final (&hst);
+
+	rspamd_snprintf (buf, buflen, "%s%c%016uxL-%016uxL.snap", cfg->maps_cache_dir,
+			G_DIR_SEPARATOR, map_id, key);
+
+	return TRUE;
+}
+
+void
+rspamd_map_cleanup_snapshots (struct rspamd_map *map, const gchar *path)
+{
+	struct rspamd_config *cfg = map->cfg;
+	const gchar *base, *sep, *name;
+	gchar stale_path[PATH_MAX];
+	gsize prefix_len;
+	GDir *dir;
+
+	base = strrchr (path, G_DIR_SEPARATOR);
+	base = base ? base + 1 : path;
+	sep = strchr (base, '-');
+
+	if (sep == NULL || cfg->maps_cache_dir == NULL) {
+		return;
+	}
+
+	prefix_len = sep - base + 1;
+	dir = g_dir_open (cfg->maps_cache_dir, 0, NULL);
+
+	if (dir == NULL) {
+		return;
+	}
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		/*
+		 * Keep the current snapshot and temporary files of concurrent
+		 * writers as they are named `<current>-XXXXXXXXXX`
+		 */
+		if (strncmp (name, base, prefix_len) != 0 ||
+				strncmp (name, base, strlen (base)) == 0) {
+			continue;
+		}
+
+		rspamd_snprintf (stale_path, sizeof (stale_path), "%s%c%s",
+				cfg->maps_cache_dir, G_DIR_SEPARATOR, name);
+
+		if (unlink (stale_path) == 0) {
+			msg_info_map ("removed outdated snapshot %s", stale_path);
+		}
+	}
+
+	g_dir_close (dir);
+}
+
+/*
+ * Maps with a single file backend are keyed by the file identity, so the
+ * first process that parses such a map leaves a snapshot that is mapped
+ * by all other processes instead of parsing the same data again
+ */
+static gboolean
+rspamd_map_try_load_snapshot (struct rspamd_map *map, struct file_map_data *data,
+		struct rspamd_map_backend *bk, struct stat *st,
+		struct map_periodic_cbdata *periodic)
+{
+	const gchar *type;
+	rspamd_cryptobox_fast_hash_state_t hst;
+	guint64 key, tmp;
+	gchar path[PATH_MAX];
+
+	periodic->cbdata.snapshot_key = 0;
+	type = rspamd_map_helper_snapshot_type (map);
+
+	if (type == NULL || map->no_file_read || map->backends->len != 1 ||
+			g_ptr_array_index (map->backends, 0) != bk ||
+			periodic->cbdata.cur_data != NULL) {
+		return FALSE;
+	}
+
+	rspamd_cryptobox_fast_hash_init (&hst, rspamd_hash_seed ());
+	rspamd_cryptobox_fast_hash_update (&hst, type, strlen (type));
+	rspamd_cryptobox_fast_hash_update (&hst, data->filename,
+			strlen (data->filename));
+	tmp = st->st_dev;
+	rspamd_cryptobox_fast_hash_update (&hst, &tmp, sizeof (tmp));
+	tmp = st->st_ino;
+	rspamd_cryptobox_fast_hash_update (&hst, &tmp, sizeof (tmp));
+	tmp = st->st_size;
+	rspamd_cryptobox_fast_hash_update (&hst, &tmp, sizeof (tmp));
+	tmp = st->st_mtime;
+	rspamd_cryptobox_fast_hash_update (&hst, &tmp, sizeof (tmp));
+	key = rspamd_cryptobox_fast_hash_final (&hst);
+
+	if (!rspamd_map_get_snapshot_path (map, key, path, sizeof (path))) {
+		return FALSE;
+	}
+
+	periodic->cbdata.snapshot_key = key;
+
+	if (access (path, R_OK) == -1) {
+		msg_debug_map ("%s: no snapshot found in %s", data->filename, path);
+
+		return FALSE;
+	}
+
+	if (!rspamd_map_helper_load_snapshot (&periodic->cbdata, path)) {
+		return FALSE;
+	}
+
+	msg_info_map ("%s: loaded %s snapshot from %s", data->filename, type, path);
+
+	return TRUE;
+}
+
 /**
  * Callback for reading data from file
  */
@@ -814,6 +950,10 @@ read_map_file (struct rspamd_map *map, struct file_map_data *data,
 		munmap (bytes, len);
 	}
 
+	if (len > 0 && rspamd_map_try_load_snapshot (map, data, bk, &st, periodic)) {
+		return TRUE;
+	}
+
 	if (len > 0) {
 		if (map->no_file_read) {
 			/* We just call read callback with backend name */
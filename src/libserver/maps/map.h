@@ -54,6 +54,7 @@ struct map_cb_data {
 	bool errored;
 	void *prev_data;
 	void *cur_data;
+	guint64 snapshot_key; /* non-zero if data can be stored as a shared snapshot */
 };
 
 /**
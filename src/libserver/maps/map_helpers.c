@@ -51,11 +51,18 @@ KHASH_INIT (rspamd_map_hash, rspamd_ftok_t,
 		struct rspamd_map_helper_value *, true,
 		rspamd_map_ftok_hash, rspamd_map_ftok_equal);
 
+struct rspamd_map_snapshot;
+
+static void rspamd_map_snapshot_traverse (const struct rspamd_map_snapshot *snap,
+		rspamd_map_traverse_cb cb,
+		gpointer cbdata);
+
 struct rspamd_radix_map_helper {
 	rspamd_mempool_t *pool;
 	khash_t(rspamd_map_hash) *htb;
 	radix_compressed_t *trie;
 	struct rspamd_map *map;
+	struct rspamd_map_snapshot *snap; /* read only shared image if not NULL */
 	rspamd_cryptobox_fast_hash_state_t hst;
 };
 
@@ -63,6 +70,7 @@ struct rspamd_hash_map_helper {
 	rspamd_mempool_t *pool;
 	khash_t(rspamd_map_hash) *htb;
 	struct rspamd_map *map;
+	struct rspamd_map_snapshot *snap; /* read only shared image if not NULL */
 	rspamd_cryptobox_fast_hash_state_t hst;
 };
 
@@ -88,6 +96,10 @@ struct rspamd_regexp_map_helper {
 	gchar **patterns;
 	gint *flags;
 	gint *ids;
+	/* Used when another process compiles the same map */
+	ev_timer hs_wait_ev;
+	ev_tstamp hs_wait_start;
+	gboolean hs_waiting;
 #endif
 };
 
@@ -774,6 +786,12 @@ rspamd_map_helper_traverse_hash (void *data,
 	struct rspamd_map_helper_value *val;
 	struct rspamd_hash_map_helper *ht = data;
 
+	if (ht->snap) {
+		rspamd_map_snapshot_traverse (ht->snap, cb, cbdata);
+
+		return;
+	}
+
 	kh_foreach (ht->htb, tok, val, {
 		if (!cb (tok.begin, val->value, val->hits, cbdata)) {
 			break;
@@ -835,6 +853,12 @@ rspamd_map_helper_traverse_radix (void *data,
 	struct rspamd_map_helper_value *val;
 	struct rspamd_radix_map_helper *r = data;
 
+	if (r->snap) {
+		rspamd_map_snapshot_traverse (r->snap, cb, cbdata);
+
+		return;
+	}
+
 	kh_foreach (r->htb, tok, val, {
 		if (!cb (tok.begin, val->value, val->hits, cbdata)) {
 			break;
@@ -846,6 +870,673 @@ rspamd_map_helper_traverse_radix (void *data,
 	});
 }
 
+/*
+ * Snapshots are flat, position independent images of hash and radix maps.
+ * They are mapped read-only, so all processes that load the same map share
+ * the same pages and skip parsing entirely.
+ *
+ * Layout: header, array of elements (key/value pairs), index (hash buckets
+ * or sorted non-overlapping address ranges) and strings area with null
+ * terminated keys and values. All offsets are relative to the image start.
+ * Hits are not counted for snapshots as the image is not writable.
+ */
+static const guchar rspamd_map_snapshot_magic[] = {'r', 'm', 's', 'n', 'a', 'p', '0', '1'};
+
+enum rspamd_map_snapshot_type {
+	RSPAMD_MAP_SNAPSHOT_HASH = 1,
+	RSPAMD_MAP_SNAPSHOT_RADIX = 2,
+};
+
+struct rspamd_map_snapshot_header {
+	guchar magic[sizeof (rspamd_map_snapshot_magic)];
+	guint32 type;
+	guint32 unused;
+	guint64 digest;
+	guint64 total_len;
+	guint64 nelts;
+	guint64 elts_off;
+	guint64 nindex;
+	guint64 index_off;
+	guint64 strings_off;
+};
+
+struct rspamd_map_snapshot_elt {
+	guint64 key_off;
+	guint64 value_off;
+	guint32 key_len;
+	guint32 value_len;
+};
+
+struct rspamd_map_snapshot_bucket {
+	guint64 hash;
+	guint64 elt; /* element index + 1, zero for an empty bucket */
+};
+
+struct rspamd_map_snapshot_range {
+	guchar start[16];
+	guchar end[16];
+	guint64 elt;
+};
+
+struct rspamd_map_snapshot {
+	const guchar *image;
+	gsize len;
+	const struct rspamd_map_snapshot_header *hdr;
+	const struct rspamd_map_snapshot_elt *elts;
+	gconstpointer index;
+};
+
+#define RSPAMD_MAP_SNAPSHOT_STR(snap, off) ((const gchar *)((snap)->image + (off)))
+#define RSPAMD_MAP_SNAPSHOT_MAX_PREFIX 128
+
+static void
+rspamd_map_snapshot_dtor (gpointer p)
+{
+	struct rspamd_map_snapshot *snap = (struct rspamd_map_snapshot *)p;
+
+	munmap ((gpointer)snap->image, snap->len);
+}
+
+static gboolean
+rspamd_map_snapshot_save (struct rspamd_map *map,
+		const gchar *path,
+		enum rspamd_map_snapshot_type type,
+		guint64 digest,
+		GArray *keys,
+		GArray *values,
+		gconstpointer index,
+		guint64 nindex,
+		gsize index_elt_size)
+{
+	struct rspamd_map_snapshot_header hdr;
+	struct rspamd_map_snapshot_elt elt;
+	rspamd_ftok_t *key, *value;
+	gchar tmp_path[PATH_MAX];
+	guint64 cur_off;
+	gboolean ret = FALSE;
+	FILE *f;
+	gint fd;
+	guint i;
+
+	memset (&hdr, 0, sizeof (hdr));
+	memcpy (hdr.magic, rspamd_map_snapshot_magic, sizeof (hdr.magic));
+	hdr.type = type;
+	hdr.digest = digest;
+	hdr.nelts = keys->len;
+	hdr.elts_off = sizeof (hdr);
+	hdr.nindex = nindex;
+	hdr.index_off = hdr.elts_off + hdr.nelts * sizeof (elt);
+	hdr.strings_off = hdr.index_off + nindex * index_elt_size;
+	hdr.total_len = hdr.strings_off;
+
+	for (i = 0; i < keys->len; i ++) {
+		key = &g_array_index (keys, rspamd_ftok_t, i);
+		value = &g_array_index (values, rspamd_ftok_t, i);
+		hdr.total_len += key->len + 1 + value->len + 1;
+	}
+
+	rspamd_snprintf (tmp_path, sizeof (tmp_path), "%s-XXXXXXXXXX", path);
+
+	if ((fd = g_mkstemp_full (tmp_path, O_WRONLY | O_CREAT | O_EXCL, 00644)) == -1) {
+		msg_warn_map ("cannot create temporary snapshot file %s: %s",
+				tmp_path, strerror (errno));
+
+		return FALSE;
+	}
+
+	f = fdopen (fd, "w");
+
+	if (f == NULL) {
+		msg_warn_map ("cannot open snapshot file %s: %s",
+				tmp_path, strerror (errno));
+		close (fd);
+		unlink (tmp_path);
+
+		return FALSE;
+	}
+
+	if (fwrite (&hdr, sizeof (hdr), 1, f) != 1) {
+		goto err;
+	}
+
+	cur_off = hdr.strings_off;
+
+	for (i = 0; i < keys->len; i ++) {
+		key = &g_array_index (keys, rspamd_ftok_t, i);
+		value = &g_array_index (values, rspamd_ftok_t, i);
+
+		elt.key_off = cur_off;
+		elt.key_len = key->len;
+		cur_off += key->len + 1;
+		elt.value_off = cur_off;
+		elt.value_len = value->len;
+		cur_off += value->len + 1;
+
+		if (fwrite (&elt, sizeof (elt), 1, f) != 1) {
+			goto err;
+		}
+	}
+
+	if (nindex > 0 && fwrite (index, index_elt_size, nindex, f) != nindex) {
+		goto err;
+	}
+
+	for (i = 0; i < keys->len; i ++) {
+		key = &g_array_index (keys, rspamd_ftok_t, i);
+		value = &g_array_index (values, rspamd_ftok_t, i);
+
+		/* Both strings are written with the trailing zero */
+		if (fwrite (key->begin, 1, key->len, f) != key->len ||
+				fputc ('\0', f) == EOF ||
+				fwrite (value->begin, 1, value->len, f) != value->len ||
+				fputc ('\0', f) == EOF) {
+			goto err;
+		}
+	}
+
+	if (fflush (f) != 0 || fsync (fd) == -1) {
+		goto err;
+	}
+
+	if (rename (tmp_path, path) == -1) {
+		msg_warn_map ("cannot rename snapshot from %s to %s: %s",
+				tmp_path, path, strerror (errno));
+		fclose (f);
+		unlink (tmp_path);
+
+		return FALSE;
+	}
+
+	msg_info_map ("written snapshot for %s to %s (%L elements, %HL length)",
+			map->name, path, hdr.nelts, hdr.total_len);
+	ret = TRUE;
+	fclose (f);
+	rspamd_map_cleanup_snapshots (map, path);
+
+	return ret;
+
+err:
+	msg_warn_map ("cannot write snapshot to %s: %s",
+			tmp_path, strerror (errno));
+	fclose (f);
+	unlink (tmp_path);
+
+	return FALSE;
+}
+
+static struct rspamd_map_snapshot *
+rspamd_map_snapshot_open (struct rspamd_map *map,
+		const gchar *path,
+		enum rspamd_map_snapshot_type type,
+		rspamd_mempool_t *pool)
+{
+	struct rspamd_map_snapshot *snap;
+	const struct rspamd_map_snapshot_header *hdr;
+	const struct rspamd_map_snapshot_elt *elt;
+	gsize index_elt_size;
+	guchar *image;
+	gsize len;
+	guint64 i;
+
+	image = rspamd_file_xmap (path, PROT_READ, &len, TRUE);
+
+	if (image == NULL) {
+		msg_warn_map ("cannot map snapshot %s: %s", path, strerror (errno));
+
+		return NULL;
+	}
+
+	hdr = (const struct rspamd_map_snapshot_header *)image;
+	index_elt_size = type == RSPAMD_MAP_SNAPSHOT_HASH ?
+			sizeof (struct rspamd_map_snapshot_bucket) :
+			sizeof (struct rspamd_map_snapshot_range);
+
+	if (len < sizeof (*hdr) ||
+			memcmp (hdr->magic, rspamd_map_snapshot_magic, sizeof (hdr->magic)) != 0 ||
+			hdr->type != type ||
+			hdr->total_len != len ||
+			hdr->elts_off != sizeof (*hdr) ||
+			hdr->nelts > (len - hdr->elts_off) / sizeof (*elt) ||
+			hdr->index_off != hdr->elts_off + hdr->nelts * sizeof (*elt) ||
+			hdr->nindex > (len - hdr->index_off) / index_elt_size ||
+			hdr->strings_off != hdr->index_off + hdr->nindex * index_elt_size) {
+		goto err;
+	}
+
+	if (type == RSPAMD_MAP_SNAPSHOT_HASH &&
+			(hdr->nindex == 0 || (hdr->nindex & (hdr->nindex - 1)) != 0)) {
+		/* Number of buckets must be a power of two */
+		goto err;
+	}
+
+	elt = (const struct rspamd_map_snapshot_elt *)(image + hdr->elts_off);
+
+	for (i = 0; i < hdr->nelts; i ++, elt ++) {
+		if (elt->key_off < hdr->strings_off || elt->key_off + elt->key_len >= len ||
+				image[elt->key_off + elt->key_len] != '\0' ||
+				elt->value_off < hdr->strings_off || elt->value_off + elt->value_len >= len ||
+				image[elt->value_off + elt->value_len] != '\0') {
+			goto err;
+		}
+	}
+
+	if (type == RSPAMD_MAP_SNAPSHOT_HASH) {
+		const struct rspamd_map_snapshot_bucket *bk =
+				(const struct rspamd_map_snapshot_bucket *)(image + hdr->index_off);
+
+		for (i = 0; i < hdr->nindex; i ++) {
+			if (bk[i].elt > hdr->nelts) {
+				goto err;
+			}
+		}
+	}
+	else {
+		const struct rspamd_map_snapshot_range *range =
+				(const struct rspamd_map_snapshot_range *)(image + hdr->index_off);
+
+		for (i = 0; i < hdr->nindex; i ++) {
+			if (range[i].elt >= hdr->nelts) {
+				goto err;
+			}
+		}
+	}
+
+	snap = rspamd_mempool_alloc0 (pool, sizeof (*snap));
+	snap->image = image;
+	snap->len = len;
+	snap->hdr = hdr;
+	snap->elts = (const struct rspamd_map_snapshot_elt *)(image + hdr->elts_off);
+	snap->index = image + hdr->index_off;
+	rspamd_mempool_add_destructor (pool, rspamd_map_snapshot_dtor, snap);
+
+	return snap;
+
+err:
+	msg_warn_map ("invalid or outdated snapshot %s, ignore it", path);
+	munmap (image, len);
+
+	return NULL;
+}
+
+static const struct rspamd_map_snapshot_elt *
+rspamd_map_snapshot_find_key (const struct rspamd_map_snapshot *snap,
+		const gchar *in, gsize len)
+{
+	const struct rspamd_map_snapshot_bucket *buckets = snap->index;
+	const struct rspamd_map_snapshot_elt *elt;
+	guint64 h, mask, i, probes;
+
+	h = rspamd_icase_hash (in, len, map_hash_seed);
+	mask = snap->hdr->nindex - 1;
+
+	for (i = h & mask, probes = 0; probes < snap->hdr->nindex;
+			i = (i + 1) & mask, probes ++) {
+		if (buckets[i].elt == 0) {
+			break;
+		}
+
+		if (buckets[i].hash == h) {
+			elt = &snap->elts[buckets[i].elt - 1];
+
+			if (elt->key_len == len &&
+					rspamd_lc_cmp (RSPAMD_MAP_SNAPSHOT_STR (snap, elt->key_off),
+							in, len) == 0) {
+				return elt;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static const struct rspamd_map_snapshot_elt *
+rspamd_map_snapshot_find_addr (const struct rspamd_map_snapshot *snap,
+		const guchar *addr)
+{
+	const struct rspamd_map_snapshot_range *ranges = snap->index, *range;
+	guint64 lo = 0, hi = snap->hdr->nindex, mid;
+
+	/* Find the last range that starts before or at addr */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (memcmp (ranges[mid].start, addr, sizeof (ranges[mid].start)) <= 0) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	if (lo == 0) {
+		return NULL;
+	}
+
+	range = &ranges[lo - 1];
+
+	if (memcmp (addr, range->end, sizeof (range->end)) > 0) {
+		return NULL;
+	}
+
+	return &snap->elts[range->elt];
+}
+
+static void
+rspamd_map_snapshot_traverse (const struct rspamd_map_snapshot *snap,
+		rspamd_map_traverse_cb cb,
+		gpointer cbdata)
+{
+	const struct rspamd_map_snapshot_elt *elt;
+	guint64 i;
+
+	for (i = 0; i < snap->hdr->nelts; i ++) {
+		elt = &snap->elts[i];
+
+		if (!cb (RSPAMD_MAP_SNAPSHOT_STR (snap, elt->key_off),
+				RSPAMD_MAP_SNAPSHOT_STR (snap, elt->value_off), 0, cbdata)) {
+			break;
+		}
+	}
+}
+
+static guint64
+rspamd_map_snapshot_hash_buckets (guint64 nelts)
+{
+	guint64 nbuckets = 2;
+
+	/* Keep load factor below 0.5 to have short probe sequences */
+	while (nbuckets < nelts * 2) {
+		nbuckets <<= 1;
+	}
+
+	return nbuckets;
+}
+
+static gboolean
+rspamd_map_helper_save_hash_snapshot (struct rspamd_hash_map_helper *ht,
+		guint64 digest, const gchar *path)
+{
+	struct rspamd_map_snapshot_bucket *buckets;
+	struct rspamd_map_helper_value *val;
+	struct rspamd_map *map = ht->map;
+	GArray *keys, *values;
+	rspamd_ftok_t tok, vtok;
+	guint64 nbuckets, mask, h, i;
+	gboolean ret;
+
+	keys = g_array_sized_new (FALSE, FALSE, sizeof (rspamd_ftok_t), kh_size (ht->htb));
+	values = g_array_sized_new (FALSE, FALSE, sizeof (rspamd_ftok_t), kh_size (ht->htb));
+	nbuckets = rspamd_map_snapshot_hash_buckets (kh_size (ht->htb));
+	mask = nbuckets - 1;
+	buckets = g_malloc0 (nbuckets * sizeof (*buckets));
+
+	kh_foreach (ht->htb, tok, val, {
+		vtok.begin = val->value;
+		vtok.len = strlen (val->value);
+		g_array_append_val (keys, tok);
+		g_array_append_val (values, vtok);
+
+		h = rspamd_icase_hash (tok.begin, tok.len, map_hash_seed);
+
+		i = h & mask;
+
+		while (buckets[i].elt != 0) {
+			i = (i + 1) & mask;
+		}
+
+		buckets[i].hash = h;
+		buckets[i].elt = keys->len;
+	});
+
+	ret = rspamd_map_snapshot_save (map, path, RSPAMD_MAP_SNAPSHOT_HASH, digest,
+			keys, values, buckets, nbuckets, sizeof (*buckets));
+
+	g_free (buckets);
+	g_array_free (keys, TRUE);
+	g_array_free (values, TRUE);
+
+	return ret;
+}
+
+struct rspamd_map_snapshot_radix_walk {
+	GHashTable *values; /* struct rspamd_map_helper_value * -> element index + 1 */
+	GArray *ranges;
+	guint depth;
+	gboolean overflow; /* pos has wrapped after the last address */
+	guchar pos[16];
+	guchar ends[RSPAMD_MAP_SNAPSHOT_MAX_PREFIX + 1][16];
+	guint64 elts[RSPAMD_MAP_SNAPSHOT_MAX_PREFIX + 1];
+};
+
+static void
+rspamd_map_snapshot_radix_emit (struct rspamd_map_snapshot_radix_walk *w,
+		const guchar *end, guint64 elt)
+{
+	struct rspamd_map_snapshot_range range;
+	gint i;
+
+	memcpy (range.start, w->pos, sizeof (range.start));
+	memcpy (range.end, end, sizeof (range.end));
+	range.elt = elt;
+	g_array_append_val (w->ranges, range);
+
+	/* pos = end + 1 */
+	memcpy (w->pos, end, sizeof (w->pos));
+
+	for (i = sizeof (w->pos) - 1; i >= 0; i --) {
+		if (++w->pos[i] != 0) {
+			break;
+		}
+	}
+
+	if (i < 0) {
+		w->overflow = TRUE;
+	}
+}
+
+static void
+rspamd_map_snapshot_radix_walk_cb (const guint8 *key, gsize keybits,
+		uintptr_t value, gboolean post, gpointer ud)
+{
+	struct rspamd_map_snapshot_radix_walk *w = ud;
+	guchar start[16], end[16];
+	gpointer pelt;
+	gsize i;
+
+	if (keybits > sizeof (start) * NBBY) {
+		return;
+	}
+
+	if (!post) {
+		memset (start, 0, sizeof (start));
+		memset (end, 0xff, sizeof (end));
+
+		for (i = 0; i < keybits; i ++) {
+			guchar bit = 0x80u >> (i % NBBY);
+
+			if (key[i / NBBY] & bit) {
+				start[i / NBBY] |= bit;
+			}
+			else {
+				end[i / NBBY] &= ~bit;
+			}
+		}
+
+		pelt = g_hash_table_lookup (w->values, (gpointer)value);
+
+		if (!w->overflow && memcmp (w->pos, start, sizeof (start)) < 0) {
+			if (w->depth > 0) {
+				/* Gap before the nested prefix belongs to the enclosing one */
+				guchar gap_end[16];
+				gint j;
+
+				memcpy (gap_end, start, sizeof (gap_end));
+
+				for (j = sizeof (gap_end) - 1; j >= 0; j --) {
+					if (gap_end[j]-- != 0) {
+						break;
+					}
+				}
+
+				/* This also moves pos to the start of the nested prefix */
+				rspamd_map_snapshot_radix_emit (w, gap_end, w->elts[w->depth - 1]);
+			}
+			else {
+				memcpy (w->pos, start, sizeof (w->pos));
+			}
+		}
+
+		g_assert (w->depth <= RSPAMD_MAP_SNAPSHOT_MAX_PREFIX);
+		memcpy (w->ends[w->depth], end, sizeof (end));
+		/* Elements are stored as index + 1, G_MAXUINT64 means unknown value */
+		w->elts[w->depth] = pelt ? GPOINTER_TO_SIZE (pelt) - 1 : G_MAXUINT64;
+		w->depth ++;
+	}
+	else {
+		g_assert (w->depth > 0);
+		w->depth --;
+
+		if (!w->overflow &&
+				memcmp (w->pos, w->ends[w->depth], sizeof (w->pos)) <= 0) {
+			rspamd_map_snapshot_radix_emit (w, w->ends[w->depth],
+					w->elts[w->depth]);
+		}
+	}
+}
+
+static gboolean
+rspamd_map_helper_save_radix_snapshot (struct rspamd_radix_map_helper *r,
+		guint64 digest, const gchar *path)
+{
+	struct rspamd_map_snapshot_radix_walk *w;
+	struct rspamd_map_snapshot_range *range;
+	struct rspamd_map_helper_value *val;
+	struct rspamd_map *map = r->map;
+	GArray *keys, *values, *ranges;
+	rspamd_ftok_t tok, vtok;
+	gboolean ret;
+	guint i, j;
+
+	keys = g_array_sized_new (FALSE, FALSE, sizeof (rspamd_ftok_t), kh_size (r->htb));
+	values = g_array_sized_new (FALSE, FALSE, sizeof (rspamd_ftok_t), kh_size (r->htb));
+	w = g_malloc0 (sizeof (*w));
+	w->values = g_hash_table_new (g_direct_hash, g_direct_equal);
+	w->ranges = g_array_new (FALSE, FALSE, sizeof (struct rspamd_map_snapshot_range));
+
+	kh_foreach (r->htb, tok, val, {
+		vtok.begin = val->value;
+		vtok.len = strlen (val->value);
+		g_array_append_val (keys, tok);
+		g_array_append_val (values, vtok);
+		g_hash_table_insert (w->values, val, GSIZE_TO_POINTER (keys->len));
+	});
+
+	radix_walk_compressed (r->trie, rspamd_map_snapshot_radix_walk_cb, w);
+
+	/* Drop ranges with unknown values, they cannot be matched anyway */
+	ranges = w->ranges;
+
+	for (i = 0, j = 0; i < ranges->len; i ++) {
+		range = &g_array_index (ranges, struct rspamd_map_snapshot_range, i);
+
+		if (range->elt != G_MAXUINT64) {
+			if (i != j) {
+				g_array_index (ranges, struct rspamd_map_snapshot_range, j) = *range;
+			}
+
+			j ++;
+		}
+	}
+
+	g_array_set_size (ranges, j);
+
+	ret = rspamd_map_snapshot_save (map, path, RSPAMD_MAP_SNAPSHOT_RADIX, digest,
+			keys, values, ranges->data, ranges->len,
+			sizeof (struct rspamd_map_snapshot_range));
+
+	g_hash_table_unref (w->values);
+	g_array_free (w->ranges, TRUE);
+	g_free (w);
+	g_array_free (keys, TRUE);
+	g_array_free (values, TRUE);
+
+	return ret;
+}
+
+static struct rspamd_hash_map_helper *
+rspamd_map_helper_hash_from_snapshot (struct rspamd_map *map, const gchar *path)
+{
+	struct rspamd_hash_map_helper *ht;
+
+	ht = rspamd_map_helper_new_hash (map);
+	ht->snap = rspamd_map_snapshot_open (map, path, RSPAMD_MAP_SNAPSHOT_HASH,
+			ht->pool);
+
+	if (ht->snap == NULL) {
+		rspamd_map_helper_destroy_hash (ht);
+
+		return NULL;
+	}
+
+	kh_destroy (rspamd_map_hash, ht->htb);
+	ht->htb = NULL;
+
+	return ht;
+}
+
+static struct rspamd_radix_map_helper *
+rspamd_map_helper_radix_from_snapshot (struct rspamd_map *map, const gchar *path)
+{
+	struct rspamd_radix_map_helper *r;
+
+	r = rspamd_map_helper_new_radix (map);
+	r->snap = rspamd_map_snapshot_open (map, path, RSPAMD_MAP_SNAPSHOT_RADIX,
+			r->pool);
+
+	if (r->snap == NULL) {
+		rspamd_map_helper_destroy_radix (r);
+
+		return NULL;
+	}
+
+	kh_destroy (rspamd_map_hash, r->htb);
+	r->htb = NULL;
+
+	return r;
+}
+
+const gchar *
+rspamd_map_helper_snapshot_type (struct rspamd_map *map)
+{
+	if (map->read_callback == rspamd_kv_list_read) {
+		return "hash";
+	}
+	else if (map->read_callback == rspamd_radix_read) {
+		return "radix";
+	}
+
+	return NULL;
+}
+
+gboolean
+rspamd_map_helper_load_snapshot (struct map_cb_data *data, const gchar *path)
+{
+	struct rspamd_map *map = data->map;
+
+	if (data->cur_data != NULL) {
+		return FALSE;
+	}
+
+	if (map->read_callback == rspamd_kv_list_read) {
+		data->cur_data = rspamd_map_helper_hash_from_snapshot (map, path);
+	}
+	else if (map->read_callback == rspamd_radix_read) {
+		data->cur_data = rspamd_map_helper_radix_from_snapshot (map, path);
+	}
+
+	return data->cur_data != NULL;
+}
+
 struct rspamd_regexp_map_helper *
 rspamd_map_helper_new_regexp (struct rspamd_map *map,
 		enum rspamd_regexp_map_flags flags)
@@ -880,6 +1571,9 @@ rspamd_map_helper_destroy_regexp (struct rspamd_regexp_map_helper *re_map)
 	}
 
 #ifdef WITH_HYPERSCAN
+	if (re_map->hs_waiting) {
+		ev_timer_stop (re_map->map->event_loop, &re_map->hs_wait_ev);
+	}
 	if (re_map->hs_scratch) {
 		hs_free_scratch (re_map->hs_scratch);
 	}
@@ -954,11 +1648,41 @@ rspamd_kv_list_fin (struct map_cb_data *data, void **target)
 	else {
 		if (data->cur_data) {
 			htb = (struct rspamd_hash_map_helper *) data->cur_data;
-			msg_info_map ("read hash of %d elements from %s", kh_size(htb->htb),
-					map->name);
+
+			if (htb->snap == NULL) {
+				guint64 digest = rspamd_cryptobox_fast_hash_final (&htb->hst);
+				gchar path[PATH_MAX];
+
+				if (rspamd_map_get_snapshot_path (map, data->snapshot_key,
+						path, sizeof (path)) &&
+						rspamd_map_helper_save_hash_snapshot (htb, digest, path)) {
+					/* Replace private data with the shared image */
+					struct rspamd_hash_map_helper *nhtb =
+							rspamd_map_helper_hash_from_snapshot (map, path);
+
+					if (nhtb) {
+						rspamd_map_helper_destroy_hash (htb);
+						htb = nhtb;
+						data->cur_data = nhtb;
+					}
+				}
+
+				if (htb->snap == NULL) {
+					msg_info_map ("read hash of %d elements from %s", kh_size(htb->htb),
+							map->name);
+					data->map->nelts = kh_size (htb->htb);
+					data->map->digest = digest;
+				}
+			}
+
+			if (htb->snap) {
+				msg_info_map ("use hash snapshot of %L elements for %s",
+						htb->snap->hdr->nelts, map->name);
+				data->map->nelts = htb->snap->hdr->nelts;
+				data->map->digest = htb->snap->hdr->digest;
+			}
+
 			data->map->traverse_function = rspamd_map_helper_traverse_hash;
-			data->map->nelts = kh_size (htb->htb);
-			data->map->digest = rspamd_cryptobox_fast_hash_final(&htb->hst);
 		}
 
 		if (target) {
@@ -1026,11 +1750,42 @@ rspamd_radix_fin (struct map_cb_data *data, void **target)
 	else {
 		if (data->cur_data) {
 			r = (struct rspamd_radix_map_helper *) data->cur_data;
-			msg_info_map ("read radix trie of %z elements: %s",
-					radix_get_size(r->trie), radix_get_info(r->trie));
+
+			if (r->snap == NULL) {
+				guint64 digest = rspamd_cryptobox_fast_hash_final (&r->hst);
+				gchar path[PATH_MAX];
+
+				msg_info_map ("read radix trie of %z elements: %s",
+						radix_get_size(r->trie), radix_get_info(r->trie));
+
+				if (rspamd_map_get_snapshot_path (map, data->snapshot_key,
+						path, sizeof (path)) &&
+						rspamd_map_helper_save_radix_snapshot (r, digest, path)) {
+					/* Replace private data with the shared image */
+					struct rspamd_radix_map_helper *nr =
+							rspamd_map_helper_radix_from_snapshot (map, path);
+
+					if (nr) {
+						rspamd_map_helper_destroy_radix (r);
+						r = nr;
+						data->cur_data = nr;
+					}
+				}
+
+				if (r->snap == NULL) {
+					data->map->nelts = kh_size (r->htb);
+					data->map->digest = digest;
+				}
+			}
+
+			if (r->snap) {
+				msg_info_map ("use radix snapshot of %L elements and %L ranges for %s",
+						r->snap->hdr->nelts, r->snap->hdr->nindex, map->name);
+				data->map->nelts = r->snap->hdr->nelts;
+				data->map->digest = r->snap->hdr->digest;
+			}
+
 			data->map->traverse_function = rspamd_map_helper_traverse_radix;
-			data->map->nelts = kh_size (r->htb);
-			data->map->digest = rspamd_cryptobox_fast_hash_final(&r->hst);
 		}
 
 		if (target) {
@@ -1137,6 +1892,256 @@ rspamd_try_save_re_map_cache (struct rspamd_regexp_map_helper *re_map)
 	return FALSE;
 }
 
+/*
+ * Compilation of a regexp map is guarded by a lock file, so when many workers
+ * load the same map simultaneously only one of them compiles it, and others
+ * load the cached database afterwards (using pcre in the meantime).
+ *
+ * Returns 1 if the lock is acquired, 0 if it is held by another alive process
+ * and -1 if locking is not possible
+ */
+static gint
+rspamd_re_map_cache_lock (struct rspamd_regexp_map_helper *re_map,
+		pid_t *owner)
+{
+	gchar fp[PATH_MAX], pidbuf[32];
+	struct rspamd_map *map = re_map->map;
+	gint fd, r, attempts = 2;
+	gulong pid;
+
+	if (!map->cfg->hs_cache_dir) {
+		return -1;
+	}
+
+	rspamd_snprintf (fp, sizeof (fp), "%s/%*xs.hsmc.lock",
+			map->cfg->hs_cache_dir,
+			(gint)rspamd_cryptobox_HASHBYTES / 2, re_map->re_digest);
+
+	while (attempts --) {
+		fd = open (fp, O_WRONLY | O_CREAT | O_EXCL, 00644);
+
+		if (fd != -1) {
+			r = rspamd_snprintf (pidbuf, sizeof (pidbuf), "%P", getpid ());
+
+			if (write (fd, pidbuf, r) == -1) {
+				msg_warn_map ("cannot write lock file %s: %s", fp, strerror (errno));
+			}
+
+			close (fd);
+
+			return 1;
+		}
+
+		if (errno != EEXIST) {
+			msg_warn_map ("cannot create lock file %s: %s", fp, strerror (errno));
+
+			return -1;
+		}
+
+		fd = open (fp, O_RDONLY);
+
+		if (fd == -1) {
+			/* Removed concurrently */
+			continue;
+		}
+
+		r = read (fd, pidbuf, sizeof (pidbuf) - 1);
+		close (fd);
+
+		if (r <= 0) {
+			/* Lock has just been created and pid is not written yet */
+			*owner = 0;
+
+			return 0;
+		}
+
+		if (rspamd_strtoul (pidbuf, r, &pid) &&
+				(kill ((pid_t)pid, 0) != -1 || errno != ESRCH)) {
+			*owner = pid;
+
+			return 0;
+		}
+
+		msg_info_map ("remove stale hyperscan lock %s", fp);
+		unlink (fp);
+	}
+
+	return -1;
+}
+
+static void
+rspamd_re_map_cache_unlock (struct rspamd_regexp_map_helper *re_map)
+{
+	gchar fp[PATH_MAX];
+	struct rspamd_map *map = re_map->map;
+
+	rspamd_snprintf (fp, sizeof (fp), "%s/%*xs.hsmc.lock",
+			map->cfg->hs_cache_dir,
+			(gint)rspamd_cryptobox_HASHBYTES / 2, re_map->re_digest);
+	unlink (fp);
+}
+
+static gboolean
+rspamd_re_map_alloc_scratch (struct rspamd_regexp_map_helper *re_map)
+{
+	struct rspamd_map *map = re_map->map;
+
+	if (hs_alloc_scratch (rspamd_hyperscan_get_database(re_map->hs_db), &re_map->hs_scratch) != HS_SUCCESS) {
+		msg_err_map ("cannot allocate scratch space for hyperscan");
+		rspamd_hyperscan_free(re_map->hs_db, true);
+		re_map->hs_db = NULL;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+rspamd_re_map_compile_hs (struct rspamd_regexp_map_helper *re_map)
+{
+	hs_platform_info_t plt;
+	hs_compile_error_t *err;
+	hs_database_t *hs_db = NULL;
+	struct rspamd_map *map = re_map->map;
+	gdouble ts1;
+
+	if (hs_populate_platform (&plt) != HS_SUCCESS) {
+		msg_err_map ("cannot populate hyperscan platform");
+		return FALSE;
+	}
+
+	ts1 = rspamd_get_ticks (FALSE);
+
+	if (hs_compile_multi ((const gchar **) re_map->patterns,
+			re_map->flags,
+			re_map->ids,
+			re_map->regexps->len,
+			HS_MODE_BLOCK,
+			&plt,
+			&hs_db,
+			&err) != HS_SUCCESS) {
+
+		msg_err_map ("cannot create tree of regexp when processing '%s': %s",
+				err->expression >= 0 ?
+				re_map->patterns[err->expression] :
+				"unknown regexp", err->message);
+		re_map->hs_db = NULL;
+		hs_free_compile_error (err);
+
+		return FALSE;
+	}
+
+	if (re_map->map->cfg->hs_cache_dir) {
+		char fpath[PATH_MAX];
+		rspamd_snprintf(fpath, sizeof(fpath), "%s/%*xs.hsmc",
+			re_map->map->cfg->hs_cache_dir,
+			(gint) rspamd_cryptobox_HASHBYTES / 2, re_map->re_digest);
+		re_map->hs_db = rspamd_hyperscan_from_raw_db(hs_db, fpath);
+	}
+	else {
+		re_map->hs_db = rspamd_hyperscan_from_raw_db(hs_db, NULL);
+	}
+
+	ts1 = (rspamd_get_ticks (FALSE) - ts1) * 1000.0;
+	msg_info_map ("hyperscan compiled %d regular expressions from %s in %.1f ms",
+			re_map->regexps->len, re_map->map->name, ts1);
+	rspamd_try_save_re_map_cache (re_map);
+
+	return TRUE;
+}
+
+/* Compiles a map with locking, returns FALSE if compilation is postponed */
+static gboolean rspamd_re_map_compile_locked (struct rspamd_regexp_map_helper *re_map);
+
+#define RE_MAP_HS_WAIT_INTERVAL 0.5
+#define RE_MAP_HS_WAIT_MAX 60.0
+
+static void
+rspamd_re_map_cache_wait_cb (EV_P_ ev_timer *w, int revents)
+{
+	struct rspamd_regexp_map_helper *re_map =
+			(struct rspamd_regexp_map_helper *)w->data;
+	struct rspamd_map *map = re_map->map;
+	ev_tstamp waited = ev_now (EV_A) - re_map->hs_wait_start;
+
+	if (rspamd_try_load_re_map_cache (re_map)) {
+		ev_timer_stop (EV_A_ w);
+		re_map->hs_waiting = FALSE;
+
+		if (rspamd_re_map_alloc_scratch (re_map)) {
+			msg_info_map ("hyperscan read %d cached regular expressions from %s "
+					"compiled by another process after %.1f seconds of waiting",
+					re_map->regexps->len, map->name, waited);
+		}
+
+		return;
+	}
+
+	if (waited > RE_MAP_HS_WAIT_MAX) {
+		msg_warn_map ("hyperscan cache for %s has not been written after %.1f seconds, "
+				"compile it in this process", map->name, waited);
+		ev_timer_stop (EV_A_ w);
+		re_map->hs_waiting = FALSE;
+
+		if (rspamd_re_map_compile_hs (re_map)) {
+			rspamd_re_map_alloc_scratch (re_map);
+		}
+
+		return;
+	}
+
+	/* Lock owner might have died, so try to take it */
+	if (rspamd_re_map_compile_locked (re_map)) {
+		ev_timer_stop (EV_A_ w);
+		re_map->hs_waiting = FALSE;
+
+		if (re_map->hs_db) {
+			rspamd_re_map_alloc_scratch (re_map);
+		}
+	}
+}
+
+static gboolean
+rspamd_re_map_compile_locked (struct rspamd_regexp_map_helper *re_map)
+{
+	struct rspamd_map *map = re_map->map;
+	pid_t owner = 0;
+	gint lock_res;
+
+	lock_res = rspamd_re_map_cache_lock (re_map, &owner);
+
+	if (lock_res == 0 && map->event_loop != NULL) {
+		if (!re_map->hs_waiting) {
+			msg_info_map ("hyperscan database for %s is being compiled by process %P, "
+					"use pcre until it is ready", map->name, owner);
+			re_map->hs_wait_ev.data = re_map;
+			re_map->hs_wait_start = ev_now (map->event_loop);
+			ev_timer_init (&re_map->hs_wait_ev, rspamd_re_map_cache_wait_cb,
+					RE_MAP_HS_WAIT_INTERVAL, RE_MAP_HS_WAIT_INTERVAL);
+			ev_timer_start (map->event_loop, &re_map->hs_wait_ev);
+			re_map->hs_waiting = TRUE;
+		}
+
+		return FALSE;
+	}
+
+	/* Cache might have been written while we were checking the lock */
+	if (lock_res == 1 && rspamd_try_load_re_map_cache (re_map)) {
+		rspamd_re_map_cache_unlock (re_map);
+
+		return TRUE;
+	}
+
+	rspamd_re_map_compile_hs (re_map);
+
+	if (lock_res == 1) {
+		rspamd_re_map_cache_unlock (re_map);
+	}
+
+	return TRUE;
+}
+
 #endif
 
 static void
@@ -1145,7 +2150,6 @@ rspamd_re_map_finalize (struct rspamd_regexp_map_helper *re_map)
 #ifdef WITH_HYPERSCAN
 	guint i;
 	hs_platform_info_t plt;
-	hs_compile_error_t *err;
 	struct rspamd_map *map;
 	rspamd_regexp_t *re;
 	gint pcre_flags;
@@ -1218,55 +2222,20 @@ rspamd_re_map_finalize (struct rspamd_regexp_map_helper *re_map)
 	}
 
 	if (re_map->regexps->len > 0 && re_map->patterns) {
+		gdouble ts1 = rspamd_get_ticks (FALSE);
 
-		if (!rspamd_try_load_re_map_cache (re_map)) {
-			gdouble ts1 = rspamd_get_ticks (FALSE);
-			hs_database_t *hs_db = NULL;
-
-			if (hs_compile_multi ((const gchar **) re_map->patterns,
-					re_map->flags,
-					re_map->ids,
-					re_map->regexps->len,
-					HS_MODE_BLOCK,
-					&plt,
-					&hs_db,
-					&err) != HS_SUCCESS) {
-
-				msg_err_map ("cannot create tree of regexp when processing '%s': %s",
-						err->expression >= 0 ?
-						re_map->patterns[err->expression] :
-						"unknown regexp", err->message);
-				re_map->hs_db = NULL;
-				hs_free_compile_error (err);
-
-				return;
-			}
-
-			if (re_map->map->cfg->hs_cache_dir) {
-				char fpath[PATH_MAX];
-				rspamd_snprintf(fpath, sizeof(fpath), "%s/%*xs.hsmc",
-					re_map->map->cfg->hs_cache_dir,
-					(gint) rspamd_cryptobox_HASHBYTES / 2, re_map->re_digest);
-				re_map->hs_db = rspamd_hyperscan_from_raw_db(hs_db, fpath);
-			}
-			else {
-				re_map->hs_db = rspamd_hyperscan_from_raw_db(hs_db, NULL);
-			}
-
+		if (rspamd_try_load_re_map_cache (re_map)) {
 			ts1 = (rspamd_get_ticks (FALSE) - ts1) * 1000.0;
-			msg_info_map ("hyperscan compiled %d regular expressions from %s in %.1f ms",
+			msg_info_map ("hyperscan read %d cached regular expressions from %s in %.1f ms",
 					re_map->regexps->len, re_map->map->name, ts1);
-			rspamd_try_save_re_map_cache (re_map);
 		}
-		else {
-			msg_info_map ("hyperscan read %d cached regular expressions from %s",
-					re_map->regexps->len, re_map->map->name);
+		else if (!rspamd_re_map_compile_locked (re_map)) {
+			/* Another process compiles this map, pcre is used meanwhile */
+			return;
 		}
 
-		if (hs_alloc_scratch (rspamd_hyperscan_get_database(re_map->hs_db), &re_map->hs_scratch) != HS_SUCCESS) {
-			msg_err_map ("cannot allocate scratch space for hyperscan");
-			rspamd_hyperscan_free(re_map->hs_db, true);
-			re_map->hs_db = NULL;
+		if (re_map->hs_db) {
+			rspamd_re_map_alloc_scratch (re_map);
 		}
 	}
 	else {
@@ -1600,7 +2569,19 @@ rspamd_match_hash_map (struct rspamd_hash_map_helper *map, const gchar *in,
 	struct rspamd_map_helper_value *val;
 	rspamd_ftok_t tok;
 
-	if (map == NULL || map->htb == NULL) {
+	if (map == NULL) {
+		return NULL;
+	}
+
+	if (map->snap) {
+		const struct rspamd_map_snapshot_elt *elt;
+
+		elt = rspamd_map_snapshot_find_key (map->snap, in, len);
+
+		return elt ? RSPAMD_MAP_SNAPSHOT_STR (map->snap, elt->value_off) : NULL;
+	}
+
+	if (map->htb == NULL) {
 		return NULL;
 	}
 
@@ -1625,7 +2606,34 @@ rspamd_match_radix_map (struct rspamd_radix_map_helper *map,
 {
 	struct rspamd_map_helper_value *val;
 
-	if (map == NULL || map->trie == NULL) {
+	if (map == NULL) {
+		return NULL;
+	}
+
+	if (map->snap) {
+		const struct rspamd_map_snapshot_elt *elt;
+		guchar buf[16];
+
+		if (inlen == 4) {
+			/* Map to ipv6 as all snapshot ranges are ipv6 */
+			memset (buf, 0, 10);
+			buf[10] = 0xffu;
+			buf[11] = 0xffu;
+			memcpy (buf + 12, in, inlen);
+		}
+		else if (inlen == sizeof (buf)) {
+			memcpy (buf, in, inlen);
+		}
+		else {
+			return NULL;
+		}
+
+		elt = rspamd_map_snapshot_find_addr (map->snap, buf);
+
+		return elt ? RSPAMD_MAP_SNAPSHOT_STR (map->snap, elt->value_off) : NULL;
+	}
+
+	if (map->trie == NULL) {
 		return NULL;
 	}
 
@@ -1647,7 +2655,24 @@ rspamd_match_radix_map_addr (struct rspamd_radix_map_helper *map,
 {
 	struct rspamd_map_helper_value *val;
 
-	if (map == NULL || map->trie == NULL) {
+	if (map == NULL) {
+		return NULL;
+	}
+
+	if (map->snap) {
+		const guchar *key;
+		guint klen = 0;
+
+		if (addr == NULL) {
+			return NULL;
+		}
+
+		key = rspamd_inet_address_get_hash_key (addr, &klen);
+
+		return key ? rspamd_match_radix_map (map, key, klen) : NULL;
+	}
+
+	if (map->trie == NULL) {
 		return NULL;
 	}
 
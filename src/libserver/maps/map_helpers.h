@@ -120,6 +120,22 @@ void rspamd_regexp_list_fin (struct map_cb_data *data, void **target);
 
 void rspamd_regexp_list_dtor (struct map_cb_data *data);
 
+/**
+ * Returns snapshot type name ("hash" or "radix") if data of the specified map
+ * can be stored as a flat read-only snapshot shared between processes,
+ * NULL otherwise
+ */
+const gchar *rspamd_map_helper_snapshot_type (struct rspamd_map *map);
+
+/**
+ * Loads map data from a snapshot file into `data->cur_data` instead of parsing
+ * @param data
+ * @param path
+ * @return TRUE if snapshot has been loaded
+ */
+gboolean rspamd_map_helper_load_snapshot (struct map_cb_data *data,
+										  const gchar *path);
+
 /**
  * FSM for lists parsing (support comments, blank lines and partial replies)
  */
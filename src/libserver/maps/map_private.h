@@ -219,6 +219,18 @@ struct http_callback_data {
 	ref_entry_t ref;
 };
 
+/**
+ * Fills `buf` with the path of a map snapshot for the specified key,
+ * returns FALSE if snapshots cannot be stored
+ */
+gboolean rspamd_map_get_snapshot_path (struct rspamd_map *map, guint64 key,
+									   gchar *buf, gsize buflen);
+
+/**
+ * Removes snapshots of the same map except the one stored in `path`
+ */
+void rspamd_map_cleanup_snapshots (struct rspamd_map *map, const gchar *path);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -1653,13 +1653,30 @@ rspamd_protocol_http_reply (struct rspamd_http_message *msg,
 		msg_notice_task (
 				"regexp statistics: %ud pcre regexps scanned, %ud regexps matched,"
 				" %ud regexps total, %ud regexps cached,"
-				" %HL scanned using pcre, %HL scanned total",
+				" %HL scanned using pcre, %HL scanned total,"
+				" %ud of %ud regexp classes scanned",
 				restat->regexp_checked,
 				restat->regexp_matched,
 				restat->regexp_total,
 				restat->regexp_fast_cached,
 				restat->bytes_scanned_pcre,
-				restat->bytes_scanned);
+				restat->bytes_scanned,
+				restat->classes_scanned,
+				restat->classes_total);
+
+		for (guint i = 0; i < restat->classes_total; i ++) {
+			const struct rspamd_re_cache_class_stat *cst = &restat->classes[i];
+
+			if (cst->scans > 1) {
+				/* Classes with several passes are the candidates for batching */
+				msg_notice_task ("regexp class %s(%*s): %ud passes, %HL scanned",
+						rspamd_re_cache_type_to_string (cst->type),
+						(gint)cst->type_len,
+						cst->type_data ? (const gchar *)cst->type_data : "",
+						cst->scans,
+						cst->bytes_scanned);
+			}
+		}
 	}
 
 	reply = rspamd_fstring_sized_new (1000);
@@ -1896,7 +1913,7 @@ rspamd_protocol_write_log_pipe (struct rspamd_task *task)
 				if (lua_isfunction (L, -1)) {
 					ptask = lua_newuserdata (L, sizeof (*ptask));
 					*ptask = task;
-					rspamd_lua_setclass (L, "rspamd{task}", -1);
+					rspamd_lua_setclass (L, rspamd_task_classname, -1);
 					/* stack:
 					 * -1: task
 					 * -2: func
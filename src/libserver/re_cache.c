@@ -84,6 +84,7 @@ static const guchar rspamd_hs_magic[] = {'r', 's', 'h', 's', 'r', 'e', '1', '1'}
 
 struct rspamd_re_class {
 	guint64 id;
+	guint idx; /* position of the class in the runtime class arrays */
 	enum rspamd_re_type type;
 	gboolean has_utf8; /* if there are any utf8 regexps */
 	gpointer type_data;
@@ -122,12 +123,14 @@ struct rspamd_re_cache {
 	khash_t (lua_selectors_hash) *selectors;
 	ref_entry_t ref;
 	guint nre;
+	guint nclasses;
 	guint max_re_data;
 	gchar hash[rspamd_cryptobox_HASHBYTES + 1];
 	lua_State *L;
 #ifdef WITH_HYPERSCAN
 	enum rspamd_hyperscan_status hyperscan_loaded;
 	gboolean disable_hyperscan;
+	gboolean batch_hyperscan;
 	hs_platform_info_t plt;
 #endif
 };
@@ -144,6 +147,7 @@ KHASH_INIT (selectors_results_hash, int, struct rspamd_re_selector_result, 1,
 struct rspamd_re_runtime {
 	guchar *checked;
 	guchar *results;
+	guchar *classes_scanned;
 	khash_t (selectors_results_hash) *sel_cache;
 	struct rspamd_re_cache *cache;
 	struct rspamd_re_cache_stat stat;
@@ -291,6 +295,7 @@ rspamd_re_cache_add (struct rspamd_re_cache *cache,
 	if (re_class == NULL) {
 		re_class = g_malloc0 (sizeof (*re_class));
 		re_class->id = class_id;
+		re_class->idx = cache->nclasses ++;
 		re_class->type_len = datalen;
 		re_class->type = type;
 		re_class->re = g_hash_table_new_full (rspamd_regexp_hash,
@@ -482,6 +487,7 @@ rspamd_re_cache_init (struct rspamd_re_cache *cache, struct rspamd_config *cfg)
 	rspamd_fstring_t *features = rspamd_fstring_new ();
 
 	cache->disable_hyperscan = cfg->disable_hyperscan;
+	cache->batch_hyperscan = cfg->batch_hyperscan;
 
 	g_assert (hs_populate_platform (&cache->plt) == HS_SUCCESS);
 
@@ -522,12 +528,16 @@ rspamd_re_cache_runtime_new (struct rspamd_re_cache *cache)
 	struct rspamd_re_runtime *rt;
 	g_assert (cache != NULL);
 
-	rt = g_malloc0 (sizeof (*rt) + NBYTES (cache->nre) + cache->nre);
+	rt = g_malloc0 (sizeof (*rt) + NBYTES (cache->nre) + cache->nre +
+			NBYTES (cache->nclasses));
 	rt->cache = cache;
 	REF_RETAIN (cache);
 	rt->checked = ((guchar *)rt) + sizeof (*rt);
 	rt->results = rt->checked + NBYTES (cache->nre);
+	rt->classes_scanned = rt->results + cache->nre;
 	rt->stat.regexp_total = cache->nre;
+	rt->stat.classes_total = cache->nclasses;
+	rt->stat.classes = g_malloc0 (sizeof (*rt->stat.classes) * MAX (cache->nclasses, 1));
 #ifdef WITH_HYPERSCAN
 	rt->has_hs = cache->hyperscan_loaded;
 #endif
@@ -564,7 +574,7 @@ rspamd_re_cache_check_lua_condition (struct rspamd_task *task,
 
 	if (!rspamd_lua_universal_pcall (L, lua_cbref,
 			G_STRLOC, 1, "utii", &err,
-			"rspamd{task}", task,
+			rspamd_task_classname, task,
 			text_pos, start, end)) {
 		msg_warn_task ("cannot call for re_cache_check_lua_condition for re %s: %e",
 				rspamd_regexp_get_pattern (re), err);
@@ -728,6 +738,52 @@ rspamd_re_cache_hyperscan_cb (unsigned int id,
 }
 #endif
 
+static inline struct rspamd_re_cache_class_stat *
+rspamd_re_cache_get_class_stat (struct rspamd_re_runtime *rt,
+		struct rspamd_re_class *re_class)
+{
+	struct rspamd_re_cache_class_stat *cst;
+
+	if (re_class->idx >= rt->stat.classes_total) {
+		/* Class has been added after this runtime has been created */
+		return NULL;
+	}
+
+	cst = &rt->stat.classes[re_class->idx];
+
+	if (cst->scans == 0 && cst->bytes_scanned == 0) {
+		cst->type = re_class->type;
+		cst->type_data = re_class->type_data;
+		cst->type_len = re_class->type_len;
+	}
+
+	return cst;
+}
+
+static void
+rspamd_re_cache_update_class_stat (struct rspamd_re_runtime *rt,
+		struct rspamd_re_class *re_class,
+		const guint *lens,
+		guint count)
+{
+	struct rspamd_re_cache_class_stat *cst;
+	guint i;
+
+	cst = rspamd_re_cache_get_class_stat (rt, re_class);
+
+	if (cst) {
+		if (cst->scans == 0) {
+			rt->stat.classes_scanned ++;
+		}
+
+		cst->scans ++;
+
+		for (i = 0; i < count; i ++) {
+			cst->bytes_scanned += lens[i];
+		}
+	}
+}
+
 static guint
 rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 		rspamd_regexp_t *re, struct rspamd_task *task,
@@ -741,6 +797,7 @@ rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 	guint ret = 0;
 	guint i;
 	struct rspamd_re_cache_elt *cache_elt;
+	struct rspamd_re_class *re_class;
 
 	re_id = rspamd_regexp_get_cache_id (re);
 
@@ -752,6 +809,7 @@ rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 	}
 
 	cache_elt = (struct rspamd_re_cache_elt *)g_ptr_array_index (rt->cache->re, re_id);
+	re_class = rspamd_regexp_get_class (re);
 
 #ifndef WITH_HYPERSCAN
 	for (i = 0; i < count; i++) {
@@ -765,29 +823,30 @@ rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 		rt->results[re_id] = ret;
 	}
 
+	rspamd_re_cache_update_class_stat (rt, re_class, lens, count);
 	setbit (rt->checked, re_id);
 #else
-	struct rspamd_re_class *re_class;
 	struct rspamd_re_hyperscan_cbdata cbdata;
+	gboolean use_hyperscan, scan_class;
 
-	cache_elt = g_ptr_array_index (rt->cache->re, re_id);
-	re_class = rspamd_regexp_get_class (re);
+	use_hyperscan = !rt->cache->disable_hyperscan && rt->has_hs &&
+			re_class->hs_db != NULL && !(is_raw && re_class->has_utf8);
 
-	if (rt->cache->disable_hyperscan || cache_elt->match_type == RSPAMD_RE_CACHE_PCRE ||
-			!rt->has_hs || (is_raw && re_class->has_utf8)) {
-		for (i = 0; i < count; i++) {
-			ret = rspamd_re_cache_process_pcre (rt,
-					re,
-					task,
-					in[i],
-					lens[i],
-					is_raw,
-					cache_elt->lua_cbref);
-		}
-
-		setbit (rt->checked, re_id);
+	if (cache_elt->match_type != RSPAMD_RE_CACHE_PCRE) {
+		scan_class = use_hyperscan;
 	}
 	else {
+		/*
+		 * In batch mode we resolve all hyperscan regexps of the class using
+		 * the inputs we have already collected for this pcre only regexp,
+		 * so the class is scanned exactly once per task
+		 */
+		scan_class = use_hyperscan && rt->cache->batch_hyperscan &&
+				re_class->idx < rt->stat.classes_total &&
+				!isset (rt->classes_scanned, re_class->idx);
+	}
+
+	if (scan_class) {
 		for (i = 0; i < count; i ++) {
 			/* For Hyperscan we can probably safely disable all those limits */
 #if 0
@@ -799,7 +858,7 @@ rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 		}
 
 		g_assert (re_class->hs_scratch != NULL);
-		g_assert (re_class->hs_db != NULL);
+		rspamd_re_cache_update_class_stat (rt, re_class, lens, count);
 
 		/* Go through hyperscan API */
 		for (i = 0; i < count; i++) {
@@ -822,6 +881,24 @@ rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 			}
 		}
 	}
+
+	if (cache_elt->match_type == RSPAMD_RE_CACHE_PCRE || !use_hyperscan) {
+		for (i = 0; i < count; i++) {
+			ret = rspamd_re_cache_process_pcre (rt,
+					re,
+					task,
+					in[i],
+					lens[i],
+					is_raw,
+					cache_elt->lua_cbref);
+		}
+
+		if (!scan_class) {
+			rspamd_re_cache_update_class_stat (rt, re_class, lens, count);
+		}
+
+		setbit (rt->checked, re_id);
+	}
 #endif
 
 	return ret;
@@ -852,6 +929,10 @@ rspamd_re_cache_finish_class (struct rspamd_task *task,
 		}
 	}
 
+	if (re_class->idx < rt->stat.classes_total) {
+		setbit (rt->classes_scanned, re_class->idx);
+	}
+
 	msg_debug_re_task ("finished hyperscan for class %s; %d "
 					   "matches found; %d hyperscan supported regexps; %d total regexps",
 			class_name, found, re_class->nhs, (gint)g_hash_table_size (re_class->re));
@@ -910,7 +991,7 @@ rspamd_re_cache_process_selector (struct rspamd_task *task,
 	lua_rawgeti (L, LUA_REGISTRYINDEX, ref);
 	ptask = lua_newuserdata (L, sizeof (*ptask));
 	*ptask = task;
-	rspamd_lua_setclass (L, "rspamd{task}", -1);
+	rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 	if ((ret = lua_pcall (L, 1, 1, err_idx)) != 0) {
 		msg_err_task ("call to selector %s "
@@ -1567,6 +1648,7 @@ rspamd_re_cache_runtime_destroy (struct rspamd_re_runtime *rt)
 		kh_destroy (selectors_results_hash, rt->sel_cache);
 	}
 
+	g_free (rt->stat.classes);
 	REF_RELEASE (rt->cache);
 	g_free (rt);
 }
@@ -47,6 +47,14 @@ enum rspamd_re_type {
 	RSPAMD_RE_MAX
 };
 
+struct rspamd_re_cache_class_stat {
+	enum rspamd_re_type type;
+	gconstpointer type_data;
+	gsize type_len;
+	guint64 bytes_scanned; /* bytes fed to hyperscan and pcre for this class */
+	guint scans; /* number of passes over the class inputs */
+};
+
 struct rspamd_re_cache_stat {
 	guint64 bytes_scanned;
 	guint64 bytes_scanned_pcre;
@@ -54,6 +62,9 @@ struct rspamd_re_cache_stat {
 	guint regexp_matched;
 	guint regexp_total;
 	guint regexp_fast_cached;
+	guint classes_total;
+	guint classes_scanned;
+	struct rspamd_re_cache_class_stat *classes; /* indexed by class, classes_total elements */
 };
 
 /**
@@ -19,8 +19,772 @@
 #include "lua/lua_common.h"
 #include "unix-std.h"
 #include "cfg_file_private.h"
+#include "cryptobox.h"
+
+#include <math.h>
 
 static const gchar rspamd_history_magic_old[] = {'r', 's', 'h', '1'};
+static const gchar rspamd_history_magic[] = {'r', 's', 'h', '2'};
+
+#define HISTORY_FILE_VERSION 1
+#define HISTORY_SYMBOLS_HASH_SIZE (HISTORY_MAX_SYMBOL_NAMES * 2)
+#define HISTORY_ALIGN(x) (((x) + 7) & ~((gsize)7))
+/* Symbol ids are persisted, so the hash must not depend on a run */
+static const guint64 rspamd_history_hash_seed = 0xdeadbabeULL;
+
+struct roll_history_header {
+	gchar magic[4];
+	guint32 version;
+	guint32 nrows;
+	guint32 next_row; /* Monotonic counter of written rows */
+	guint32 nsymbols;
+	guint32 gc_row;   /* Value of next_row when symbols were reclaimed */
+	guint32 unused[2];
+};
+
+/*
+ * Assigns columns of history to the storage at `base`, if `base` is NULL then
+ * just calculates the required storage size
+ */
+static gsize
+rspamd_roll_history_layout (struct roll_history *history, guchar *base,
+		guint nrows)
+{
+	gsize off = 0;
+
+#define HISTORY_COLUMN(field, type, n) do { \
+	if (base != NULL) { \
+		history->field = (type *)(base + off); \
+	} \
+	off += HISTORY_ALIGN (sizeof (type) * (gsize)(n)); \
+} while (0)
+
+	HISTORY_COLUMN (hdr, struct roll_history_header, 1);
+	HISTORY_COLUMN (timestamps, ev_tstamp, nrows);
+	HISTORY_COLUMN (scores, gdouble, nrows);
+	HISTORY_COLUMN (required_scores, gdouble, nrows);
+	HISTORY_COLUMN (scan_times, gdouble, nrows);
+	HISTORY_COLUMN (lens, guint32, nrows);
+	HISTORY_COLUMN (seqs, guint32, nrows);
+	HISTORY_COLUMN (actions, guint8, nrows);
+	HISTORY_COLUMN (nsymbols, guint8, nrows);
+	HISTORY_COLUMN (symbols, guint16, nrows * HISTORY_MAX_ROW_SYMBOLS);
+	HISTORY_COLUMN (message_ids, gchar, nrows * HISTORY_MAX_ID);
+	HISTORY_COLUMN (users, gchar, nrows * HISTORY_MAX_USER);
+	HISTORY_COLUMN (from_addrs, gchar, nrows * HISTORY_MAX_ADDR);
+	HISTORY_COLUMN (symbol_names, gchar,
+			HISTORY_MAX_SYMBOL_NAMES * HISTORY_MAX_SYMBOL_NAME);
+	HISTORY_COLUMN (symbol_hash, guint32, HISTORY_SYMBOLS_HASH_SIZE);
+
+#undef HISTORY_COLUMN
+
+	return off;
+}
+
+static void
+rspamd_roll_history_init_storage (struct roll_history *history, guchar *base)
+{
+	struct roll_history_header *hdr = (struct roll_history_header *)base;
+
+	memset (hdr, 0, sizeof (*hdr));
+	memcpy (hdr->magic, rspamd_history_magic, sizeof (hdr->magic));
+	hdr->version = HISTORY_FILE_VERSION;
+	hdr->nrows = history->nrows;
+	rspamd_roll_history_layout (history, base, history->nrows);
+}
+
+/*
+ * Storage mapped from file is not trusted: symbols counter and hash ids are
+ * clamped and names are terminated, so lookups never read past the table
+ */
+static void
+rspamd_roll_history_check_storage (struct roll_history *history)
+{
+	struct roll_history_header *hdr = history->hdr;
+	guint i, nsymbols;
+
+	if (hdr->nsymbols > HISTORY_MAX_SYMBOL_NAMES) {
+		msg_warn ("invalid number of history symbols: %ud, truncate it to %d",
+				hdr->nsymbols, HISTORY_MAX_SYMBOL_NAMES);
+		hdr->nsymbols = HISTORY_MAX_SYMBOL_NAMES;
+	}
+
+	nsymbols = hdr->nsymbols;
+
+	for (i = 0; i < nsymbols; i ++) {
+		history->symbol_names[(i + 1) * HISTORY_MAX_SYMBOL_NAME - 1] = '\0';
+	}
+
+	for (i = 0; i < HISTORY_SYMBOLS_HASH_SIZE; i ++) {
+		if (history->symbol_hash[i] > nsymbols) {
+			history->symbol_hash[i] = 0;
+		}
+	}
+}
+
+/*
+ * Returns symbol id or -1, if `empty_slot` is not NULL it is set to the
+ * hash slot where a missing symbol should be inserted
+ */
+static gint
+rspamd_roll_history_find_symbol (struct roll_history *history,
+		const gchar *name, gsize len, guint *empty_slot)
+{
+	guint slot, i, id;
+	const gchar *stored;
+
+	slot = rspamd_cryptobox_fast_hash (name, len, rspamd_history_hash_seed) %
+			HISTORY_SYMBOLS_HASH_SIZE;
+
+	for (i = 0; i < HISTORY_SYMBOLS_HASH_SIZE; i ++) {
+		id = g_atomic_int_get (&history->symbol_hash[slot]);
+
+		if (id == 0) {
+			if (empty_slot) {
+				*empty_slot = slot;
+			}
+
+			return -1;
+		}
+
+		if (id > HISTORY_MAX_SYMBOL_NAMES) {
+			/* Garbage in the shared table, never dereference it */
+			slot = (slot + 1) % HISTORY_SYMBOLS_HASH_SIZE;
+			continue;
+		}
+
+		stored = history->symbol_names + (id - 1) * HISTORY_MAX_SYMBOL_NAME;
+
+		if (memcmp (stored, name, len) == 0 && stored[len] == '\0') {
+			return id - 1;
+		}
+
+		slot = (slot + 1) % HISTORY_SYMBOLS_HASH_SIZE;
+	}
+
+	return -1;
+}
+
+/*
+ * Frees names that are not referenced by any row nor by the `pending` one
+ * and rebuilds the hash of the remaining ones, must be called with the
+ * symbols lock held. Freed names are emptied, so their ids are reused by the
+ * new symbols.
+ *
+ * Lookups running meanwhile may miss a symbol, and a row that is being
+ * written by another process with a just freed id can show a wrong name:
+ * both are harmless for history and much better than dropping all new
+ * symbols forever.
+ */
+static guint
+rspamd_roll_history_reclaim_symbols (struct roll_history *history,
+		const struct roll_history_row *pending)
+{
+	guint8 *used;
+	const guint16 *syms;
+	gchar *name;
+	guint i, j, nsyms, slot, freed = 0;
+
+	used = g_malloc0 (HISTORY_MAX_SYMBOL_NAMES);
+
+	for (i = 0; pending && i < pending->nsymbols; i ++) {
+		if (pending->symbols[i] < HISTORY_MAX_SYMBOL_NAMES) {
+			used[pending->symbols[i]] = 1;
+		}
+	}
+
+	for (i = 0; i < history->nrows; i ++) {
+		if (g_atomic_int_get (&history->seqs[i]) == 0) {
+			continue;
+		}
+
+		syms = history->symbols + i * HISTORY_MAX_ROW_SYMBOLS;
+		nsyms = MIN (history->nsymbols[i], HISTORY_MAX_ROW_SYMBOLS);
+
+		for (j = 0; j < nsyms; j ++) {
+			if (syms[j] < HISTORY_MAX_SYMBOL_NAMES) {
+				used[syms[j]] = 1;
+			}
+		}
+	}
+
+	for (i = 0; i < HISTORY_SYMBOLS_HASH_SIZE; i ++) {
+		g_atomic_int_set (&history->symbol_hash[i], 0);
+	}
+
+	for (i = 0; i < history->hdr->nsymbols; i ++) {
+		name = history->symbol_names + i * HISTORY_MAX_SYMBOL_NAME;
+
+		if (name[0] == '\0') {
+			continue;
+		}
+
+		if (!used[i]) {
+			name[0] = '\0';
+			freed ++;
+			continue;
+		}
+
+		slot = G_MAXUINT;
+
+		if (rspamd_roll_history_find_symbol (history, name, strlen (name),
+				&slot) < 0 && slot != G_MAXUINT) {
+			g_atomic_int_set (&history->symbol_hash[slot], i + 1);
+		}
+	}
+
+	history->hdr->gc_row = history->hdr->next_row;
+	g_free (used);
+
+	return freed;
+}
+
+/* Returns id for a new name or -1, must be called with the symbols lock held */
+static gint
+rspamd_roll_history_alloc_symbol (struct roll_history *history)
+{
+	guint i;
+
+	if (history->hdr->nsymbols < HISTORY_MAX_SYMBOL_NAMES) {
+		return history->hdr->nsymbols ++;
+	}
+
+	for (i = 0; i < HISTORY_MAX_SYMBOL_NAMES; i ++) {
+		if (history->symbol_names[i * HISTORY_MAX_SYMBOL_NAME] == '\0') {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Lookups are lock free, the shared lock is taken only to add a new name,
+ * `pending` is the row being filled, its symbols are never reclaimed
+ */
+static gint
+rspamd_roll_history_intern_symbol (struct roll_history *history,
+		const gchar *name, const struct roll_history_row *pending)
+{
+	gsize len;
+	gint id;
+	guint slot = G_MAXUINT;
+
+	len = MIN (strlen (name), HISTORY_MAX_SYMBOL_NAME - 1);
+
+	if (len == 0) {
+		return -1;
+	}
+
+	id = rspamd_roll_history_find_symbol (history, name, len, NULL);
+
+	if (id >= 0) {
+		return id;
+	}
+
+	rspamd_mempool_lock_mutex (history->symbols_lock);
+	id = rspamd_roll_history_find_symbol (history, name, len, &slot);
+
+	if (id < 0 && slot != G_MAXUINT) {
+		id = rspamd_roll_history_alloc_symbol (history);
+
+		/*
+		 * Table is full, reclaim names of the overwritten rows but no more
+		 * than once per a whole ring of rows
+		 */
+		if (id < 0 && history->hdr->next_row - history->hdr->gc_row >=
+				history->nrows) {
+			if (rspamd_roll_history_reclaim_symbols (history, pending) > 0) {
+				msg_info ("reclaimed unused history symbols");
+				slot = G_MAXUINT;
+				rspamd_roll_history_find_symbol (history, name, len, &slot);
+				id = rspamd_roll_history_alloc_symbol (history);
+			}
+		}
+
+		if (id >= 0 && slot != G_MAXUINT) {
+			rspamd_strlcpy (history->symbol_names + id * HISTORY_MAX_SYMBOL_NAME,
+					name, len + 1);
+			/* Publish the name only after it has been written */
+			g_atomic_int_set (&history->symbol_hash[slot], id + 1);
+		}
+		else {
+			id = -1;
+		}
+	}
+
+	rspamd_mempool_unlock_mutex (history->symbols_lock);
+
+	return id;
+}
+
+const gchar *
+rspamd_roll_history_symbol_name (struct roll_history *history, guint id)
+{
+	const gchar *name;
+
+	if (history->disabled || id >= HISTORY_MAX_SYMBOL_NAMES ||
+			id >= (guint)g_atomic_int_get (&history->hdr->nsymbols)) {
+		return NULL;
+	}
+
+	name = history->symbol_names + id * HISTORY_MAX_SYMBOL_NAME;
+
+	/* Reclaimed name */
+	return name[0] != '\0' ? name : NULL;
+}
+
+static void
+rspamd_roll_history_append (struct roll_history *history,
+		const struct roll_history_row *row)
+{
+	guint32 seq, idx;
+
+	/* First of all obtain row number */
+#if ((GLIB_MAJOR_VERSION == 2) && (GLIB_MINOR_VERSION > 30))
+	seq = g_atomic_int_add (&history->hdr->next_row, 1);
+#else
+	seq = g_atomic_int_exchange_and_add (&history->hdr->next_row, 1);
+#endif
+	idx = seq % history->nrows;
+	seq ++;
+
+	if (seq == 0) {
+		/* Counter wrap */
+		seq = 1;
+	}
+
+	g_atomic_int_set (&history->seqs[idx], 0);
+
+	history->timestamps[idx] = row->timestamp;
+	history->scores[idx] = row->score;
+	history->required_scores[idx] = row->required_score;
+	history->scan_times[idx] = row->scan_time;
+	history->lens[idx] = MIN (row->len, G_MAXUINT32);
+	history->actions[idx] = row->action;
+	history->nsymbols[idx] = MIN (row->nsymbols, HISTORY_MAX_ROW_SYMBOLS);
+	memcpy (history->symbols + idx * HISTORY_MAX_ROW_SYMBOLS, row->symbols,
+			history->nsymbols[idx] * sizeof (row->symbols[0]));
+	rspamd_strlcpy (history->message_ids + idx * HISTORY_MAX_ID,
+			row->message_id, HISTORY_MAX_ID);
+	rspamd_strlcpy (history->users + idx * HISTORY_MAX_USER,
+			row->user, HISTORY_MAX_USER);
+	rspamd_strlcpy (history->from_addrs + idx * HISTORY_MAX_ADDR,
+			row->from_addr, HISTORY_MAX_ADDR);
+
+	g_atomic_int_set (&history->seqs[idx], seq);
+}
+
+/*
+ * Copies row from columns, returns FALSE if row is empty or has been
+ * overwritten while being copied
+ */
+static gboolean
+rspamd_roll_history_read_row (struct roll_history *history, guint idx,
+		struct roll_history_row *row)
+{
+	guint32 seq;
+
+	seq = g_atomic_int_get (&history->seqs[idx]);
+
+	if (seq == 0) {
+		return FALSE;
+	}
+
+	row->timestamp = history->timestamps[idx];
+	row->score = history->scores[idx];
+	row->required_score = history->required_scores[idx];
+	row->scan_time = history->scan_times[idx];
+	row->len = history->lens[idx];
+	row->action = history->actions[idx];
+	row->nsymbols = MIN (history->nsymbols[idx], HISTORY_MAX_ROW_SYMBOLS);
+	memcpy (row->symbols, history->symbols + idx * HISTORY_MAX_ROW_SYMBOLS,
+			row->nsymbols * sizeof (row->symbols[0]));
+	rspamd_strlcpy (row->message_id, history->message_ids + idx * HISTORY_MAX_ID,
+			sizeof (row->message_id));
+	rspamd_strlcpy (row->user, history->users + idx * HISTORY_MAX_USER,
+			sizeof (row->user));
+	rspamd_strlcpy (row->from_addr, history->from_addrs + idx * HISTORY_MAX_ADDR,
+			sizeof (row->from_addr));
+
+	return g_atomic_int_get (&history->seqs[idx]) == seq;
+}
+
+/* Copies rows from the oldest to the newest remapping symbol ids */
+static void
+rspamd_roll_history_copy (struct roll_history *dst, struct roll_history *src)
+{
+	struct roll_history_row row;
+	const gchar *name;
+	guint i, j, start, nsyms;
+	gint id;
+
+	start = src->hdr->next_row % src->nrows;
+
+	for (i = 0; i < src->nrows; i ++) {
+		if (!rspamd_roll_history_read_row (src, (start + i) % src->nrows, &row)) {
+			continue;
+		}
+
+		for (j = 0, nsyms = 0; j < row.nsymbols; j ++) {
+			name = rspamd_roll_history_symbol_name (src, row.symbols[j]);
+
+			if (name && (id = rspamd_roll_history_intern_symbol (dst, name, &row)) >= 0) {
+				row.symbols[nsyms++] = id;
+			}
+		}
+
+		row.nsymbols = nsyms;
+		rspamd_roll_history_append (dst, &row);
+	}
+}
+
+static ucl_object_t *
+rspamd_roll_history_read_legacy (const gchar *filename)
+{
+	gint fd;
+	gchar magic[sizeof(rspamd_history_magic_old)];
+	ucl_object_t *top;
+	struct ucl_parser *parser;
+
+	if ((fd = open (filename, O_RDONLY)) == -1) {
+		msg_info ("cannot load history from %s: %s", filename,
+			strerror (errno));
+		return NULL;
+	}
+
+	/* Check for old format */
+	if (read (fd, magic, sizeof (magic)) == -1) {
+		close (fd);
+		msg_info ("cannot read history from %s: %s", filename,
+				strerror (errno));
+		return NULL;
+	}
+
+	if (memcmp (magic, rspamd_history_magic_old, sizeof (magic)) == 0) {
+		close (fd);
+		msg_warn ("cannot read history from old format %s, "
+				"it will be replaced after restart", filename);
+		return NULL;
+	}
+
+	if (lseek (fd, 0, SEEK_SET) == -1) {
+		close (fd);
+		msg_info ("cannot read history from %s: %s", filename,
+				strerror (errno));
+		return NULL;
+	}
+
+	parser = ucl_parser_new (0);
+
+	if (!ucl_parser_add_fd (parser, fd)) {
+		msg_warn ("cannot parse history file %s: %s", filename,
+				ucl_parser_get_error (parser));
+		ucl_parser_free (parser);
+		close (fd);
+
+		return NULL;
+	}
+
+	top = ucl_parser_get_object (parser);
+	ucl_parser_free (parser);
+	close (fd);
+
+	if (top == NULL) {
+		msg_warn ("cannot parse history file %s: no object", filename);
+
+		return NULL;
+	}
+
+	if (ucl_object_type (top) != UCL_ARRAY) {
+		msg_warn ("invalid object type read from: %s", filename);
+		ucl_object_unref (top);
+
+		return NULL;
+	}
+
+	return top;
+}
+
+struct roll_history_import_row {
+	struct roll_history_row row;
+	const gchar *symbols;
+};
+
+static gint
+rspamd_roll_history_row_cmp (gconstpointer a, gconstpointer b)
+{
+	const struct roll_history_import_row *r1 = a, *r2 = b;
+
+	if (r1->row.timestamp < r2->row.timestamp) {
+		return -1;
+	}
+	else if (r1->row.timestamp > r2->row.timestamp) {
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Symbols are interned just before row is appended, so they cannot be reclaimed */
+static void
+rspamd_roll_history_import_row (struct roll_history *history,
+		struct roll_history_import_row *irow)
+{
+	struct roll_history_row *row = &irow->row;
+	gchar **syms;
+	guint j;
+	gint id;
+
+	if (irow->symbols) {
+		syms = g_strsplit_set (irow->symbols, ", ", -1);
+
+		for (j = 0; syms[j] != NULL &&
+				row->nsymbols < G_N_ELEMENTS (row->symbols); j ++) {
+			g_strstrip (syms[j]);
+
+			if (syms[j][0] == '\0') {
+				continue;
+			}
+
+			id = rspamd_roll_history_intern_symbol (history, syms[j], row);
+
+			if (id >= 0) {
+				row->symbols[row->nsymbols++] = id;
+			}
+		}
+
+		g_strfreev (syms);
+	}
+
+	rspamd_roll_history_append (history, row);
+}
+
+/* Imports json rows written by the previous versions */
+static void
+rspamd_roll_history_import_ucl (struct roll_history *history,
+		const ucl_object_t *top)
+{
+	const ucl_object_t *cur, *elt;
+	struct roll_history_import_row irow;
+	struct roll_history_row *row = &irow.row;
+	GArray *rows;
+	guint i, n;
+
+	rows = g_array_sized_new (FALSE, FALSE, sizeof (irow), top->len);
+
+	for (i = 0; i < top->len; i ++) {
+		cur = ucl_array_find_index (top, i);
+
+		if (cur == NULL || ucl_object_type (cur) != UCL_OBJECT) {
+			continue;
+		}
+
+		memset (&irow, 0, sizeof (irow));
+
+		elt = ucl_object_lookup (cur, "time");
+
+		if (elt && ucl_object_type (elt) == UCL_FLOAT) {
+			row->timestamp = ucl_object_todouble (elt);
+		}
+
+		elt = ucl_object_lookup (cur, "id");
+
+		if (elt && ucl_object_type (elt) == UCL_STRING) {
+			rspamd_strlcpy (row->message_id, ucl_object_tostring (elt),
+					sizeof (row->message_id));
+		}
+
+		elt = ucl_object_lookup (cur, "symbols");
+
+		if (elt && ucl_object_type (elt) == UCL_STRING) {
+			irow.symbols = ucl_object_tostring (elt);
+		}
+
+		elt = ucl_object_lookup (cur, "user");
+
+		if (elt && ucl_object_type (elt) == UCL_STRING) {
+			rspamd_strlcpy (row->user, ucl_object_tostring (elt),
+					sizeof (row->user));
+		}
+
+		elt = ucl_object_lookup (cur, "from");
+
+		if (elt && ucl_object_type (elt) == UCL_STRING) {
+			rspamd_strlcpy (row->from_addr, ucl_object_tostring (elt),
+					sizeof (row->from_addr));
+		}
+
+		elt = ucl_object_lookup (cur, "len");
+
+		if (elt && ucl_object_type (elt) == UCL_INT) {
+			row->len = ucl_object_toint (elt);
+		}
+
+		elt = ucl_object_lookup (cur, "scan_time");
+
+		if (elt && ucl_object_type (elt) == UCL_FLOAT) {
+			row->scan_time = ucl_object_todouble (elt);
+		}
+
+		elt = ucl_object_lookup (cur, "score");
+
+		if (elt && ucl_object_type (elt) == UCL_FLOAT) {
+			row->score = ucl_object_todouble (elt);
+		}
+
+		elt = ucl_object_lookup (cur, "required_score");
+
+		if (elt && ucl_object_type (elt) == UCL_FLOAT) {
+			row->required_score = ucl_object_todouble (elt);
+		}
+
+		elt = ucl_object_lookup (cur, "action");
+
+		if (elt && ucl_object_type (elt) == UCL_INT) {
+			row->action = ucl_object_toint (elt);
+		}
+
+		g_array_append_val (rows, irow);
+	}
+
+	/* Rows were dumped in ring order, so restore the chronological one */
+	g_array_sort (rows, rspamd_roll_history_row_cmp);
+
+	if (rows->len > history->nrows) {
+		msg_warn ("stored history is larger than the current one: %ud (file) vs "
+				"%ud (history)", rows->len, history->nrows);
+		n = rows->len - history->nrows;
+	}
+	else {
+		n = 0;
+	}
+
+	for (i = n; i < rows->len; i ++) {
+		rspamd_roll_history_import_row (history,
+				&g_array_index (rows, struct roll_history_import_row, i));
+	}
+
+	g_array_free (rows, TRUE);
+}
+
+/*
+ * Maps history from file, files of a different size are resized and json
+ * files are converted to the columnar format
+ */
+static gboolean
+rspamd_roll_history_map_file (struct roll_history *history,
+		const gchar *filename)
+{
+	struct roll_history_header *hdr;
+	struct roll_history old;
+	ucl_object_t *legacy = NULL;
+	gpointer map, old_map = NULL;
+	gsize size, old_size = 0;
+	gchar *tmpname;
+	gint fd;
+
+	size = rspamd_roll_history_layout (NULL, NULL, history->nrows);
+	map = rspamd_file_xmap (filename, PROT_READ | PROT_WRITE, &old_size, FALSE);
+
+	if (map != NULL) {
+		hdr = map;
+
+		if (old_size >= sizeof (*hdr) &&
+				memcmp (hdr->magic, rspamd_history_magic, sizeof (hdr->magic)) == 0 &&
+				hdr->version == HISTORY_FILE_VERSION &&
+				hdr->nrows > 0 &&
+				old_size == rspamd_roll_history_layout (NULL, NULL, hdr->nrows)) {
+
+			if (hdr->nrows == history->nrows) {
+				history->map = map;
+				history->map_len = size;
+				rspamd_roll_history_layout (history, map, history->nrows);
+				rspamd_roll_history_check_storage (history);
+				msg_info ("mapped history of %ud rows from %s",
+						history->nrows, filename);
+
+				return TRUE;
+			}
+
+			msg_info ("resize history in %s: %ud rows (file) vs %ud rows (config)",
+					filename, hdr->nrows, history->nrows);
+			old_map = map;
+		}
+		else {
+			munmap (map, old_size);
+			legacy = rspamd_roll_history_read_legacy (filename);
+		}
+	}
+
+	tmpname = g_strdup_printf ("%s.new", filename);
+	fd = rspamd_file_xopen (tmpname, O_RDWR | O_CREAT | O_TRUNC, 00600, FALSE);
+
+	if (fd == -1 || ftruncate (fd, size) == -1) {
+		msg_err ("cannot create history file %s: %s", tmpname, strerror (errno));
+		goto err;
+	}
+
+	map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED) {
+		msg_err ("cannot map history file %s: %s", tmpname, strerror (errno));
+		goto err;
+	}
+
+	close (fd);
+	fd = -1;
+	history->map = map;
+	history->map_len = size;
+	rspamd_roll_history_init_storage (history, map);
+
+	if (old_map != NULL) {
+		memset (&old, 0, sizeof (old));
+		old.nrows = ((struct roll_history_header *)old_map)->nrows;
+		rspamd_roll_history_layout (&old, old_map, old.nrows);
+		rspamd_roll_history_check_storage (&old);
+		rspamd_roll_history_copy (history, &old);
+		munmap (old_map, old_size);
+		old_map = NULL;
+	}
+	else if (legacy != NULL) {
+		rspamd_roll_history_import_ucl (history, legacy);
+		ucl_object_unref (legacy);
+		legacy = NULL;
+		msg_info ("converted json history in %s", filename);
+	}
+
+	if (rename (tmpname, filename) == -1) {
+		msg_err ("cannot rename %s to %s: %s", tmpname, filename,
+				strerror (errno));
+		munmap (history->map, history->map_len);
+		history->map = NULL;
+		history->map_len = 0;
+		goto err;
+	}
+
+	g_free (tmpname);
+
+	return TRUE;
+
+err:
+	if (fd != -1) {
+		close (fd);
+	}
+
+	unlink (tmpname);
+	g_free (tmpname);
+
+	if (old_map != NULL) {
+		munmap (old_map, old_size);
+	}
+
+	if (legacy != NULL) {
+		ucl_object_unref (legacy);
+	}
+
+	return FALSE;
+}
 
 /**
  * Returns new roll history
@@ -33,6 +797,7 @@ rspamd_roll_history_new (rspamd_mempool_t *pool, guint max_rows,
 {
 	struct roll_history *history;
 	lua_State *L = cfg->lua_state;
+	gsize size;
 
 	if (pool == NULL || max_rows == 0) {
 		return NULL;
@@ -59,17 +824,23 @@ rspamd_roll_history_new (rspamd_mempool_t *pool, guint max_rows,
 	lua_pop (L, 1);
 
 	if (!history->disabled) {
-		history->rows = rspamd_mempool_alloc0_shared (pool,
-				sizeof (struct roll_history_row) * max_rows);
 		history->nrows = max_rows;
+		history->symbols_lock = rspamd_mempool_get_mutex (pool);
+
+		if (cfg->history_file == NULL ||
+				!rspamd_roll_history_map_file (history, cfg->history_file)) {
+			size = rspamd_roll_history_layout (NULL, NULL, max_rows);
+			rspamd_roll_history_init_storage (history,
+					rspamd_mempool_alloc0_shared (pool, size));
+		}
 	}
 
 	return history;
 }
 
 struct history_metric_callback_data {
-	gchar *pos;
-	gint remain;
+	struct roll_history *history;
+	struct roll_history_row *row;
 };
 
 static void
@@ -77,16 +848,18 @@ roll_history_symbols_callback (gpointer key, gpointer value, void *user_data)
 {
 	struct history_metric_callback_data *cb = user_data;
 	struct rspamd_symbol_result *s = value;
-	guint wr;
+	gint id;
 
 	if (s->flags & RSPAMD_SYMBOL_RESULT_IGNORED) {
 		return;
 	}
 
-	if (cb->remain > 0) {
-		wr = rspamd_snprintf (cb->pos, cb->remain, "%s, ", s->name);
-		cb->pos += wr;
-		cb->remain -= wr;
+	if (cb->row->nsymbols < G_N_ELEMENTS (cb->row->symbols)) {
+		id = rspamd_roll_history_intern_symbol (cb->history, s->name, cb->row);
+
+		if (id >= 0) {
+			cb->row->symbols[cb->row->nsymbols++] = id;
+		}
 	}
 }
 
@@ -99,8 +872,7 @@ void
 rspamd_roll_history_update (struct roll_history *history,
 	struct rspamd_task *task)
 {
-	guint row_num;
-	struct roll_history_row *row;
+	struct roll_history_row row;
 	struct rspamd_scan_result *metric_res;
 	struct history_metric_callback_data cbdata;
 	struct rspamd_action *action;
@@ -109,252 +881,251 @@ rspamd_roll_history_update (struct roll_history *history,
 		return;
 	}
 
-	/* First of all obtain check and obtain row number */
-	g_atomic_int_compare_and_exchange (&history->cur_row, history->nrows, 0);
-#if ((GLIB_MAJOR_VERSION == 2) && (GLIB_MINOR_VERSION > 30))
-	row_num = g_atomic_int_add (&history->cur_row, 1);
-#else
-	row_num = g_atomic_int_exchange_and_add (&history->cur_row, 1);
-#endif
-
-	if (row_num < history->nrows) {
-		row = &history->rows[row_num];
-		g_atomic_int_set (&row->completed, FALSE);
-	}
-	else {
-		/* Race condition */
-		history->cur_row = 0;
-		return;
-	}
+	memset (&row, 0, sizeof (row));
 
 	/* Add information from task to roll history */
 	if (task->from_addr) {
-		rspamd_strlcpy (row->from_addr,
+		rspamd_strlcpy (row.from_addr,
 				rspamd_inet_address_to_string (task->from_addr),
-				sizeof (row->from_addr));
+				sizeof (row.from_addr));
 	}
 	else {
-		rspamd_strlcpy (row->from_addr, "unknown", sizeof (row->from_addr));
+		rspamd_strlcpy (row.from_addr, "unknown", sizeof (row.from_addr));
 	}
 
-	row->timestamp = task->task_timestamp;
+	row.timestamp = task->task_timestamp;
 
 	/* Strings */
 	if (task->message) {
-		rspamd_strlcpy (row->message_id, MESSAGE_FIELD (task, message_id),
-				sizeof (row->message_id));
+		rspamd_strlcpy (row.message_id, MESSAGE_FIELD (task, message_id),
+				sizeof (row.message_id));
 	}
 	if (task->auth_user) {
-		rspamd_strlcpy (row->user, task->auth_user, sizeof (row->user));
-	}
-	else {
-		row->user[0] = '\0';
+		rspamd_strlcpy (row.user, task->auth_user, sizeof (row.user));
 	}
 
 	/* Get default metric */
 	metric_res = task->result;
 
 	if (metric_res == NULL) {
-		row->symbols[0] = '\0';
-		row->action = METRIC_ACTION_NOACTION;
+		row.action = METRIC_ACTION_NOACTION;
 	}
 	else {
-		row->score = metric_res->score;
+		row.score = metric_res->score;
 		action = rspamd_check_action_metric (task, NULL, NULL);
-		row->action = action->action_type;
-		row->required_score = rspamd_task_get_required_score (task, metric_res);
-		cbdata.pos = row->symbols;
-		cbdata.remain = sizeof (row->symbols);
+		row.action = action->action_type;
+		row.required_score = rspamd_task_get_required_score (task, metric_res);
+		cbdata.history = history;
+		cbdata.row = &row;
 		rspamd_task_symbol_result_foreach (task, NULL,
 				roll_history_symbols_callback,
 				&cbdata);
-		if (cbdata.remain > 0) {
-			/* Remove last whitespace and comma */
-			*cbdata.pos-- = '\0';
-			*cbdata.pos-- = '\0';
-			*cbdata.pos = '\0';
-		}
 	}
 
-	row->scan_time = task->time_real_finish - task->task_timestamp;
-	row->len = task->msg.len;
-	g_atomic_int_set (&row->completed, TRUE);
+	row.scan_time = task->time_real_finish - task->task_timestamp;
+	row.len = task->msg.len;
+	rspamd_roll_history_append (history, &row);
 }
 
-/**
- * Load previously saved history from file
- * @param history roll history object
- * @param filename filename to load from
- * @return TRUE if history has been loaded
- */
-gboolean
-rspamd_roll_history_load (struct roll_history *history, const gchar *filename)
+void
+rspamd_roll_history_query_init (struct roll_history_query *query)
 {
-	gint fd;
-	struct stat st;
-	gchar magic[sizeof(rspamd_history_magic_old)];
-	ucl_object_t *top;
-	const ucl_object_t *cur, *elt;
-	struct ucl_parser *parser;
-	struct roll_history_row *row;
-	guint n, i;
-
-	g_assert (history != NULL);
-	if (history->disabled) {
-		return TRUE;
-	}
+	memset (query, 0, sizeof (*query));
+	query->min_score = -INFINITY;
+	query->max_score = INFINITY;
+	query->action = -1;
+	query->limit = G_MAXUINT;
+}
 
-	if (stat (filename, &st) == -1) {
-		msg_info ("cannot load history from %s: %s", filename,
-			strerror (errno));
-		return FALSE;
-	}
+/* Checks row using columns only, without copying it */
+static inline gboolean
+rspamd_roll_history_row_matches (struct roll_history *history, guint idx,
+		const struct roll_history_query *query, gint symbol_id)
+{
+	const guint16 *syms;
+	gdouble score;
+	guint i, nsyms;
 
-	if ((fd = open (filename, O_RDONLY)) == -1) {
-		msg_info ("cannot load history from %s: %s", filename,
-			strerror (errno));
+	if (query->since > 0 && history->timestamps[idx] < query->since) {
 		return FALSE;
 	}
 
-	/* Check for old format */
-	if (read (fd, magic, sizeof (magic)) == -1) {
-		close (fd);
-		msg_info ("cannot read history from %s: %s", filename,
-				strerror (errno));
+	if (query->until > 0 && history->timestamps[idx] > query->until) {
 		return FALSE;
 	}
 
-	if (memcmp (magic, rspamd_history_magic_old, sizeof (magic)) == 0) {
-		close (fd);
-		msg_warn ("cannot read history from old format %s, "
-				"it will be replaced after restart", filename);
+	if (query->action >= 0 && history->actions[idx] != query->action) {
 		return FALSE;
 	}
 
-	parser = ucl_parser_new (0);
+	score = history->scores[idx];
 
-	if (!ucl_parser_add_fd (parser, fd)) {
-		msg_warn ("cannot parse history file %s: %s", filename,
-				ucl_parser_get_error (parser));
-		ucl_parser_free (parser);
-		close (fd);
+	if (isnan (score)) {
+		score = 0.0;
+	}
 
+	if (score < query->min_score || score > query->max_score) {
 		return FALSE;
 	}
 
-	top = ucl_parser_get_object (parser);
-	ucl_parser_free (parser);
-	close (fd);
+	if (symbol_id >= 0) {
+		syms = history->symbols + idx * HISTORY_MAX_ROW_SYMBOLS;
+		nsyms = MIN (history->nsymbols[idx], HISTORY_MAX_ROW_SYMBOLS);
 
-	if (top == NULL) {
-		msg_warn ("cannot parse history file %s: no object", filename);
+		for (i = 0; i < nsyms; i ++) {
+			if (syms[i] == symbol_id) {
+				return TRUE;
+			}
+		}
 
 		return FALSE;
 	}
 
-	if (ucl_object_type (top) != UCL_ARRAY) {
-		msg_warn ("invalid object type read from: %s", filename);
-		ucl_object_unref (top);
+	return TRUE;
+}
 
-		return FALSE;
-	}
+guint
+rspamd_roll_history_query (struct roll_history *history,
+		const struct roll_history_query *query,
+		roll_history_row_cb cb,
+		gpointer ud)
+{
+	struct roll_history_row row;
+	guint i, idx, start, matched = 0, emitted = 0;
+	gint symbol_id = -1;
 
-	if (top->len > history->nrows) {
-		msg_warn ("stored history is larger than the current one: %ud (file) vs "
-				"%ud (history)", top->len, history->nrows);
-		n = history->nrows;
-	}
-	else if (top->len < history->nrows) {
-		msg_warn (
-				"stored history is smaller than the current one: %ud (file) vs "
-						"%ud (history)",
-				top->len, history->nrows);
-		n = top->len;
-	}
-	else {
-		n = top->len;
+	if (history->disabled) {
+		return 0;
 	}
 
-	for (i = 0; i < n; i ++) {
-		cur = ucl_array_find_index (top, i);
+	if (query->symbol) {
+		symbol_id = rspamd_roll_history_find_symbol (history, query->symbol,
+				MIN (strlen (query->symbol), HISTORY_MAX_SYMBOL_NAME - 1), NULL);
 
-		if (cur != NULL && ucl_object_type (cur) == UCL_OBJECT) {
-			row = &history->rows[i];
-			memset (row, 0, sizeof (*row));
+		if (symbol_id < 0) {
+			/* Symbol has never been seen */
+			return 0;
+		}
+	}
 
-			elt = ucl_object_lookup (cur, "time");
+	start = g_atomic_int_get (&history->hdr->next_row) % history->nrows;
 
-			if (elt && ucl_object_type (elt) == UCL_FLOAT) {
-				row->timestamp = ucl_object_todouble (elt);
-			}
+	for (i = 0; i < history->nrows; i ++) {
+		/* From the newest row to the oldest one */
+		idx = (start + history->nrows - 1 - i) % history->nrows;
 
-			elt = ucl_object_lookup (cur, "id");
+		if (g_atomic_int_get (&history->seqs[idx]) == 0 ||
+				!rspamd_roll_history_row_matches (history, idx, query, symbol_id)) {
+			continue;
+		}
 
-			if (elt && ucl_object_type (elt) == UCL_STRING) {
-				rspamd_strlcpy (row->message_id, ucl_object_tostring (elt),
-						sizeof (row->message_id));
-			}
+		if (matched ++ < query->offset || emitted >= query->limit) {
+			continue;
+		}
 
-			elt = ucl_object_lookup (cur, "symbols");
+		if (rspamd_roll_history_read_row (history, idx, &row)) {
+			cb (history, &row, ud);
+			emitted ++;
+		}
+	}
 
-			if (elt && ucl_object_type (elt) == UCL_STRING) {
-				rspamd_strlcpy (row->symbols, ucl_object_tostring (elt),
-						sizeof (row->symbols));
-			}
+	return matched;
+}
 
-			elt = ucl_object_lookup (cur, "user");
+guint
+rspamd_roll_history_reset (struct roll_history *history)
+{
+	guint i, cleared = 0;
 
-			if (elt && ucl_object_type (elt) == UCL_STRING) {
-				rspamd_strlcpy (row->user, ucl_object_tostring (elt),
-						sizeof (row->user));
-			}
+	if (history->disabled) {
+		return 0;
+	}
 
-			elt = ucl_object_lookup (cur, "from");
+	for (i = 0; i < history->nrows; i ++) {
+		if (g_atomic_int_get (&history->seqs[i]) != 0) {
+			g_atomic_int_set (&history->seqs[i], 0);
+			cleared ++;
+		}
+	}
 
-			if (elt && ucl_object_type (elt) == UCL_STRING) {
-				rspamd_strlcpy (row->from_addr, ucl_object_tostring (elt),
-						sizeof (row->from_addr));
-			}
+	return cleared;
+}
 
-			elt = ucl_object_lookup (cur, "len");
+/**
+ * Load previously saved history from file
+ * @param history roll history object
+ * @param filename filename to load from
+ * @return TRUE if history has been loaded
+ */
+gboolean
+rspamd_roll_history_load (struct roll_history *history, const gchar *filename)
+{
+	ucl_object_t *top;
 
-			if (elt && ucl_object_type (elt) == UCL_INT) {
-				row->len = ucl_object_toint (elt);
-			}
+	g_assert (history != NULL);
 
-			elt = ucl_object_lookup (cur, "scan_time");
+	if (history->disabled || history->map != NULL) {
+		/* Mapped history is loaded on creation */
+		return TRUE;
+	}
 
-			if (elt && ucl_object_type (elt) == UCL_FLOAT) {
-				row->scan_time = ucl_object_todouble (elt);
-			}
+	top = rspamd_roll_history_read_legacy (filename);
 
-			elt = ucl_object_lookup (cur, "score");
+	if (top == NULL) {
+		return FALSE;
+	}
 
-			if (elt && ucl_object_type (elt) == UCL_FLOAT) {
-				row->score = ucl_object_todouble (elt);
-			}
+	rspamd_roll_history_import_ucl (history, top);
+	ucl_object_unref (top);
 
-			elt = ucl_object_lookup (cur, "required_score");
+	return TRUE;
+}
 
-			if (elt && ucl_object_type (elt) == UCL_FLOAT) {
-				row->required_score = ucl_object_todouble (elt);
-			}
+static void
+rspamd_roll_history_save_row (struct roll_history *history,
+		const struct roll_history_row *row, gpointer ud)
+{
+	ucl_object_t *obj = ud, *elt;
+	const gchar *name;
+	GString *syms;
+	guint i;
 
-			elt = ucl_object_lookup (cur, "action");
+	syms = g_string_sized_new (row->nsymbols * 16);
 
-			if (elt && ucl_object_type (elt) == UCL_INT) {
-				row->action = ucl_object_toint (elt);
-			}
+	for (i = 0; i < row->nsymbols; i ++) {
+		name = rspamd_roll_history_symbol_name (history, row->symbols[i]);
 
-			row->completed = TRUE;
+		if (name) {
+			rspamd_printf_gstring (syms, "%s%s", syms->len > 0 ? ", " : "",
+					name);
 		}
 	}
 
-	ucl_object_unref (top);
-
-	history->cur_row = n;
-
-	return TRUE;
+	elt = ucl_object_typed_new (UCL_OBJECT);
+
+	ucl_object_insert_key (elt, ucl_object_fromdouble (row->timestamp),
+			"time", 0, false);
+	ucl_object_insert_key (elt, ucl_object_fromstring (row->message_id),
+			"id", 0, false);
+	ucl_object_insert_key (elt, ucl_object_fromstring (syms->str),
+			"symbols", 0, false);
+	ucl_object_insert_key (elt, ucl_object_fromstring (row->user),
+			"user", 0, false);
+	ucl_object_insert_key (elt, ucl_object_fromstring (row->from_addr),
+			"from", 0, false);
+	ucl_object_insert_key (elt, ucl_object_fromint (row->len),
+			"len", 0, false);
+	ucl_object_insert_key (elt, ucl_object_fromdouble (row->scan_time),
+			"scan_time", 0, false);
+	ucl_object_insert_key (elt, ucl_object_fromdouble (row->score),
+			"score", 0, false);
+	ucl_object_insert_key (elt, ucl_object_fromdouble (row->required_score),
+			"required_score", 0, false);
+	ucl_object_insert_key (elt, ucl_object_fromint (row->action),
+			"action", 0, false);
+
+	ucl_array_append (obj, elt);
+	g_string_free (syms, TRUE);
 }
 
 /**
@@ -368,9 +1139,8 @@ rspamd_roll_history_save (struct roll_history *history, const gchar *filename)
 {
 	gint fd;
 	FILE *fp;
-	ucl_object_t *obj, *elt;
-	guint i;
-	struct roll_history_row *row;
+	ucl_object_t *obj;
+	struct roll_history_query query;
 	struct ucl_emitter_functions *emitter_func;
 
 	g_assert (history != NULL);
@@ -379,6 +1149,17 @@ rspamd_roll_history_save (struct roll_history *history, const gchar *filename)
 		return TRUE;
 	}
 
+	if (history->map != NULL) {
+		if (msync (history->map, history->map_len, MS_SYNC) == -1) {
+			msg_info ("cannot sync history to %s: %s", filename,
+					strerror (errno));
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	/* History could not be mapped, so fall back to json dump */
 	if ((fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 00600)) == -1) {
 		msg_info ("cannot save history to %s: %s", filename, strerror (errno));
 		return FALSE;
@@ -386,39 +1167,9 @@ rspamd_roll_history_save (struct roll_history *history, const gchar *filename)
 
 	fp = fdopen (fd, "w");
 	obj = ucl_object_typed_new (UCL_ARRAY);
-
-	for (i = 0; i < history->nrows; i ++) {
-		row = &history->rows[i];
-
-		if (!row->completed) {
-			continue;
-		}
-
-		elt = ucl_object_typed_new (UCL_OBJECT);
-
-		ucl_object_insert_key (elt, ucl_object_fromdouble (row->timestamp),
-				"time", 0, false);
-		ucl_object_insert_key (elt, ucl_object_fromstring (row->message_id),
-				"id", 0, false);
-		ucl_object_insert_key (elt, ucl_object_fromstring (row->symbols),
-				"symbols", 0, false);
-		ucl_object_insert_key (elt, ucl_object_fromstring (row->user),
-				"user", 0, false);
-		ucl_object_insert_key (elt, ucl_object_fromstring (row->from_addr),
-				"from", 0, false);
-		ucl_object_insert_key (elt, ucl_object_fromint (row->len),
-				"len", 0, false);
-		ucl_object_insert_key (elt, ucl_object_fromdouble (row->scan_time),
-				"scan_time", 0, false);
-		ucl_object_insert_key (elt, ucl_object_fromdouble (row->score),
-				"score", 0, false);
-		ucl_object_insert_key (elt, ucl_object_fromdouble (row->required_score),
-				"required_score", 0, false);
-		ucl_object_insert_key (elt, ucl_object_fromint (row->action),
-				"action", 0, false);
-
-		ucl_array_append (obj, elt);
-	}
+	rspamd_roll_history_query_init (&query);
+	rspamd_roll_history_query (history, &query, rspamd_roll_history_save_row,
+			obj);
 
 	emitter_func = ucl_object_emit_file_funcs (fp);
 	ucl_object_emit_full (obj, UCL_EMIT_JSON_COMPACT, emitter_func, NULL);
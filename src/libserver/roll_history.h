@@ -25,21 +25,33 @@ extern "C" {
 
 /*
  * Roll history is a special cycled buffer for checked messages, it is designed for writing history messages
- * and displaying them in webui
+ * and displaying them in webui.
+ *
+ * Rows are stored column by column (timestamps, scores, actions and so on are
+ * contiguous arrays), so filtering a large history touches only the columns
+ * that are actually compared. Symbol names are interned in a shared table and
+ * rows keep only their ids, names of overwritten rows are reclaimed when the
+ * table is full. When `history_file` is set, the whole storage is a
+ * shared file mapping and survives restarts as is.
  */
 
 #define HISTORY_MAX_ID 256
-#define HISTORY_MAX_SYMBOLS 256
 #define HISTORY_MAX_USER 32
 #define HISTORY_MAX_ADDR 32
+#define HISTORY_MAX_ROW_SYMBOLS 64
+#define HISTORY_MAX_SYMBOL_NAME 128
+#define HISTORY_MAX_SYMBOL_NAMES 8192
 
 struct rspamd_task;
 struct rspamd_config;
+struct roll_history_header;
 
+/*
+ * Decoded copy of a single history row
+ */
 struct roll_history_row {
 	ev_tstamp timestamp;
 	gchar message_id[HISTORY_MAX_ID];
-	gchar symbols[HISTORY_MAX_SYMBOLS];
 	gchar user[HISTORY_MAX_USER];
 	gchar from_addr[HISTORY_MAX_ADDR];
 	gsize len;
@@ -47,18 +59,56 @@ struct roll_history_row {
 	gdouble score;
 	gdouble required_score;
 	gint action;
-	guint completed;
+	guint nsymbols;
+	guint16 symbols[HISTORY_MAX_ROW_SYMBOLS]; /**< interned symbol ids */
 };
 
 struct roll_history {
-	struct roll_history_row *rows;
+	struct roll_history_header *hdr;
+	/* Columns */
+	ev_tstamp *timestamps;
+	gdouble *scores;
+	gdouble *required_scores;
+	gdouble *scan_times;
+	guint32 *lens;
+	guint32 *seqs;                 /**< 0 means empty or being written */
+	guint8 *actions;
+	guint8 *nsymbols;
+	guint16 *symbols;              /**< HISTORY_MAX_ROW_SYMBOLS per row */
+	gchar *message_ids;
+	gchar *users;
+	gchar *from_addrs;
+	/* Interned symbols */
+	gchar *symbol_names;           /**< HISTORY_MAX_SYMBOL_NAME per name */
+	guint32 *symbol_hash;          /**< open addressing, id + 1 per slot */
+	rspamd_mempool_mutex_t *symbols_lock;
+	gpointer map;                  /**< file mapping if history is persistent */
+	gsize map_len;
 	gboolean disabled;
 	guint nrows;
-	guint cur_row;
 };
 
+/*
+ * Server side history filter, rows are visited from the newest to the oldest
+ */
+struct roll_history_query {
+	ev_tstamp since;               /**< 0 means unbounded */
+	ev_tstamp until;               /**< 0 means unbounded */
+	gdouble min_score;
+	gdouble max_score;
+	gint action;                   /**< -1 means any action */
+	const gchar *symbol;           /**< NULL means any symbol */
+	guint offset;                  /**< number of matched rows to skip */
+	guint limit;                   /**< maximum number of rows to return */
+};
+
+typedef void (*roll_history_row_cb) (struct roll_history *history,
+									 const struct roll_history_row *row,
+									 gpointer ud);
+
 /**
- * Returns new roll history
+ * Returns new roll history, if `history_file` is set in config, then
+ * history is mapped from that file (legacy json dumps are converted)
  * @param pool pool for shared memory
  * @return new structure
  */
@@ -74,7 +124,43 @@ void rspamd_roll_history_update (struct roll_history *history,
 								 struct rspamd_task *task);
 
 /**
- * Load previously saved history from file
+ * Initialize query to match all rows
+ * @param query query to initialize
+ */
+void rspamd_roll_history_query_init (struct roll_history_query *query);
+
+/**
+ * Visit rows matching query from the newest to the oldest
+ * @param history roll history object
+ * @param query filter and pagination parameters
+ * @param cb callback called for rows in [offset, offset + limit)
+ * @param ud opaque data for callback
+ * @return total number of matched rows (regardless of pagination)
+ */
+guint rspamd_roll_history_query (struct roll_history *history,
+								 const struct roll_history_query *query,
+								 roll_history_row_cb cb,
+								 gpointer ud);
+
+/**
+ * Returns name of an interned symbol
+ * @param history roll history object
+ * @param id symbol id from a row
+ * @return symbol name or NULL
+ */
+const gchar *rspamd_roll_history_symbol_name (struct roll_history *history,
+											  guint id);
+
+/**
+ * Remove all rows from history
+ * @param history roll history object
+ * @return number of rows removed
+ */
+guint rspamd_roll_history_reset (struct roll_history *history);
+
+/**
+ * Load previously saved history from file, it is a no-op for file
+ * mapped history
  * @param history roll history object
  * @param filename filename to load from
  * @return TRUE if history has been loaded
@@ -83,7 +169,7 @@ gboolean rspamd_roll_history_load (struct roll_history *history,
 								   const gchar *filename);
 
 /**
- * Save history to file
+ * Save history to file, file mapped history is just synced
  * @param history roll history object
  * @param filename filename to load from
  * @return TRUE if history has been saved
@@ -82,6 +82,8 @@ struct rspamd_symcache_item_stat {
 	struct rspamd_counter_data frequency_counter;
 	gdouble avg_frequency;
 	gdouble stddev_frequency;
+	guint skipped;
+	guint64 total_skipped;
 };
 
 /**
@@ -646,6 +646,21 @@ auto symcache::resort() -> void
 				(t > time_alpha ? t : time_alpha));
 	};
 
+	/*
+	 * Adaptive mode: expected positive score per millisecond, so filters that
+	 * are likely to push a message over the reject limit go first and
+	 * expensive ones are more likely to be skipped by check_metric_limit.
+	 * Negative and zero weights cannot help to reach the limit at all.
+	 */
+	constexpr auto adaptive_score_functor = [](auto w, auto f, auto t) -> auto {
+		auto time_alpha = 0.01, weight_alpha = 0.001, freq_alpha = 0.01,
+			max_score = 1e4;
+		auto res = ((w > 0.0 ? w : weight_alpha) * (f > 0.0 ? f : freq_alpha) /
+				(t > time_alpha ? t : time_alpha));
+
+		return res > max_score ? max_score : res;
+	};
+
 	auto cache_order_cmp = [&](const auto &it1, const auto &it2) -> auto {
 		constexpr const auto topology_mult = 1e7,
 				priority_mult = 1e6,
@@ -662,12 +677,19 @@ auto symcache::resort() -> void
 		auto avg_weight = (total_weight / used_items);
 		auto f1 = (double) it1->st->total_hits / avg_freq;
 		auto f2 = (double) it2->st->total_hits / avg_freq;
-		auto weight1 = std::fabs(it1->st->weight) / avg_weight;
-		auto weight2 = std::fabs(it2->st->weight) / avg_weight;
 		auto t1 = it1->st->avg_time;
 		auto t2 = it2->st->avg_time;
-		w1 += score_functor(weight1, f1, t1);
-		w2 += score_functor(weight2, f2, t2);
+
+		if (adaptive_order) {
+			w1 += adaptive_score_functor(it1->st->weight / avg_weight, f1, t1);
+			w2 += adaptive_score_functor(it2->st->weight / avg_weight, f2, t2);
+		}
+		else {
+			auto weight1 = std::fabs(it1->st->weight) / avg_weight;
+			auto weight2 = std::fabs(it2->st->weight) / avg_weight;
+			w1 += score_functor(weight1, f1, t1);
+			w2 += score_functor(weight2, f2, t2);
+		}
 
 		return w1 > w2;
 	};
@@ -959,6 +981,17 @@ auto symcache::counters() const -> ucl_object_t *
 		const auto power10 = ::pow(10, digits);
 		return (::floor(x * power10) / power10);
 	};
+	/* Filters skipped after reaching the reject limit and the time it saved */
+	const auto add_skipped_stats = [&](ucl_object_t *obj, const cache_item *it) {
+		auto skipped = it->st->total_skipped + it->st->skipped;
+
+		ucl_object_insert_key(obj,
+				ucl_object_fromint(skipped),
+				"skipped", 0, false);
+		ucl_object_insert_key(obj,
+				ucl_object_fromdouble(round_float(skipped * it->st->avg_time, 3)),
+				"time_saved", 0, false);
+	};
 
 	for (auto &pair: items_by_symbol) {
 		auto &item = pair.second;
@@ -983,6 +1016,7 @@ auto symcache::counters() const -> ucl_object_t *
 				ucl_object_insert_key(obj,
 						ucl_object_fromdouble(round_float(parent->st->avg_time, 3)),
 						"time", 0, false);
+				add_skipped_stats(obj, parent);
 			}
 			else {
 				ucl_object_insert_key(obj,
@@ -1012,6 +1046,7 @@ auto symcache::counters() const -> ucl_object_t *
 			ucl_object_insert_key(obj,
 					ucl_object_fromdouble(round_float(item->st->avg_time, 3)),
 					"time", 0, false);
+			add_skipped_stats(obj, item);
 		}
 
 		ucl_array_append(top, obj);
@@ -1043,7 +1078,7 @@ auto symcache::periodic_resort(struct ev_loop *ev_loop, double cur_time, double
 				lua_rawgeti(L, LUA_REGISTRYINDEX, peak_cb);
 				pbase = (struct ev_loop **) lua_newuserdata(L, sizeof(*pbase));
 				*pbase = ev_loop;
-				rspamd_lua_setclass(L, "rspamd{ev_base}", -1);
+				rspamd_lua_setclass(L, rspamd_ev_base_classname, -1);
 				lua_pushlstring(L, item->symbol.c_str(), item->symbol.size());
 				lua_pushnumber(L, item->st->avg_frequency);
 				lua_pushnumber(L, ::sqrt(item->st->stddev_frequency));
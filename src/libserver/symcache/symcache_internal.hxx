@@ -276,6 +276,7 @@ private:
 	lua_State *L;
 	double reload_time;
 	double last_profile;
+	bool adaptive_order;
 
 private:
 	int peak_cb;
@@ -294,6 +295,7 @@ public:
 		/* XXX: do we need a special pool for symcache? I don't think so */
 		static_pool = cfg->cfg_pool;
 		reload_time = cfg->cache_reload_time;
+		adaptive_order = cfg->cache_adaptive_order;
 		total_hits = 1;
 		total_weight = 1.0;
 		cksum = 0xdeadbabe;
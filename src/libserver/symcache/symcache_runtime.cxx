@@ -441,9 +441,46 @@ symcache_runtime::process_filters(struct rspamd_task *task, symcache &cache, int
 		}
 	}
 
+	if (all_done && has_passtrough) {
+		account_skipped_filters(task);
+	}
+
 	return all_done;
 }
 
+/*
+ * Counts filters that have not been started because the task has reached
+ * its limit, so the time saved is visible in the symcache counters
+ */
+auto
+symcache_runtime::account_skipped_filters(struct rspamd_task *task) -> void
+{
+	auto log_func = RSPAMD_LOG_FUNC;
+
+	if (skipped_accounted) {
+		return;
+	}
+
+	skipped_accounted = true;
+	auto nskipped = 0u;
+	auto time_saved = 0.0;
+
+	for (const auto[idx, item]: rspamd::enumerate(order->d)) {
+		if (item->type != symcache_item_type::FILTER) {
+			break;
+		}
+
+		if (!dynamic_items[idx].started) {
+			g_atomic_int_inc(&item->st->skipped);
+			time_saved += item->st->avg_time;
+			nskipped++;
+		}
+	}
+
+	msg_debug_cache_task_lambda("skipped %ud filters after reaching the limit, "
+								"saved %.2f ms (estimated)", nskipped, time_saved);
+}
+
 auto
 symcache_runtime::process_symbol(struct rspamd_task *task, symcache &cache, cache_item *item,
 								 cache_dynamic_item *dyn_item) -> bool
@@ -50,6 +50,7 @@ class symcache_runtime {
 	unsigned items_inflight;
 	bool profile;
 	bool has_slow;
+	bool skipped_accounted;
 
 	double profile_start;
 	double lim;
@@ -67,6 +68,7 @@ class symcache_runtime {
 	auto process_pre_postfilters(struct rspamd_task *task, symcache &cache, int start_events, int stage) -> bool;
 	auto process_filters(struct rspamd_task *task, symcache &cache, int start_events) -> bool;
 	auto check_metric_limit(struct rspamd_task *task) -> bool;
+	auto account_skipped_filters(struct rspamd_task *task) -> void;
 	auto check_item_deps(struct rspamd_task *task, symcache &cache, cache_item *item,
 						 cache_dynamic_item *dyn_item, bool check_only) -> bool;
 
@@ -29,6 +29,7 @@
 #include "libserver/cfg_file_private.h"
 #include "libmime/lang_detection.h"
 #include "libmime/scan_result_private.h"
+#include "libserver/latency_hist.h"
 
 #ifdef WITH_JEMALLOC
 #include <jemalloc/jemalloc.h>
@@ -112,6 +113,7 @@ rspamd_task_new (struct rspamd_worker *worker,
 	new_task->event_loop = event_loop;
 	new_task->task_timestamp = ev_time ();
 	new_task->time_real_finish = NAN;
+	new_task->latency_stage = -1;
 
 	new_task->request_headers = kh_init (rspamd_req_headers_hash);
 	new_task->sock = -1;
@@ -625,6 +627,23 @@ rspamd_task_load_message (struct rspamd_task *task,
 	else {
 		task->msg.begin = start;
 		task->msg.len = len;
+
+		if (msg && len > 0) {
+			/*
+			 * Message data belongs to the HTTP message (and it might be a
+			 * shared memory segment filled by the HTTP reader), so the task
+			 * holds a reference instead of copying the body; this keeps data
+			 * valid after the connection is reset for reply
+			 */
+			rspamd_mempool_add_destructor (task->task_pool,
+					(rspamd_mempool_destruct_t)rspamd_http_message_unref,
+					rspamd_http_message_ref (msg));
+
+			if (rspamd_http_message_get_flags (msg) & RSPAMD_HTTP_FLAG_SHMEM) {
+				debug_task ("use %z bytes of message body from shared memory "
+							"without copying", len);
+			}
+		}
 	}
 
 	if (task->msg.len == 0) {
@@ -700,11 +719,54 @@ rspamd_task_select_processing_stage (struct rspamd_task *task, guint stages)
 	return RSPAMD_TASK_STAGE_DONE;
 }
 
+/*
+ * Maps processing stage to a latency histogram; classifiers stages are
+ * accounted as a single stage that is finished by CLASSIFIERS_POST
+ */
+static gint
+rspamd_task_latency_stage (guint st, gboolean *last)
+{
+	*last = TRUE;
+
+	switch (st) {
+	case RSPAMD_TASK_STAGE_READ_MESSAGE:
+		return RSPAMD_LATENCY_STAGE_READ_MESSAGE;
+	case RSPAMD_TASK_STAGE_PRE_FILTERS:
+		return RSPAMD_LATENCY_STAGE_PRE_FILTERS;
+	case RSPAMD_TASK_STAGE_FILTERS:
+		return RSPAMD_LATENCY_STAGE_FILTERS;
+	case RSPAMD_TASK_STAGE_CLASSIFIERS_PRE:
+	case RSPAMD_TASK_STAGE_CLASSIFIERS:
+		*last = FALSE;
+		return RSPAMD_LATENCY_STAGE_CLASSIFIERS;
+	case RSPAMD_TASK_STAGE_CLASSIFIERS_POST:
+		return RSPAMD_LATENCY_STAGE_CLASSIFIERS;
+	case RSPAMD_TASK_STAGE_COMPOSITES:
+		return RSPAMD_LATENCY_STAGE_COMPOSITES;
+	case RSPAMD_TASK_STAGE_POST_FILTERS:
+		return RSPAMD_LATENCY_STAGE_POST_FILTERS;
+	case RSPAMD_TASK_STAGE_IDEMPOTENT:
+		return RSPAMD_LATENCY_STAGE_IDEMPOTENT;
+	default:
+		return -1;
+	}
+}
+
+static inline struct rspamd_latency_stat *
+rspamd_task_latency_stat (struct rspamd_task *task)
+{
+	if (task->worker && task->worker->srv && task->worker->srv->stat) {
+		return task->worker->srv->stat->latency;
+	}
+
+	return NULL;
+}
+
 gboolean
 rspamd_task_process (struct rspamd_task *task, guint stages)
 {
-	gint st;
-	gboolean ret = TRUE, all_done = TRUE;
+	gint st, lat_stage;
+	gboolean ret = TRUE, all_done = TRUE, lat_last;
 	GError *stat_error = NULL;
 
 	/* Avoid nested calls */
@@ -719,6 +781,13 @@ rspamd_task_process (struct rspamd_task *task, guint stages)
 	task->flags |= RSPAMD_TASK_FLAG_PROCESSING;
 
 	st = rspamd_task_select_processing_stage (task, stages);
+	lat_stage = rspamd_task_latency_stage (st, &lat_last);
+
+	if (lat_stage != -1 && lat_stage != task->latency_stage) {
+		/* Stage is entered for the first time */
+		task->latency_stage = lat_stage;
+		task->latency_stage_start = rspamd_get_ticks (FALSE);
+	}
 
 	switch (st) {
 	case RSPAMD_TASK_STAGE_CONNFILTERS:
@@ -834,6 +903,8 @@ rspamd_task_process (struct rspamd_task *task, guint stages)
 
 	case RSPAMD_TASK_STAGE_DONE:
 		task->processed_stages |= RSPAMD_TASK_STAGE_DONE;
+		rspamd_latency_stat_record (rspamd_task_latency_stat (task), task->worker,
+				RSPAMD_LATENCY_STAGE_TOTAL, ev_time () - task->task_timestamp);
 		break;
 
 	default:
@@ -869,6 +940,12 @@ rspamd_task_process (struct rspamd_task *task, guint stages)
 				/* Mark the current stage as done and go to the next stage */
 				msg_debug_task ("completed stage %d", st);
 				task->processed_stages |= st;
+
+				if (lat_stage != -1 && lat_last) {
+					rspamd_latency_stat_record (rspamd_task_latency_stat (task),
+							task->worker, lat_stage,
+							rspamd_get_ticks (FALSE) - task->latency_stage_start);
+				}
 			}
 			else {
 				msg_debug_task ("need more processing on stage %d", st);
@@ -1619,7 +1696,7 @@ rspamd_task_write_log (struct rspamd_task *task)
 			L = task->cfg->lua_state;
 			lua_rawgeti (L, LUA_REGISTRYINDEX, GPOINTER_TO_INT (lf->data));
 			ptask = lua_newuserdata (L, sizeof (*ptask));
-			rspamd_lua_setclass (L, "rspamd{task}", -1);
+			rspamd_lua_setclass (L, rspamd_task_classname, -1);
 			*ptask = task;
 
 			if (lua_pcall (L, 1, 1, 0) != 0) {
@@ -204,6 +204,8 @@ struct rspamd_task {
 	rspamd_mempool_t *task_pool;                    /**< memory pool for task							*/
 	double time_real_finish;
 	ev_tstamp task_timestamp;
+	gdouble latency_stage_start;                    /**< start ticks of the currently timed stage		*/
+	gint latency_stage;                              /**< currently timed latency stage (or -1)			*/
 
 	gboolean (*fin_callback) (struct rspamd_task *task, void *arg);
 	/**< callback for filters finalizing					*/
@@ -52,6 +52,10 @@
 #include <unicode/usprep.h>
 #include <unicode/ucnv.h>
 
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
 typedef struct url_match_s {
 	const gchar *m_begin;
 	gsize m_len;
@@ -3195,7 +3199,7 @@ rspamd_url_trie_callback (struct rspamd_multipattern *mp,
 	m.prefix = matcher->prefix;
 	m.add_prefix = FALSE;
 	m.newline_pos = newline_pos;
-	pos = cb->begin + match_start;
+	pos = text + match_start;
 
 	if (matcher->start (cb, pos, &m) &&
 			matcher->end (cb, pos, &m)) {
@@ -3231,6 +3235,132 @@ rspamd_url_trie_callback (struct rspamd_multipattern *mp,
 	return 0;
 }
 
+/*
+ * Each url pattern (both static and TLD ones) contains at least one of
+ * these characters, and no pattern can match across a whitespace
+ */
+static inline const gchar *
+rspamd_url_next_anchor (const gchar *p, const gchar *end)
+{
+#ifdef __x86_64__
+	const __m128i dot = _mm_set1_epi8 ('.'), colon = _mm_set1_epi8 (':'),
+			at = _mm_set1_epi8 ('@');
+
+	while (end - p >= 32) {
+		__m128i v1 = _mm_loadu_si128 ((const __m128i *)p);
+		__m128i v2 = _mm_loadu_si128 ((const __m128i *)(p + 16));
+		guint32 m1, m2;
+
+		m1 = _mm_movemask_epi8 (_mm_or_si128 (
+				_mm_or_si128 (_mm_cmpeq_epi8 (v1, dot), _mm_cmpeq_epi8 (v1, colon)),
+				_mm_cmpeq_epi8 (v1, at)));
+		m2 = _mm_movemask_epi8 (_mm_or_si128 (
+				_mm_or_si128 (_mm_cmpeq_epi8 (v2, dot), _mm_cmpeq_epi8 (v2, colon)),
+				_mm_cmpeq_epi8 (v2, at)));
+
+		if (m1 | m2) {
+			return p + __builtin_ctz (m1 | (m2 << 16));
+		}
+
+		p += 32;
+	}
+#endif
+
+	while (p < end) {
+		if (*p == '.' || *p == ':' || *p == '@') {
+			return p;
+		}
+
+		p ++;
+	}
+
+	return end;
+}
+
+/*
+ * Runs url multipattern over the parts of the text that might contain urls:
+ * whitespace separated tokens with an anchor character. Tokens that are
+ * closer than URL_PREFILTER_MAX_GAP are merged to a single window to avoid
+ * per scan overhead. Each window starts just after a whitespace and ends
+ * just after a whitespace (or at the end of the text), so the matches
+ * (including `\b` and `$` assertions of TLD patterns) are exactly the same as
+ * for the whole text scan. Callbacks must use cb->begin and cb->end as
+ * the text boundaries and not the text passed by the multipattern.
+ */
+#define URL_PREFILTER_MAX_GAP 256
+
+static gboolean url_prefilter_enabled = TRUE;
+
+void
+rspamd_url_set_prefilter (gboolean enabled)
+{
+	url_prefilter_enabled = enabled;
+}
+
+static gint
+rspamd_url_lookup_anchored (struct rspamd_multipattern *mp,
+							const gchar *in, gsize len,
+							rspamd_multipattern_cb_t func,
+							struct url_callback_data *cb)
+{
+	const gchar *p = in, *end = in + len, *anchor, *tok,
+			*wstart = NULL, *wend = NULL;
+	gint ret;
+
+	if (!url_prefilter_enabled) {
+		return rspamd_multipattern_lookup (mp, in, len, func, cb, NULL);
+	}
+
+	while (p < end) {
+		anchor = rspamd_url_next_anchor (p, end);
+
+		if (anchor == end) {
+			break;
+		}
+
+		tok = anchor;
+
+		while (tok > p && !g_ascii_isspace (tok[-1])) {
+			tok --;
+		}
+
+		if (wstart == NULL) {
+			wstart = tok;
+		}
+		else if (tok - wend > URL_PREFILTER_MAX_GAP) {
+			ret = rspamd_multipattern_lookup (mp, wstart, wend - wstart,
+					func, cb, NULL);
+
+			if (ret != 0) {
+				return ret;
+			}
+
+			wstart = tok;
+		}
+
+		wend = anchor + 1;
+
+		while (wend < end && !g_ascii_isspace (*wend)) {
+			wend ++;
+		}
+
+		if (wend < end) {
+			/* Include the trailing space */
+			wend ++;
+		}
+
+		p = wend;
+	}
+
+	if (wstart == NULL) {
+		/* No anchors, no urls */
+		return 0;
+	}
+
+	return rspamd_multipattern_lookup (mp, wstart, wend - wstart,
+			func, cb, NULL);
+}
+
 gboolean
 rspamd_url_find (rspamd_mempool_t *pool,
 				 const gchar *begin, gsize len,
@@ -3251,22 +3381,22 @@ rspamd_url_find (rspamd_mempool_t *pool,
 	if (how == RSPAMD_URL_FIND_ALL) {
 		if (url_scanner->search_trie_full) {
 			cb.matchers = url_scanner->matchers_full;
-			ret = rspamd_multipattern_lookup (url_scanner->search_trie_full,
+			ret = rspamd_url_lookup_anchored (url_scanner->search_trie_full,
 					begin, len,
-					rspamd_url_trie_callback, &cb, NULL);
+					rspamd_url_trie_callback, &cb);
 		}
 		else {
 			cb.matchers = url_scanner->matchers_strict;
-			ret = rspamd_multipattern_lookup (url_scanner->search_trie_strict,
+			ret = rspamd_url_lookup_anchored (url_scanner->search_trie_strict,
 					begin, len,
-					rspamd_url_trie_callback, &cb, NULL);
+					rspamd_url_trie_callback, &cb);
 		}
 	}
 	else {
 		cb.matchers = url_scanner->matchers_strict;
-		ret = rspamd_multipattern_lookup (url_scanner->search_trie_strict,
+		ret = rspamd_url_lookup_anchored (url_scanner->search_trie_strict,
 				begin, len,
-				rspamd_url_trie_callback, &cb, NULL);
+				rspamd_url_trie_callback, &cb);
 	}
 
 	if (ret) {
@@ -3343,12 +3473,12 @@ rspamd_url_trie_generic_callback_common (struct rspamd_multipattern *mp,
 		}
 	}
 
-	if (!rspamd_url_trie_is_match (matcher, pos, text + len, newline_pos)) {
+	if (!rspamd_url_trie_is_match (matcher, pos, cb->end, newline_pos)) {
 		/* Mismatch, continue */
 		return 0;
 	}
 
-	pos = cb->begin + match_start;
+	pos = text + match_start;
 	m.pattern = matcher->pattern;
 	m.prefix = matcher->prefix;
 	m.add_prefix = FALSE;
@@ -3393,7 +3523,8 @@ rspamd_url_trie_generic_callback_common (struct rspamd_multipattern *mp,
 			}
 
 			if (cb->func) {
-				if (!cb->func (url, cb->start - text, (m.m_begin + m.m_len) - text,
+				if (!cb->func (url, cb->start - cb->begin,
+						(m.m_begin + m.m_len) - cb->begin,
 						cb->funcd)) {
 					/* We need to stop here in any case! */
 					return -1;
@@ -3605,22 +3736,22 @@ rspamd_url_find_multiple (rspamd_mempool_t *pool,
 	if (how == RSPAMD_URL_FIND_ALL) {
 		if (url_scanner->search_trie_full) {
 			cb.matchers = url_scanner->matchers_full;
-			rspamd_multipattern_lookup (url_scanner->search_trie_full,
+			rspamd_url_lookup_anchored (url_scanner->search_trie_full,
 					in, inlen,
-					rspamd_url_trie_generic_callback_multiple, &cb, NULL);
+					rspamd_url_trie_generic_callback_multiple, &cb);
 		}
 		else {
 			cb.matchers = url_scanner->matchers_strict;
-			rspamd_multipattern_lookup (url_scanner->search_trie_strict,
+			rspamd_url_lookup_anchored (url_scanner->search_trie_strict,
 					in, inlen,
-					rspamd_url_trie_generic_callback_multiple, &cb, NULL);
+					rspamd_url_trie_generic_callback_multiple, &cb);
 		}
 	}
 	else {
 		cb.matchers = url_scanner->matchers_strict;
-		rspamd_multipattern_lookup (url_scanner->search_trie_strict,
+		rspamd_url_lookup_anchored (url_scanner->search_trie_strict,
 				in, inlen,
-				rspamd_url_trie_generic_callback_multiple, &cb, NULL);
+				rspamd_url_trie_generic_callback_multiple, &cb);
 	}
 }
 
@@ -3661,22 +3792,22 @@ rspamd_url_find_single (rspamd_mempool_t *pool,
 	if (how == RSPAMD_URL_FIND_ALL) {
 		if (url_scanner->search_trie_full) {
 			cb.matchers = url_scanner->matchers_full;
-			rspamd_multipattern_lookup (url_scanner->search_trie_full,
+			rspamd_url_lookup_anchored (url_scanner->search_trie_full,
 					in, inlen,
-					rspamd_url_trie_generic_callback_single, &cb, NULL);
+					rspamd_url_trie_generic_callback_single, &cb);
 		}
 		else {
 			cb.matchers = url_scanner->matchers_strict;
-			rspamd_multipattern_lookup (url_scanner->search_trie_strict,
+			rspamd_url_lookup_anchored (url_scanner->search_trie_strict,
 					in, inlen,
-					rspamd_url_trie_generic_callback_single, &cb, NULL);
+					rspamd_url_trie_generic_callback_single, &cb);
 		}
 	}
 	else {
 		cb.matchers = url_scanner->matchers_strict;
-		rspamd_multipattern_lookup (url_scanner->search_trie_strict,
+		rspamd_url_lookup_anchored (url_scanner->search_trie_strict,
 				in, inlen,
-				rspamd_url_trie_generic_callback_single, &cb, NULL);
+				rspamd_url_trie_generic_callback_single, &cb);
 	}
 }
 
@@ -135,6 +135,13 @@ void rspamd_url_init(const gchar *tld_file);
 
 void rspamd_url_deinit(void);
 
+/**
+ * Enables or disables prefiltering of text before url matching (enabled by
+ * default), disabled prefilter is used to compare results in tests
+ * @param enabled
+ */
+void rspamd_url_set_prefilter(gboolean enabled);
+
 /*
  * Parse urls inside text
  * @param pool memory pool
@@ -842,6 +842,8 @@ rspamd_worker_heartbeat_cb (EV_P_ ev_timer *w, int revents)
 	memset (&cmd, 0, sizeof (cmd));
 	cmd.type = RSPAMD_SRV_HEARTBEAT;
 	rspamd_srv_send_command (wrk, EV_A, &cmd, -1, NULL, NULL);
+	/* Release pool chunks that have not been reused since the last beat */
+	rspamd_mempool_cache_trim (FALSE);
 }
 
 static void
@@ -115,11 +115,25 @@ struct rspamd_stat_backend {
         void rspamd_##name##_close (gpointer ctx)
 
 RSPAMD_STAT_BACKEND_DEF(mmaped_file);
+RSPAMD_STAT_BACKEND_DEF(mmaped_table);
 RSPAMD_STAT_BACKEND_DEF(sqlite3);
 RSPAMD_STAT_BACKEND_DEF(cdb);
 RSPAMD_STAT_BACKEND_DEF(redis);
 RSPAMD_STAT_BACKEND_DEF(http);
 
+typedef void (*rspamd_stat_token_cb) (guint64 token, gdouble value, gpointer ud);
+
+/**
+ * Iterates over all tokens of a legacy mmap statfile (used by converters)
+ * @param filename path to statfile
+ * @param cb callback for each token
+ * @param ud user data for callback
+ * @param learns output number of learns
+ * @return TRUE if file is valid
+ */
+gboolean rspamd_mmaped_file_foreach_token (const gchar *filename,
+		rspamd_stat_token_cb cb, gpointer ud, guint64 *learns);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -17,10 +17,14 @@
 #include "config.h"
 #include "stat_internal.h"
 #include "libserver/http/http_connection.h"
+#include "libserver/http/http_message.h"
 #include "libserver/mempool_vars_internal.h"
 #include "upstream.h"
 #include "contrib/ankerl/unordered_dense.h"
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
 
 namespace rspamd::stat::http {
 
@@ -31,6 +35,14 @@ namespace rspamd::stat::http {
 
 INIT_LOG_MODULE(stat_http)
 
+static const char *M = "http statistics";
+
+static GQuark
+rspamd_http_stat_quark(void)
+{
+	return g_quark_from_static_string(M);
+}
+
 /* Represents all http backends defined in some configuration */
 class http_backends_collection {
 	std::vector<struct rspamd_statfile *> backends;
@@ -67,6 +79,10 @@ public:
 
 	upstream *get_upstream(bool is_learn);
 
+	auto get_timeout() const -> double {
+		return timeout;
+	}
+
 private:
 	http_backends_collection() = default;
 	auto first_init(struct rspamd_stat_ctx *ctx,
@@ -75,7 +91,8 @@ private:
 };
 
 /*
- * Created one per each task
+ * Created one per each task (and one more for learning), shared by all
+ * statfiles, so all of them are fetched or learned by a single request
  */
 class http_backend_runtime final {
 public:
@@ -89,30 +106,138 @@ public:
 						GPtrArray* tokens,
 						gint id,
 						bool learn) -> bool;
+	/* Returns false if the request has failed */
+	auto finalize(GError **err) -> bool;
+	auto get_learns(int id) const -> gulong {
+		auto found = learns.find(id);
+
+		if (found != learns.end()) {
+			return found->second;
+		}
+
+		return 0;
+	}
 private:
+	struct rspamd_task *task;
 	http_backends_collection *all_backends;
 	ankerl::unordered_dense::map<int, const struct rspamd_statfile_config *> seen_statfiles;
+	/* Statfiles ids in the order they are sent in the current request */
+	std::vector<int> requested_ids;
+	ankerl::unordered_dense::map<int, gulong> learns;
 	struct upstream *selected;
+	struct rspamd_http_connection *conn = nullptr;
+	bool has_event = false;
+	bool sent = false;
+	GError *err = nullptr;
 private:
 	http_backend_runtime(struct rspamd_task *task, bool is_learn) :
-			all_backends(&http_backends_collection::get()) {
+			task(task), all_backends(&http_backends_collection::get()) {
 		selected = all_backends->get_upstream(is_learn);
 	}
-	~http_backend_runtime() = default;
+	~http_backend_runtime() {
+		if (conn) {
+			rspamd_http_connection_unref(conn);
+		}
+
+		if (err) {
+			g_error_free(err);
+		}
+	}
 	static auto dtor(void *p) -> void {
 		((http_backend_runtime *)p)->~http_backend_runtime();
 	}
+
+	auto send_request(const char *path, std::vector<std::uint8_t> &&payload) -> bool;
+	auto process_reply(const gchar *body, gsize len) -> bool;
+	auto set_error(int code, const char *reason) -> void;
+	auto finish_event() -> void;
+	static auto session_fin(gpointer ud) -> void;
+	static auto error_handler(struct rspamd_http_connection *conn, GError *err) -> void;
+	static auto finish_handler(struct rspamd_http_connection *conn,
+							   struct rspamd_http_message *msg) -> int;
 };
 
+/*
+ * Runtime handle for a specific statfile: backends API does not pass statfile
+ * id to some methods (e.g. `total_learns`)
+ */
+struct http_statfile_runtime {
+	http_backend_runtime *rt;
+	int id;
+};
+
+/*
+ * Minimal messagepack writers, we use just a small subset of the format:
+ * maps and arrays headers, strings, 64 bit integers and doubles
+ */
+static auto
+msgpack_append_be(std::vector<std::uint8_t> &ret, std::uint8_t marker,
+				  std::uint64_t val, std::size_t nbytes) -> void
+{
+	ret.push_back(marker);
+
+	for (auto i = nbytes; i > 0; i --) {
+		ret.push_back((val >> ((i - 1) * 8)) & 0xff);
+	}
+}
+
+static auto
+msgpack_append_container(std::vector<std::uint8_t> &ret, bool is_map,
+						 std::size_t nelts) -> void
+{
+	if (nelts < 16) {
+		ret.push_back((is_map ? 0x80 : 0x90) | nelts);
+	}
+	else if (nelts <= G_MAXUINT16) {
+		msgpack_append_be(ret, is_map ? 0xde : 0xdc, nelts, 2);
+	}
+	else {
+		msgpack_append_be(ret, is_map ? 0xdf : 0xdd, nelts, 4);
+	}
+}
+
+static auto
+msgpack_append_str(std::vector<std::uint8_t> &ret, std::string_view str) -> void
+{
+	if (str.size() < 32) {
+		ret.push_back(0xa0 | str.size());
+	}
+	else if (str.size() <= G_MAXUINT8) {
+		msgpack_append_be(ret, 0xd9, str.size(), 1);
+	}
+	else if (str.size() <= G_MAXUINT16) {
+		msgpack_append_be(ret, 0xda, str.size(), 2);
+	}
+	else {
+		msgpack_append_be(ret, 0xdb, str.size(), 4);
+	}
+
+	ret.insert(ret.end(), str.begin(), str.end());
+}
+
+static auto
+msgpack_append_int(std::vector<std::uint8_t> &ret, std::int64_t val) -> void
+{
+	msgpack_append_be(ret, 0xd3, (std::uint64_t)val, sizeof(val));
+}
+
+static auto
+msgpack_append_double(std::vector<std::uint8_t> &ret, double val) -> void
+{
+	std::uint64_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+	msgpack_append_be(ret, 0xcb, bits, sizeof(bits));
+}
+
 /*
  * Efficient way to make a messagepack payload from stat tokens,
  * avoiding any intermediate libraries, as we would send many tokens
  * all together
  */
 static auto
-stat_tokens_to_msgpack(GPtrArray *tokens) -> std::vector<std::uint8_t>
+stat_tokens_to_msgpack(GPtrArray *tokens, std::vector<std::uint8_t> &ret) -> void
 {
-	std::vector<std::uint8_t> ret;
 	rspamd_token_t *cur;
 	int i;
 
@@ -123,20 +248,12 @@ stat_tokens_to_msgpack(GPtrArray *tokens) -> std::vector<std::uint8_t>
 	 * [4 bytes be] - size of the array
 	 * [ 0xcf + <8 bytes BE integer>] * N - array elements
 	 */
-	ret.resize(tokens->len * (sizeof(std::uint64_t) + 1) + 5);
-	ret.push_back('\xdd');
-	std::uint32_t ulen = GUINT32_TO_BE(tokens->len);
-	std::copy((const std::uint8_t *)&ulen,
-			((const std::uint8_t *)&ulen) + sizeof(ulen), std::back_inserter(ret));
+	ret.reserve(ret.size() + tokens->len * (sizeof(std::uint64_t) + 1) + 5);
+	msgpack_append_be(ret, 0xdd, tokens->len, sizeof(std::uint32_t));
 
 	PTR_ARRAY_FOREACH(tokens, i, cur) {
-		ret.push_back('\xcf');
-		std::uint64_t val = GUINT64_TO_BE(cur->data);
-		std::copy((const std::uint8_t *)&val,
-				((const std::uint8_t *)&val) + sizeof(val), std::back_inserter(ret));
+		msgpack_append_be(ret, 0xcf, cur->data, sizeof(std::uint64_t));
 	}
-
-	return ret;
 }
 
 auto http_backend_runtime::create(struct rspamd_task *task, bool is_learn) -> http_backend_runtime *
@@ -149,23 +266,344 @@ auto http_backend_runtime::create(struct rspamd_task *task, bool is_learn) -> ht
 	return new (allocated_runtime) http_backend_runtime{task, is_learn};
 }
 
+/*
+ * Classify request:
+ * {"statfiles": [<symbol>, ...], "tokens": [<uint64>, ...]}
+ * Learn request additionally contains per statfile increments:
+ * {..., "values": [[<double per token>, ...], ...], "learns": [<int>, ...]}
+ * Reply:
+ * {"learns": [<int per statfile>, ...], "values": [[<number per token>, ...], ...]}
+ * where `values` are optional for learn replies
+ */
 auto
 http_backend_runtime::process_tokens(struct rspamd_task *task, GPtrArray *tokens, gint id, bool learn) -> bool
 {
+	if (sent) {
+		/* All statfiles have been already requested by a single request */
+		return true;
+	}
+
+	if (tokens == nullptr || tokens->len == 0 || rspamd_session_blocked(task->s)) {
+		return false;
+	}
+
+	std::vector<std::uint8_t> payload;
+
 	if (!learn) {
-		if (id == seen_statfiles.size() - 1) {
+		auto max_id = -1;
+
+		for (const auto &[seen_id, _] : seen_statfiles) {
+			max_id = MAX(max_id, seen_id);
+		}
+
+		if (id != max_id) {
 			/* Emit http request on the last statfile */
+			return true;
+		}
+
+		for (const auto &[seen_id, _] : seen_statfiles) {
+			requested_ids.push_back(seen_id);
 		}
+
+		std::sort(requested_ids.begin(), requested_ids.end());
+		msgpack_append_container(payload, true, 2);
 	}
 	else {
-		/* On learn we need to learn all statfiles that we were requested to learn */
-		if (seen_statfiles.empty()) {
-			/* Request has been already set, or nothing to learn */
-			return true;
+		/*
+		 * On learn we need to learn all statfiles that we were requested to learn,
+		 * this is the first statfile of the learned classifier, so we select
+		 * the same class statfiles (or all statfiles on unlearn) from it
+		 */
+		auto *st_ctx = rspamd_stat_get_ctx();
+		auto *st = (struct rspamd_statfile *)g_ptr_array_index(st_ctx->statfiles, id);
+		auto unlearn = !!(task->flags & RSPAMD_TASK_FLAG_UNLEARN);
+
+		for (auto i = 0u; i < st->classifier->statfiles_ids->len; i ++) {
+			auto cl_id = g_array_index(st->classifier->statfiles_ids, gint, i);
+			auto found = seen_statfiles.find(cl_id);
+
+			if (found != seen_statfiles.end() &&
+				(unlearn || !!found->second->is_spam == !!st->stcf->is_spam)) {
+				requested_ids.push_back(cl_id);
+			}
+		}
+
+		msgpack_append_container(payload, true, 4);
+	}
+
+	msgpack_append_str(payload, "statfiles");
+	msgpack_append_container(payload, false, requested_ids.size());
+
+	for (auto req_id : requested_ids) {
+		msgpack_append_str(payload, seen_statfiles[req_id]->symbol);
+	}
+
+	msgpack_append_str(payload, "tokens");
+	stat_tokens_to_msgpack(tokens, payload);
+
+	if (learn) {
+		auto *first_tok = (rspamd_token_t *)g_ptr_array_index(tokens, 0);
+
+		msgpack_append_str(payload, "values");
+		msgpack_append_container(payload, false, requested_ids.size());
+
+		for (auto req_id : requested_ids) {
+			rspamd_token_t *tok;
+			int i;
+
+			msgpack_append_container(payload, false, tokens->len);
+
+			PTR_ARRAY_FOREACH(tokens, i, tok) {
+				msgpack_append_double(payload, tok->values[req_id]);
+			}
+		}
+
+		/* Like in Redis backend, the sign of values defines learn or unlearn */
+		msgpack_append_str(payload, "learns");
+		msgpack_append_container(payload, false, requested_ids.size());
+
+		for (auto req_id : requested_ids) {
+			auto val = first_tok->values[req_id];
+			msgpack_append_int(payload, val > 0 ? 1 : (val < 0 ? -1 : 0));
+		}
+	}
+
+	sent = true;
+
+	return send_request(learn ? "/learn" : "/classify", std::move(payload));
+}
+
+auto
+http_backend_runtime::send_request(const char *path, std::vector<std::uint8_t> &&payload) -> bool
+{
+	if (selected == nullptr) {
+		msg_err_task("no servers defined for http statistics");
+
+		return false;
+	}
+
+	auto *addr = rspamd_upstream_addr_next(selected);
+	conn = rspamd_http_connection_new_client_keepalive(nullptr,
+			nullptr,
+			http_backend_runtime::error_handler,
+			http_backend_runtime::finish_handler,
+			RSPAMD_HTTP_CLIENT_SIMPLE,
+			addr,
+			rspamd_upstream_name(selected));
+
+	if (conn == nullptr) {
+		msg_err_task("cannot connect to http statistics server %s",
+				rspamd_upstream_name(selected));
+		rspamd_upstream_fail(selected, TRUE, "cannot connect");
+
+		return false;
+	}
+
+	auto *msg = rspamd_http_new_message(HTTP_REQUEST);
+	msg->url = rspamd_fstring_append(msg->url, path, strlen(path));
+	msg->method = HTTP_POST;
+	rspamd_http_message_set_body(msg, (const gchar *)payload.data(), payload.size());
+
+	conn->log_tag = task->task_pool->tag.uid;
+	rspamd_session_add_event(task->s, http_backend_runtime::session_fin, this, M);
+	has_event = true;
+
+	msg_debug_stat_http("send %s request with %d statfiles to %s; %z bytes",
+			path, (int)requested_ids.size(), rspamd_upstream_name(selected),
+			payload.size());
+
+	/* Message is now owned by a connection object */
+	if (!rspamd_http_connection_write_message(conn, msg,
+			rspamd_upstream_name(selected), "application/msgpack", this,
+			all_backends->get_timeout())) {
+		msg_err_task("cannot send request to http statistics server %s",
+				rspamd_upstream_name(selected));
+		rspamd_upstream_fail(selected, TRUE, "cannot send request");
+		finish_event();
+
+		return false;
+	}
+
+	return true;
+}
+
+auto
+http_backend_runtime::process_reply(const gchar *body, gsize len) -> bool
+{
+	auto *parser = ucl_parser_new(0);
+
+	if (!ucl_parser_add_chunk_full(parser, (const unsigned char *)body, len,
+			0, UCL_DUPLICATE_APPEND, UCL_PARSE_MSGPACK)) {
+		msg_err_task("cannot parse reply from %s: %s",
+				rspamd_upstream_name(selected), ucl_parser_get_error(parser));
+		ucl_parser_free(parser);
+
+		return false;
+	}
+
+	auto *top = ucl_parser_get_object(parser);
+	ucl_parser_free(parser);
+
+	const auto *learns_obj = ucl_object_lookup(top, "learns");
+	const auto *values_obj = ucl_object_lookup(top, "values");
+
+	if (learns_obj == nullptr || ucl_object_type(learns_obj) != UCL_ARRAY ||
+		learns_obj->len != requested_ids.size()) {
+		msg_err_task("invalid reply from %s: bad learns array",
+				rspamd_upstream_name(selected));
+		ucl_object_unref(top);
+
+		return false;
+	}
+
+	if (values_obj != nullptr && (ucl_object_type(values_obj) != UCL_ARRAY ||
+		values_obj->len != requested_ids.size())) {
+		msg_err_task("invalid reply from %s: bad values array",
+				rspamd_upstream_name(selected));
+		ucl_object_unref(top);
+
+		return false;
+	}
+
+	for (auto i = 0u; i < requested_ids.size(); i ++) {
+		auto id = requested_ids[i];
+		const auto *st = seen_statfiles[id];
+
+		learns[id] = ucl_object_toint(ucl_array_find_index(learns_obj, i));
+
+		if (values_obj == nullptr) {
+			continue;
+		}
+
+		const auto *st_values = ucl_array_find_index(values_obj, i);
+
+		if (ucl_object_type(st_values) != UCL_ARRAY || st_values->len != task->tokens->len) {
+			msg_err_task("invalid reply from %s: got %d values for %s, %d expected",
+					rspamd_upstream_name(selected),
+					(int)(st_values ? st_values->len : 0), st->symbol,
+					(int)task->tokens->len);
+			ucl_object_unref(top);
+
+			return false;
+		}
+
+		ucl_object_iter_t it = nullptr;
+		const ucl_object_t *cur;
+		auto tok_idx = 0u, found = 0u;
+
+		while ((cur = ucl_object_iterate(st_values, &it, true)) != nullptr) {
+			auto *tok = (rspamd_token_t *)g_ptr_array_index(task->tokens, tok_idx);
+			tok->values[id] = ucl_object_todouble(cur);
+
+			if (tok->values[id] != 0) {
+				found ++;
+			}
+
+			tok_idx ++;
+		}
+
+		if (st->is_spam) {
+			task->flags |= RSPAMD_TASK_FLAG_HAS_SPAM_TOKENS;
 		}
 		else {
-			seen_statfiles.clear();
+			task->flags |= RSPAMD_TASK_FLAG_HAS_HAM_TOKENS;
 		}
+
+		msg_debug_stat_http("received tokens for %s: %d processed, %d found; %L learns",
+				st->symbol, (int)tok_idx, (int)found, (gint64)learns[id]);
+	}
+
+	ucl_object_unref(top);
+
+	return true;
+}
+
+auto
+http_backend_runtime::set_error(int code, const char *reason) -> void
+{
+	if (err == nullptr) {
+		g_set_error(&err, rspamd_http_stat_quark(), code,
+				"error getting reply from http statistics server %s: %s",
+				rspamd_upstream_name(selected), reason);
+	}
+}
+
+auto
+http_backend_runtime::finish_event() -> void
+{
+	if (has_event) {
+		/* Calls session_fin */
+		rspamd_session_remove_event(task->s, http_backend_runtime::session_fin, this);
+	}
+}
+
+auto
+http_backend_runtime::session_fin(gpointer ud) -> void
+{
+	auto *rt = (http_backend_runtime *)ud;
+
+	rt->has_event = false;
+
+	if (rt->conn) {
+		rspamd_http_connection_unref(rt->conn);
+		rt->conn = nullptr;
+	}
+}
+
+auto
+http_backend_runtime::error_handler(struct rspamd_http_connection *conn, GError *err) -> void
+{
+	auto *rt = (http_backend_runtime *)conn->ud;
+	auto *task = rt->task;
+
+	msg_info_task("error getting reply from http statistics server %s: %e",
+			rspamd_upstream_name(rt->selected), err);
+	rspamd_upstream_fail(rt->selected, FALSE, err ? err->message : "unknown error");
+	rt->set_error(err ? err->code : EINVAL, err ? err->message : "unknown error");
+	rt->finish_event();
+}
+
+auto
+http_backend_runtime::finish_handler(struct rspamd_http_connection *conn,
+									 struct rspamd_http_message *msg) -> int
+{
+	auto *rt = (http_backend_runtime *)conn->ud;
+	const gchar *body;
+	gsize body_len;
+
+	if (msg->code != 200) {
+		rt->set_error(msg->code, "bad reply code");
+		rspamd_upstream_fail(rt->selected, FALSE, "bad reply code");
+	}
+	else {
+		body = rspamd_http_message_get_body(msg, &body_len);
+
+		if (!rt->process_reply(body, body_len)) {
+			rt->set_error(EINVAL, "invalid reply");
+		}
+
+		rspamd_upstream_ok(rt->selected);
+	}
+
+	rt->finish_event();
+
+	return 0;
+}
+
+auto
+http_backend_runtime::finalize(GError **perr) -> bool
+{
+	if (err) {
+		if (perr) {
+			g_propagate_error(perr, err);
+		}
+		else {
+			g_error_free(err);
+		}
+
+		err = nullptr;
+
+		return false;
 	}
 
 	return true;
@@ -198,7 +636,7 @@ auto http_backends_collection::first_init(struct rspamd_stat_ctx *ctx,
 		}
 
 		/* First try to load read servers */
-		auto *rs = ucl_object_lookup_any(obj, "read_servers", "servers", nullptr);
+		auto *rs = ucl_object_lookup_any(obj, "read_servers", "servers", "server", nullptr);
 		if (rs) {
 			read_servers = rspamd_upstreams_create(cfg->ups_ctx);
 
@@ -211,7 +649,7 @@ auto http_backends_collection::first_init(struct rspamd_stat_ctx *ctx,
 				return false;
 			}
 		}
-		auto *ws = ucl_object_lookup_any(obj, "write_servers", "servers", nullptr);
+		auto *ws = ucl_object_lookup_any(obj, "write_servers", "servers", "server", nullptr);
 		if (ws) {
 			write_servers = rspamd_upstreams_create(cfg->ups_ctx);
 
@@ -219,7 +657,7 @@ auto http_backends_collection::first_init(struct rspamd_stat_ctx *ctx,
 				return false;
 			}
 
-			if (!rspamd_upstreams_from_ucl(write_servers, rs, 80, this)) {
+			if (!rspamd_upstreams_from_ucl(write_servers, ws, 80, this)) {
 				rspamd_upstreams_destroy(write_servers);
 				return false;
 			}
@@ -231,10 +669,13 @@ auto http_backends_collection::first_init(struct rspamd_stat_ctx *ctx,
 			timeout = ucl_object_todouble(tim);
 		}
 
-		return true;
+		return read_servers != nullptr || write_servers != nullptr;
 	};
 
 	auto ret = false;
+	/* Values sent on learn are increments, like in Redis */
+	st->classifier->cfg->flags |= RSPAMD_FLAG_CLASSIFIER_INCREMENTING_BACKEND;
+
 	auto obj = ucl_object_lookup (st->classifier->cfg->opts, "backend");
 	if (obj != nullptr) {
 		ret = try_load_backend_config(obj);
@@ -288,6 +729,10 @@ upstream *http_backends_collection::get_upstream(bool is_learn)
 		ups_list = write_servers;
 	}
 
+	if (ups_list == nullptr) {
+		return nullptr;
+	}
+
 	return rspamd_upstream_get(ups_list, RSPAMD_UPSTREAM_ROUND_ROBIN, nullptr, 0);
 }
 
@@ -317,24 +762,37 @@ rspamd_http_runtime(struct rspamd_task* task,
 					gpointer ctx,
 					gint id)
 {
-	auto maybe_existing = rspamd_mempool_get_variable(task->task_pool, RSPAMD_MEMPOOL_HTTP_STAT_BACKEND_RUNTIME);
-
-	if (maybe_existing != nullptr) {
-		auto real_runtime = (rspamd::stat::http::http_backend_runtime *)maybe_existing;
-		real_runtime->notice_statfile(id, stcf);
+	/*
+	 * Learn runtime must not reuse the classification one; classifiers are
+	 * learned by separate requests, so each of them has its own runtime
+	 */
+	std::string var_name = RSPAMD_MEMPOOL_HTTP_STAT_BACKEND_RUNTIME;
 
-		return maybe_existing;
+	if (learn) {
+		var_name = RSPAMD_MEMPOOL_HTTP_STAT_BACKEND_LEARN_RUNTIME;
+		if (stcf->clcf->name) {
+			var_name += "_";
+			var_name += stcf->clcf->name;
+		}
 	}
 
-	auto runtime = rspamd::stat::http::http_backend_runtime::create(task, learn);
+	auto *runtime = (rspamd::stat::http::http_backend_runtime *)
+			rspamd_mempool_get_variable(task->task_pool, var_name.c_str());
 
-	if (runtime) {
-		runtime->notice_statfile(id, stcf);
-		rspamd_mempool_set_variable(task->task_pool, RSPAMD_MEMPOOL_HTTP_STAT_BACKEND_RUNTIME,
+	if (runtime == nullptr) {
+		runtime = rspamd::stat::http::http_backend_runtime::create(task, learn);
+		rspamd_mempool_set_variable(task->task_pool, var_name.c_str(),
 				(void *)runtime, nullptr);
 	}
 
-	return (void *)runtime;
+	runtime->notice_statfile(id, stcf);
+
+	auto *st_runtime = rspamd_mempool_alloc_type(task->task_pool,
+			rspamd::stat::http::http_statfile_runtime);
+	st_runtime->rt = runtime;
+	st_runtime->id = id;
+
+	return (void *)st_runtime;
 }
 
 gboolean
@@ -343,23 +801,31 @@ rspamd_http_process_tokens(struct rspamd_task* task,
 						  gint id,
 						  gpointer runtime)
 {
-	auto real_runtime = (rspamd::stat::http::http_backend_runtime *)runtime;
+	auto *st_runtime = (rspamd::stat::http::http_statfile_runtime *)runtime;
 
-	if (real_runtime) {
-		return real_runtime->process_tokens(task, tokens, id, false);
+	if (st_runtime) {
+		return st_runtime->rt->process_tokens(task, tokens, id, false);
 	}
 
-
 	return false;
-
 }
+
 gboolean
 rspamd_http_finalize_process(struct rspamd_task* task,
 							gpointer runtime,
 							gpointer ctx)
 {
-	/* Not needed */
-	return true;
+	auto *st_runtime = (rspamd::stat::http::http_statfile_runtime *)runtime;
+	GError *err = nullptr;
+
+	if (!st_runtime->rt->finalize(&err)) {
+		msg_info_task("cannot retrieve stat tokens from http server: %e", err);
+		g_error_free(err);
+
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 gboolean
@@ -368,54 +834,62 @@ rspamd_http_learn_tokens(struct rspamd_task* task,
 						gint id,
 						gpointer runtime)
 {
-	auto real_runtime = (rspamd::stat::http::http_backend_runtime *)runtime;
+	auto *st_runtime = (rspamd::stat::http::http_statfile_runtime *)runtime;
 
-	if (real_runtime) {
-		return real_runtime->process_tokens(task, tokens, id, true);
+	if (st_runtime) {
+		return st_runtime->rt->process_tokens(task, tokens, id, true);
 	}
 
-
 	return false;
 }
+
 gboolean
 rspamd_http_finalize_learn(struct rspamd_task* task,
 						  gpointer runtime,
 						  gpointer ctx,
 						  GError** err)
 {
-	return false;
+	auto *st_runtime = (rspamd::stat::http::http_statfile_runtime *)runtime;
+
+	return st_runtime->rt->finalize(err);
 }
 
 gulong rspamd_http_total_learns(struct rspamd_task* task,
 							   gpointer runtime,
 							   gpointer ctx)
 {
-	/* TODO */
-	return 0;
+	auto *st_runtime = (rspamd::stat::http::http_statfile_runtime *)runtime;
+
+	return st_runtime->rt->get_learns(st_runtime->id);
 }
 gulong
 rspamd_http_inc_learns(struct rspamd_task* task,
 					  gpointer runtime,
 					  gpointer ctx)
 {
-	/* TODO */
-	return 0;
+	auto *st_runtime = (rspamd::stat::http::http_statfile_runtime *)runtime;
+
+	/* Learns are incremented by the server */
+	return st_runtime->rt->get_learns(st_runtime->id) + 1;
 }
 gulong
 rspamd_http_dec_learns(struct rspamd_task* task,
 					  gpointer runtime,
 					  gpointer ctx)
 {
-	/* TODO */
-	return (gulong)-1;
+	auto *st_runtime = (rspamd::stat::http::http_statfile_runtime *)runtime;
+	auto learns = st_runtime->rt->get_learns(st_runtime->id);
+
+	return learns > 0 ? learns - 1 : 0;
 }
 gulong
 rspamd_http_learns(struct rspamd_task* task,
 				  gpointer runtime,
 				  gpointer ctx)
 {
-	/* TODO */
-	return 0;
+	auto *st_runtime = (rspamd::stat::http::http_statfile_runtime *)runtime;
+
+	return st_runtime->rt->get_learns(st_runtime->id);
 }
 ucl_object_t*
 rspamd_http_get_stat(gpointer runtime, gpointer ctx)
@@ -1109,6 +1109,76 @@ rspamd_mmaped_file_finalize_process (struct rspamd_task *task, gpointer runtime,
 	return TRUE;
 }
 
+gboolean
+rspamd_mmaped_file_foreach_token (const gchar *filename,
+		rspamd_stat_token_cb cb, gpointer ud, guint64 *learns)
+{
+	static gchar valid_version[] = RSPAMD_STATFILE_VERSION;
+	struct stat_file *f;
+	struct stat_file_block *block;
+	struct stat st;
+	guint64 i, token;
+	guchar *map;
+	gint fd;
+
+	if ((fd = open (filename, O_RDONLY)) == -1) {
+		msg_err ("cannot open file %s, error %d, %s", filename, errno,
+				strerror (errno));
+		return FALSE;
+	}
+
+	if (fstat (fd, &st) == -1 || st.st_size < (off_t)sizeof (struct stat_file)) {
+		msg_err ("file %s is too short to be stat file", filename);
+		close (fd);
+
+		return FALSE;
+	}
+
+	if ((map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+			MAP_FAILED) {
+		msg_err ("cannot mmap file %s, error %d, %s", filename, errno,
+				strerror (errno));
+		close (fd);
+
+		return FALSE;
+	}
+
+	f = (struct stat_file *)map;
+
+	if (memcmp (f->header.magic, "rsd", sizeof (f->header.magic)) != 0 ||
+			memcmp (f->header.version, valid_version, sizeof (valid_version)) != 0 ||
+			(sizeof (struct stat_file) - sizeof (struct stat_file_block)) +
+			f->section.length * sizeof (struct stat_file_block) >
+			(guint64)st.st_size) {
+		msg_err ("file %s is invalid stat file", filename);
+		munmap (map, st.st_size);
+		close (fd);
+
+		return FALSE;
+	}
+
+	for (i = 0; i < f->section.length; i ++) {
+		block = &f->blocks[i];
+
+		if ((block->hash1 != 0 || block->hash2 != 0) && block->value != 0) {
+			/* Reverse of splitting token data in process_tokens */
+			memcpy ((guchar *)&token, &block->hash1, sizeof (block->hash1));
+			memcpy (((guchar *)&token) + sizeof (block->hash1), &block->hash2,
+					sizeof (block->hash2));
+			cb (token, block->value, ud);
+		}
+	}
+
+	if (learns) {
+		*learns = f->header.revision;
+	}
+
+	munmap (map, st.st_size);
+	close (fd);
+
+	return TRUE;
+}
+
 gpointer
 rspamd_mmaped_file_load_tokenizer_config (gpointer runtime,
 		gsize *len)
@@ -0,0 +1,1011 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "stat_internal.h"
+#include "mmaped_table.h"
+#include "unix-std.h"
+
+/*
+ * File layout: 256 bytes header followed by a power of two number of cache
+ * line sized buckets. Each bucket holds up to 5 tokens with their counters,
+ * tokens that do not fit are placed in the following buckets (up to
+ * MMAPED_TABLE_MAX_PROBES). Empty slots have zero key.
+ *
+ * Tokens are inserted and counters are changed by atomic operations, so
+ * workers learn concurrently. Growth is done by building a larger file and
+ * renaming it over the old one, the old file is marked as obsolete and other
+ * processes remap statfile on the next task. Learners hold a shared lock on
+ * the file, whereas growth requires an exclusive one.
+ */
+
+#define MMAPED_TABLE_MAGIC "rsstat01"
+#define MMAPED_TABLE_VERSION 1
+#define MMAPED_TABLE_SLOTS 5
+#define MMAPED_TABLE_MAX_PROBES 16
+#define MMAPED_TABLE_MIN_BUCKETS 1024
+#define MMAPED_TABLE_MAX_LOAD 0.75
+/* Attempts to take a shared lock while the file is being grown */
+#define MMAPED_TABLE_LOCK_TRIES 10
+#define MMAPED_TABLE_LOCK_WAIT 1000 /* microseconds */
+/* Token 0 is used to mark empty slots */
+#define MMAPED_TABLE_KEY(tok) ((tok) == 0 ? 1 : (tok))
+
+#define msg_debug_stat_mmap(...)  rspamd_conditional_debug_fast (NULL, NULL, \
+        rspamd_stat_mmap_table_log_id, "mmap_table", "", \
+        G_STRFUNC, \
+        __VA_ARGS__)
+
+INIT_LOG_MODULE(stat_mmap_table)
+
+struct rspamd_mmaped_table_header {
+	gchar magic[8];
+	guint32 version;
+	guint32 obsolete;
+	guint64 nbuckets;
+	guint64 used;
+	gint64 learns;
+	guint64 create_time;
+	guint64 tokenizer_conf_len;
+	guchar tokenizer_conf[200];
+};
+
+struct rspamd_mmaped_table_bucket {
+	guint64 keys[MMAPED_TABLE_SLOTS];
+	guint32 values[MMAPED_TABLE_SLOTS];
+	guint32 reserved;
+};
+
+struct rspamd_mmaped_table {
+	gchar *filename;
+	struct rspamd_mmaped_table_header *hdr;
+	struct rspamd_mmaped_table_bucket *buckets;
+	gsize len;
+	gint fd;
+	struct rspamd_statfile_config *stcf;
+};
+
+struct rspamd_mmaped_table_pending {
+	guint64 key;
+	gint64 delta;
+};
+
+struct rspamd_mmaped_table_runtime {
+	rspamd_mmaped_table_t *tbl;
+	/* Tokens that have not fit into statfile during learning */
+	GArray *pending;
+	gboolean need_grow;
+};
+
+static GQuark
+rspamd_mmaped_table_quark (void)
+{
+	return g_quark_from_static_string ("mmap-table-backend");
+}
+
+static gboolean
+rspamd_mmaped_table_lock (gint fd, gboolean exclusive, gboolean nonblock)
+{
+#ifdef HAVE_FLOCK
+	return flock (fd, (exclusive ? LOCK_EX : LOCK_SH) |
+			(nonblock ? LOCK_NB : 0)) == 0;
+#else
+	struct flock fl = {
+			.l_type = exclusive ? F_WRLCK : F_RDLCK,
+			.l_whence = SEEK_SET,
+			.l_start = 0,
+			.l_len = 0
+	};
+
+	if (fcntl (fd, nonblock ? F_SETLK : F_SETLKW, &fl) == -1) {
+		if (errno == EACCES) {
+			errno = EAGAIN;
+		}
+
+		return FALSE;
+	}
+
+	return TRUE;
+#endif
+}
+
+static void
+rspamd_mmaped_table_unlock (gint fd)
+{
+#ifdef HAVE_FLOCK
+	(void)flock (fd, LOCK_UN);
+#else
+	struct flock fl = {
+			.l_type = F_UNLCK,
+			.l_whence = SEEK_SET,
+			.l_start = 0,
+			.l_len = 0
+	};
+
+	(void)fcntl (fd, F_SETLK, &fl);
+#endif
+}
+
+static inline gsize
+rspamd_mmaped_table_file_len (guint64 nbuckets)
+{
+	return sizeof (struct rspamd_mmaped_table_header) +
+			nbuckets * sizeof (struct rspamd_mmaped_table_bucket);
+}
+
+static guint64
+rspamd_mmaped_table_nbuckets (gsize size)
+{
+	guint64 nbuckets = MMAPED_TABLE_MIN_BUCKETS;
+
+	while (rspamd_mmaped_table_file_len (nbuckets * 2) <= size) {
+		nbuckets *= 2;
+	}
+
+	return nbuckets;
+}
+
+static gboolean
+rspamd_mmaped_table_map (rspamd_mmaped_table_t *tbl, gint fd, GError **err)
+{
+	struct rspamd_mmaped_table_header *hdr;
+	struct stat st;
+	void *map;
+
+	if (fstat (fd, &st) == -1) {
+		g_set_error (err, rspamd_mmaped_table_quark (), errno,
+				"cannot stat %s: %s", tbl->filename, strerror (errno));
+		return FALSE;
+	}
+
+	if ((gsize)st.st_size < sizeof (*hdr)) {
+		g_set_error (err, rspamd_mmaped_table_quark (), EINVAL,
+				"file %s is too short to be a statfile", tbl->filename);
+		return FALSE;
+	}
+
+	map = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED) {
+		g_set_error (err, rspamd_mmaped_table_quark (), errno,
+				"cannot mmap %s: %s", tbl->filename, strerror (errno));
+		return FALSE;
+	}
+
+	hdr = map;
+
+	if (memcmp (hdr->magic, MMAPED_TABLE_MAGIC, sizeof (hdr->magic)) != 0 ||
+			hdr->version != MMAPED_TABLE_VERSION ||
+			hdr->nbuckets == 0 || (hdr->nbuckets & (hdr->nbuckets - 1)) != 0 ||
+			rspamd_mmaped_table_file_len (hdr->nbuckets) != (gsize)st.st_size) {
+		g_set_error (err, rspamd_mmaped_table_quark (), EINVAL,
+				"file %s is not a valid statfile", tbl->filename);
+		munmap (map, st.st_size);
+
+		return FALSE;
+	}
+
+	if (tbl->hdr) {
+		munmap (tbl->hdr, tbl->len);
+	}
+
+	if (tbl->fd != -1) {
+		close (tbl->fd);
+	}
+
+	tbl->hdr = hdr;
+	tbl->buckets = (struct rspamd_mmaped_table_bucket *)(hdr + 1);
+	tbl->len = st.st_size;
+	tbl->fd = fd;
+
+	return TRUE;
+}
+
+/*
+ * Creates an empty statfile in a temporary file and returns its descriptor
+ */
+static gint
+rspamd_mmaped_table_create (const gchar *filename, guint64 nbuckets,
+		gconstpointer tok_conf, gsize tok_conf_len, GError **err)
+{
+	struct rspamd_mmaped_table_header hdr;
+	gint fd;
+
+	memset (&hdr, 0, sizeof (hdr));
+	memcpy (hdr.magic, MMAPED_TABLE_MAGIC, sizeof (hdr.magic));
+	hdr.version = MMAPED_TABLE_VERSION;
+	hdr.nbuckets = nbuckets;
+	hdr.create_time = (guint64)time (NULL);
+
+	if (tok_conf != NULL && tok_conf_len <= sizeof (hdr.tokenizer_conf)) {
+		hdr.tokenizer_conf_len = tok_conf_len;
+		memcpy (hdr.tokenizer_conf, tok_conf, tok_conf_len);
+	}
+
+	fd = open (filename, O_RDWR | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+
+	if (fd == -1) {
+		g_set_error (err, rspamd_mmaped_table_quark (), errno,
+				"cannot create %s: %s", filename, strerror (errno));
+		return -1;
+	}
+
+	if (ftruncate (fd, rspamd_mmaped_table_file_len (nbuckets)) == -1 ||
+			write (fd, &hdr, sizeof (hdr)) != sizeof (hdr)) {
+		g_set_error (err, rspamd_mmaped_table_quark (), errno,
+				"cannot write %s: %s", filename, strerror (errno));
+		close (fd);
+		unlink (filename);
+
+		return -1;
+	}
+
+	rspamd_fallocate (fd, 0, rspamd_mmaped_table_file_len (nbuckets));
+
+	return fd;
+}
+
+rspamd_mmaped_table_t *
+rspamd_mmaped_table_open (const gchar *filename, gsize size,
+		gconstpointer tok_conf, gsize tok_conf_len, GError **err)
+{
+	rspamd_mmaped_table_t *tbl;
+	gchar *tmp;
+	gint fd, saved_errno;
+
+	tbl = g_malloc0 (sizeof (*tbl));
+	tbl->filename = g_strdup (filename);
+	tbl->fd = -1;
+
+	for (;;) {
+		fd = open (filename, O_RDWR);
+
+		if (fd != -1 || errno != ENOENT) {
+			break;
+		}
+
+		/* Create file aside and publish it atomically */
+		tmp = g_strdup_printf ("%s.%d.new", filename, (gint)getpid ());
+		fd = rspamd_mmaped_table_create (tmp,
+				rspamd_mmaped_table_nbuckets (size), tok_conf, tok_conf_len, err);
+
+		if (fd == -1) {
+			g_free (tmp);
+			rspamd_mmaped_table_close_file (tbl);
+
+			return NULL;
+		}
+
+		if (link (tmp, filename) == 0) {
+			unlink (tmp);
+			g_free (tmp);
+			msg_info ("created statfile %s of size %Hz", filename,
+					rspamd_mmaped_table_file_len (rspamd_mmaped_table_nbuckets (size)));
+			break;
+		}
+
+		/* Somebody else has created it */
+		saved_errno = errno;
+		close (fd);
+		unlink (tmp);
+		g_free (tmp);
+		fd = -1;
+
+		if (saved_errno != EEXIST) {
+			errno = saved_errno;
+			break;
+		}
+	}
+
+	if (fd == -1) {
+		g_set_error (err, rspamd_mmaped_table_quark (), errno,
+				"cannot open %s: %s", filename, strerror (errno));
+		rspamd_mmaped_table_close_file (tbl);
+
+		return NULL;
+	}
+
+	if (!rspamd_mmaped_table_map (tbl, fd, err)) {
+		close (fd);
+		rspamd_mmaped_table_close_file (tbl);
+
+		return NULL;
+	}
+
+	return tbl;
+}
+
+void
+rspamd_mmaped_table_close_file (rspamd_mmaped_table_t *tbl)
+{
+	if (tbl->hdr) {
+		msync (tbl->hdr, tbl->len, MS_ASYNC);
+		munmap (tbl->hdr, tbl->len);
+	}
+
+	if (tbl->fd != -1) {
+		close (tbl->fd);
+	}
+
+	g_free (tbl->filename);
+	g_free (tbl);
+}
+
+/* Switches to a new file if the current one has been replaced */
+static void
+rspamd_mmaped_table_maybe_remap (rspamd_mmaped_table_t *tbl)
+{
+	GError *err = NULL;
+	gint fd;
+
+	while (__atomic_load_n (&tbl->hdr->obsolete, __ATOMIC_ACQUIRE)) {
+		fd = open (tbl->filename, O_RDWR);
+
+		if (fd == -1) {
+			msg_err ("cannot reopen statfile %s: %s", tbl->filename,
+					strerror (errno));
+			return;
+		}
+
+		if (!rspamd_mmaped_table_map (tbl, fd, &err)) {
+			msg_err ("cannot remap statfile: %e", err);
+			g_error_free (err);
+			close (fd);
+
+			return;
+		}
+
+		msg_debug_stat_mmap ("remapped statfile %s", tbl->filename);
+	}
+}
+
+/*
+ * Returns pointer to the counter of `key` or NULL if it is not found
+ * (or cannot be inserted)
+ */
+static guint32 *
+rspamd_mmaped_table_lookup (rspamd_mmaped_table_t *tbl, guint64 key,
+		gboolean insert)
+{
+	struct rspamd_mmaped_table_bucket *bucket;
+	guint64 mask, cur, expected;
+	guint i, j;
+
+	mask = tbl->hdr->nbuckets - 1;
+
+	for (i = 0; i < MMAPED_TABLE_MAX_PROBES; i ++) {
+		bucket = &tbl->buckets[(key + i) & mask];
+
+		for (j = 0; j < MMAPED_TABLE_SLOTS; j ++) {
+			cur = __atomic_load_n (&bucket->keys[j], __ATOMIC_ACQUIRE);
+
+			if (cur == key) {
+				return &bucket->values[j];
+			}
+
+			if (cur == 0) {
+				if (!insert) {
+					return NULL;
+				}
+
+				expected = 0;
+
+				if (__atomic_compare_exchange_n (&bucket->keys[j], &expected,
+						key, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+					__atomic_add_fetch (&tbl->hdr->used, 1, __ATOMIC_RELAXED);
+
+					return &bucket->values[j];
+				}
+				else if (expected == key) {
+					/* Inserted concurrently */
+					return &bucket->values[j];
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Saturating atomic addition */
+static void
+rspamd_mmaped_table_add_value (guint32 *pval, gint64 delta)
+{
+	guint32 old, nval;
+	gint64 res;
+
+	old = __atomic_load_n (pval, __ATOMIC_RELAXED);
+
+	do {
+		res = (gint64)old + delta;
+		nval = res < 0 ? 0 : (res > G_MAXUINT32 ? G_MAXUINT32 : (guint32)res);
+	} while (!__atomic_compare_exchange_n (pval, &old, nval, TRUE,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* Returns FALSE if token cannot be inserted without growing the file */
+static gboolean
+rspamd_mmaped_table_add (rspamd_mmaped_table_t *tbl, guint64 key,
+		gint64 delta)
+{
+	guint32 *pval;
+
+	if (delta == 0) {
+		return TRUE;
+	}
+
+	/* Do not insert tokens just to unlearn them */
+	pval = rspamd_mmaped_table_lookup (tbl, key, delta > 0);
+
+	if (pval == NULL) {
+		return delta < 0;
+	}
+
+	rspamd_mmaped_table_add_value (pval, delta);
+
+	return TRUE;
+}
+
+static inline gboolean
+rspamd_mmaped_table_overloaded (rspamd_mmaped_table_t *tbl)
+{
+	return __atomic_load_n (&tbl->hdr->used, __ATOMIC_RELAXED) >
+			tbl->hdr->nbuckets * MMAPED_TABLE_SLOTS * MMAPED_TABLE_MAX_LOAD;
+}
+
+/*
+ * Doubles the number of buckets, must be called with an exclusive lock
+ */
+static gboolean
+rspamd_mmaped_table_resize (rspamd_mmaped_table_t *tbl)
+{
+	rspamd_mmaped_table_t ntbl;
+	struct rspamd_mmaped_table_header *old_hdr = tbl->hdr;
+	struct rspamd_mmaped_table_bucket *bucket;
+	GError *err = NULL;
+	guint64 i, nbuckets;
+	guint32 *pval;
+	gchar *tmp;
+	guint j;
+	gint fd;
+
+	nbuckets = old_hdr->nbuckets;
+	tmp = g_strdup_printf ("%s.%d.new", tbl->filename, (gint)getpid ());
+
+retry:
+	nbuckets *= 2;
+	memset (&ntbl, 0, sizeof (ntbl));
+	ntbl.filename = tmp;
+	ntbl.fd = -1;
+	fd = rspamd_mmaped_table_create (tmp, nbuckets,
+			old_hdr->tokenizer_conf, old_hdr->tokenizer_conf_len, &err);
+
+	if (fd == -1 || !rspamd_mmaped_table_map (&ntbl, fd, &err)) {
+		msg_err ("cannot grow statfile %s: %e", tbl->filename, err);
+		g_error_free (err);
+
+		if (fd != -1) {
+			close (fd);
+			unlink (tmp);
+		}
+
+		g_free (tmp);
+
+		return FALSE;
+	}
+
+	ntbl.hdr->create_time = old_hdr->create_time;
+	ntbl.hdr->learns = __atomic_load_n (&old_hdr->learns, __ATOMIC_RELAXED);
+
+	for (i = 0; i < old_hdr->nbuckets; i ++) {
+		bucket = &tbl->buckets[i];
+
+		for (j = 0; j < MMAPED_TABLE_SLOTS; j ++) {
+			if (bucket->keys[j] == 0) {
+				continue;
+			}
+
+			pval = rspamd_mmaped_table_lookup (&ntbl, bucket->keys[j], TRUE);
+
+			if (pval == NULL) {
+				/* Too many collisions, try even larger file */
+				munmap (ntbl.hdr, ntbl.len);
+				close (ntbl.fd);
+				goto retry;
+			}
+
+			*pval = __atomic_load_n (&bucket->values[j], __ATOMIC_RELAXED);
+		}
+	}
+
+	if (msync (ntbl.hdr, ntbl.len, MS_SYNC) == -1 ||
+			rename (tmp, tbl->filename) == -1) {
+		msg_err ("cannot replace statfile %s: %s", tbl->filename,
+				strerror (errno));
+		munmap (ntbl.hdr, ntbl.len);
+		close (ntbl.fd);
+		unlink (tmp);
+		g_free (tmp);
+
+		return FALSE;
+	}
+
+	msg_info ("grown statfile %s: %uL buckets -> %uL buckets, %uL tokens",
+			tbl->filename, old_hdr->nbuckets, nbuckets, ntbl.hdr->used);
+
+	__atomic_store_n (&old_hdr->obsolete, 1, __ATOMIC_RELEASE);
+	munmap (old_hdr, tbl->len);
+	/* Closing old descriptor also releases our lock */
+	close (tbl->fd);
+	tbl->hdr = ntbl.hdr;
+	tbl->buckets = ntbl.buckets;
+	tbl->len = ntbl.len;
+	tbl->fd = ntbl.fd;
+	g_free (tmp);
+
+	return TRUE;
+}
+
+static gboolean
+rspamd_mmaped_table_grow (rspamd_mmaped_table_t *tbl)
+{
+	if (!rspamd_mmaped_table_lock (tbl->fd, TRUE, FALSE)) {
+		msg_err ("cannot lock statfile %s: %s", tbl->filename, strerror (errno));
+		return FALSE;
+	}
+
+	if (__atomic_load_n (&tbl->hdr->obsolete, __ATOMIC_ACQUIRE)) {
+		/* Another process has grown it already */
+		rspamd_mmaped_table_unlock (tbl->fd);
+		rspamd_mmaped_table_maybe_remap (tbl);
+
+		return TRUE;
+	}
+
+	if (!rspamd_mmaped_table_resize (tbl)) {
+		rspamd_mmaped_table_unlock (tbl->fd);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Takes a shared lock on the actual statfile, which prevents its growth.
+ * Growth of a large file takes a while, so we do not block waiting for it
+ * and return FALSE with EAGAIN if the file is still locked after a few tries
+ */
+static gboolean
+rspamd_mmaped_table_lock_shared (rspamd_mmaped_table_t *tbl)
+{
+	guint ntries = 0;
+
+	for (;;) {
+		if (!rspamd_mmaped_table_lock (tbl->fd, FALSE, TRUE)) {
+			if ((errno != EAGAIN && errno != EWOULDBLOCK) ||
+					++ntries >= MMAPED_TABLE_LOCK_TRIES) {
+				return FALSE;
+			}
+
+			usleep (MMAPED_TABLE_LOCK_WAIT);
+			continue;
+		}
+
+		if (!__atomic_load_n (&tbl->hdr->obsolete, __ATOMIC_ACQUIRE)) {
+			return TRUE;
+		}
+
+		rspamd_mmaped_table_unlock (tbl->fd);
+		rspamd_mmaped_table_maybe_remap (tbl);
+	}
+}
+
+/*
+ * Adds pending tokens under a shared lock growing the file when they
+ * do not fit
+ */
+static gboolean
+rspamd_mmaped_table_add_pending (rspamd_mmaped_table_t *tbl, GArray *pending,
+		GError **err)
+{
+	struct rspamd_mmaped_table_pending *elt;
+	guint i = 0;
+
+	while (i < pending->len) {
+		if (!rspamd_mmaped_table_lock_shared (tbl)) {
+			g_set_error (err, rspamd_mmaped_table_quark (), errno,
+					"cannot lock statfile %s: %s", tbl->filename,
+					strerror (errno));
+			return FALSE;
+		}
+
+		for (; i < pending->len; i ++) {
+			elt = &g_array_index (pending, struct rspamd_mmaped_table_pending, i);
+
+			if (!rspamd_mmaped_table_add (tbl, elt->key, elt->delta)) {
+				break;
+			}
+		}
+
+		rspamd_mmaped_table_unlock (tbl->fd);
+
+		if (i < pending->len && !rspamd_mmaped_table_grow (tbl)) {
+			g_set_error (err, rspamd_mmaped_table_quark (), EINVAL,
+					"cannot grow statfile %s", tbl->filename);
+			return FALSE;
+		}
+	}
+
+	if (rspamd_mmaped_table_overloaded (tbl) && !rspamd_mmaped_table_grow (tbl)) {
+		g_set_error (err, rspamd_mmaped_table_quark (), EINVAL,
+				"cannot grow statfile %s", tbl->filename);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+guint32
+rspamd_mmaped_table_get (rspamd_mmaped_table_t *tbl, guint64 token)
+{
+	guint32 *pval;
+
+	pval = rspamd_mmaped_table_lookup (tbl, MMAPED_TABLE_KEY (token), FALSE);
+
+	return pval ? __atomic_load_n (pval, __ATOMIC_RELAXED) : 0;
+}
+
+gboolean
+rspamd_mmaped_table_incr (rspamd_mmaped_table_t *tbl, guint64 token,
+		gint64 delta)
+{
+	guint64 key = MMAPED_TABLE_KEY (token);
+
+	rspamd_mmaped_table_maybe_remap (tbl);
+
+	while (!rspamd_mmaped_table_add (tbl, key, delta)) {
+		if (!rspamd_mmaped_table_grow (tbl)) {
+			return FALSE;
+		}
+	}
+
+	if (rspamd_mmaped_table_overloaded (tbl)) {
+		return rspamd_mmaped_table_grow (tbl);
+	}
+
+	return TRUE;
+}
+
+gint64
+rspamd_mmaped_table_incr_learns (rspamd_mmaped_table_t *tbl, gint64 delta)
+{
+	return __atomic_add_fetch (&tbl->hdr->learns, delta, __ATOMIC_RELAXED);
+}
+
+gpointer
+rspamd_mmaped_table_init (struct rspamd_stat_ctx *ctx,
+		struct rspamd_config *cfg, struct rspamd_statfile *st)
+{
+	struct rspamd_statfile_config *stf = st->stcf;
+	struct rspamd_stat_tokenizer *tokenizer;
+	rspamd_mmaped_table_t *tbl;
+	const ucl_object_t *filenameo, *sizeo;
+	gpointer tok_conf = NULL;
+	gsize size = 0, tok_conf_len = 0;
+	GError *err = NULL;
+
+	filenameo = ucl_object_lookup_any (stf->opts, "filename", "path", NULL);
+
+	if (filenameo == NULL || ucl_object_type (filenameo) != UCL_STRING) {
+		msg_err_config ("statfile %s has no filename defined", stf->symbol);
+		return NULL;
+	}
+
+	sizeo = ucl_object_lookup (stf->opts, "size");
+
+	if (sizeo != NULL && ucl_object_type (sizeo) == UCL_INT) {
+		size = ucl_object_toint (sizeo);
+	}
+
+	g_assert (stf->clcf != NULL);
+
+	if (stf->clcf->tokenizer != NULL) {
+		tokenizer = rspamd_stat_get_tokenizer (stf->clcf->tokenizer->name);
+
+		if (tokenizer != NULL) {
+			tok_conf = tokenizer->get_config (cfg->cfg_pool,
+					stf->clcf->tokenizer, &tok_conf_len);
+		}
+	}
+
+	tbl = rspamd_mmaped_table_open (ucl_object_tostring (filenameo), size,
+			tok_conf, tok_conf_len, &err);
+
+	if (tbl == NULL) {
+		msg_err_config ("cannot open statfile %s: %e", stf->symbol, err);
+		g_error_free (err);
+
+		return NULL;
+	}
+
+	tbl->stcf = stf;
+	/* Learning sends deltas, not the resulting values */
+	stf->clcf->flags |= RSPAMD_FLAG_CLASSIFIER_INCREMENTING_BACKEND;
+
+	return tbl;
+}
+
+void
+rspamd_mmaped_table_close (gpointer p)
+{
+	rspamd_mmaped_table_t *tbl = p;
+
+	if (tbl) {
+		rspamd_mmaped_table_close_file (tbl);
+	}
+}
+
+gpointer
+rspamd_mmaped_table_runtime (struct rspamd_task *task,
+		struct rspamd_statfile_config *stcf,
+		gboolean learn,
+		gpointer p,
+		gint _id)
+{
+	rspamd_mmaped_table_t *tbl = p;
+	struct rspamd_mmaped_table_runtime *rt;
+
+	if (tbl == NULL) {
+		return NULL;
+	}
+
+	rspamd_mmaped_table_maybe_remap (tbl);
+	rt = rspamd_mempool_alloc0 (task->task_pool, sizeof (*rt));
+	rt->tbl = tbl;
+
+	return rt;
+}
+
+gboolean
+rspamd_mmaped_table_process_tokens (struct rspamd_task *task, GPtrArray *tokens,
+		gint id,
+		gpointer p)
+{
+	struct rspamd_mmaped_table_runtime *rt = p;
+	rspamd_token_t *tok;
+	guint i;
+
+	g_assert (tokens != NULL);
+	g_assert (p != NULL);
+
+	for (i = 0; i < tokens->len; i++) {
+		tok = g_ptr_array_index (tokens, i);
+		tok->values[id] = rspamd_mmaped_table_get (rt->tbl, tok->data);
+	}
+
+	if (rt->tbl->stcf->is_spam) {
+		task->flags |= RSPAMD_TASK_FLAG_HAS_SPAM_TOKENS;
+	}
+	else {
+		task->flags |= RSPAMD_TASK_FLAG_HAS_HAM_TOKENS;
+	}
+
+	return TRUE;
+}
+
+gboolean
+rspamd_mmaped_table_finalize_process (struct rspamd_task *task, gpointer runtime,
+		gpointer ctx)
+{
+	return TRUE;
+}
+
+/* Saves tokens starting from `start` to be learned in finalize_learn */
+static void
+rspamd_mmaped_table_defer_tokens (struct rspamd_task *task,
+		struct rspamd_mmaped_table_runtime *rt, GPtrArray *tokens, gint id,
+		guint start)
+{
+	struct rspamd_mmaped_table_pending pending;
+	rspamd_token_t *tok;
+	guint i;
+
+	if (rt->pending == NULL) {
+		rt->pending = g_array_sized_new (FALSE, FALSE, sizeof (pending),
+				tokens->len - start);
+		rspamd_mempool_add_destructor (task->task_pool,
+				rspamd_array_free_hard, rt->pending);
+	}
+
+	for (i = start; i < tokens->len; i++) {
+		tok = g_ptr_array_index (tokens, i);
+		pending.key = MMAPED_TABLE_KEY (tok->data);
+		pending.delta = tok->values[id];
+		g_array_append_val (rt->pending, pending);
+	}
+}
+
+gboolean
+rspamd_mmaped_table_learn_tokens (struct rspamd_task *task, GPtrArray *tokens,
+		gint id,
+		gpointer p)
+{
+	struct rspamd_mmaped_table_runtime *rt = p;
+	rspamd_mmaped_table_t *tbl = rt->tbl;
+	rspamd_token_t *tok;
+	guint i;
+
+	g_assert (tokens != NULL);
+	g_assert (p != NULL);
+
+	/* Shared lock only prevents growth of the file while we learn */
+	if (!rspamd_mmaped_table_lock_shared (tbl)) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			msg_err_task ("cannot lock statfile %s: %s", tbl->filename,
+					strerror (errno));
+			return FALSE;
+		}
+
+		/* File is being grown, learn tokens when finalizing learning */
+		msg_info_task ("statfile %s is locked, defer learning", tbl->filename);
+		rspamd_mmaped_table_defer_tokens (task, rt, tokens, id, 0);
+
+		return TRUE;
+	}
+
+	for (i = 0; i < tokens->len; i++) {
+		tok = g_ptr_array_index (tokens, i);
+
+		if (!rspamd_mmaped_table_add (tbl, MMAPED_TABLE_KEY (tok->data),
+				tok->values[id])) {
+			break;
+		}
+	}
+
+	if (i < tokens->len) {
+		rt->need_grow = TRUE;
+		rspamd_mmaped_table_defer_tokens (task, rt, tokens, id, i);
+	}
+	else {
+		rt->need_grow = rspamd_mmaped_table_overloaded (tbl);
+	}
+
+	rspamd_mmaped_table_unlock (tbl->fd);
+
+	return TRUE;
+}
+
+gboolean
+rspamd_mmaped_table_finalize_learn (struct rspamd_task *task, gpointer runtime,
+		gpointer ctx, GError **err)
+{
+	struct rspamd_mmaped_table_runtime *rt = runtime;
+
+	if (rt == NULL) {
+		return TRUE;
+	}
+
+	if (rt->pending) {
+		/* Grows statfile if needed */
+		if (!rspamd_mmaped_table_add_pending (rt->tbl, rt->pending, err)) {
+			return FALSE;
+		}
+	}
+	else if (rt->need_grow) {
+		if (!rspamd_mmaped_table_grow (rt->tbl)) {
+			g_set_error (err, rspamd_mmaped_table_quark (), EINVAL,
+					"cannot grow statfile %s", rt->tbl->filename);
+			return FALSE;
+		}
+	}
+
+	msync (rt->tbl->hdr, rt->tbl->len, MS_ASYNC);
+
+	return TRUE;
+}
+
+gulong
+rspamd_mmaped_table_total_learns (struct rspamd_task *task, gpointer runtime,
+		gpointer ctx)
+{
+	struct rspamd_mmaped_table_runtime *rt = runtime;
+
+	if (rt == NULL) {
+		return 0;
+	}
+
+	return __atomic_load_n (&rt->tbl->hdr->learns, __ATOMIC_RELAXED);
+}
+
+gulong
+rspamd_mmaped_table_inc_learns (struct rspamd_task *task, gpointer runtime,
+		gpointer ctx)
+{
+	struct rspamd_mmaped_table_runtime *rt = runtime;
+
+	if (rt == NULL) {
+		return 0;
+	}
+
+	return rspamd_mmaped_table_incr_learns (rt->tbl, 1);
+}
+
+gulong
+rspamd_mmaped_table_dec_learns (struct rspamd_task *task, gpointer runtime,
+		gpointer ctx)
+{
+	struct rspamd_mmaped_table_runtime *rt = runtime;
+
+	if (rt == NULL) {
+		return 0;
+	}
+
+	return rspamd_mmaped_table_incr_learns (rt->tbl, -1);
+}
+
+ucl_object_t *
+rspamd_mmaped_table_get_stat (gpointer runtime,
+		gpointer ctx)
+{
+	struct rspamd_mmaped_table_runtime *rt = runtime;
+	rspamd_mmaped_table_t *tbl;
+	ucl_object_t *res = NULL;
+
+	if (rt != NULL) {
+		tbl = rt->tbl;
+		res = ucl_object_typed_new (UCL_OBJECT);
+		ucl_object_insert_key (res, ucl_object_fromint (
+				__atomic_load_n (&tbl->hdr->learns, __ATOMIC_RELAXED)),
+				"revision", 0, false);
+		ucl_object_insert_key (res, ucl_object_fromint (tbl->len), "size",
+				0, false);
+		ucl_object_insert_key (res, ucl_object_fromint (
+				tbl->hdr->nbuckets * MMAPED_TABLE_SLOTS), "total",  0, false);
+		ucl_object_insert_key (res, ucl_object_fromint (
+				__atomic_load_n (&tbl->hdr->used, __ATOMIC_RELAXED)),
+				"used", 0, false);
+		ucl_object_insert_key (res, ucl_object_fromstring (tbl->stcf->symbol),
+				"symbol", 0, false);
+		ucl_object_insert_key (res, ucl_object_fromstring ("mmap_table"),
+				"type", 0, false);
+		ucl_object_insert_key (res, ucl_object_fromint (0),
+				"languages", 0, false);
+		ucl_object_insert_key (res, ucl_object_fromint (0),
+				"users", 0, false);
+
+		if (tbl->stcf->label) {
+			ucl_object_insert_key (res, ucl_object_fromstring (tbl->stcf->label),
+					"label", 0, false);
+		}
+	}
+
+	return res;
+}
+
+gpointer
+rspamd_mmaped_table_load_tokenizer_config (gpointer runtime,
+		gsize *len)
+{
+	struct rspamd_mmaped_table_runtime *rt = runtime;
+
+	g_assert (rt != NULL);
+
+	if (len) {
+		*len = rt->tbl->hdr->tokenizer_conf_len;
+	}
+
+	return rt->tbl->hdr->tokenizer_conf;
+}
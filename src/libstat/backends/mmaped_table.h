@@ -0,0 +1,77 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RSPAMD_MMAPED_TABLE_H
+#define RSPAMD_MMAPED_TABLE_H
+
+#include "config.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Statfile stored as a memory mapped hash table of 64 bit tokens and 32 bit
+ * counters (`mmap_table` backend)
+ */
+struct rspamd_mmaped_table;
+typedef struct rspamd_mmaped_table rspamd_mmaped_table_t;
+
+/**
+ * Opens statfile, creating it with capacity for `size` bytes if it does not
+ * exist
+ * @param filename path to the statfile
+ * @param size initial size of a new file
+ * @param tok_conf tokenizer configuration to store in a new file (may be NULL)
+ * @param tok_conf_len length of tokenizer configuration
+ * @param err error
+ * @return statfile or NULL
+ */
+rspamd_mmaped_table_t *rspamd_mmaped_table_open (const gchar *filename,
+												 gsize size,
+												 gconstpointer tok_conf,
+												 gsize tok_conf_len,
+												 GError **err);
+
+/**
+ * Returns counter of a token
+ */
+guint32 rspamd_mmaped_table_get (rspamd_mmaped_table_t *tbl, guint64 token);
+
+/**
+ * Atomically adds `delta` to a counter of a token, inserting token if needed
+ * and growing the file if it is full
+ * @return FALSE if statfile cannot be grown
+ */
+gboolean rspamd_mmaped_table_incr (rspamd_mmaped_table_t *tbl, guint64 token,
+								   gint64 delta);
+
+/**
+ * Atomically adds `delta` to the number of learns
+ * @return new number of learns
+ */
+gint64 rspamd_mmaped_table_incr_learns (rspamd_mmaped_table_t *tbl,
+										gint64 delta);
+
+/**
+ * Syncs and closes statfile
+ */
+void rspamd_mmaped_table_close_file (rspamd_mmaped_table_t *tbl);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -23,6 +23,8 @@
 #include "adapters/libev.h"
 #include "ref.h"
 
+#include <openssl/evp.h>
+
 #define msg_debug_stat_redis(...)  rspamd_conditional_debug_fast (NULL, NULL, \
         rspamd_stat_redis_log_id, "stat_redis", task->task_pool->tag.uid, \
         RSPAMD_LOG_FUNC, \
@@ -52,8 +54,11 @@ struct redis_stat_ctx {
 	gboolean store_tokens;
 	gboolean new_schema;
 	gboolean enable_signatures;
+	gboolean use_scripts;
 	guint expiry;
 	gint cbref_user;
+	gchar classify_sha[EVP_MAX_MD_SIZE * 2 + 1];
+	gchar learn_sha[EVP_MAX_MD_SIZE * 2 + 1];
 };
 
 enum rspamd_redis_connection_state {
@@ -77,6 +82,15 @@ struct redis_stat_runtime {
 	guint64 learned;
 	gint id;
 	gboolean has_event;
+	/* Script mode: statfile is processed by a request of another runtime */
+	gboolean script_handled;
+	gboolean script_retried;
+	/* Script mode: runtimes of all statfiles covered by the request */
+	GPtrArray *script_siblings;
+	const gchar *script_body;
+	const gchar *script_sha;
+	rspamd_fstring_t *script_args;
+	guint script_nargs;
 	GError *err;
 };
 
@@ -105,6 +119,103 @@ struct rspamd_redis_stat_cbdata {
 
 static const gchar *M = "redis statistics";
 
+/*
+ * Scripts mode: a whole classifier is processed by a single EVALSHA call
+ *
+ * KEYS: expanded prefixes of statfiles
+ * ARGV[1]: flags ('n' - new schema)
+ * ARGV[2]: classes of statfiles ('S' or 'H' per key)
+ * ARGV[3]: min_learns
+ * ARGV[4..]: tokens
+ *
+ * Returns {learns_1, values_1, ..., learns_n, values_n}, where values are
+ * packed little endian floats or an empty string if there are not enough learns
+ */
+static const gchar rspamd_redis_classify_script[] = ""
+		"local flags, classes = ARGV[1], ARGV[2]\n"
+		"local min_learns = tonumber(ARGV[3]) or 0\n"
+		"local new_schema = string.find(flags, 'n', 1, true)\n"
+		"local ntokens = #ARGV - 3\n"
+		"local res = {}\n"
+		"for i = 1, #KEYS do\n"
+		"  local key, cls = KEYS[i], string.sub(classes, i, i)\n"
+		"  local lkey = 'learns'\n"
+		"  if new_schema then\n"
+		"    if cls == 'S' then lkey = 'learns_spam' else lkey = 'learns_ham' end\n"
+		"  end\n"
+		"  local learns = tonumber(redis.call('HGET', key, lkey)) or 0\n"
+		"  local out = {}\n"
+		"  if learns > 0 and learns >= min_learns then\n"
+		"    if new_schema then\n"
+		"      for j = 1, ntokens do\n"
+		"        local v = redis.call('HGET', key .. '_' .. ARGV[j + 3], cls)\n"
+		"        out[j] = struct.pack('<f', tonumber(v) or 0)\n"
+		"      end\n"
+		"    else\n"
+		"      for s = 1, ntokens, 1000 do\n"
+		"        local e = math.min(s + 999, ntokens)\n"
+		"        local vals = redis.call('HMGET', key, unpack(ARGV, s + 3, e + 3))\n"
+		"        for j = 1, #vals do\n"
+		"          out[s + j - 1] = struct.pack('<f', tonumber(vals[j]) or 0)\n"
+		"        end\n"
+		"      end\n"
+		"    end\n"
+		"  end\n"
+		"  if learns < 0 then learns = 0 end\n"
+		"  res[#res + 1] = learns\n"
+		"  res[#res + 1] = table.concat(out)\n"
+		"end\n"
+		"return res\n";
+
+/*
+ * KEYS: expanded prefixes of statfiles
+ * ARGV[1]: flags ('n' - new schema, 'i' - integer values)
+ * ARGV[2]: classes of statfiles ('S' or 'H' per key)
+ * ARGV[3]: expiry of tokens (new schema only)
+ * ARGV[4]: learns deltas ('+' or '-' per key)
+ * ARGV[5..4 + #KEYS]: packed little endian floats to add per key
+ * ARGV[5 + #KEYS..]: tokens
+ */
+static const gchar rspamd_redis_learn_script[] = ""
+		"local flags, classes = ARGV[1], ARGV[2]\n"
+		"local expiry = tonumber(ARGV[3]) or 0\n"
+		"local deltas = ARGV[4]\n"
+		"local new_schema = string.find(flags, 'n', 1, true)\n"
+		"local intvals = string.find(flags, 'i', 1, true)\n"
+		"local cmd = 'HINCRBYFLOAT'\n"
+		"if intvals then cmd = 'HINCRBY' end\n"
+		"local first = 5 + #KEYS\n"
+		"for i = 1, #KEYS do\n"
+		"  local key, cls = KEYS[i], string.sub(classes, i, i)\n"
+		"  local vals = ARGV[4 + i]\n"
+		"  local lkey = 'learns'\n"
+		"  if new_schema then\n"
+		"    if cls == 'S' then lkey = 'learns_spam' else lkey = 'learns_ham' end\n"
+		"    redis.call('HSET', key, 'version', '2')\n"
+		"  end\n"
+		"  for j = first, #ARGV do\n"
+		"    local v = struct.unpack('<f', vals, (j - first) * 4 + 1)\n"
+		"    if intvals then\n"
+		"      if v > 0 then v = math.floor(v) else v = math.ceil(v) end\n"
+		"    end\n"
+		"    if v ~= 0 then\n"
+		"      if new_schema then\n"
+		"        local tkey = key .. '_' .. ARGV[j]\n"
+		"        redis.call(cmd, tkey, cls, v)\n"
+		"        if expiry > 0 then redis.call('EXPIRE', tkey, expiry) end\n"
+		"      else\n"
+		"        redis.call(cmd, key, ARGV[j], v)\n"
+		"      end\n"
+		"    end\n"
+		"  end\n"
+		"  if string.sub(deltas, i, i) == '+' then\n"
+		"    redis.call('HINCRBY', key, lkey, 1)\n"
+		"  else\n"
+		"    redis.call('HINCRBY', key, lkey, -1)\n"
+		"  end\n"
+		"end\n"
+		"return #KEYS\n";
+
 static GQuark
 rspamd_redis_stat_quark (void)
 {
@@ -169,7 +280,7 @@ rspamd_redis_expand_object (const gchar *pattern,
 			lua_rawgeti (L, LUA_REGISTRYINDEX, ctx->cbref_user);
 			ptask = lua_newuserdata (L, sizeof (struct rspamd_task *));
 			*ptask = task;
-			rspamd_lua_setclass (L, "rspamd{task}", -1);
+			rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 			if (lua_pcall (L, 1, 1, err_idx) != 0) {
 				msg_err_task ("call to user extraction script failed: %s",
@@ -1256,6 +1367,37 @@ rspamd_redis_processed (redisAsyncContext *c, gpointer r, gpointer priv)
 	}
 }
 
+/* Save learn count in mempool variable */
+static void
+rspamd_redis_save_learns (struct rspamd_task *task,
+		struct redis_stat_runtime *rt)
+{
+	gint64 *learns_cnt;
+	const gchar *var_name;
+
+	if (rt->stcf->is_spam) {
+		var_name = RSPAMD_MEMPOOL_SPAM_LEARNS;
+	}
+	else {
+		var_name = RSPAMD_MEMPOOL_HAM_LEARNS;
+	}
+
+	learns_cnt = rspamd_mempool_get_variable (task->task_pool,
+			var_name);
+
+	if (learns_cnt) {
+		(*learns_cnt) += rt->learned;
+	}
+	else {
+		learns_cnt = rspamd_mempool_alloc (task->task_pool,
+				sizeof (*learns_cnt));
+		*learns_cnt = rt->learned;
+		rspamd_mempool_set_variable (task->task_pool,
+				var_name,
+				learns_cnt, NULL);
+	}
+}
+
 /* Called when we have connected to the redis server and got stats */
 static void
 rspamd_redis_connected (redisAsyncContext *c, gpointer r, gpointer priv)
@@ -1302,32 +1444,7 @@ rspamd_redis_connected (redisAsyncContext *c, gpointer r, gpointer priv)
 			msg_debug_stat_redis ("connected to redis server, tokens learned for %s: %uL",
 					rt->redis_object_expanded, rt->learned);
 			rspamd_upstream_ok (rt->selected);
-
-			/* Save learn count in mempool variable */
-			gint64 *learns_cnt;
-			const gchar *var_name;
-
-			if (rt->stcf->is_spam) {
-				var_name = RSPAMD_MEMPOOL_SPAM_LEARNS;
-			}
-			else {
-				var_name = RSPAMD_MEMPOOL_HAM_LEARNS;
-			}
-
-			learns_cnt = rspamd_mempool_get_variable (task->task_pool,
-					var_name);
-
-			if (learns_cnt) {
-				(*learns_cnt) += rt->learned;
-			}
-			else {
-				learns_cnt = rspamd_mempool_alloc (task->task_pool,
-						sizeof (*learns_cnt));
-				*learns_cnt = rt->learned;
-				rspamd_mempool_set_variable (task->task_pool,
-						var_name,
-						learns_cnt, NULL);
-			}
+			rspamd_redis_save_learns (task, rt);
 
 			if (rt->learned >= rt->stcf->clcf->min_learns && rt->learned > 0) {
 				rspamd_fstring_t *query = rspamd_redis_tokens_to_query (
@@ -1515,6 +1632,25 @@ rspamd_redis_parse_classifier_opts (struct redis_stat_ctx *backend,
 	else {
 		backend->expiry = 0;
 	}
+
+	elt = ucl_object_lookup (obj, "use_scripts");
+	if (elt) {
+		backend->use_scripts = ucl_object_toboolean (elt);
+	}
+	else {
+		backend->use_scripts = FALSE;
+	}
+}
+
+static void
+rspamd_redis_script_sha (const gchar *script, gchar *out)
+{
+	guchar digest[EVP_MAX_MD_SIZE];
+	guint dlen = 0;
+
+	EVP_Digest (script, strlen (script), digest, &dlen, EVP_sha1 (), NULL);
+	rspamd_encode_hex_buf (digest, dlen, out, dlen * 2 + 1);
+	out[dlen * 2] = '\0';
 }
 
 gpointer
@@ -1606,6 +1742,14 @@ rspamd_redis_init (struct rspamd_stat_ctx *ctx,
 	lua_settop (L, 0);
 
 	rspamd_redis_parse_classifier_opts (backend, st->classifier->cfg->opts, cfg);
+
+	if (backend->use_scripts) {
+		rspamd_redis_script_sha (rspamd_redis_classify_script,
+				backend->classify_sha);
+		rspamd_redis_script_sha (rspamd_redis_learn_script,
+				backend->learn_sha);
+	}
+
 	stf->clcf->flags |= RSPAMD_FLAG_CLASSIFIER_INCREMENTING_BACKEND;
 	backend->stcf = stf;
 
@@ -1655,6 +1799,48 @@ rspamd_stat_redis_on_connect(const struct redisAsyncContext *ac, int status)
 	}
 }
 
+static gboolean
+rspamd_redis_runtime_connect (struct redis_stat_runtime *rt)
+{
+	struct rspamd_task *task = rt->task;
+	rspamd_inet_addr_t *addr;
+
+	addr = rspamd_upstream_addr_next (rt->selected);
+	g_assert (addr != NULL);
+
+	if (rspamd_inet_address_get_af (addr) == AF_UNIX) {
+		rt->redis = redisAsyncConnectUnix (rspamd_inet_address_to_string (addr));
+	}
+	else {
+		rt->redis = redisAsyncConnect (rspamd_inet_address_to_string (addr),
+				rspamd_inet_address_get_port (addr));
+	}
+
+	if (rt->redis == NULL) {
+		msg_warn_task ("cannot connect to redis server %s: %s",
+				rspamd_inet_address_to_string_pretty (addr),
+				strerror (errno));
+		return FALSE;
+	}
+	else if (rt->redis->err != REDIS_OK) {
+		msg_warn_task ("cannot connect to redis server %s: %s",
+				rspamd_inet_address_to_string_pretty (addr),
+				rt->redis->errstr);
+		redisAsyncFree (rt->redis);
+		rt->redis = NULL;
+
+		return FALSE;
+	}
+
+	redisLibevAttach (task->event_loop, rt->redis);
+	rspamd_redis_maybe_auth (rt->ctx, rt->redis);
+	rt->redis->data = rt;
+	redisAsyncSetDisconnectCallback (rt->redis, rspamd_stat_redis_on_disconnect);
+	redisAsyncSetConnectCallback (rt->redis, rspamd_stat_redis_on_connect);
+
+	return TRUE;
+}
+
 gpointer
 rspamd_redis_runtime (struct rspamd_task *task,
 		struct rspamd_statfile_config *stcf,
@@ -1665,7 +1851,6 @@ rspamd_redis_runtime (struct rspamd_task *task,
 	struct upstream *up;
 	struct upstream_list *ups;
 	char *object_expanded = NULL;
-	rspamd_inet_addr_t *addr;
 
 	g_assert (ctx != NULL);
 	g_assert (stcf != NULL);
@@ -1718,39 +1903,14 @@ rspamd_redis_runtime (struct rspamd_task *task,
 	rt->stcf = stcf;
 	rt->redis_object_expanded = object_expanded;
 
-	addr = rspamd_upstream_addr_next (up);
-	g_assert (addr != NULL);
-
-	if (rspamd_inet_address_get_af (addr) == AF_UNIX) {
-		rt->redis = redisAsyncConnectUnix (rspamd_inet_address_to_string (addr));
-	}
-	else {
-		rt->redis = redisAsyncConnect (rspamd_inet_address_to_string (addr),
-				rspamd_inet_address_get_port (addr));
-	}
-
-	if (rt->redis == NULL) {
-		msg_warn_task ("cannot connect to redis server %s: %s",
-				rspamd_inet_address_to_string_pretty (addr),
-				strerror (errno));
-		return NULL;
-	}
-	else if (rt->redis->err != REDIS_OK) {
-		msg_warn_task ("cannot connect to redis server %s: %s",
-				rspamd_inet_address_to_string_pretty (addr),
-				rt->redis->errstr);
-		redisAsyncFree (rt->redis);
-		rt->redis = NULL;
-
+	/*
+	 * In scripts mode only one runtime per classifier talks to redis, so
+	 * we connect lazily when a request is really issued
+	 */
+	if (!ctx->use_scripts && !rspamd_redis_runtime_connect (rt)) {
 		return NULL;
 	}
 
-	redisLibevAttach (task->event_loop, rt->redis);
-	rspamd_redis_maybe_auth (ctx, rt->redis);
-	rt->redis->data = rt;
-	redisAsyncSetDisconnectCallback (rt->redis, rspamd_stat_redis_on_disconnect);
-	redisAsyncSetConnectCallback (rt->redis, rspamd_stat_redis_on_connect);
-
 	rspamd_mempool_add_destructor (task->task_pool, rspamd_redis_fin, rt);
 
 	return rt;
@@ -1769,6 +1929,545 @@ rspamd_redis_close (gpointer p)
 	g_free (ctx);
 }
 
+static void
+rspamd_redis_script_append_arg (rspamd_fstring_t **out,
+		const gchar *arg, gsize len)
+{
+	rspamd_printf_fstring (out, "$%uz\r\n", len);
+	*out = rspamd_fstring_append (*out, arg, len);
+	*out = rspamd_fstring_append (*out, "\r\n", 2);
+}
+
+/*
+ * Statfiles could share a script call merely if they are stored on the same
+ * server with the same keys layout
+ */
+static gboolean
+rspamd_redis_script_compatible (struct redis_stat_runtime *rt,
+		struct redis_stat_runtime *sib)
+{
+	struct redis_stat_ctx *c1 = rt->ctx, *c2 = sib->ctx;
+
+	if (c1 == c2) {
+		return TRUE;
+	}
+
+	if (!c2->use_scripts || c1->new_schema != c2->new_schema ||
+			c1->expiry != c2->expiry ||
+			c1->enable_users != c2->enable_users ||
+			c1->store_tokens != c2->store_tokens) {
+		return FALSE;
+	}
+
+	if (g_strcmp0 (c1->password, c2->password) != 0 ||
+			g_strcmp0 (c1->dbname, c2->dbname) != 0) {
+		return FALSE;
+	}
+
+	return strcmp (rspamd_upstream_name (rt->selected),
+			rspamd_upstream_name (sib->selected)) == 0;
+}
+
+/*
+ * Collects runtimes of all statfiles in the classifier of `id` that could be
+ * served by a single script call and marks them as handled
+ */
+static GPtrArray *
+rspamd_redis_script_siblings (struct rspamd_task *task,
+		struct redis_stat_runtime *rt, gint id, gboolean learn)
+{
+	struct rspamd_stat_ctx *st_ctx = rspamd_stat_get_ctx ();
+	struct rspamd_statfile *st, *sib_st;
+	struct redis_stat_runtime *sib;
+	GPtrArray *res;
+	guint i;
+	gint sib_id;
+
+	st = g_ptr_array_index (st_ctx->statfiles, id);
+	res = g_ptr_array_sized_new (st->classifier->statfiles_ids->len);
+	rspamd_mempool_add_destructor (task->task_pool,
+			rspamd_ptr_array_free_hard, res);
+
+	for (i = 0; i < st->classifier->statfiles_ids->len; i ++) {
+		sib_id = g_array_index (st->classifier->statfiles_ids, gint, i);
+		sib_st = g_ptr_array_index (st_ctx->statfiles, sib_id);
+		sib = g_ptr_array_index (task->stat_runtimes, sib_id);
+
+		if (sib == NULL || sib_st->backend != st->backend ||
+				sib->script_handled ||
+				!rspamd_redis_script_compatible (rt, sib)) {
+			continue;
+		}
+
+		if (learn && !(task->flags & RSPAMD_TASK_FLAG_UNLEARN) &&
+				!!sib_st->stcf->is_spam != !!st->stcf->is_spam) {
+			/* We learn merely statfiles of the same class */
+			continue;
+		}
+
+		sib->id = sib_id;
+		sib->script_handled = TRUE;
+		g_ptr_array_add (res, sib);
+	}
+
+	return res;
+}
+
+/* Writes common arguments of both scripts starting from KEYS */
+static rspamd_fstring_t *
+rspamd_redis_script_prepare_args (struct redis_stat_runtime *rt,
+		gboolean learn)
+{
+	rspamd_fstring_t *out;
+	struct redis_stat_runtime *sib;
+	gchar flags[3], *classes;
+	gchar numbuf[64];
+	guint i, nflags = 0;
+	gint r;
+
+	out = rspamd_fstring_sized_new (1024);
+	r = rspamd_snprintf (numbuf, sizeof (numbuf), "%ud",
+			rt->script_siblings->len);
+	rspamd_redis_script_append_arg (&out, numbuf, r);
+	classes = g_alloca (rt->script_siblings->len + 1);
+
+	for (i = 0; i < rt->script_siblings->len; i ++) {
+		sib = g_ptr_array_index (rt->script_siblings, i);
+		rspamd_redis_script_append_arg (&out, sib->redis_object_expanded,
+				strlen (sib->redis_object_expanded));
+		classes[i] = sib->stcf->is_spam ? 'S' : 'H';
+	}
+
+	classes[i] = '\0';
+
+	if (rt->ctx->new_schema) {
+		flags[nflags++] = 'n';
+	}
+
+	if (learn && (rt->stcf->clcf->flags & RSPAMD_FLAG_CLASSIFIER_INTEGER)) {
+		flags[nflags++] = 'i';
+	}
+
+	rspamd_redis_script_append_arg (&out, flags, nflags);
+	rspamd_redis_script_append_arg (&out, classes, i);
+	/* Numkeys + keys + flags + classes */
+	rt->script_nargs = rt->script_siblings->len + 3;
+
+	return out;
+}
+
+static void
+rspamd_redis_script_append_tokens (struct redis_stat_runtime *rt,
+		GPtrArray *tokens)
+{
+	rspamd_token_t *tok;
+	gchar numbuf[64];
+	guint i;
+	gint r;
+
+	for (i = 0; i < tokens->len; i ++) {
+		tok = g_ptr_array_index (tokens, i);
+		r = rspamd_snprintf (numbuf, sizeof (numbuf), "%uL", tok->data);
+		rspamd_redis_script_append_arg (&rt->script_args, numbuf, r);
+	}
+
+	rt->script_nargs += tokens->len;
+}
+
+/*
+ * Sends prepared script arguments either via EVALSHA or, if redis does not
+ * know our script yet, via EVAL with the whole script body
+ */
+static gboolean
+rspamd_redis_script_send (struct redis_stat_runtime *rt,
+		gboolean use_sha, redisCallbackFn *cb)
+{
+	struct rspamd_task *task = rt->task;
+	rspamd_fstring_t *cmd;
+	gsize blen;
+	gint ret;
+
+	cmd = rspamd_fstring_sized_new (rt->script_args->len + 64);
+
+	if (use_sha) {
+		rspamd_printf_fstring (&cmd, "*%ud\r\n$7\r\nEVALSHA\r\n",
+				rt->script_nargs + 2);
+		rspamd_redis_script_append_arg (&cmd, rt->script_sha,
+				strlen (rt->script_sha));
+	}
+	else {
+		blen = strlen (rt->script_body);
+		rspamd_printf_fstring (&cmd, "*%ud\r\n$4\r\nEVAL\r\n",
+				rt->script_nargs + 2);
+		rspamd_redis_script_append_arg (&cmd, rt->script_body, blen);
+	}
+
+	cmd = rspamd_fstring_append (cmd, rt->script_args->str,
+			rt->script_args->len);
+	/* Hiredis copies the command to its own output buffer */
+	ret = redisAsyncFormattedCommand (rt->redis, cb, rt, cmd->str, cmd->len);
+	rspamd_fstring_free (cmd);
+
+	if (ret != REDIS_OK) {
+		msg_err_task ("call to redis failed: %s", rt->redis->errstr);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+rspamd_redis_script_set_error (struct redis_stat_runtime *rt, gint code,
+		const gchar *err)
+{
+	struct redis_stat_runtime *sib;
+	guint i;
+
+	if (!rt->err) {
+		g_set_error (&rt->err, rspamd_redis_stat_quark (), code,
+				"%s", err);
+	}
+
+	if (rt->script_siblings) {
+		for (i = 0; i < rt->script_siblings->len; i ++) {
+			sib = g_ptr_array_index (rt->script_siblings, i);
+
+			if (!sib->err) {
+				g_set_error (&sib->err, rspamd_redis_stat_quark (), code,
+						"%s", err);
+			}
+		}
+	}
+}
+
+static void
+rspamd_redis_script_start (struct redis_stat_runtime *rt)
+{
+	struct rspamd_task *task = rt->task;
+
+	rspamd_session_add_event (task->s, NULL, rt, M);
+	rt->has_event = TRUE;
+
+	if (ev_can_stop (&rt->timeout_event)) {
+		rt->timeout_event.repeat = rt->ctx->timeout;
+		ev_timer_again (task->event_loop, &rt->timeout_event);
+	}
+	else {
+		rt->timeout_event.data = rt;
+		ev_timer_init (&rt->timeout_event, rspamd_redis_timeout,
+				rt->ctx->timeout, 0.);
+		ev_timer_start (task->event_loop, &rt->timeout_event);
+	}
+}
+
+/* Checks for NOSCRIPT reply and resends script body if needed */
+static gboolean
+rspamd_redis_script_maybe_reload (struct redis_stat_runtime *rt,
+		redisReply *reply, redisCallbackFn *cb)
+{
+	if (reply->type == REDIS_REPLY_ERROR && !rt->script_retried &&
+			reply->len >= sizeof ("NOSCRIPT") - 1 &&
+			memcmp (reply->str, "NOSCRIPT", sizeof ("NOSCRIPT") - 1) == 0) {
+		rt->script_retried = TRUE;
+
+		return rspamd_redis_script_send (rt, FALSE, cb);
+	}
+
+	return FALSE;
+}
+
+static void
+rspamd_redis_script_processed (redisAsyncContext *c, gpointer r, gpointer priv)
+{
+	struct redis_stat_runtime *rt = REDIS_RUNTIME (priv), *sib;
+	redisReply *reply = r, *learns_elt, *values_elt;
+	struct rspamd_task *task;
+	rspamd_token_t *tok;
+	guint i, j, found;
+	guint32 packed;
+	gfloat val;
+	gchar errbuf[256];
+
+	task = rt->task;
+
+	if (c->err == 0 && rt->has_event) {
+		if (r != NULL) {
+			if (rspamd_redis_script_maybe_reload (rt, reply,
+					rspamd_redis_script_processed)) {
+				/* Wait for the reply of EVAL */
+				return;
+			}
+
+			if (reply->type == REDIS_REPLY_ARRAY &&
+					reply->elements == rt->script_siblings->len * 2) {
+				for (i = 0; i < rt->script_siblings->len; i ++) {
+					sib = g_ptr_array_index (rt->script_siblings, i);
+					learns_elt = reply->element[i * 2];
+					values_elt = reply->element[i * 2 + 1];
+
+					if (learns_elt->type == REDIS_REPLY_INTEGER &&
+							learns_elt->integer > 0) {
+						sib->learned = learns_elt->integer;
+					}
+					else {
+						sib->learned = 0;
+					}
+
+					rspamd_redis_save_learns (task, sib);
+
+					if (values_elt->type != REDIS_REPLY_STRING ||
+							values_elt->len == 0) {
+						msg_warn_task ("skip obtaining bayes tokens for %s of classifier "
+									   "%s: not enough learns %d; %d required",
+								sib->stcf->symbol, sib->stcf->clcf->name,
+								(int)sib->learned, sib->stcf->clcf->min_learns);
+						continue;
+					}
+
+					if (values_elt->len != task->tokens->len * sizeof (packed)) {
+						msg_err_task ("got invalid length of values from redis: "
+									  "%d, expected: %d",
+								(gint)values_elt->len,
+								(gint)(task->tokens->len * sizeof (packed)));
+						continue;
+					}
+
+					found = 0;
+
+					for (j = 0; j < task->tokens->len; j ++) {
+						tok = g_ptr_array_index (task->tokens, j);
+						memcpy (&packed, values_elt->str + j * sizeof (packed),
+								sizeof (packed));
+						packed = GUINT32_FROM_LE (packed);
+						memcpy (&val, &packed, sizeof (val));
+						tok->values[sib->id] = val;
+
+						if (val != 0) {
+							found ++;
+						}
+					}
+
+					if (sib->stcf->is_spam) {
+						task->flags |= RSPAMD_TASK_FLAG_HAS_SPAM_TOKENS;
+					}
+					else {
+						task->flags |= RSPAMD_TASK_FLAG_HAS_HAM_TOKENS;
+					}
+
+					msg_debug_stat_redis ("received tokens for %s: %ud learns, "
+							"%ud found",
+							sib->redis_object_expanded, (guint)sib->learned,
+							found);
+				}
+
+				rspamd_upstream_ok (rt->selected);
+			}
+			else {
+				if (reply->type == REDIS_REPLY_ERROR) {
+					rspamd_snprintf (errbuf, sizeof (errbuf),
+							"cannot classify %s: redis error: \"%s\"",
+							rt->stcf->clcf->name, reply->str);
+				}
+				else {
+					rspamd_snprintf (errbuf, sizeof (errbuf),
+							"got invalid reply from redis: %s, array expected",
+							rspamd_redis_type_to_string (reply->type));
+				}
+
+				msg_err_task ("%s", errbuf);
+				rspamd_redis_script_set_error (rt, EINVAL, errbuf);
+			}
+		}
+	}
+	else if (rt->has_event) {
+		rspamd_snprintf (errbuf, sizeof (errbuf),
+				"error getting reply from redis server %s: %s",
+				rspamd_upstream_name (rt->selected), c->errstr);
+		msg_err_task ("%s", errbuf);
+		rspamd_upstream_fail (rt->selected, FALSE, c->errstr);
+		rspamd_redis_script_set_error (rt, c->err, errbuf);
+	}
+
+	if (rt->has_event) {
+		rt->has_event = FALSE;
+		rspamd_session_remove_event (task->s, NULL, rt);
+	}
+}
+
+static void
+rspamd_redis_script_learned (redisAsyncContext *c, gpointer r, gpointer priv)
+{
+	struct redis_stat_runtime *rt = REDIS_RUNTIME (priv);
+	redisReply *reply = r;
+	struct rspamd_task *task;
+	gchar errbuf[256];
+
+	task = rt->task;
+
+	if (c->err == 0 && rt->has_event) {
+		if (r != NULL) {
+			if (rspamd_redis_script_maybe_reload (rt, reply,
+					rspamd_redis_script_learned)) {
+				return;
+			}
+
+			if (reply->type == REDIS_REPLY_ERROR) {
+				rspamd_snprintf (errbuf, sizeof (errbuf),
+						"cannot learn %s: redis error: \"%s\"",
+						rt->stcf->clcf->name, reply->str);
+				msg_err_task ("%s", errbuf);
+				rspamd_redis_script_set_error (rt, EINVAL, errbuf);
+			}
+			else {
+				rspamd_upstream_ok (rt->selected);
+			}
+		}
+	}
+	else if (rt->has_event) {
+		rspamd_snprintf (errbuf, sizeof (errbuf),
+				"cannot get learned: error getting reply from redis server %s: %s",
+				rspamd_upstream_name (rt->selected), c->errstr);
+		msg_err_task ("%s", errbuf);
+		rspamd_upstream_fail (rt->selected, FALSE, c->errstr);
+		rspamd_redis_script_set_error (rt, c->err, errbuf);
+	}
+
+	if (rt->has_event) {
+		rt->has_event = FALSE;
+		rspamd_session_remove_event (task->s, NULL, rt);
+	}
+}
+
+static gboolean
+rspamd_redis_script_process_tokens (struct rspamd_task *task,
+		struct redis_stat_runtime *rt,
+		GPtrArray *tokens, gint id)
+{
+	gchar numbuf[64];
+	gint r;
+
+	if (rt->script_handled) {
+		/* Values are filled by a request of another statfile */
+		return FALSE;
+	}
+
+	rt->script_siblings = rspamd_redis_script_siblings (task, rt, id, FALSE);
+
+	if (rt->redis == NULL && !rspamd_redis_runtime_connect (rt)) {
+		rspamd_redis_script_set_error (rt, ECONNREFUSED,
+				"cannot connect to redis server");
+
+		return FALSE;
+	}
+
+	rt->script_sha = rt->ctx->classify_sha;
+	rt->script_body = rspamd_redis_classify_script;
+	rt->script_args = rspamd_redis_script_prepare_args (rt, FALSE);
+	r = rspamd_snprintf (numbuf, sizeof (numbuf), "%ud",
+			rt->stcf->clcf->min_learns);
+	rspamd_redis_script_append_arg (&rt->script_args, numbuf, r);
+	rt->script_nargs ++;
+	rspamd_redis_script_append_tokens (rt, tokens);
+	/* Appending might reallocate arguments, so register the final buffer */
+	rspamd_mempool_add_destructor (task->task_pool,
+			(rspamd_mempool_destruct_t)rspamd_fstring_free, rt->script_args);
+
+	if (rspamd_redis_script_send (rt, TRUE, rspamd_redis_script_processed)) {
+		rspamd_redis_script_start (rt);
+	}
+	else {
+		rspamd_redis_script_set_error (rt, EINVAL, "call to redis failed");
+	}
+
+	return FALSE;
+}
+
+static gboolean
+rspamd_redis_script_learn_tokens (struct rspamd_task *task,
+		struct redis_stat_runtime *rt,
+		GPtrArray *tokens, gint id)
+{
+	struct redis_stat_runtime *sib;
+	rspamd_token_t *tok;
+	gchar numbuf[64], *deltas;
+	guint32 *packed;
+	gfloat val;
+	guint i, j;
+	gint r;
+
+	if (rt->script_handled) {
+		/* Tokens are learned by a request of another statfile */
+		return TRUE;
+	}
+
+	rt->script_siblings = rspamd_redis_script_siblings (task, rt, id, TRUE);
+
+	if (rt->redis == NULL && !rspamd_redis_runtime_connect (rt)) {
+		rspamd_redis_script_set_error (rt, ECONNREFUSED,
+				"cannot connect to redis server");
+
+		return FALSE;
+	}
+
+	rt->script_sha = rt->ctx->learn_sha;
+	rt->script_body = rspamd_redis_learn_script;
+	rt->script_args = rspamd_redis_script_prepare_args (rt, TRUE);
+	r = rspamd_snprintf (numbuf, sizeof (numbuf), "%ud", rt->ctx->expiry);
+	rspamd_redis_script_append_arg (&rt->script_args, numbuf, r);
+
+	/*
+	 * Same hack as in the plain mode: the sign of the first token value
+	 * tells whether we learn or unlearn a statfile
+	 */
+	deltas = g_alloca (rt->script_siblings->len);
+	tok = g_ptr_array_index (task->tokens, 0);
+
+	for (i = 0; i < rt->script_siblings->len; i ++) {
+		sib = g_ptr_array_index (rt->script_siblings, i);
+		deltas[i] = tok->values[sib->id] > 0 ? '+' : '-';
+
+		/* Add the current key to the set of learned keys */
+		redisAsyncCommand (rt->redis, NULL, NULL, "SADD %s_keys %s",
+				sib->stcf->symbol, sib->redis_object_expanded);
+	}
+
+	rspamd_redis_script_append_arg (&rt->script_args, deltas, i);
+	packed = g_malloc (tokens->len * sizeof (*packed) + 1);
+
+	for (i = 0; i < rt->script_siblings->len; i ++) {
+		sib = g_ptr_array_index (rt->script_siblings, i);
+
+		for (j = 0; j < tokens->len; j ++) {
+			tok = g_ptr_array_index (tokens, j);
+			val = tok->values[sib->id];
+			memcpy (&packed[j], &val, sizeof (val));
+			packed[j] = GUINT32_TO_LE (packed[j]);
+		}
+
+		rspamd_redis_script_append_arg (&rt->script_args, (const gchar *)packed,
+				tokens->len * sizeof (*packed));
+	}
+
+	g_free (packed);
+	/* Expiry + deltas + values */
+	rt->script_nargs += 2 + rt->script_siblings->len;
+	rspamd_redis_script_append_tokens (rt, tokens);
+	/* Appending might reallocate arguments, so register the final buffer */
+	rspamd_mempool_add_destructor (task->task_pool,
+			(rspamd_mempool_destruct_t)rspamd_fstring_free, rt->script_args);
+
+	if (rspamd_redis_script_send (rt, TRUE, rspamd_redis_script_learned)) {
+		rspamd_redis_script_start (rt);
+
+		return TRUE;
+	}
+
+	rspamd_redis_script_set_error (rt, EINVAL, "call to redis failed");
+
+	return FALSE;
+}
+
 gboolean
 rspamd_redis_process_tokens (struct rspamd_task *task,
 		GPtrArray *tokens,
@@ -1781,7 +2480,15 @@ rspamd_redis_process_tokens (struct rspamd_task *task,
 		return FALSE;
 	}
 
-	if (tokens == NULL || tokens->len == 0 || rt->redis == NULL) {
+	if (tokens == NULL || tokens->len == 0) {
+		return FALSE;
+	}
+
+	if (rt->ctx->use_scripts) {
+		return rspamd_redis_script_process_tokens (task, rt, tokens, id);
+	}
+
+	if (rt->redis == NULL) {
 		return FALSE;
 	}
 
@@ -1854,6 +2561,17 @@ rspamd_redis_learn_tokens (struct rspamd_task *task, GPtrArray *tokens,
 		return FALSE;
 	}
 
+	if (rt->ctx->use_scripts) {
+		if (!rt->ctx->store_tokens && !rt->ctx->enable_signatures) {
+			return rspamd_redis_script_learn_tokens (task, rt, tokens, id);
+		}
+
+		/* Tokens and signatures storage is available in the plain mode only */
+		if (rt->redis == NULL && !rspamd_redis_runtime_connect (rt)) {
+			return FALSE;
+		}
+	}
+
 	if (rt->ctx->new_schema) {
 		if (rt->ctx->stcf->is_spam) {
 			learned_key = "learns_spam";
@@ -25,11 +25,16 @@
 #define SQLITE3_BACKEND_TYPE "sqlite3"
 #define SQLITE3_SCHEMA_VERSION "1"
 #define SQLITE3_DEFAULT "default"
+/* Number of tokens processed by a single statement */
+#define SQLITE3_BATCH_SIZE 128
 
 struct rspamd_stat_sqlite3_db {
 	sqlite3 *sqlite;
 	gchar *fname;
 	GArray *prstmt;
+	sqlite3_stmt *get_batch_full;
+	sqlite3_stmt *get_batch_simple;
+	sqlite3_stmt *set_batch;
 	lua_State *L;
 	rspamd_mempool_t *pool;
 	gboolean in_transaction;
@@ -336,7 +341,7 @@ rspamd_sqlite3_get_user (struct rspamd_stat_sqlite3_db *db,
 		lua_rawgeti (L, LUA_REGISTRYINDEX, db->cbref_user);
 		ptask = lua_newuserdata (L, sizeof (struct rspamd_task *));
 		*ptask = task;
-		rspamd_lua_setclass (L, "rspamd{task}", -1);
+		rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 		if (lua_pcall (L, 1, 1, err_idx) != 0) {
 			msg_err_task ("call to user extraction script failed: %s",
@@ -404,7 +409,7 @@ rspamd_sqlite3_get_language (struct rspamd_stat_sqlite3_db *db,
 		lua_rawgeti (L, LUA_REGISTRYINDEX, db->cbref_language);
 		ptask = lua_newuserdata (L, sizeof (struct rspamd_task *));
 		*ptask = task;
-		rspamd_lua_setclass (L, "rspamd{task}", -1);
+		rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 		if (lua_pcall (L, 1, 1, err_idx) != 0) {
 			msg_err_task ("call to language extraction script failed: %s",
@@ -441,6 +446,116 @@ rspamd_sqlite3_get_language (struct rspamd_stat_sqlite3_db *db,
 	return id;
 }
 
+/*
+ * Batch statements take user id as ?1, language id as ?2 and then tokens
+ * (and values for updates) starting from ?3
+ */
+static sqlite3_stmt *
+rspamd_sqlite3_prepare_lookup_batch (sqlite3 *sqlite, gboolean full,
+		GError **err)
+{
+	GString *sql;
+	sqlite3_stmt *stmt = NULL;
+	guint i;
+
+	sql = g_string_new ("SELECT token,value FROM tokens WHERE token IN (");
+
+	for (i = 0; i < SQLITE3_BATCH_SIZE; i ++) {
+		rspamd_printf_gstring (sql, "%s?%ud", i > 0 ? "," : "", i + 3);
+	}
+
+	g_string_append_c (sql, ')');
+
+	if (full) {
+		g_string_append (sql, " AND user=?1 AND (language=?2 OR language=0)");
+	}
+
+	if (sqlite3_prepare_v2 (sqlite, sql->str, -1, &stmt, NULL) != SQLITE_OK) {
+		g_set_error (err, rspamd_sqlite3_backend_quark (), -1,
+				"cannot prepare batch lookup: %s", sqlite3_errmsg (sqlite));
+		stmt = NULL;
+	}
+
+	g_string_free (sql, TRUE);
+
+	return stmt;
+}
+
+static sqlite3_stmt *
+rspamd_sqlite3_prepare_set_batch (sqlite3 *sqlite, gboolean upsert,
+		GError **err)
+{
+	GString *sql;
+	sqlite3_stmt *stmt = NULL;
+	guint i;
+
+	sql = g_string_new (upsert ? "INSERT INTO tokens " :
+			"INSERT OR REPLACE INTO tokens ");
+	g_string_append (sql, "(token, user, language, value, modified) VALUES ");
+
+	for (i = 0; i < SQLITE3_BATCH_SIZE; i ++) {
+		rspamd_printf_gstring (sql, "%s(?%ud,?1,?2,?%ud,strftime('%%s','now'))",
+				i > 0 ? "," : "", i * 2 + 3, i * 2 + 4);
+	}
+
+	if (upsert) {
+		/* Update in place instead of delete + insert done by REPLACE */
+		g_string_append (sql, " ON CONFLICT(token, user, language) DO UPDATE "
+				"SET value=excluded.value, modified=excluded.modified");
+	}
+
+	if (sqlite3_prepare_v2 (sqlite, sql->str, -1, &stmt, NULL) != SQLITE_OK) {
+		g_set_error (err, rspamd_sqlite3_backend_quark (), -1,
+				"cannot prepare batch update: %s", sqlite3_errmsg (sqlite));
+		stmt = NULL;
+	}
+
+	g_string_free (sql, TRUE);
+
+	return stmt;
+}
+
+/*
+ * Upsert is supported since sqlite 3.24, the runtime library can be older
+ * than headers, so REPLACE is used if upsert cannot be prepared
+ */
+static sqlite3_stmt *
+rspamd_sqlite3_prepare_update_batch (rspamd_mempool_t *pool, sqlite3 *sqlite,
+		GError **err)
+{
+	sqlite3_stmt *stmt = NULL;
+	GError *upsert_err = NULL;
+
+	if (sqlite3_libversion_number () >= 3024000) {
+		stmt = rspamd_sqlite3_prepare_set_batch (sqlite, TRUE, &upsert_err);
+
+		if (stmt == NULL) {
+			msg_info_pool ("%e, use replace instead", upsert_err);
+			g_error_free (upsert_err);
+		}
+	}
+
+	if (stmt == NULL) {
+		stmt = rspamd_sqlite3_prepare_set_batch (sqlite, FALSE, err);
+	}
+
+	return stmt;
+}
+
+static void
+rspamd_sqlite3_close_batch (struct rspamd_stat_sqlite3_db *bk)
+{
+	if (bk->get_batch_full) {
+		sqlite3_finalize (bk->get_batch_full);
+	}
+	if (bk->get_batch_simple) {
+		sqlite3_finalize (bk->get_batch_simple);
+	}
+	if (bk->set_batch) {
+		sqlite3_finalize (bk->set_batch);
+	}
+}
+
 static struct rspamd_stat_sqlite3_db *
 rspamd_sqlite3_opendb (rspamd_mempool_t *pool,
 		struct rspamd_statfile_config *stcf,
@@ -449,8 +564,9 @@ rspamd_sqlite3_opendb (rspamd_mempool_t *pool,
 {
 	struct rspamd_stat_sqlite3_db *bk;
 	struct rspamd_stat_tokenizer *tokenizer;
+	const ucl_object_t *elt;
 	gpointer tk_conf;
-	gsize sz = 0;
+	gsize sz = 0, mmap_size = 0;
 	gint64 sz64 = 0;
 	gchar *tok_conf_encoded;
 	gint ret, ntries = 0;
@@ -460,9 +576,14 @@ rspamd_sqlite3_opendb (rspamd_mempool_t *pool,
 			.tv_nsec = 1000000
 	};
 
+	if (opts != NULL &&
+			(elt = ucl_object_lookup (opts, "mmap_size")) != NULL) {
+		mmap_size = ucl_object_toint (elt);
+	}
+
 	bk = g_malloc0 (sizeof (*bk));
 	bk->sqlite = rspamd_sqlite3_open_or_create (pool, path, create_tables_sql,
-			0, err);
+			0, mmap_size, err);
 	bk->pool = pool;
 
 	if (bk->sqlite == NULL) {
@@ -483,6 +604,20 @@ rspamd_sqlite3_opendb (rspamd_mempool_t *pool,
 		return NULL;
 	}
 
+	if ((bk->get_batch_full = rspamd_sqlite3_prepare_lookup_batch (bk->sqlite,
+			TRUE, err)) == NULL ||
+			(bk->get_batch_simple = rspamd_sqlite3_prepare_lookup_batch (
+					bk->sqlite, FALSE, err)) == NULL ||
+			(bk->set_batch = rspamd_sqlite3_prepare_update_batch (pool,
+					bk->sqlite, err)) == NULL) {
+		rspamd_sqlite3_close_batch (bk);
+		rspamd_sqlite3_close_prstmt (bk->sqlite, bk->prstmt);
+		sqlite3_close (bk->sqlite);
+		g_free (bk);
+
+		return NULL;
+	}
+
 	/* Check tokenizer configuration */
 	if (rspamd_sqlite3_run_prstmt (pool, bk->sqlite, bk->prstmt,
 			RSPAMD_STAT_BACKEND_LOAD_TOKENIZER, &sz64, &tk_conf) != SQLITE_OK ||
@@ -508,6 +643,8 @@ rspamd_sqlite3_opendb (rspamd_mempool_t *pool,
 				RSPAMD_STAT_BACKEND_SAVE_TOKENIZER,
 				(gint64)strlen (tok_conf_encoded),
 				tok_conf_encoded) != SQLITE_OK) {
+			rspamd_sqlite3_close_batch (bk);
+			rspamd_sqlite3_close_prstmt (bk->sqlite, bk->prstmt);
 			sqlite3_close (bk->sqlite);
 			g_free (bk);
 			g_free (tok_conf_encoded);
@@ -652,6 +789,7 @@ rspamd_sqlite3_close (gpointer p)
 					RSPAMD_STAT_BACKEND_TRANSACTION_COMMIT);
 		}
 
+		rspamd_sqlite3_close_batch (bk);
 		rspamd_sqlite3_close_prstmt (bk->sqlite, bk->prstmt);
 		sqlite3_close (bk->sqlite);
 		g_free (bk->fname);
@@ -678,6 +816,81 @@ rspamd_sqlite3_runtime (struct rspamd_task *task,
 	return rt;
 }
 
+static gint
+rspamd_sqlite3_token_cmp (const void *a, const void *b)
+{
+	const rspamd_token_t *t1 = *(const rspamd_token_t **)a,
+			*t2 = *(const rspamd_token_t **)b;
+
+	if (t1->data < t2->data) {
+		return -1;
+	}
+
+	return t1->data > t2->data ? 1 : 0;
+}
+
+static void
+rspamd_sqlite3_lookup_batch (struct rspamd_task *task,
+		struct rspamd_stat_sqlite3_rt *rt,
+		rspamd_token_t **batch, guint n, gint id)
+{
+	struct rspamd_stat_sqlite3_db *bk = rt->db;
+	sqlite3_stmt *stmt;
+	rspamd_token_t key, *pkey = &key, **found;
+	guint i;
+	gint rc;
+
+	if (bk->enable_languages || bk->enable_users) {
+		stmt = bk->get_batch_full;
+	}
+	else {
+		stmt = bk->get_batch_simple;
+	}
+
+	/* Unbound parameters are NULL, so they match nothing */
+	sqlite3_reset (stmt);
+	sqlite3_clear_bindings (stmt);
+
+	if (stmt == bk->get_batch_full) {
+		sqlite3_bind_int64 (stmt, 1, rt->user_id);
+		sqlite3_bind_int64 (stmt, 2, rt->lang_id);
+	}
+
+	for (i = 0; i < n; i ++) {
+		batch[i]->values[id] = 0.0f;
+		sqlite3_bind_int64 (stmt, i + 3, batch[i]->data);
+	}
+
+	qsort (batch, n, sizeof (*batch), rspamd_sqlite3_token_cmp);
+
+	while ((rc = sqlite3_step (stmt)) == SQLITE_ROW) {
+		key.data = sqlite3_column_int64 (stmt, 0);
+		found = bsearch (&pkey, batch, n, sizeof (*batch),
+				rspamd_sqlite3_token_cmp);
+
+		if (found == NULL) {
+			continue;
+		}
+
+		/* Duplicate tokens are adjacent after sorting */
+		while (found > batch && (*(found - 1))->data == key.data) {
+			found --;
+		}
+
+		while (found < batch + n && (*found)->data == key.data) {
+			(*found)->values[id] = sqlite3_column_int64 (stmt, 1);
+			found ++;
+		}
+	}
+
+	if (rc != SQLITE_DONE) {
+		msg_warn_task ("failed to lookup tokens in %s: %s", bk->fname,
+				sqlite3_errmsg (bk->sqlite));
+	}
+
+	sqlite3_reset (stmt);
+}
+
 gboolean
 rspamd_sqlite3_process_tokens (struct rspamd_task *task,
 		GPtrArray *tokens,
@@ -685,77 +898,64 @@ rspamd_sqlite3_process_tokens (struct rspamd_task *task,
 {
 	struct rspamd_stat_sqlite3_db *bk;
 	struct rspamd_stat_sqlite3_rt *rt = p;
-	gint64 iv = 0;
-	guint i;
-	rspamd_token_t *tok;
+	rspamd_token_t *batch[SQLITE3_BATCH_SIZE];
+	guint i, n;
 
 	g_assert (p != NULL);
 	g_assert (tokens != NULL);
 
 	bk = rt->db;
 
-	for (i = 0; i < tokens->len; i ++) {
-		tok = g_ptr_array_index (tokens, i);
-
-		if (bk == NULL) {
-			/* Statfile is does not exist, so all values are zero */
-			tok->values[id] = 0.0f;
-			continue;
+	if (bk == NULL) {
+		/* Statfile is does not exist, so all values are zero */
+		for (i = 0; i < tokens->len; i ++) {
+			((rspamd_token_t *)g_ptr_array_index (tokens, i))->values[id] = 0.0f;
 		}
 
-		if (!bk->in_transaction) {
-			rspamd_sqlite3_run_prstmt (task->task_pool, bk->sqlite, bk->prstmt,
-					RSPAMD_STAT_BACKEND_TRANSACTION_START_DEF);
-			bk->in_transaction = TRUE;
-		}
+		return TRUE;
+	}
 
-		if (rt->user_id == -1) {
-			if (bk->enable_users) {
-				rt->user_id = rspamd_sqlite3_get_user (bk, task, FALSE);
-			}
-			else {
-				rt->user_id = 0;
-			}
-		}
+	if (tokens->len == 0) {
+		return TRUE;
+	}
 
-		if (rt->lang_id == -1) {
-			if (bk->enable_languages) {
-				rt->lang_id = rspamd_sqlite3_get_language (bk, task, FALSE);
-			}
-			else {
-				rt->lang_id = 0;
-			}
-		}
+	if (!bk->in_transaction) {
+		rspamd_sqlite3_run_prstmt (task->task_pool, bk->sqlite, bk->prstmt,
+				RSPAMD_STAT_BACKEND_TRANSACTION_START_DEF);
+		bk->in_transaction = TRUE;
+	}
 
-		if (bk->enable_languages || bk->enable_users) {
-			if (rspamd_sqlite3_run_prstmt (task->task_pool, bk->sqlite, bk->prstmt,
-					RSPAMD_STAT_BACKEND_GET_TOKEN_FULL,
-					tok->data, rt->user_id, rt->lang_id, &iv) == SQLITE_OK) {
-				tok->values[id] = iv;
-			}
-			else {
-				tok->values[id] = 0.0f;
-			}
+	if (rt->user_id == -1) {
+		if (bk->enable_users) {
+			rt->user_id = rspamd_sqlite3_get_user (bk, task, FALSE);
 		}
 		else {
-			if (rspamd_sqlite3_run_prstmt (task->task_pool, bk->sqlite, bk->prstmt,
-					RSPAMD_STAT_BACKEND_GET_TOKEN_SIMPLE,
-					tok->data, &iv) == SQLITE_OK) {
-				tok->values[id] = iv;
-			}
-			else {
-				tok->values[id] = 0.0f;
-			}
+			rt->user_id = 0;
 		}
+	}
 
-		if (rt->cf->is_spam) {
-			task->flags |= RSPAMD_TASK_FLAG_HAS_SPAM_TOKENS;
+	if (rt->lang_id == -1) {
+		if (bk->enable_languages) {
+			rt->lang_id = rspamd_sqlite3_get_language (bk, task, FALSE);
 		}
 		else {
-			task->flags |= RSPAMD_TASK_FLAG_HAS_HAM_TOKENS;
+			rt->lang_id = 0;
 		}
 	}
 
+	for (i = 0; i < tokens->len; i += n) {
+		n = MIN (SQLITE3_BATCH_SIZE, tokens->len - i);
+		/* Sorted copy, order of tokens in task is preserved */
+		memcpy (batch, &tokens->pdata[i], n * sizeof (batch[0]));
+		rspamd_sqlite3_lookup_batch (task, rt, batch, n, id);
+	}
+
+	if (rt->cf->is_spam) {
+		task->flags |= RSPAMD_TASK_FLAG_HAS_SPAM_TOKENS;
+	}
+	else {
+		task->flags |= RSPAMD_TASK_FLAG_HAS_HAM_TOKENS;
+	}
 
 	return TRUE;
 }
@@ -782,6 +982,41 @@ rspamd_sqlite3_finalize_process (struct rspamd_task *task, gpointer runtime,
 	return TRUE;
 }
 
+static gboolean
+rspamd_sqlite3_learn_batch (struct rspamd_task *task,
+		struct rspamd_stat_sqlite3_rt *rt,
+		gpointer *batch, gint id)
+{
+	struct rspamd_stat_sqlite3_db *bk = rt->db;
+	sqlite3_stmt *stmt = bk->set_batch;
+	rspamd_token_t *tok;
+	guint i;
+	gint rc;
+
+	sqlite3_reset (stmt);
+	sqlite3_clear_bindings (stmt);
+	sqlite3_bind_int64 (stmt, 1, rt->user_id);
+	sqlite3_bind_int64 (stmt, 2, rt->lang_id);
+
+	for (i = 0; i < SQLITE3_BATCH_SIZE; i ++) {
+		tok = batch[i];
+		sqlite3_bind_int64 (stmt, i * 2 + 3, tok->data);
+		sqlite3_bind_int64 (stmt, i * 2 + 4, tok->values[id]);
+	}
+
+	rc = sqlite3_step (stmt);
+	sqlite3_reset (stmt);
+
+	if (rc != SQLITE_DONE) {
+		msg_warn_task ("failed to learn tokens in %s: %s", bk->fname,
+				sqlite3_errmsg (bk->sqlite));
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 gboolean
 rspamd_sqlite3_learn_tokens (struct rspamd_task *task, GPtrArray *tokens,
 		gint id, gpointer p)
@@ -789,59 +1024,78 @@ rspamd_sqlite3_learn_tokens (struct rspamd_task *task, GPtrArray *tokens,
 	struct rspamd_stat_sqlite3_db *bk;
 	struct rspamd_stat_sqlite3_rt *rt = p;
 	gint64 iv = 0;
-	guint i;
+	guint i, j, n;
 	rspamd_token_t *tok;
+	gboolean ret = TRUE;
 
 	g_assert (tokens != NULL);
 	g_assert (p != NULL);
 
 	bk = rt->db;
 
-	for (i = 0; i < tokens->len; i++) {
-		tok = g_ptr_array_index (tokens, i);
-		if (bk == NULL) {
-			/* Statfile is does not exist, so all values are zero */
-			return FALSE;
-		}
+	if (bk == NULL) {
+		/* Statfile is does not exist, so all values are zero */
+		return FALSE;
+	}
 
-		if (!bk->in_transaction) {
-			rspamd_sqlite3_run_prstmt (task->task_pool, bk->sqlite, bk->prstmt,
-					RSPAMD_STAT_BACKEND_TRANSACTION_START_IM);
-			bk->in_transaction = TRUE;
-		}
+	if (tokens->len == 0) {
+		return TRUE;
+	}
 
-		if (rt->user_id == -1) {
-			if (bk->enable_users) {
-				rt->user_id = rspamd_sqlite3_get_user (bk, task, TRUE);
-			}
-			else {
-				rt->user_id = 0;
-			}
+	/* All tokens are learned in a single transaction committed on finalize */
+	if (!bk->in_transaction) {
+		rspamd_sqlite3_run_prstmt (task->task_pool, bk->sqlite, bk->prstmt,
+				RSPAMD_STAT_BACKEND_TRANSACTION_START_IM);
+		bk->in_transaction = TRUE;
+	}
+
+	if (rt->user_id == -1) {
+		if (bk->enable_users) {
+			rt->user_id = rspamd_sqlite3_get_user (bk, task, TRUE);
+		}
+		else {
+			rt->user_id = 0;
 		}
+	}
 
-		if (rt->lang_id == -1) {
-			if (bk->enable_languages) {
-				rt->lang_id = rspamd_sqlite3_get_language (bk, task, TRUE);
-			}
-			else {
-				rt->lang_id = 0;
-			}
+	if (rt->lang_id == -1) {
+		if (bk->enable_languages) {
+			rt->lang_id = rspamd_sqlite3_get_language (bk, task, TRUE);
 		}
+		else {
+			rt->lang_id = 0;
+		}
+	}
 
-		iv = tok->values[id];
+	for (i = 0; i < tokens->len && ret; i += n) {
+		n = MIN (SQLITE3_BATCH_SIZE, tokens->len - i);
 
-		if (rspamd_sqlite3_run_prstmt (task->task_pool, bk->sqlite, bk->prstmt,
-				RSPAMD_STAT_BACKEND_SET_TOKEN,
-				tok->data, rt->user_id, rt->lang_id, iv) != SQLITE_OK) {
-			rspamd_sqlite3_run_prstmt (task->task_pool, bk->sqlite, bk->prstmt,
-					RSPAMD_STAT_BACKEND_TRANSACTION_ROLLBACK);
-			bk->in_transaction = FALSE;
+		if (n == SQLITE3_BATCH_SIZE) {
+			ret = rspamd_sqlite3_learn_batch (task, rt, &tokens->pdata[i], id);
+			continue;
+		}
+
+		/* Tail is learned token by token */
+		for (j = i; j < i + n; j ++) {
+			tok = g_ptr_array_index (tokens, j);
+			iv = tok->values[id];
 
-			return FALSE;
+			if (rspamd_sqlite3_run_prstmt (task->task_pool, bk->sqlite,
+					bk->prstmt, RSPAMD_STAT_BACKEND_SET_TOKEN,
+					tok->data, rt->user_id, rt->lang_id, iv) != SQLITE_OK) {
+				ret = FALSE;
+				break;
+			}
 		}
 	}
 
-	return TRUE;
+	if (!ret) {
+		rspamd_sqlite3_run_prstmt (task->task_pool, bk->sqlite, bk->prstmt,
+				RSPAMD_STAT_BACKEND_TRANSACTION_ROLLBACK);
+		bk->in_transaction = FALSE;
+	}
+
+	return ret;
 }
 
 gboolean
@@ -166,7 +166,7 @@ bayes_classify_token (struct rspamd_classifier *ctx,
 			}
 
 			total_count += val;
-			cl->total_hits += val;
+			cl->total_hits += val * tok->count;
 		}
 	}
 
@@ -204,12 +204,13 @@ bayes_classify_token (struct rspamd_classifier *ctx,
 
 		bayes_ham_prob = PROB_COMBINE (ham_prob, total_count, w, 0.5);
 
-		cl->spam_prob += log (bayes_spam_prob);
-		cl->ham_prob += log (bayes_ham_prob);
-		cl->processed_tokens ++;
+		/* Duplicate tokens are merged, so count each occurrence */
+		cl->spam_prob += tok->count * log (bayes_spam_prob);
+		cl->ham_prob += tok->count * log (bayes_ham_prob);
+		cl->processed_tokens += tok->count;
 
 		if (!(tok->flags & RSPAMD_STAT_TOKEN_FLAG_META)) {
-			cl->text_tokens ++;
+			cl->text_tokens += tok->count;
 		}
 		else {
 			token_type = "meta";
@@ -275,7 +276,7 @@ bayes_classify (struct rspamd_classifier * ctx,
 	struct rspamd_statfile *st = NULL;
 	struct bayes_task_closure cl;
 	rspamd_token_t *tok;
-	guint i, text_tokens = 0;
+	guint i, text_tokens = 0, total_tokens = 0;
 	gint id;
 
 	g_assert (ctx != NULL);
@@ -304,15 +305,17 @@ bayes_classify (struct rspamd_classifier * ctx,
 
 	for (i = 0; i < tokens->len; i ++) {
 		tok = g_ptr_array_index (tokens, i);
+		total_tokens += tok->count;
+
 		if (!(tok->flags & RSPAMD_STAT_TOKEN_FLAG_META)) {
-			text_tokens ++;
+			text_tokens += tok->count;
 		}
 	}
 
 	if (text_tokens == 0) {
 		msg_info_task ("skipped classification as there are no text tokens. "
 				"Total tokens: %ud",
-				tokens->len);
+				total_tokens);
 
 		return TRUE;
 	}
@@ -320,11 +323,11 @@ bayes_classify (struct rspamd_classifier * ctx,
 	/*
 	 * Skip some metatokens if we don't have enough text tokens
 	 */
-	if (text_tokens > tokens->len - text_tokens) {
+	if (text_tokens > total_tokens - text_tokens) {
 		cl.meta_skip_prob = 0.0;
 	}
 	else {
-		cl.meta_skip_prob = 1.0 - text_tokens / tokens->len;
+		cl.meta_skip_prob = 1.0 - text_tokens / total_tokens;
 	}
 
 	for (i = 0; i < tokens->len; i ++) {
@@ -336,7 +339,7 @@ bayes_classify (struct rspamd_classifier * ctx,
 	if (cl.processed_tokens == 0) {
 		msg_info_bayes ("no tokens found in bayes database "
 				  "(%ud total tokens, %ud text tokens), ignore stats",
-				tokens->len, text_tokens);
+				total_tokens, text_tokens);
 
 		return TRUE;
 	}
@@ -383,7 +386,7 @@ bayes_classify (struct rspamd_classifier * ctx,
 				cl.spam_prob,
 				s,
 				cl.processed_tokens,
-				tokens->len,
+				total_tokens,
 				cl.text_tokens,
 				text_tokens);
 	}
@@ -493,7 +496,8 @@ bayes_learn_spam (struct rspamd_classifier * ctx,
 
 			if (!!st->stcf->is_spam == !!is_spam) {
 				if (incrementing) {
-					tok->values[id] = 1;
+					/* Add all occurrences of a merged token */
+					tok->values[id] = tok->count;
 				}
 				else {
 					tok->values[id]++;
@@ -512,7 +516,7 @@ bayes_learn_spam (struct rspamd_classifier * ctx,
 				if (tok->values[id] > 0 && unlearn) {
 					/* Unlearning */
 					if (incrementing) {
-						tok->values[id] = -1;
+						tok->values[id] = -(gdouble)tok->count;
 					}
 					else {
 						tok->values[id]--;
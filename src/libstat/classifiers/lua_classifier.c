@@ -145,24 +145,29 @@ lua_classifier_classify (struct rspamd_classifier *cl,
 	lua_rawgeti (L, LUA_REGISTRYINDEX, ctx->classify_ref);
 	ptask = lua_newuserdata (L, sizeof (*ptask));
 	*ptask = task;
-	rspamd_lua_setclass (L, "rspamd{task}", -1);
+	rspamd_lua_setclass (L, rspamd_task_classname, -1);
 	pcfg = lua_newuserdata (L, sizeof (*pcfg));
 	*pcfg = cl->cfg;
-	rspamd_lua_setclass (L, "rspamd{classifier}", -1);
+	rspamd_lua_setclass (L, rspamd_classifier_classname, -1);
 
 	lua_createtable (L, tokens->len, 0);
 
 	for (i = 0; i < tokens->len; i ++) {
 		tok = g_ptr_array_index (tokens, i);
 		v = tok->data;
-		lua_createtable (L, 3, 0);
-		/* High word, low word, order */
+		lua_createtable (L, 4, 0);
+		/*
+		 * High word, low word, order, number of occurrences: duplicate
+		 * tokens are merged, so each token is passed only once
+		 */
 		lua_pushinteger (L, (guint32)(v >> 32));
 		lua_rawseti (L, -2, 1);
 		lua_pushinteger (L, (guint32)(v));
 		lua_rawseti (L, -2, 2);
 		lua_pushinteger (L, tok->window_idx);
 		lua_rawseti (L, -2, 3);
+		lua_pushinteger (L, tok->count);
+		lua_rawseti (L, -2, 4);
 		lua_rawseti (L, -2, i + 1);
 	}
 
@@ -200,10 +205,10 @@ lua_classifier_learn_spam (struct rspamd_classifier *cl,
 	lua_rawgeti (L, LUA_REGISTRYINDEX, ctx->learn_ref);
 	ptask = lua_newuserdata (L, sizeof (*ptask));
 	*ptask = task;
-	rspamd_lua_setclass (L, "rspamd{task}", -1);
+	rspamd_lua_setclass (L, rspamd_task_classname, -1);
 	pcfg = lua_newuserdata (L, sizeof (*pcfg));
 	*pcfg = cl->cfg;
-	rspamd_lua_setclass (L, "rspamd{classifier}", -1);
+	rspamd_lua_setclass (L, rspamd_classifier_classname, -1);
 
 	lua_createtable (L, tokens->len, 0);
 
@@ -211,14 +216,19 @@ lua_classifier_learn_spam (struct rspamd_classifier *cl,
 		tok = g_ptr_array_index (tokens, i);
 		v = 0;
 		v = tok->data;
-		lua_createtable (L, 3, 0);
-		/* High word, low word, order */
+		lua_createtable (L, 4, 0);
+		/*
+		 * High word, low word, order, number of occurrences: duplicate
+		 * tokens are merged, so each token is passed only once
+		 */
 		lua_pushinteger (L, (guint32)(v >> 32));
 		lua_rawseti (L, -2, 1);
 		lua_pushinteger (L, (guint32)(v));
 		lua_rawseti (L, -2, 2);
 		lua_pushinteger (L, tok->window_idx);
 		lua_rawseti (L, -2, 3);
+		lua_pushinteger (L, tok->count);
+		lua_rawseti (L, -2, 4);
 		lua_rawseti (L, -2, i + 1);
 	}
 
@@ -204,7 +204,6 @@ static void
 rspamd_stat_cache_redis_generate_id (struct rspamd_task *task)
 {
 	rspamd_cryptobox_hash_state_t st;
-	rspamd_token_t *tok;
 	guint i;
 	guchar out[rspamd_cryptobox_HASHBYTES];
 	gchar *b32out;
@@ -218,11 +217,7 @@ rspamd_stat_cache_redis_generate_id (struct rspamd_task *task)
 		rspamd_cryptobox_hash_update (&st, user, strlen (user));
 	}
 
-	for (i = 0; i < task->tokens->len; i ++) {
-		tok = g_ptr_array_index (task->tokens, i);
-		rspamd_cryptobox_hash_update (&st, (guchar *)&tok->data,
-				sizeof (tok->data));
-	}
+	rspamd_stat_tokens_hash_update (task, &st);
 
 	rspamd_cryptobox_hash_final (&st, out);
 
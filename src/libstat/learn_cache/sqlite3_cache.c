@@ -135,7 +135,7 @@ rspamd_stat_cache_sqlite3_init (struct rspamd_stat_ctx *ctx,
 	rspamd_snprintf (dbpath, sizeof (dbpath), "%s", path);
 
 	sqlite = rspamd_sqlite3_open_or_create (cfg->cfg_pool,
-			dbpath, create_tables_sql, 0, &err);
+			dbpath, create_tables_sql, 0, 0, &err);
 
 	if (sqlite == NULL) {
 		msg_err ("cannot open sqlite3 cache: %e", err);
@@ -176,10 +176,8 @@ rspamd_stat_cache_sqlite3_check (struct rspamd_task *task,
 {
 	struct rspamd_stat_sqlite3_ctx *ctx = runtime;
 	rspamd_cryptobox_hash_state_t st;
-	rspamd_token_t *tok;
 	guchar *out;
 	gchar *user = NULL;
-	guint i;
 	gint rc;
 	gint64 flag;
 
@@ -198,11 +196,7 @@ rspamd_stat_cache_sqlite3_check (struct rspamd_task *task,
 			rspamd_cryptobox_hash_update (&st, user, strlen (user));
 		}
 
-		for (i = 0; i < task->tokens->len; i ++) {
-			tok = g_ptr_array_index (task->tokens, i);
-			rspamd_cryptobox_hash_update (&st, (guchar *)&tok->data,
-					sizeof (tok->data));
-		}
+		rspamd_stat_tokens_hash_update (task, &st);
 
 		rspamd_cryptobox_hash_final (&st, out);
 
@@ -57,6 +57,7 @@ typedef struct token_node_s {
 	guint64 data;
 	guint window_idx;
 	guint flags;
+	guint count; /* number of occurrences in a message */
 	rspamd_stat_token_t *t1;
 	rspamd_stat_token_t *t2;
 	float values[];
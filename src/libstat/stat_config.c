@@ -89,9 +89,11 @@ static struct rspamd_stat_tokenizer stat_tokenizers[] = {
 
 static struct rspamd_stat_backend stat_backends[] = {
 		RSPAMD_STAT_BACKEND_ELT(mmap, mmaped_file),
+		RSPAMD_STAT_BACKEND_ELT(mmap_table, mmaped_table),
 		RSPAMD_STAT_BACKEND_ELT(sqlite3, sqlite3),
 		RSPAMD_STAT_BACKEND_ELT_READONLY(cdb, cdb),
-		RSPAMD_STAT_BACKEND_ELT(redis, redis)
+		RSPAMD_STAT_BACKEND_ELT(redis, redis),
+		RSPAMD_STAT_BACKEND_ELT(http, http)
 };
 
 #define RSPAMD_STAT_CACHE_ELT(nam, eltn) { \
@@ -214,7 +216,7 @@ rspamd_stat_init (struct rspamd_config *cfg, struct ev_loop *ev_base)
 
 				pcfg = lua_newuserdata (L, sizeof (*pcfg));
 				*pcfg = cfg;
-				rspamd_lua_setclass (L, "rspamd{config}", -1);
+				rspamd_lua_setclass (L, rspamd_config_classname, -1);
 
 				if ((ret = lua_pcall (L, 1, 1, err_idx)) != 0) {
 					msg_err_config ("call to gen_stat_tokens lua "
@@ -322,6 +324,17 @@ rspamd_stat_init (struct rspamd_config *cfg, struct ev_loop *ev_base)
 		if (cache_name == NULL && !skip_cache) {
 			/* We assume that learn cache is the same as backend */
 			cache_name = clf->backend;
+
+			for (i = 0; i < stat_ctx->caches_count; i++) {
+				if (cache_name && strcmp (cache_name, stat_ctx->caches_subrs[i].name) == 0) {
+					break;
+				}
+			}
+
+			if (i == stat_ctx->caches_count) {
+				/* No such cache (e.g. http backend), use the default one */
+				cache_name = NULL;
+			}
 		}
 
 		curst = clf->statfiles;
@@ -23,6 +23,7 @@
 #include "tokenizers/tokenizers.h"
 #include "backends/backends.h"
 #include "learn_cache/learn_cache.h"
+#include "cryptobox.h"
 
 #ifdef  __cplusplus
 extern "C" {
@@ -122,6 +123,29 @@ struct rspamd_stat_async_elt *rspamd_stat_ctx_register_async (
 		rspamd_stat_async_handler handler, rspamd_stat_async_cleanup cleanup,
 		gpointer d, gdouble timeout);
 
+/**
+ * Sorts tokens by hash and merges duplicates setting their count, unique
+ * tokens are then moved to a single flat chunk of `pool`
+ * @param tokens array of rspamd_token_t pointers
+ * @param token_size size of a token including its values
+ * @return number of unique tokens
+ */
+guint rspamd_stat_tokens_merge (GPtrArray *tokens, rspamd_mempool_t *pool,
+		gsize token_size);
+
+/**
+ * Returns number of tokens in a task including all occurrences of merged
+ * duplicate tokens
+ */
+guint rspamd_stat_tokens_total (struct rspamd_task *task);
+
+/**
+ * Updates hash with tokens hashes in the order they have been produced by
+ * tokenizer, so the digest does not depend on merging of duplicate tokens
+ */
+void rspamd_stat_tokens_hash_update (struct rspamd_task *task,
+		rspamd_cryptobox_hash_state_t *st);
+
 static GQuark rspamd_stat_quark (void) {
 	return g_quark_from_static_string ("rspamd-statistics");
 }
@@ -54,7 +54,7 @@ rspamd_stat_tokenize_parts_metadata (struct rspamd_stat_ctx *st_ctx,
 
 		ptask = lua_newuserdata (L, sizeof (*ptask));
 		*ptask = task;
-		rspamd_lua_setclass (L, "rspamd{task}", -1);
+		rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 		if ((ret = lua_pcall (L, 1, 1, err_idx)) != 0) {
 			msg_err_task ("call to stat_tokens lua "
@@ -110,6 +110,112 @@ rspamd_stat_tokenize_parts_metadata (struct rspamd_stat_ctx *st_ctx,
 			rspamd_array_free_hard, ar);
 }
 
+static gint
+rspamd_stat_token_cmp (const void *a, const void *b)
+{
+	const rspamd_token_t *t1 = *(const rspamd_token_t **)a,
+			*t2 = *(const rspamd_token_t **)b;
+
+	if (t1->data < t2->data) {
+		return -1;
+	}
+
+	return t1->data > t2->data ? 1 : 0;
+}
+
+guint
+rspamd_stat_tokens_merge (GPtrArray *tokens, rspamd_mempool_t *pool,
+		gsize token_size)
+{
+	rspamd_token_t *tok, *prev = NULL;
+	guchar *flat;
+	guint i, nunique = 0;
+
+	if (tokens->len == 0) {
+		return 0;
+	}
+
+	qsort (tokens->pdata, tokens->len, sizeof (gpointer),
+			rspamd_stat_token_cmp);
+
+	for (i = 0; i < tokens->len; i ++) {
+		tok = g_ptr_array_index (tokens, i);
+
+		if (prev != NULL && prev->data == tok->data) {
+			prev->count ++;
+			continue;
+		}
+
+		tok->count = 1;
+		g_ptr_array_index (tokens, nunique ++) = tok;
+		prev = tok;
+	}
+
+	flat = rspamd_mempool_alloc (pool, token_size * nunique);
+
+	for (i = 0; i < nunique; i ++) {
+		memcpy (flat + token_size * i, g_ptr_array_index (tokens, i),
+				token_size);
+		g_ptr_array_index (tokens, i) = flat + token_size * i;
+	}
+
+	g_ptr_array_set_size (tokens, nunique);
+
+	return nunique;
+}
+
+static void
+rspamd_stat_tokens_compact (struct rspamd_stat_ctx *st_ctx,
+		struct rspamd_task *task)
+{
+	guint ntokens = task->tokens->len, nunique;
+
+	/* Same as tokenizer uses */
+	nunique = rspamd_stat_tokens_merge (task->tokens, task->task_pool,
+			sizeof (rspamd_token_t) +
+			sizeof (gdouble) * st_ctx->statfiles->len);
+	msg_debug_bayes ("compacted %ud tokens to %ud unique tokens",
+			ntokens, nunique);
+}
+
+guint
+rspamd_stat_tokens_total (struct rspamd_task *task)
+{
+	GArray *order;
+
+	order = rspamd_mempool_get_variable (task->task_pool,
+			RSPAMD_MEMPOOL_STAT_TOKENS_ORDER);
+
+	if (order != NULL) {
+		return order->len;
+	}
+
+	return task->tokens ? task->tokens->len : 0;
+}
+
+void
+rspamd_stat_tokens_hash_update (struct rspamd_task *task,
+		rspamd_cryptobox_hash_state_t *st)
+{
+	GArray *order;
+	rspamd_token_t *tok;
+	guint i;
+
+	order = rspamd_mempool_get_variable (task->task_pool,
+			RSPAMD_MEMPOOL_STAT_TOKENS_ORDER);
+
+	if (order != NULL) {
+		rspamd_cryptobox_hash_update (st, (const guchar *)order->data,
+				order->len * sizeof (guint64));
+	}
+	else if (task->tokens) {
+		PTR_ARRAY_FOREACH (task->tokens, i, tok) {
+			rspamd_cryptobox_hash_update (st, (const guchar *)&tok->data,
+					sizeof (tok->data));
+		}
+	}
+}
+
 /*
  * Tokenize task using the tokenizer specified
  */
@@ -120,6 +226,7 @@ rspamd_stat_process_tokenize (struct rspamd_stat_ctx *st_ctx,
 	struct rspamd_mime_text_part *part;
 	rspamd_cryptobox_hash_state_t hst;
 	rspamd_token_t *st_tok;
+	GArray *order;
 	guint i, reserved_len = 0;
 	gdouble *pdiff;
 	guchar hout[rspamd_cryptobox_HASHBYTES];
@@ -171,14 +278,23 @@ rspamd_stat_process_tokenize (struct rspamd_stat_ctx *st_ctx,
 
 	rspamd_stat_tokenize_parts_metadata (st_ctx, task);
 
-	/* Produce signature */
-	rspamd_cryptobox_hash_init (&hst, NULL, 0);
+	/*
+	 * Save the original order of tokens: signature and learn caches digests
+	 * are computed on it, so they are not changed by tokens merging
+	 */
+	order = g_array_sized_new (FALSE, FALSE, sizeof (guint64),
+			task->tokens->len);
 
 	PTR_ARRAY_FOREACH (task->tokens, i, st_tok) {
-		rspamd_cryptobox_hash_update (&hst, (guchar *)&st_tok->data,
-				sizeof (st_tok->data));
+		g_array_append_val (order, st_tok->data);
 	}
 
+	rspamd_mempool_set_variable (task->task_pool,
+			RSPAMD_MEMPOOL_STAT_TOKENS_ORDER, order, rspamd_array_free_hard);
+
+	/* Produce signature */
+	rspamd_cryptobox_hash_init (&hst, NULL, 0);
+	rspamd_stat_tokens_hash_update (task, &hst);
 	rspamd_cryptobox_hash_final (&hst, hout);
 	b32_hout = rspamd_encode_base32 (hout, sizeof (hout), RSPAMD_BASE32_DEFAULT);
 	/*
@@ -188,6 +304,8 @@ rspamd_stat_process_tokenize (struct rspamd_stat_ctx *st_ctx,
 	b32_hout[32] = '\0';
 	rspamd_mempool_set_variable (task->task_pool, RSPAMD_MEMPOOL_STAT_SIGNATURE,
 			b32_hout, g_free);
+
+	rspamd_stat_tokens_compact (st_ctx, task);
 }
 
 static gboolean
@@ -207,7 +325,7 @@ rspamd_stat_classifier_is_skipped (struct rspamd_task *task,
 		/* Push task and two booleans: is_spam and is_unlearn */
 		struct rspamd_task **ptask = lua_newuserdata (L, sizeof (*ptask));
 		*ptask = task;
-		rspamd_lua_setclass (L, "rspamd{task}", -1);
+		rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 		if (is_learn) {
 			lua_pushboolean(L, is_spam);
@@ -363,7 +481,7 @@ static void
 rspamd_stat_classifiers_process (struct rspamd_stat_ctx *st_ctx,
 		struct rspamd_task *task)
 {
-	guint i, j, id;
+	guint i, j, id, ntokens;
 	struct rspamd_classifier *cl;
 	struct rspamd_statfile *st;
 	gpointer bk_run;
@@ -373,6 +491,8 @@ rspamd_stat_classifiers_process (struct rspamd_stat_ctx *st_ctx,
 		return;
 	}
 
+	ntokens = rspamd_stat_tokens_total (task);
+
 	/*
 	 * Do not classify a message if some class is missing
 	 */
@@ -454,21 +574,21 @@ rspamd_stat_classifiers_process (struct rspamd_stat_ctx *st_ctx,
 		}
 
 		if (!skip) {
-			if (cl->cfg->min_tokens > 0 && task->tokens->len < cl->cfg->min_tokens) {
+			if (cl->cfg->min_tokens > 0 && ntokens < cl->cfg->min_tokens) {
 				msg_debug_bayes (
 						"contains less tokens than required for %s classifier: "
 						"%ud < %ud",
 						cl->cfg->name,
-						task->tokens->len,
+						ntokens,
 						cl->cfg->min_tokens);
 				continue;
 			}
-			else if (cl->cfg->max_tokens > 0 && task->tokens->len > cl->cfg->max_tokens) {
+			else if (cl->cfg->max_tokens > 0 && ntokens > cl->cfg->max_tokens) {
 				msg_debug_bayes (
 						"contains more tokens than allowed for %s classifier: "
 						"%ud > %ud",
 						cl->cfg->name,
-						task->tokens->len,
+						ntokens,
 						cl->cfg->max_tokens);
 				continue;
 			}
@@ -578,7 +698,7 @@ rspamd_stat_classifiers_learn (struct rspamd_stat_ctx *st_ctx,
 		 GError **err)
 {
 	struct rspamd_classifier *cl, *sel = NULL;
-	guint i;
+	guint i, ntokens;
 	gboolean learned = FALSE, too_small = FALSE, too_large = FALSE;
 
 	if ((task->flags & RSPAMD_TASK_FLAG_ALREADY_LEARNED) && err != NULL &&
@@ -591,6 +711,8 @@ rspamd_stat_classifiers_learn (struct rspamd_stat_ctx *st_ctx,
 		return FALSE;
 	}
 
+	ntokens = rspamd_stat_tokens_total (task);
+
 	/* Check whether we have learned that file */
 	for (i = 0; i < st_ctx->classifiers->len; i ++) {
 		cl = g_ptr_array_index (st_ctx->classifiers, i);
@@ -604,24 +726,24 @@ rspamd_stat_classifiers_learn (struct rspamd_stat_ctx *st_ctx,
 		sel = cl;
 
 		/* Now check max and min tokens */
-		if (cl->cfg->min_tokens > 0 && task->tokens->len < cl->cfg->min_tokens) {
+		if (cl->cfg->min_tokens > 0 && ntokens < cl->cfg->min_tokens) {
 			msg_info_task (
 				"<%s> contains less tokens than required for %s classifier: "
 						"%ud < %ud",
 					MESSAGE_FIELD (task, message_id),
 					cl->cfg->name,
-					task->tokens->len,
+					ntokens,
 					cl->cfg->min_tokens);
 			too_small = TRUE;
 			continue;
 		}
-		else if (cl->cfg->max_tokens > 0 && task->tokens->len > cl->cfg->max_tokens) {
+		else if (cl->cfg->max_tokens > 0 && ntokens > cl->cfg->max_tokens) {
 			msg_info_task (
 				"<%s> contains more tokens than allowed for %s classifier: "
 						"%ud > %ud",
 					MESSAGE_FIELD (task, message_id),
 					cl->cfg->name,
-					task->tokens->len,
+					ntokens,
 					cl->cfg->max_tokens);
 			too_large = TRUE;
 			continue;
@@ -652,7 +774,7 @@ rspamd_stat_classifiers_learn (struct rspamd_stat_ctx *st_ctx,
 					"%d > %d",
 					MESSAGE_FIELD (task, message_id),
 					sel->cfg->name,
-					task->tokens->len,
+					ntokens,
 					sel->cfg->max_tokens);
 		}
 		else if (too_small) {
@@ -661,7 +783,7 @@ rspamd_stat_classifiers_learn (struct rspamd_stat_ctx *st_ctx,
 					"%d < %d",
 					MESSAGE_FIELD (task, message_id),
 					sel->cfg->name,
-					task->tokens->len,
+					ntokens,
 					sel->cfg->min_tokens);
 		}
 	}
@@ -1053,7 +1175,7 @@ rspamd_stat_check_autolearn (struct rspamd_task *task)
 
 						ptask = lua_newuserdata (L, sizeof (struct rspamd_task *));
 						*ptask = task;
-						rspamd_lua_setclass (L, "rspamd{task}", -1);
+						rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 						if (lua_pcall (L, 1, 1, err_idx) != 0) {
 							msg_err_task ("call to autolearn script failed: "
@@ -1107,7 +1229,7 @@ rspamd_stat_check_autolearn (struct rspamd_task *task)
 
 					ptask = lua_newuserdata (L, sizeof (struct rspamd_task *));
 					*ptask = task;
-					rspamd_lua_setclass (L, "rspamd{task}", -1);
+					rspamd_lua_setclass (L, rspamd_task_classname, -1);
 					/* Push the whole object as well */
 					ucl_object_push_lua (L, obj, true);
 
@@ -82,6 +82,152 @@ static rspamd_mempool_stat_t *mem_pool_stat = NULL;
 /* Environment variable */
 static gboolean env_checked = FALSE;
 static gboolean always_malloc = FALSE;
+/* Normal chunks freed by the previous pools of this process */
+static struct rspamd_mempool_chunks_cache chunks_cache;
+G_LOCK_DEFINE_STATIC (chunks_cache);
+
+static inline gint
+rspamd_mempool_cache_class (gsize len)
+{
+	guint nbits = g_bit_storage (len);
+
+	if (nbits <= MEMPOOL_CACHE_MIN_SHIFT) {
+		return 0;
+	}
+
+	nbits -= MEMPOOL_CACHE_MIN_SHIFT;
+
+	if (nbits >= MEMPOOL_CACHE_CLASSES) {
+		return -1;
+	}
+
+	return nbits;
+}
+
+/*
+ * Returns a cached chunk of at least `len` bytes and sets `real_len` to its
+ * actual size or returns NULL if nothing suitable has been found
+ */
+static gpointer
+rspamd_mempool_cache_get (gsize len, gsize *real_len)
+{
+	struct rspamd_mempool_cached_chunk *cur, *prev = NULL;
+	gint cls;
+
+	cls = rspamd_mempool_cache_class (len);
+
+	if (cls < 0 || always_malloc) {
+		return NULL;
+	}
+
+	G_LOCK (chunks_cache);
+
+	for (cur = chunks_cache.chunks[cls]; cur != NULL; cur = cur->next) {
+		if (cur->len >= len) {
+			if (prev) {
+				prev->next = cur->next;
+			}
+			else {
+				chunks_cache.chunks[cls] = cur->next;
+			}
+
+			chunks_cache.nchunks[cls] --;
+			chunks_cache.bytes -= cur->len;
+
+			if (chunks_cache.nchunks[cls] < chunks_cache.low_water[cls]) {
+				chunks_cache.low_water[cls] = chunks_cache.nchunks[cls];
+			}
+
+			G_UNLOCK (chunks_cache);
+
+			*real_len = cur->len;
+			g_atomic_int_inc (&mem_pool_stat->cache_hits);
+			g_atomic_int_add (&mem_pool_stat->cached_bytes, -((gint)cur->len));
+
+			return (gpointer)cur;
+		}
+
+		prev = cur;
+	}
+
+	G_UNLOCK (chunks_cache);
+	g_atomic_int_inc (&mem_pool_stat->cache_misses);
+
+	return NULL;
+}
+
+/*
+ * Stores a normal chunk allocated by posix_memalign in the cache or frees it
+ * if the cache is full
+ */
+static void
+rspamd_mempool_cache_put (gpointer p, gsize len)
+{
+	struct rspamd_mempool_cached_chunk *chunk = p;
+	gint cls;
+
+	cls = rspamd_mempool_cache_class (len);
+
+	if (cls < 0 || always_malloc) {
+		free (p);
+
+		return;
+	}
+
+	G_LOCK (chunks_cache);
+
+	if (chunks_cache.nchunks[cls] >= MEMPOOL_CACHE_MAX_ELTS ||
+			chunks_cache.bytes + len > MEMPOOL_CACHE_MAX_BYTES) {
+		G_UNLOCK (chunks_cache);
+		free (p);
+
+		return;
+	}
+
+	chunk->len = len;
+	chunk->next = chunks_cache.chunks[cls];
+	chunks_cache.chunks[cls] = chunk;
+	chunks_cache.nchunks[cls] ++;
+	chunks_cache.bytes += len;
+	G_UNLOCK (chunks_cache);
+
+	g_atomic_int_add (&mem_pool_stat->cached_bytes, (gint)len);
+}
+
+void
+rspamd_mempool_cache_trim (gboolean full)
+{
+	struct rspamd_mempool_cached_chunk *cur;
+	guint i, ntrim, ntrimmed = 0;
+	gsize trimmed_bytes = 0;
+
+	G_LOCK (chunks_cache);
+
+	for (i = 0; i < MEMPOOL_CACHE_CLASSES; i ++) {
+		/* Chunks that have not been reused since the last trim */
+		ntrim = full ? chunks_cache.nchunks[i] : chunks_cache.low_water[i];
+
+		while (ntrim > 0 && chunks_cache.chunks[i] != NULL) {
+			cur = chunks_cache.chunks[i];
+			chunks_cache.chunks[i] = cur->next;
+			chunks_cache.nchunks[i] --;
+			chunks_cache.bytes -= cur->len;
+			trimmed_bytes += cur->len;
+			ntrimmed ++;
+			ntrim --;
+			free (cur);
+		}
+
+		chunks_cache.low_water[i] = chunks_cache.nchunks[i];
+	}
+
+	G_UNLOCK (chunks_cache);
+
+	if (ntrimmed > 0 && mem_pool_stat != NULL) {
+		g_atomic_int_add (&mem_pool_stat->cache_trimmed, ntrimmed);
+		g_atomic_int_add (&mem_pool_stat->cached_bytes, -((gint)trimmed_bytes));
+	}
+}
 
 /**
  * Function that return free space in pool page
@@ -223,12 +369,16 @@ rspamd_mempool_chain_new (gsize size, gsize alignment, enum rspamd_mempool_chain
 		optimal_size = sys_alloc_size (total_size);
 #endif
 		total_size = MAX (total_size, optimal_size);
-		gint ret = posix_memalign (&map, alignment, total_size);
+		map = rspamd_mempool_cache_get (total_size, &total_size);
 
-		if (ret != 0 || map == NULL) {
-			g_error ("%s: failed to allocate %"G_GSIZE_FORMAT" bytes: %d - %s",
-					G_STRLOC, total_size, ret, strerror (errno));
-			abort ();
+		if (map == NULL) {
+			gint ret = posix_memalign (&map, alignment, total_size);
+
+			if (ret != 0 || map == NULL) {
+				g_error ("%s: failed to allocate %"G_GSIZE_FORMAT" bytes: %d - %s",
+						G_STRLOC, total_size, ret, strerror (errno));
+				abort ();
+			}
 		}
 
 		chain = map;
@@ -360,14 +510,19 @@ rspamd_mempool_new_ (gsize size, const gchar *tag, gint flags, const gchar *loc)
 	 * memory chunk
 	 */
 	guchar *mem_chunk;
-	gint ret = posix_memalign ((void **)&mem_chunk, MIN_MEM_ALIGNMENT,
-			total_size);
-	gsize priv_offset;
+	gsize priv_offset, chunk_len = total_size;
+
+	mem_chunk = rspamd_mempool_cache_get (total_size, &chunk_len);
+
+	if (mem_chunk == NULL) {
+		gint ret = posix_memalign ((void **)&mem_chunk, MIN_MEM_ALIGNMENT,
+				total_size);
 
-	if (ret != 0 || mem_chunk == NULL) {
-		g_error ("%s: failed to allocate %"G_GSIZE_FORMAT" bytes: %d - %s",
-				G_STRLOC, total_size, ret, strerror (errno));
-		abort ();
+		if (ret != 0 || mem_chunk == NULL) {
+			g_error ("%s: failed to allocate %"G_GSIZE_FORMAT" bytes: %d - %s",
+					G_STRLOC, total_size, ret, strerror (errno));
+			abort ();
+		}
 	}
 
 	/* Set memory layout */
@@ -393,6 +548,7 @@ rspamd_mempool_new_ (gsize size, const gchar *tag, gint flags, const gchar *loc)
 
 	new_pool->priv->entry = entry;
 	new_pool->priv->elt_len = size;
+	new_pool->priv->chunk_len = chunk_len;
 	new_pool->priv->flags = flags;
 
 	if (tag) {
@@ -425,16 +581,16 @@ rspamd_mempool_new_ (gsize size, const gchar *tag, gint flags, const gchar *loc)
 						sizeof (struct rspamd_mempool_specific) +
 						sizeof (struct _pool_chain);
 
-	nchain->slice_size = size;
+	/* A reused chunk might be larger than requested, so use all of it */
 	nchain->begin = unaligned;
-	nchain->slice_size = size;
+	nchain->slice_size = size + (chunk_len - total_size);
 	nchain->pos = align_ptr (unaligned, MIN_MEM_ALIGNMENT);
 	new_pool->priv->pools[RSPAMD_MEMPOOL_NORMAL] = nchain;
 	new_pool->priv->used_memory = size;
 
 	/* Adjust stats */
 	g_atomic_int_add (&mem_pool_stat->bytes_allocated,
-			(gint)size);
+			(gint)nchain->slice_size);
 	g_atomic_int_add (&mem_pool_stat->chunks_allocated, 1);
 
 	return new_pool;
@@ -914,7 +1070,7 @@ rspamd_mempool_delete (rspamd_mempool_t * pool)
 				else {
 					/* The last pool is special, it is a part of the initial chunk */
 					if (cur->next != NULL) {
-						free (cur); /* Not g_free as we use system allocator */
+						rspamd_mempool_cache_put (cur, len);
 					}
 				}
 			}
@@ -922,8 +1078,9 @@ rspamd_mempool_delete (rspamd_mempool_t * pool)
 	}
 
 	g_atomic_int_inc (&mem_pool_stat->pools_freed);
+	len = pool->priv->chunk_len;
 	POOL_MTX_UNLOCK ();
-	free (pool); /* allocated by posix_memalign */
+	rspamd_mempool_cache_put (pool, len); /* allocated by posix_memalign */
 }
 
 void
@@ -937,6 +1094,11 @@ rspamd_mempool_stat (rspamd_mempool_stat_t * st)
 		st->chunks_allocated = mem_pool_stat->chunks_allocated;
 		st->chunks_freed = mem_pool_stat->chunks_freed;
 		st->oversized_chunks = mem_pool_stat->oversized_chunks;
+		st->fragmented_size = mem_pool_stat->fragmented_size;
+		st->cache_hits = mem_pool_stat->cache_hits;
+		st->cache_misses = mem_pool_stat->cache_misses;
+		st->cache_trimmed = mem_pool_stat->cache_trimmed;
+		st->cached_bytes = mem_pool_stat->cached_bytes;
 	}
 }
 
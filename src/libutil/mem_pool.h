@@ -136,6 +136,10 @@ typedef struct memory_pool_stat_s {
 	guint chunks_freed;                 /**< chunks freed										*/
 	guint oversized_chunks;             /**< oversized chunks									*/
 	guint fragmented_size;                /**< fragmentation size								*/
+	guint cache_hits;                   /**< chunks reused from the per-process cache			*/
+	guint cache_misses;                 /**< chunks that could not be found in the cache		*/
+	guint cache_trimmed;                /**< cached chunks released on idle						*/
+	guint cached_bytes;                 /**< bytes kept in chunks caches						*/
 } rspamd_mempool_stat_t;
 
 
@@ -354,6 +358,13 @@ void rspamd_mempool_stat (rspamd_mempool_stat_t *st);
  */
 void rspamd_mempool_stat_reset (void);
 
+/**
+ * Release cached chunks that have not been reused since the previous call,
+ * should be called periodically from an idle event
+ * @param full release all cached chunks
+ */
+void rspamd_mempool_cache_trim (gboolean full);
+
 /**
  * Get optimal pool size based on page size for this system
  * @return size of memory page in system
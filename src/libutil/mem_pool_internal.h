@@ -73,6 +73,7 @@ struct rspamd_mempool_specific {
 	khash_t(rspamd_mempool_vars_hash) *variables;
 	struct rspamd_mempool_entry_point *entry;
 	gsize elt_len;                            /**< size of an element						*/
+	gsize chunk_len;                          /**< size of the initial memory chunk			*/
 	gsize used_memory;
 	guint wasted_memory;
 	gint flags;
@@ -88,5 +89,26 @@ struct _pool_chain {
 	struct _pool_chain *next;
 };
 
+/*
+ * Freed normal chunks are kept in a per-process cache to be reused by the
+ * subsequent pools, so we avoid malloc/free churn on each task
+ */
+#define MEMPOOL_CACHE_MIN_SHIFT 12
+#define MEMPOOL_CACHE_CLASSES 12
+#define MEMPOOL_CACHE_MAX_ELTS 32
+#define MEMPOOL_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+struct rspamd_mempool_cached_chunk {
+	gsize len;
+	struct rspamd_mempool_cached_chunk *next;
+};
+
+struct rspamd_mempool_chunks_cache {
+	struct rspamd_mempool_cached_chunk *chunks[MEMPOOL_CACHE_CLASSES];
+	guint nchunks[MEMPOOL_CACHE_CLASSES];
+	/* Minimum number of cached chunks since the last trim */
+	guint low_water[MEMPOOL_CACHE_CLASSES];
+	gsize bytes;
+};
 
 #endif
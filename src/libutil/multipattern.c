@@ -24,6 +24,7 @@
 #include "unix-std.h"
 #include "hs.h"
 #include "libserver/hyperscan_tools.h"
+#include "libutil/util.h"
 #endif
 #include "acism.h"
 #include "libutil/regexp.h"
@@ -487,6 +488,7 @@ rspamd_multipattern_compile (struct rspamd_multipattern *mp, GError **err)
 			g_assert (hs_populate_platform (&plt) == HS_SUCCESS);
 			rspamd_cryptobox_hash_update (&mp->hash_state, (void *)&plt, sizeof (plt));
 			rspamd_cryptobox_hash_final (&mp->hash_state, hash);
+			gdouble ts1 = rspamd_get_ticks (FALSE);
 
 			if (!rspamd_multipattern_try_load_hs (mp, hash)) {
 				hs_database_t *db = NULL;
@@ -521,6 +523,12 @@ rspamd_multipattern_compile (struct rspamd_multipattern *mp, GError **err)
 				}
 
 				rspamd_multipattern_try_save_hs (mp, hash);
+				msg_info ("hyperscan compiled %d patterns to multipattern in %.1f ms",
+						mp->cnt, (rspamd_get_ticks (FALSE) - ts1) * 1000.0);
+			}
+			else {
+				msg_debug ("hyperscan read %d cached multipattern patterns in %.1f ms",
+						mp->cnt, (rspamd_get_ticks (FALSE) - ts1) * 1000.0);
 			}
 
 			for (i = 0; i < MAX_SCRATCH; i ++) {
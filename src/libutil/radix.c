@@ -423,6 +423,34 @@ radix_get_pool (radix_compressed_t *tree)
 	return NULL;
 }
 
+struct radix_walk_cbdata {
+	radix_walk_cb cb;
+	gpointer ud;
+};
+
+static void
+radix_walk_helper (const btrie_oct_t *prefix, unsigned len,
+		const void *data, int post, void *user_data)
+{
+	struct radix_walk_cbdata *cbd = (struct radix_walk_cbdata *)user_data;
+
+	cbd->cb (prefix, len, (uintptr_t)data, post, cbd->ud);
+}
+
+void
+radix_walk_compressed (radix_compressed_t *tree, radix_walk_cb cb,
+		gpointer ud)
+{
+	struct radix_walk_cbdata cbd;
+
+	g_assert (tree != NULL);
+
+	cbd.cb = cb;
+	cbd.ud = ud;
+
+	btrie_walk (tree->tree, radix_walk_helper, &cbd);
+}
+
 const gchar *
 radix_get_info (radix_compressed_t *tree)
 {
@@ -116,6 +116,20 @@ const gchar *radix_get_info (radix_compressed_t *tree);
  */
 rspamd_mempool_t *radix_get_pool (radix_compressed_t *tree);
 
+typedef void (*radix_walk_cb) (const guint8 *key, gsize keybits,
+							   uintptr_t value, gboolean post, gpointer ud);
+
+/**
+ * Walks all prefixes stored in the radix tree in lexicographical order,
+ * callback is called twice for each prefix: before (post == FALSE) and
+ * after (post == TRUE) all nested prefixes
+ * @param tree
+ * @param cb
+ * @param ud
+ */
+void radix_walk_compressed (radix_compressed_t *tree, radix_walk_cb cb,
+							gpointer ud);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -213,7 +213,8 @@ rspamd_shingles_from_text (GArray *input,
 		}
 	}
 	else {
-		guint64 window[SHINGLES_WINDOW * RSPAMD_SHINGLE_SIZE], seed;
+		guint64 window[SHINGLES_WINDOW * RSPAMD_SHINGLE_SIZE],
+				seeds[RSPAMD_SHINGLE_SIZE], whashes[RSPAMD_SHINGLE_SIZE];
 
 		switch (alg) {
 		case RSPAMD_SHINGLES_XXHASH:
@@ -227,60 +228,64 @@ rspamd_shingles_from_text (GArray *input,
 			break;
 		}
 
+		for (j = 0; j < RSPAMD_SHINGLE_SIZE; j ++) {
+			memcpy (&seeds[j], keys[j], sizeof (seeds[j]));
+		}
+
 		memset (window, 0, sizeof (window));
 		for (i = 0; i <= ilen; i ++) {
 			if (i - beg >= SHINGLES_WINDOW || i == ilen) {
+				word = NULL;
 
-				for (j = 0; j < RSPAMD_SHINGLE_SIZE; j ++) {
-					/* Shift hashes window to right */
-					for (k = 0; k < SHINGLES_WINDOW - 1; k ++) {
-						window[j * SHINGLES_WINDOW + k] =
-								window[j * SHINGLES_WINDOW + k + 1];
-					}
+				while (widx < input->len) {
+					word = &g_array_index (input, rspamd_stat_token_t, widx);
 
-					word = NULL;
+					if ((word->flags & RSPAMD_STAT_TOKEN_FLAG_SKIPPED)
+						 || word->stemmed.len == 0) {
+						widx++;
+					}
+					else {
+						break;
+					}
+				}
 
-					while (widx < input->len) {
-						word = &g_array_index (input, rspamd_stat_token_t, widx);
+				if (word == NULL) {
+					/* Nothing but exceptions */
+					for (i = 0; i < RSPAMD_SHINGLE_SIZE; i ++) {
+						g_free (hashes[i]);
+					}
 
-						if ((word->flags & RSPAMD_STAT_TOKEN_FLAG_SKIPPED)
-							 || word->stemmed.len == 0) {
-							widx++;
-						}
-						else {
-							break;
-						}
+					if (pool == NULL) {
+						g_free (res);
 					}
 
-					if (word == NULL) {
-						/* Nothing but exceptions */
-						for (i = 0; i < RSPAMD_SHINGLE_SIZE; i ++) {
-							g_free (hashes[i]);
-						}
+					g_free (hashes);
+					rspamd_fstring_free (row);
 
-						if (pool == NULL) {
-							g_free (res);
-						}
+					return NULL;
+				}
 
-						g_free (hashes);
-						rspamd_fstring_free (row);
+				/* Hash the word with all keys at once */
+				rspamd_cryptobox_fast_hash_multi (ht,
+						word->stemmed.begin, word->stemmed.len,
+						seeds, whashes, RSPAMD_SHINGLE_SIZE);
+				g_assert (hlen > beg);
 
-						return NULL;
+				for (j = 0; j < RSPAMD_SHINGLE_SIZE; j ++) {
+					/* Shift hashes window to right */
+					for (k = 0; k < SHINGLES_WINDOW - 1; k ++) {
+						window[j * SHINGLES_WINDOW + k] =
+								window[j * SHINGLES_WINDOW + k + 1];
 					}
 
 					/* Insert the last element to the pipe */
-					memcpy (&seed, keys[j], sizeof (seed));
-					window[j * SHINGLES_WINDOW + SHINGLES_WINDOW - 1] =
-							rspamd_cryptobox_fast_hash_specific (ht,
-									word->stemmed.begin, word->stemmed.len,
-									seed);
+					window[j * SHINGLES_WINDOW + SHINGLES_WINDOW - 1] = whashes[j];
 					val = 0;
 					for (k = 0; k < SHINGLES_WINDOW; k ++) {
 						val ^= window[j * SHINGLES_WINDOW + k] >>
 								(8 * (SHINGLES_WINDOW - k - 1));
 					}
 
-					g_assert (hlen > beg);
 					hashes[j][beg] = val;
 				}
 
@@ -282,11 +282,14 @@ rspamd_sqlite3_wait (rspamd_mempool_t *pool, const gchar *lock)
 
 sqlite3 *
 rspamd_sqlite3_open_or_create (rspamd_mempool_t *pool, const gchar *path, const
-		gchar *create_sql, guint version, GError **err)
+		gchar *create_sql, guint version, gsize mmap_size, GError **err)
 {
 	sqlite3 *sqlite;
 	gint rc, flags, lock_fd;
 	gchar lock_path[PATH_MAX], dbdir[PATH_MAX], *pdir;
+#if defined(__LP64__) || defined(_LP64)
+	gchar enable_mmap[64];
+#endif
 	static const char sqlite_wal[] =
 									"PRAGMA journal_mode=\"wal\";"
 									"PRAGMA wal_autocheckpoint = 16;"
@@ -297,11 +300,6 @@ rspamd_sqlite3_open_or_create (rspamd_mempool_t *pool, const gchar *path, const
 
 			foreign_keys[] = 		"PRAGMA foreign_keys=\"ON\";",
 
-#if defined(__LP64__) || defined(_LP64)
-			enable_mmap[] = 		"PRAGMA mmap_size="
-									G_STRINGIFY(RSPAMD_SQLITE_MMAP_LIMIT) ";",
-#endif
-
 			other_pragmas[] = 		"PRAGMA read_uncommitted=\"ON\";"
 									"PRAGMA cache_size="
 									G_STRINGIFY(RSPAMD_SQLITE_CACHE_SIZE) ";",
@@ -572,6 +570,9 @@ rspamd_sqlite3_open_or_create (rspamd_mempool_t *pool, const gchar *path, const
 	}
 
 #if defined(__LP64__) || defined(_LP64)
+	rspamd_snprintf (enable_mmap, sizeof (enable_mmap), "PRAGMA mmap_size=%z;",
+			mmap_size > 0 ? mmap_size : RSPAMD_SQLITE_MMAP_LIMIT);
+
 	if ((rc = sqlite3_exec (sqlite, enable_mmap, NULL, NULL, NULL)) != SQLITE_OK) {
 		msg_warn_pool_check ("cannot enable mmap: %s",
 				sqlite3_errmsg (sqlite));
@@ -70,11 +70,13 @@ void rspamd_sqlite3_close_prstmt (sqlite3 *db, GArray *stmts);
  * Creates or opens sqlite database trying to share it between processes
  * @param path
  * @param create_sql
+ * @param mmap_size maximum size of memory mapped I/O (0 for default)
  * @return
  */
 sqlite3 *rspamd_sqlite3_open_or_create (rspamd_mempool_t *pool,
 										const gchar *path, const gchar *create_sql,
-										guint32 version, GError **err);
+										guint32 version, gsize mmap_size,
+										GError **err);
 
 
 /**
@@ -60,6 +60,9 @@ struct upstream {
 	ev_timer ev;
 	gdouble last_fail;
 	gdouble last_resolve;
+	gdouble latency_ewma;
+	gdouble inflight_ts;
+	guint inflight;
 	gpointer ud;
 	enum rspamd_upstream_flag flags;
 	struct upstream_list *ls;
@@ -155,6 +158,14 @@ static const guint default_dns_retransmits = DEFAULT_DNS_RETRANSMITS;
 /* TODO: make it configurable */
 #define DEFAULT_LAZY_RESOLVE_TIME 3600.0
 static const gdouble default_lazy_resolve_time = DEFAULT_LAZY_RESOLVE_TIME;
+/* Weight of a new sample in the latency moving average */
+#define UPSTREAM_LATENCY_EWMA_ALPHA 0.3
+/* Multiplier applied to the latency average on failure */
+#define UPSTREAM_LATENCY_FAIL_PENALTY 2.0
+/* Latency average set on failure of an upstream that has no samples yet */
+#define UPSTREAM_LATENCY_FAIL_SEED 1.0
+/* Requests in flight are dropped if none of them has completed for so long */
+#define UPSTREAM_INFLIGHT_TIMEOUT 60.0
 
 static const struct upstream_limits default_limits = {
 		.revive_time = DEFAULT_REVIVE_TIME,
@@ -751,6 +762,9 @@ rspamd_upstream_set_inactive (struct upstream_list *ls, struct upstream *upstrea
 	RSPAMD_UPSTREAM_LOCK (ls);
 	g_ptr_array_remove_index (ls->alive, upstream->active_idx);
 	upstream->active_idx = -1;
+	/* Forget latency stats, so a revived upstream is probed again */
+	upstream->latency_ewma = 0;
+	upstream->inflight = 0;
 
 	/* We need to update all indices */
 	for (i = 0; i < ls->alive->len; i ++) {
@@ -788,6 +802,37 @@ rspamd_upstream_set_inactive (struct upstream_list *ls, struct upstream *upstrea
 	RSPAMD_UPSTREAM_UNLOCK (ls);
 }
 
+/*
+ * Callers that never report ok or fail would otherwise make an upstream look
+ * busy forever, so the counter is reset when nothing has completed for a while
+ */
+static inline void
+rspamd_upstream_inflight_expire (struct upstream *up, gdouble now)
+{
+	if (up->inflight > 0 && now - up->inflight_ts > UPSTREAM_INFLIGHT_TIMEOUT) {
+		up->inflight = 0;
+	}
+}
+
+static inline void
+rspamd_upstream_inflight_inc (struct upstream *up, gdouble now)
+{
+	rspamd_upstream_inflight_expire (up, now);
+
+	if (up->inflight ++ == 0) {
+		up->inflight_ts = now;
+	}
+}
+
+static inline void
+rspamd_upstream_inflight_dec (struct upstream *up, gdouble now)
+{
+	if (up->inflight > 0) {
+		up->inflight --;
+		up->inflight_ts = now;
+	}
+}
+
 void
 rspamd_upstream_fail (struct upstream *upstream,
 					  gboolean addr_failure,
@@ -806,6 +851,16 @@ rspamd_upstream_fail (struct upstream *upstream,
 		sec_cur = rspamd_get_ticks (FALSE);
 
 		RSPAMD_UPSTREAM_LOCK (upstream);
+		rspamd_upstream_inflight_dec (upstream, sec_cur);
+
+		/* Failures are treated as very slow replies by the latency rotation */
+		if (upstream->latency_ewma == 0) {
+			upstream->latency_ewma = UPSTREAM_LATENCY_FAIL_SEED;
+		}
+		else {
+			upstream->latency_ewma *= UPSTREAM_LATENCY_FAIL_PENALTY;
+		}
+
 		if (upstream->errors == 0) {
 			/* We have the first error */
 			upstream->last_fail = sec_cur;
@@ -912,6 +967,8 @@ rspamd_upstream_ok (struct upstream *upstream)
 	struct upstream_list_watcher *w;
 
 	RSPAMD_UPSTREAM_LOCK (upstream);
+	rspamd_upstream_inflight_dec (upstream, rspamd_get_ticks (FALSE));
+
 	if (upstream->errors > 0 && upstream->active_idx != -1 && upstream->ls) {
 		/* We touch upstream if and only if it is active */
 		msg_debug_upstream ("reset errors on upstream %s (was %ud)", upstream->name, upstream->errors);
@@ -932,6 +989,39 @@ rspamd_upstream_ok (struct upstream *upstream)
 	RSPAMD_UPSTREAM_UNLOCK (upstream);
 }
 
+void
+rspamd_upstream_ok_latency (struct upstream *up, gdouble latency)
+{
+	if (!isnan (latency) && latency >= 0) {
+		RSPAMD_UPSTREAM_LOCK (up);
+
+		if (up->latency_ewma == 0) {
+			/* The first sample */
+			up->latency_ewma = latency;
+		}
+		else {
+			up->latency_ewma = UPSTREAM_LATENCY_EWMA_ALPHA * latency +
+					(1.0 - UPSTREAM_LATENCY_EWMA_ALPHA) * up->latency_ewma;
+		}
+
+		RSPAMD_UPSTREAM_UNLOCK (up);
+	}
+
+	rspamd_upstream_ok (up);
+}
+
+gdouble
+rspamd_upstream_latency (struct upstream *up, guint *inflight)
+{
+	rspamd_upstream_inflight_expire (up, rspamd_get_ticks (FALSE));
+
+	if (inflight) {
+		*inflight = up->inflight;
+	}
+
+	return up->latency_ewma;
+}
+
 void
 rspamd_upstream_set_weight (struct upstream *up, guint weight)
 {
@@ -1268,6 +1358,10 @@ rspamd_upstreams_parse_line_len (struct upstream_list *ups,
 		ups->rot_alg = RSPAMD_UPSTREAM_HASHED;
 		p += sizeof ("hash:") - 1;
 	}
+	else if (RSPAMD_LEN_CHECK_STARTS_WITH(p, len, "latency:")) {
+		ups->rot_alg = RSPAMD_UPSTREAM_LATENCY;
+		p += sizeof ("latency:") - 1;
+	}
 
 	while (p < end) {
 		span_len = rspamd_memcspn (p, separators, end - p);
@@ -1410,6 +1504,90 @@ rspamd_upstream_get_random (struct upstream_list *ups,
 	}
 }
 
+static inline gdouble
+rspamd_upstream_latency_cost (struct upstream *up)
+{
+	/* Expected wait: average response time scaled by the queue in front of us */
+	return up->latency_ewma * (gdouble)(up->inflight + 1);
+}
+
+/*
+ * Power of two choices: compare two random alive upstreams and pick the one
+ * with the lower expected latency. Upstreams with no samples yet are preferred
+ * so that each of them gets probed.
+ */
+static struct upstream*
+rspamd_upstream_get_latency (struct upstream_list *ups,
+							 struct upstream *except)
+{
+	struct upstream *first, *second, *selected;
+	guint nalive, i1, i2;
+	gdouble now = rspamd_get_ticks (FALSE);
+
+	RSPAMD_UPSTREAM_LOCK (ups);
+	nalive = ups->alive->len;
+
+	if (except && except->active_idx != -1 && nalive > 2) {
+		/* Select two distinct positions ignoring the excepted one */
+		i1 = ottery_rand_range (nalive - 2);
+		i2 = ottery_rand_range (nalive - 3);
+
+		if (i2 >= i1) {
+			i2 ++;
+		}
+
+		if (i1 >= (guint)except->active_idx) {
+			i1 ++;
+		}
+		if (i2 >= (guint)except->active_idx) {
+			i2 ++;
+		}
+
+		first = g_ptr_array_index (ups->alive, i1);
+		second = g_ptr_array_index (ups->alive, i2);
+	}
+	else if (nalive > 1) {
+		i1 = ottery_rand_range (nalive - 1);
+		i2 = ottery_rand_range (nalive - 2);
+
+		if (i2 >= i1) {
+			i2 ++;
+		}
+
+		first = g_ptr_array_index (ups->alive, i1);
+		second = g_ptr_array_index (ups->alive, i2);
+
+		if (except) {
+			/* Two alive upstreams, one of them is excepted */
+			if (first == except) {
+				first = second;
+			}
+			else if (second == except) {
+				second = first;
+			}
+		}
+	}
+	else {
+		first = g_ptr_array_index (ups->alive, 0);
+		second = first;
+	}
+
+	rspamd_upstream_inflight_expire (first, now);
+	rspamd_upstream_inflight_expire (second, now);
+
+	if (rspamd_upstream_latency_cost (second) < rspamd_upstream_latency_cost (first)) {
+		selected = second;
+	}
+	else {
+		selected = first;
+	}
+
+	rspamd_upstream_inflight_inc (selected, now);
+	RSPAMD_UPSTREAM_UNLOCK (ups);
+
+	return selected;
+}
+
 static struct upstream*
 rspamd_upstream_get_round_robin (struct upstream_list *ups,
 								 struct upstream *except,
@@ -1565,12 +1743,6 @@ rspamd_upstream_get_common (struct upstream_list *ups,
 	}
 	RSPAMD_UPSTREAM_UNLOCK (ups);
 
-	if (ups->alive->len == 1 && default_type != RSPAMD_UPSTREAM_SEQUENTIAL) {
-		/* Fast path */
-		up =  g_ptr_array_index (ups->alive, 0);
-		goto end;
-	}
-
 	if (!forced) {
 		type = ups->rot_alg != RSPAMD_UPSTREAM_UNDEF ? ups->rot_alg : default_type;
 	}
@@ -1578,6 +1750,20 @@ rspamd_upstream_get_common (struct upstream_list *ups,
 		type = default_type != RSPAMD_UPSTREAM_UNDEF ? default_type : ups->rot_alg;
 	}
 
+	if (ups->alive->len == 1 && default_type != RSPAMD_UPSTREAM_SEQUENTIAL) {
+		/* Fast path */
+		up =  g_ptr_array_index (ups->alive, 0);
+
+		if (type == RSPAMD_UPSTREAM_LATENCY) {
+			/* Completions are reported for this request, so count it */
+			RSPAMD_UPSTREAM_LOCK (ups);
+			rspamd_upstream_inflight_inc (up, rspamd_get_ticks (FALSE));
+			RSPAMD_UPSTREAM_UNLOCK (ups);
+		}
+
+		goto end;
+	}
+
 	if (type == RSPAMD_UPSTREAM_HASHED && (keylen == 0 || key == NULL)) {
 		/* Cannot use hashed rotation when no key is specified, switch to random */
 		type = RSPAMD_UPSTREAM_RANDOM;
@@ -1597,6 +1783,9 @@ rspamd_upstream_get_common (struct upstream_list *ups,
 	case RSPAMD_UPSTREAM_MASTER_SLAVE:
 		up = rspamd_upstream_get_round_robin (ups, except, FALSE);
 		break;
+	case RSPAMD_UPSTREAM_LATENCY:
+		up = rspamd_upstream_get_latency (ups, except);
+		break;
 	case RSPAMD_UPSTREAM_SEQUENTIAL:
 		if (ups->cur_elt >= ups->alive->len) {
 			ups->cur_elt = 0;
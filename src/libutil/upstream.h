@@ -16,6 +16,7 @@ enum rspamd_upstream_rotation {
 	RSPAMD_UPSTREAM_ROUND_ROBIN,
 	RSPAMD_UPSTREAM_MASTER_SLAVE,
 	RSPAMD_UPSTREAM_SEQUENTIAL,
+	RSPAMD_UPSTREAM_LATENCY,
 	RSPAMD_UPSTREAM_UNDEF
 };
 
@@ -67,6 +68,18 @@ void rspamd_upstream_fail (struct upstream *upstream, gboolean addr_failure, con
  */
 void rspamd_upstream_ok (struct upstream *up);
 
+/**
+ * Increase upstream successes count and account the observed response time
+ * (in seconds) in the moving average used by the latency rotation
+ */
+void rspamd_upstream_ok_latency (struct upstream *up, gdouble latency);
+
+/**
+ * Returns the moving average of the response time of an upstream (0 if unknown)
+ * and optionally the number of requests currently in flight
+ */
+gdouble rspamd_upstream_latency (struct upstream *up, guint *inflight);
+
 /**
  * Set weight for an upstream
  * @param up
@@ -0,0 +1,23 @@
+/*-
+ * Copyright 2023 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "lua_classnames.h"
+
+const gchar rspamd_lua_classnames[RSPAMD_LUA_CLASS_MAX][RSPAMD_LUA_CLASSNAME_MAXLEN] = {
+#define RSPAMD_LUA_CLASS_NAME(id, name) [RSPAMD_LUA_CLASS_##id] = "rspamd{" #name "}",
+	RSPAMD_LUA_CLASSES(RSPAMD_LUA_CLASS_NAME)
+#undef RSPAMD_LUA_CLASS_NAME
+};
@@ -0,0 +1,164 @@
+/*-
+ * Copyright 2023 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RSPAMD_LUA_CLASSNAMES_H
+#define RSPAMD_LUA_CLASSNAMES_H
+
+#include "config.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * All lua classes known at compile time. Each class gets an integer id, that
+ * is used to find its metatable in a lua context without hashing class names.
+ * Classnames below are real C strings stored in a single static table, so
+ * `rspamd_task_classname` can still be used where a string is expected,
+ * e.g. in error messages or in `rspamd_lua_universal_pcall`.
+ */
+#define RSPAMD_LUA_CLASSES(X) \
+	X(ARCHIVE, archive) \
+	X(CDB, cdb) \
+	X(CDB_BUILDER, cdb_builder) \
+	X(CLASSIFIER, classifier) \
+	X(CONFIG, config) \
+	X(CRYPTOBOX_HASH, cryptobox_hash) \
+	X(CRYPTOBOX_KEYPAIR, cryptobox_keypair) \
+	X(CRYPTOBOX_PUBKEY, cryptobox_pubkey) \
+	X(CRYPTOBOX_SECRETBOX, cryptobox_secretbox) \
+	X(CRYPTOBOX_SIGNATURE, cryptobox_signature) \
+	X(CSESSION, csession) \
+	X(EV_BASE, ev_base) \
+	X(EXPR, expr) \
+	X(HTML, html) \
+	X(HTML_TAG, html_tag) \
+	X(IMAGE, image) \
+	X(INT64, int64) \
+	X(IP, ip) \
+	X(KANN, kann) \
+	X(KANN_NODE, kann_node) \
+	X(MAP, map) \
+	X(MEMPOOL, mempool) \
+	X(MIMEPART, mimepart) \
+	X(MONITORED, monitored) \
+	X(REDIS, redis) \
+	X(REGEXP, regexp) \
+	X(RESOLVER, resolver) \
+	X(RSA_PRIVKEY, rsa_privkey) \
+	X(RSA_PUBKEY, rsa_pubkey) \
+	X(RSA_SIGNATURE, rsa_signature) \
+	X(SESSION, session) \
+	X(SPF_RECORD, spf_record) \
+	X(SQLITE3, sqlite3) \
+	X(SQLITE3_STMT, sqlite3_stmt) \
+	X(STATFILE, statfile) \
+	X(TASK, task) \
+	X(TCP, tcp) \
+	X(TCP_SYNC, tcp_sync) \
+	X(TENSOR, tensor) \
+	X(TEXT, text) \
+	X(TEXTPART, textpart) \
+	X(TRIE, trie) \
+	X(UPSTREAM, upstream) \
+	X(UPSTREAM_LIST, upstream_list) \
+	X(URL, url) \
+	X(WORKER, worker) \
+	X(ZSTD_COMPRESS, zstd_compress) \
+	X(ZSTD_DECOMPRESS, zstd_decompress)
+
+enum rspamd_lua_class_id {
+#define RSPAMD_LUA_CLASS_ENUM(id, name) RSPAMD_LUA_CLASS_##id,
+	RSPAMD_LUA_CLASSES(RSPAMD_LUA_CLASS_ENUM)
+#undef RSPAMD_LUA_CLASS_ENUM
+	RSPAMD_LUA_CLASS_MAX
+};
+
+#define RSPAMD_LUA_CLASSNAME_MAXLEN 32
+
+extern const gchar rspamd_lua_classnames[RSPAMD_LUA_CLASS_MAX][RSPAMD_LUA_CLASSNAME_MAXLEN];
+
+/**
+ * Returns class id for a classname or -1 if it is not a static classname.
+ * Only pointers to `rspamd_lua_classnames` are recognised, so this is a
+ * couple of arithmetic operations and not a string lookup
+ */
+static inline gint
+rspamd_lua_static_class_id (const gchar *classname)
+{
+	guintptr off = (guintptr)classname - (guintptr)rspamd_lua_classnames;
+
+	if (off < sizeof (rspamd_lua_classnames) &&
+		off % RSPAMD_LUA_CLASSNAME_MAXLEN == 0) {
+		return (gint)(off / RSPAMD_LUA_CLASSNAME_MAXLEN);
+	}
+
+	return -1;
+}
+
+#define rspamd_archive_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_ARCHIVE])
+#define rspamd_cdb_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_CDB])
+#define rspamd_cdb_builder_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_CDB_BUILDER])
+#define rspamd_classifier_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_CLASSIFIER])
+#define rspamd_config_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_CONFIG])
+#define rspamd_cryptobox_hash_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_CRYPTOBOX_HASH])
+#define rspamd_cryptobox_keypair_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_CRYPTOBOX_KEYPAIR])
+#define rspamd_cryptobox_pubkey_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_CRYPTOBOX_PUBKEY])
+#define rspamd_cryptobox_secretbox_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_CRYPTOBOX_SECRETBOX])
+#define rspamd_cryptobox_signature_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_CRYPTOBOX_SIGNATURE])
+#define rspamd_csession_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_CSESSION])
+#define rspamd_ev_base_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_EV_BASE])
+#define rspamd_expr_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_EXPR])
+#define rspamd_html_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_HTML])
+#define rspamd_html_tag_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_HTML_TAG])
+#define rspamd_image_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_IMAGE])
+#define rspamd_int64_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_INT64])
+#define rspamd_ip_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_IP])
+#define rspamd_kann_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_KANN])
+#define rspamd_kann_node_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_KANN_NODE])
+#define rspamd_map_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_MAP])
+#define rspamd_mempool_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_MEMPOOL])
+#define rspamd_mimepart_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_MIMEPART])
+#define rspamd_monitored_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_MONITORED])
+#define rspamd_redis_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_REDIS])
+#define rspamd_regexp_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_REGEXP])
+#define rspamd_resolver_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_RESOLVER])
+#define rspamd_rsa_privkey_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_RSA_PRIVKEY])
+#define rspamd_rsa_pubkey_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_RSA_PUBKEY])
+#define rspamd_rsa_signature_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_RSA_SIGNATURE])
+#define rspamd_session_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_SESSION])
+#define rspamd_spf_record_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_SPF_RECORD])
+#define rspamd_sqlite3_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_SQLITE3])
+#define rspamd_sqlite3_stmt_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_SQLITE3_STMT])
+#define rspamd_statfile_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_STATFILE])
+#define rspamd_task_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_TASK])
+#define rspamd_tcp_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_TCP])
+#define rspamd_tcp_sync_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_TCP_SYNC])
+#define rspamd_tensor_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_TENSOR])
+#define rspamd_text_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_TEXT])
+#define rspamd_textpart_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_TEXTPART])
+#define rspamd_trie_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_TRIE])
+#define rspamd_upstream_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_UPSTREAM])
+#define rspamd_upstream_list_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_UPSTREAM_LIST])
+#define rspamd_url_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_URL])
+#define rspamd_worker_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_WORKER])
+#define rspamd_zstd_compress_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_ZSTD_COMPRESS])
+#define rspamd_zstd_decompress_classname (rspamd_lua_classnames[RSPAMD_LUA_CLASS_ZSTD_DECOMPRESS])
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -47,12 +47,15 @@ lua_error_quark (void)
 }
 
 /*
- * Used to map string to a pointer
+ * Used to map dynamic class names (e.g. from `U{task}` argument specs) to class ids
  */
 KHASH_INIT (lua_class_set, const char*, int, 1, rspamd_str_hash, rspamd_str_equal);
 struct rspamd_lua_context {
 	lua_State *L;
 	khash_t(lua_class_set) *classes;
+	/* Registry references and raw pointers of class metatables indexed by class id */
+	gint class_refs[RSPAMD_LUA_CLASS_MAX];
+	const void *class_mts[RSPAMD_LUA_CLASS_MAX];
 	struct rspamd_lua_context *prev, *next; /* Expensive but we usually have exactly one lua state */
 };
 struct rspamd_lua_context *rspamd_lua_global_ctx = NULL;
@@ -72,6 +75,45 @@ rspamd_lua_ctx_by_state (lua_State *L)
 	return rspamd_lua_global_ctx;
 }
 
+/*
+ * Returns id of a class or -1 if the class is unknown; static classnames
+ * are resolved without any lookups
+ */
+static inline gint
+rspamd_lua_class_id (struct rspamd_lua_context *ctx, const gchar *classname)
+{
+	gint id = rspamd_lua_static_class_id (classname);
+	khiter_t k;
+
+	if (G_LIKELY (id >= 0)) {
+		return id;
+	}
+
+	k = kh_get (lua_class_set, ctx->classes, classname);
+
+	if (k == kh_end (ctx->classes)) {
+		return -1;
+	}
+
+	return kh_value (ctx->classes, k);
+}
+
+/*
+ * Checks if the metatable on top of the stack belongs to the specified class
+ */
+static inline gboolean
+rspamd_lua_is_class_metatable (lua_State *L, struct rspamd_lua_context *ctx,
+		const gchar *classname)
+{
+	gint id = rspamd_lua_class_id (ctx, classname);
+
+	if (id < 0 || ctx->class_mts[id] == NULL) {
+		return FALSE;
+	}
+
+	return lua_topointer (L, -1) == ctx->class_mts[id];
+}
+
 /* Util functions */
 /**
  * Create new class and store metatable on top of the stack (must be popped if not needed)
@@ -85,10 +127,24 @@ rspamd_lua_new_class (lua_State * L,
 	const struct luaL_reg *methods)
 {
 	khiter_t k;
-	gint r, nmethods = 0;
+	gint r, id, nmethods = 0;
 	gboolean seen_index = false;
 	struct rspamd_lua_context *ctx = rspamd_lua_ctx_by_state(L);
 
+	id = rspamd_lua_static_class_id (classname);
+
+	if (id < 0) {
+		/* Classname is not a pointer to the static table, find it by name */
+		for (id = 0; id < RSPAMD_LUA_CLASS_MAX; id ++) {
+			if (strcmp (rspamd_lua_classnames[id], classname) == 0) {
+				break;
+			}
+		}
+
+		/* All classes must be listed in lua_classnames.h */
+		g_assert (id < RSPAMD_LUA_CLASS_MAX);
+	}
+
 	if (methods) {
 		for (;;) {
 			if (methods[nmethods].name != NULL) {
@@ -112,7 +168,7 @@ rspamd_lua_new_class (lua_State * L,
 	}
 
 	lua_pushstring (L, "class");
-	lua_pushstring (L, classname);
+	lua_pushstring (L, rspamd_lua_classnames[id]);
 	lua_rawset (L, -3);
 
 	if (methods) {
@@ -120,9 +176,10 @@ rspamd_lua_new_class (lua_State * L,
 	}
 
 	lua_pushvalue (L, -1); /* Preserves metatable */
-	int offset = luaL_ref (L, LUA_REGISTRYINDEX);
-	k = kh_put (lua_class_set, ctx->classes, classname, &r);
-	kh_value(ctx->classes, k) = offset;
+	ctx->class_mts[id] = lua_topointer (L, -1);
+	ctx->class_refs[id] = luaL_ref (L, LUA_REGISTRYINDEX);
+	k = kh_put (lua_class_set, ctx->classes, rspamd_lua_classnames[id], &r);
+	kh_value(ctx->classes, k) = id;
 	/* MT is left on stack ! */
 }
 
@@ -183,13 +240,11 @@ rspamd_lua_class_tostring (lua_State * L)
 void
 rspamd_lua_setclass (lua_State * L, const gchar *classname, gint objidx)
 {
-	khiter_t k;
 	struct rspamd_lua_context *ctx = rspamd_lua_ctx_by_state(L);
+	gint id = rspamd_lua_class_id (ctx, classname);
 
-	k = kh_get (lua_class_set, ctx->classes, classname);
-
-	g_assert (k != kh_end (ctx->classes));
-	lua_rawgeti (L, LUA_REGISTRYINDEX, kh_value(ctx->classes, k));
+	g_assert (id >= 0 && ctx->class_refs[id] != LUA_NOREF);
+	lua_rawgeti (L, LUA_REGISTRYINDEX, ctx->class_refs[id]);
 
 	if (objidx < 0) {
 		objidx--;
@@ -200,26 +255,22 @@ rspamd_lua_setclass (lua_State * L, const gchar *classname, gint objidx)
 void
 rspamd_lua_class_metatable (lua_State *L, const gchar *classname)
 {
-	khiter_t k;
 	struct rspamd_lua_context *ctx = rspamd_lua_ctx_by_state(L);
+	gint id = rspamd_lua_class_id (ctx, classname);
 
-	k = kh_get (lua_class_set, ctx->classes, classname);
-
-	g_assert (k != kh_end (ctx->classes));
-	lua_rawgeti (L, LUA_REGISTRYINDEX, kh_value(ctx->classes, k));
+	g_assert (id >= 0 && ctx->class_refs[id] != LUA_NOREF);
+	lua_rawgeti (L, LUA_REGISTRYINDEX, ctx->class_refs[id]);
 }
 
 void
 rspamd_lua_add_metamethod (lua_State *L, const gchar *classname,
 								luaL_Reg *meth)
 {
-	khiter_t k;
 	struct rspamd_lua_context *ctx = rspamd_lua_ctx_by_state(L);
+	gint id = rspamd_lua_class_id (ctx, classname);
 
-	k = kh_get (lua_class_set, ctx->classes, classname);
-
-	g_assert (k != kh_end (ctx->classes));
-	lua_rawgeti (L, LUA_REGISTRYINDEX, kh_value(ctx->classes, k));
+	g_assert (id >= 0 && ctx->class_refs[id] != LUA_NOREF);
+	lua_rawgeti (L, LUA_REGISTRYINDEX, ctx->class_refs[id]);
 
 	lua_pushcfunction (L, meth->func);
 	lua_setfield (L, -2, meth->name);
@@ -856,7 +907,7 @@ rspamd_lua_set_globals (struct rspamd_config *cfg, lua_State *L)
 
 	if (cfg != NULL) {
 		pcfg = lua_newuserdata (L, sizeof (struct rspamd_config *));
-		rspamd_lua_setclass (L, "rspamd{config}", -1);
+		rspamd_lua_setclass (L, rspamd_config_classname, -1);
 		*pcfg = cfg;
 		lua_setglobal (L, "rspamd_config");
 	}
@@ -943,6 +994,10 @@ rspamd_lua_init (bool wipe_mem)
 	ctx->L = L;
 	ctx->classes = kh_init(lua_class_set);
 	kh_resize(lua_class_set, ctx->classes, RSPAMD_LUA_NCLASSES);
+
+	for (gint i = 0; i < RSPAMD_LUA_CLASS_MAX; i ++) {
+		ctx->class_refs[i] = LUA_NOREF;
+	}
 	DL_APPEND(rspamd_lua_global_ctx, ctx);
 
 	lua_gc (L, LUA_GCSTOP, 0);
@@ -989,7 +1044,7 @@ rspamd_lua_init (bool wipe_mem)
 	lua_settop (L, 0);
 #endif
 
-	rspamd_lua_new_class (L, "rspamd{session}", NULL);
+	rspamd_lua_new_class (L, rspamd_session_classname, NULL);
 	lua_pop (L, 1);
 
 	rspamd_lua_add_preload (L, "lpeg", luaopen_lpeg);
@@ -1057,10 +1112,9 @@ rspamd_lua_close (lua_State *L)
 	 * For now, it is safe to leave it as is, I'm afraid
 	 */
 #if 0
-	int ref;
-	kh_foreach_value(ctx->classes, ref, {
-		luaL_unref(L, LUA_REGISTRYINDEX, ref);
-	});
+	for (gint i = 0; i < RSPAMD_LUA_CLASS_MAX; i ++) {
+		luaL_unref(L, LUA_REGISTRYINDEX, ctx->class_refs[i]);
+	}
 #endif
 
 	lua_close(L);
@@ -1126,7 +1180,7 @@ rspamd_init_lua_filters (struct rspamd_config *cfg, bool force_load, bool strict
 	gint err_idx;
 
 	pcfg = lua_newuserdata (L, sizeof (struct rspamd_config *));
-	rspamd_lua_setclass (L, "rspamd{config}", -1);
+	rspamd_lua_setclass (L, rspamd_config_classname, -1);
 	*pcfg = cfg;
 	lua_setglobal (L, "rspamd_config");
 
@@ -1285,7 +1339,6 @@ gpointer
 rspamd_lua_check_class (lua_State *L, gint index, const gchar *name)
 {
 	gpointer p;
-	khiter_t k;
 
 	if (lua_type (L, index) == LUA_TUSERDATA) {
 		p = lua_touserdata (L, index);
@@ -1293,21 +1346,12 @@ rspamd_lua_check_class (lua_State *L, gint index, const gchar *name)
 			if (lua_getmetatable (L, index)) {
 				struct rspamd_lua_context *ctx = rspamd_lua_ctx_by_state(L);
 
-				k = kh_get (lua_class_set, ctx->classes, name);
-
-				if (k == kh_end (ctx->classes)) {
+				/* does it have the correct mt? */
+				if (rspamd_lua_is_class_metatable (L, ctx, name)) {
 					lua_pop (L, 1);
-
-					return NULL;
-				}
-
-				lua_rawgeti (L, LUA_REGISTRYINDEX, kh_value(ctx->classes, k));
-
-				if (lua_rawequal (L, -1, -2)) {  /* does it have the correct mt? */
-					lua_pop (L, 2);  /* remove both metatables */
 					return p;
 				}
-				lua_pop (L, 2);
+				lua_pop (L, 1);
 			}
 		}
 	}
@@ -1993,7 +2037,6 @@ rspamd_lua_check_udata_common (lua_State *L, gint pos, const gchar *classname,
 {
 	void *p = lua_touserdata (L, pos);
 	guint i, top = lua_gettop (L);
-	khiter_t k;
 
 	if (p == NULL) {
 		goto err;
@@ -2003,15 +2046,7 @@ rspamd_lua_check_udata_common (lua_State *L, gint pos, const gchar *classname,
 		if (lua_getmetatable (L, pos)) {
 			struct rspamd_lua_context *ctx = rspamd_lua_ctx_by_state(L);
 
-			k = kh_get (lua_class_set, ctx->classes, classname);
-
-			if (k == kh_end (ctx->classes)) {
-				goto err;
-			}
-
-			lua_rawgeti (L, LUA_REGISTRYINDEX, kh_value(ctx->classes, k));
-
-			if (!lua_rawequal (L, -1, -2)) {
+			if (!rspamd_lua_is_class_metatable (L, ctx, classname)) {
 				goto err;
 			}
 		}
@@ -2103,7 +2138,7 @@ rspamd_lua_check_udata_maybe (lua_State *L, gint pos, const gchar *classname)
 struct rspamd_async_session*
 lua_check_session (lua_State * L, gint pos)
 {
-	void *ud = rspamd_lua_check_udata (L, pos, "rspamd{session}");
+	void *ud = rspamd_lua_check_udata (L, pos, rspamd_session_classname);
 	luaL_argcheck (L, ud != NULL, pos, "'session' expected");
 	return ud ? *((struct rspamd_async_session **)ud) : NULL;
 }
@@ -2111,7 +2146,7 @@ lua_check_session (lua_State * L, gint pos)
 struct ev_loop*
 lua_check_ev_base (lua_State * L, gint pos)
 {
-	void *ud = rspamd_lua_check_udata (L, pos, "rspamd{ev_base}");
+	void *ud = rspamd_lua_check_udata (L, pos, rspamd_ev_base_classname);
 	luaL_argcheck (L, ud != NULL, pos, "'event_base' expected");
 	return ud ? *((struct ev_loop **)ud) : NULL;
 }
@@ -2136,15 +2171,15 @@ rspamd_lua_run_postloads (lua_State *L, struct rspamd_config *cfg,
 		lua_rawgeti (L, LUA_REGISTRYINDEX, sc->cbref);
 		pcfg = lua_newuserdata (L, sizeof (*pcfg));
 		*pcfg = cfg;
-		rspamd_lua_setclass (L, "rspamd{config}", -1);
+		rspamd_lua_setclass (L, rspamd_config_classname, -1);
 
 		pev_base = lua_newuserdata (L, sizeof (*pev_base));
 		*pev_base = ev_base;
-		rspamd_lua_setclass (L, "rspamd{ev_base}", -1);
+		rspamd_lua_setclass (L, rspamd_ev_base_classname, -1);
 
 		pw = lua_newuserdata (L, sizeof (*pw));
 		*pw = w;
-		rspamd_lua_setclass (L, "rspamd{worker}", -1);
+		rspamd_lua_setclass (L, rspamd_worker_classname, -1);
 
 		lua_thread_call (thread, 3);
 	}
@@ -2164,7 +2199,7 @@ rspamd_lua_run_config_post_init (lua_State *L, struct rspamd_config *cfg)
 		lua_rawgeti (L, LUA_REGISTRYINDEX, sc->cbref);
 		pcfg = lua_newuserdata (L, sizeof (*pcfg));
 		*pcfg = cfg;
-		rspamd_lua_setclass (L, "rspamd{config}", -1);
+		rspamd_lua_setclass (L, rspamd_config_classname, -1);
 
 		if (lua_pcall (L, 1, 0, err_idx) != 0) {
 			msg_err_config ("cannot run config post init script: %s; priority = %d",
@@ -2189,7 +2224,7 @@ rspamd_lua_run_config_unload (lua_State *L, struct rspamd_config *cfg)
 		lua_rawgeti (L, LUA_REGISTRYINDEX, sc->cbref);
 		pcfg = lua_newuserdata (L, sizeof (*pcfg));
 		*pcfg = cfg;
-		rspamd_lua_setclass (L, "rspamd{config}", -1);
+		rspamd_lua_setclass (L, rspamd_config_classname, -1);
 
 		if (lua_pcall (L, 1, 0, err_idx) != 0) {
 			msg_err_config ("cannot run config post init script: %s",
@@ -2374,7 +2409,7 @@ rspamd_lua_try_load_redis (lua_State *L, const ucl_object_t *obj,
 	/* Function arguments */
 	ucl_object_push_lua (L, obj, false);
 	pcfg = lua_newuserdata (L, sizeof (*pcfg));
-	rspamd_lua_setclass (L, "rspamd{config}", -1);
+	rspamd_lua_setclass (L, rspamd_config_classname, -1);
 	*pcfg = cfg;
 	lua_pushboolean (L, false); /* no_fallback */
 
@@ -25,6 +25,7 @@ extern "C" {
 #include "rspamd.h"
 #include "ucl.h"
 #include "lua_ucl.h"
+#include "lua_classnames.h"
 
 #ifdef  __cplusplus
 extern "C" {
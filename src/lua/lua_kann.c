@@ -23,8 +23,8 @@
  * `rspamd_kann` is a Lua interface to kann library
  */
 
-#define KANN_NODE_CLASS "rspamd{kann_node}"
-#define KANN_NETWORK_CLASS "rspamd{kann}"
+#define KANN_NODE_CLASS rspamd_kann_node_classname
+#define KANN_NETWORK_CLASS rspamd_kann_classname
 
 /* Simple macros to define behaviour */
 #define KANN_LAYER_DEF(name) static int lua_kann_layer_ ## name (lua_State *L)
@@ -146,11 +146,15 @@ LUA_FUNCTION_DEF (kann, destroy);
 LUA_FUNCTION_DEF (kann, save);
 LUA_FUNCTION_DEF (kann, train1);
 LUA_FUNCTION_DEF (kann, apply1);
+LUA_FUNCTION_DEF (kann, train_async);
+LUA_FUNCTION_DEF (kann, apply_batch);
 
 static luaL_reg rspamd_kann_m[] = {
 		LUA_INTERFACE_DEF (kann, save),
 		LUA_INTERFACE_DEF (kann, train1),
 		LUA_INTERFACE_DEF (kann, apply1),
+		LUA_INTERFACE_DEF (kann, train_async),
+		LUA_INTERFACE_DEF (kann, apply_batch),
 		{"__gc", lua_kann_destroy},
 		{NULL, NULL},
 };
@@ -911,7 +915,7 @@ lua_kann_save (lua_State *L)
 			fclose (f);
 
 			t = lua_newuserdata (L, sizeof (*t));
-			rspamd_lua_setclass (L, "rspamd{text}", -1);
+			rspamd_lua_setclass (L, rspamd_text_classname, -1);
 			t->flags = RSPAMD_TEXT_FLAG_OWN;
 			t->start = (const gchar *)buf;
 			t->len = buflen;
@@ -1023,162 +1027,189 @@ lua_kann_train_cb (int iter, float train_cost, float val_cost, void *ud)
 
 #define FREE_VEC(a, n) do { for(int i = 0; i < (n); i ++) g_free((a)[i]); g_free(a); } while(0)
 
+/*
+ * Loads training vectors from tables at `inputs_pos` and `outputs_pos`,
+ * optionally projecting inputs with a pca matrix. If `in_len` is positive,
+ * inputs are loaded as is and must have `in_len` elements.
+ * Returns number of rows or -1 on error (with the error message in `err`)
+ */
 static int
-lua_kann_train1 (lua_State *L)
+lua_kann_load_train_vectors (lua_State *L, kann_t *k, gint inputs_pos,
+		gint outputs_pos, struct rspamd_lua_tensor *pca, gint in_len,
+		float ***px, float ***py, gchar *err, gsize errlen)
 {
-	kann_t *k = lua_check_kann (L, 1);
-	struct rspamd_lua_tensor *pca = NULL;
+	int n = rspamd_lua_table_size (L, inputs_pos);
+	int n_in = in_len > 0 ? in_len : kann_dim_in (k);
+	int n_out = kann_dim_out (k);
+	float **x, **y, *tmp_row = NULL;
+
+	if (n_in <= 0) {
+		rspamd_snprintf (err, errlen, "invalid inputs count: %d", n_in);
+		return -1;
+	}
 
-	/* Default train params */
-	double lr = 0.001;
-	gint64 mini_size = 64;
-	gint64 max_epoch = 25;
-	gint64 max_drop_streak = 10;
-	double frac_val = 0.1;
-	gint cbref = -1;
+	if (n_out <= 0) {
+		rspamd_snprintf (err, errlen, "invalid outputs count: %d", n_out);
+		return -1;
+	}
 
-	if (k && lua_istable (L, 2) && lua_istable (L, 3)) {
-		int n = rspamd_lua_table_size (L, 2);
-		int n_in = kann_dim_in (k);
-		int n_out = kann_dim_out (k);
+	if (n != rspamd_lua_table_size (L, outputs_pos) || n == 0) {
+		rspamd_snprintf (err, errlen, "invalid dimensions: outputs size must be "
+				"equal to inputs and non zero");
+		return -1;
+	}
 
-		if (n_in <= 0) {
-			return luaL_error (L, "invalid inputs count: %d", n_in);
+	if (pca) {
+		/* Check pca matrix validity */
+		if (pca->ndims != 2) {
+			rspamd_snprintf (err, errlen, "invalid pca tensor: matrix expected, got a row");
+			return -1;
 		}
 
-		if (n_out <= 0) {
-			return luaL_error (L, "invalid outputs count: %d", n_out);
+		if (pca->dim[0] != n_in) {
+			rspamd_snprintf (err, errlen, "invalid pca tensor: "
+					"matrix must have %d rows and it has %d rows instead",
+					n_in, pca->dim[0]);
+			return -1;
 		}
+	}
 
-		if (n != rspamd_lua_table_size (L, 3) || n == 0) {
-			return luaL_error (L, "invalid dimensions: outputs size must be "
-						 "equal to inputs and non zero");
-		}
+	/* Fill vectors row by row */
+	x = (float **)g_malloc0 (sizeof (float *) * n);
+	y = (float **)g_malloc0 (sizeof (float *) * n);
 
-		if (lua_istable (L, 4)) {
-			GError *err = NULL;
+	if (pca) {
+		tmp_row = g_malloc (sizeof (float) * pca->dim[1]);
+	}
 
-			if (!rspamd_lua_parse_table_arguments (L, 4, &err,
-					RSPAMD_LUA_PARSE_ARGUMENTS_IGNORE_MISSING,
-					"lr=N;mini_size=I;max_epoch=I;max_drop_streak=I;frac_val=N;cb=F;pca=u{tensor}",
-					&lr, &mini_size, &max_epoch, &max_drop_streak, &frac_val, &cbref, &pca)) {
-				n = luaL_error (L, "invalid params: %s",
-						err ? err->message : "unknown error");
-				g_error_free (err);
+	for (int s = 0; s < n; s ++) {
+		/* Inputs */
+		lua_rawgeti (L, inputs_pos, s + 1);
+		/* kad_sgemm_simple accumulates results, so we need zeroed rows */
+		x[s] = (float *)g_malloc0 (sizeof (float) * n_in);
 
-				return n;
+		if (pca == NULL) {
+			if (rspamd_lua_table_size (L, -1) != n_in) {
+				rspamd_snprintf (err, errlen, "invalid params at pos %d: "
+						"bad input dimension %d; %d expected",
+						s + 1,
+						(int) rspamd_lua_table_size (L, -1),
+						n_in);
+				lua_pop (L, 1);
+				goto err;
 			}
-		}
 
-		if (pca) {
-			/* Check pca matrix validity */
-			if (pca->ndims != 2) {
-				return luaL_error (L, "invalid pca tensor: matrix expected, got a row");
-			}
+			for (int i = 0; i < n_in; i++) {
+				lua_rawgeti (L, -1, i + 1);
+				x[s][i] = lua_tonumber (L, -1);
 
-			if (pca->dim[0] != n_in) {
-				return luaL_error (L, "invalid pca tensor: "
-						  "matrix must have %d rows and it has %d rows instead",
-						  n_in, pca->dim[0]);
+				lua_pop (L, 1);
 			}
 		}
+		else {
+			if (rspamd_lua_table_size (L, -1) != pca->dim[1]) {
+				rspamd_snprintf (err, errlen, "(pca on) invalid params at pos %d: "
+						"bad input dimension %d; %d expected",
+						s + 1,
+						(int) rspamd_lua_table_size (L, -1),
+						pca->dim[1]);
+				lua_pop (L, 1);
+				goto err;
+			}
 
-		float **x, **y, *tmp_row = NULL;
 
-		/* Fill vectors row by row */
-		x = (float **)g_malloc0 (sizeof (float *) * n);
-		y = (float **)g_malloc0 (sizeof (float *) * n);
+			for (int i = 0; i < pca->dim[1]; i++) {
+				lua_rawgeti (L, -1, i + 1);
+				tmp_row[i] = lua_tonumber (L, -1);
+
+				lua_pop (L, 1);
+			}
 
-		if (pca) {
-			tmp_row = g_malloc (sizeof (float) * pca->dim[1]);
+			kad_sgemm_simple (0, 1, 1, n_in,
+					pca->dim[1], tmp_row, pca->data,
+					x[s]);
 		}
 
-		for (int s = 0; s < n; s ++) {
-			/* Inputs */
-			lua_rawgeti (L, 2, s + 1);
-			x[s] = (float *)g_malloc (sizeof (float) * n_in);
-
-			if (pca == NULL) {
-				if (rspamd_lua_table_size (L, -1) != n_in) {
-					FREE_VEC (x, n);
-					FREE_VEC (y, n);
-
-					n = luaL_error (L, "invalid params at pos %d: "
-									   "bad input dimension %d; %d expected",
-							s + 1,
-							(int) rspamd_lua_table_size (L, -1),
-							n_in);
-					lua_pop (L, 1);
+		lua_pop (L, 1);
 
-					return n;
-				}
+		/* Outputs */
+		y[s] = (float *)g_malloc (sizeof (float) * n_out);
+		lua_rawgeti (L, outputs_pos, s + 1);
+
+		if (rspamd_lua_table_size (L, -1) != n_out) {
+			rspamd_snprintf (err, errlen, "invalid params at pos %d: "
+					"bad output dimension %d; "
+					"%d expected",
+					s + 1,
+					(int)rspamd_lua_table_size (L, -1),
+					n_out);
+			lua_pop (L, 1);
+			goto err;
+		}
 
-				for (int i = 0; i < n_in; i++) {
-					lua_rawgeti (L, -1, i + 1);
-					x[s][i] = lua_tonumber (L, -1);
+		for (int i = 0; i < n_out; i ++) {
+			lua_rawgeti (L, -1, i + 1);
+			y[s][i] = lua_tonumber (L, -1);
 
-					lua_pop (L, 1);
-				}
-			}
-			else {
-				if (rspamd_lua_table_size (L, -1) != pca->dim[1]) {
-					FREE_VEC (x, n);
-					FREE_VEC (y, n);
-					g_free (tmp_row);
-
-					n = luaL_error (L, "(pca on) invalid params at pos %d: "
-									   "bad input dimension %d; %d expected",
-							s + 1,
-							(int) rspamd_lua_table_size (L, -1),
-							pca->dim[1]);
-					lua_pop (L, 1);
+			lua_pop (L, 1);
+		}
 
-					return n;
-				}
+		lua_pop (L, 1);
+	}
 
+	g_free (tmp_row);
+	*px = x;
+	*py = y;
 
-				for (int i = 0; i < pca->dim[1]; i++) {
-					lua_rawgeti (L, -1, i + 1);
-					tmp_row[i] = lua_tonumber (L, -1);
+	return n;
 
-					lua_pop (L, 1);
-				}
+err:
+	FREE_VEC (x, n);
+	FREE_VEC (y, n);
+	g_free (tmp_row);
 
-				kad_sgemm_simple (0, 1, 1, n_in,
-						pca->dim[1], tmp_row, pca->data,
-						x[s]);
-			}
+	return -1;
+}
 
-			lua_pop (L, 1);
+static int
+lua_kann_train1 (lua_State *L)
+{
+	kann_t *k = lua_check_kann (L, 1);
+	struct rspamd_lua_tensor *pca = NULL;
+
+	/* Default train params */
+	double lr = 0.001;
+	gint64 mini_size = 64;
+	gint64 max_epoch = 25;
+	gint64 max_drop_streak = 10;
+	double frac_val = 0.1;
+	gint cbref = -1;
 
-			/* Outputs */
-			y[s] = (float *)g_malloc (sizeof (float) * n_out);
-			lua_rawgeti (L, 3, s + 1);
+	if (k && lua_istable (L, 2) && lua_istable (L, 3)) {
+		int n;
+		float **x, **y;
+		gchar err_buf[256];
 
-			if (rspamd_lua_table_size (L, -1) != n_out) {
-				FREE_VEC (x, n);
-				FREE_VEC (y, n);
-				g_free (tmp_row);
+		if (lua_istable (L, 4)) {
+			GError *err = NULL;
 
-				n = luaL_error (L, "invalid params at pos %d: "
-					   "bad output dimension %d; "
-					   "%d expected",
-						s + 1,
-						(int)rspamd_lua_table_size (L, -1),
-						n_out);
-				lua_pop (L, 1);
+			if (!rspamd_lua_parse_table_arguments (L, 4, &err,
+					RSPAMD_LUA_PARSE_ARGUMENTS_IGNORE_MISSING,
+					"lr=N;mini_size=I;max_epoch=I;max_drop_streak=I;frac_val=N;cb=F;pca=u{tensor}",
+					&lr, &mini_size, &max_epoch, &max_drop_streak, &frac_val, &cbref, &pca)) {
+				n = luaL_error (L, "invalid params: %s",
+						err ? err->message : "unknown error");
+				g_error_free (err);
 
 				return n;
 			}
+		}
 
-			for (int i = 0; i < n_out; i ++) {
-				lua_rawgeti (L, -1, i + 1);
-				y[s][i] = lua_tonumber (L, -1);
-
-				lua_pop (L, 1);
-			}
+		n = lua_kann_load_train_vectors (L, k, 2, 3, pca, 0, &x, &y,
+				err_buf, sizeof (err_buf));
 
-			lua_pop (L, 1);
+		if (n == -1) {
+			return luaL_error (L, "%s", err_buf);
 		}
 
 		struct rspamd_kann_train_cbdata cbd;
@@ -1195,7 +1226,6 @@ lua_kann_train1 (lua_State *L)
 
 		FREE_VEC (x, n);
 		FREE_VEC (y, n);
-		g_free (tmp_row);
 	}
 	else {
 		return luaL_error (L, "invalid arguments: kann, inputs, outputs and"
@@ -1269,7 +1299,7 @@ lua_kann_apply1 (lua_State *L)
 
 			kann_set_batch_size (k, 1);
 			if (pca) {
-				pca_out = g_malloc (sizeof (float) * n_in);
+				pca_out = g_malloc0 (sizeof (float) * n_in);
 
 				kad_sgemm_simple (0, 1, 1, n_in,
 						vec_len, vec, pca->data,
@@ -1319,7 +1349,7 @@ lua_kann_apply1 (lua_State *L)
 
 				gint outlen = kad_len (k->v[i_out]);
 				struct rspamd_lua_tensor *out;
-				out = lua_newtensor (L, 1, &outlen, false, false);
+				out = lua_newtensor (L, 1, &outlen, false, true);
 				/* Ensure that kann and tensor have the same understanding of floats */
 				G_STATIC_ASSERT (sizeof (float) == sizeof (rspamd_tensor_num_t));
 				memcpy (out->data, k->v[i_out]->x, outlen * sizeof (float));
@@ -1337,4 +1367,496 @@ lua_kann_apply1 (lua_State *L)
 	}
 
 	return 1;
-}
\ No newline at end of file
+}
+struct rspamd_kann_async_train {
+	kann_t *k; /* clone of the network that is trained */
+	float **x;
+	float **y;
+	int n;
+	int niters;
+	int raw_len; /* length of input vectors if pca is learned in thread */
+	float *pca; /* learned pca matrix */
+	const gchar *err;
+	double lr;
+	gint64 mini_size;
+	gint64 max_epoch;
+	gint64 max_drop_streak;
+	double frac_val;
+	gint64 nthreads;
+	GArray *costs; /* train and validation costs for each epoch */
+	GThread *thread;
+	struct ev_loop *event_loop;
+	ev_async async_ev;
+	struct rspamd_config *cfg;
+	lua_State *L;
+	gint cbref;
+};
+
+static void
+lua_kann_async_train_free (struct rspamd_kann_async_train *tr)
+{
+	FREE_VEC (tr->x, tr->n);
+	FREE_VEC (tr->y, tr->n);
+
+	if (tr->k) {
+		kann_delete (tr->k);
+	}
+
+	if (tr->cbref != -1) {
+		luaL_unref (tr->L, LUA_REGISTRYINDEX, tr->cbref);
+	}
+
+	g_free (tr->pca);
+	g_array_free (tr->costs, TRUE);
+	g_free (tr);
+}
+
+/*
+ * Called on config destruction (e.g. on worker termination) if the training
+ * has not been finished yet: the thread is joined, as it uses the network
+ * and training vectors, the callback is not called
+ */
+static void
+lua_kann_async_train_dtor (gpointer ud)
+{
+	struct rspamd_kann_async_train *tr = (struct rspamd_kann_async_train *)ud;
+
+	msg_info ("waiting for the unfinished ANN training");
+	g_thread_join (tr->thread);
+	ev_async_stop (tr->event_loop, &tr->async_ev);
+	lua_kann_async_train_free (tr);
+}
+
+/* Called from the training thread, so it must not touch Lua state */
+static void
+lua_kann_async_train_epoch_cb (int iter, float train_cost, float val_cost, void *ud)
+{
+	struct rspamd_kann_async_train *tr = (struct rspamd_kann_async_train *)ud;
+	float costs[2] = {train_cost, val_cost};
+
+	g_array_append_vals (tr->costs, costs, G_N_ELEMENTS (costs));
+}
+
+/*
+ * Learns pca matrix from the raw input vectors and projects them to the
+ * network inputs, the same as `rspamd_tensor.scatter_matrix` + `eigen` do
+ */
+static gboolean
+lua_kann_async_train_pca (struct rspamd_kann_async_train *tr)
+{
+	int n_in = kann_dim_in (tr->k), m = tr->raw_len;
+	rspamd_tensor_num_t *data, *scatter, *eigenvals;
+
+	data = g_malloc (sizeof (rspamd_tensor_num_t) * tr->n * m);
+
+	for (int s = 0; s < tr->n; s ++) {
+		memcpy (&data[s * m], tr->x[s], sizeof (rspamd_tensor_num_t) * m);
+	}
+
+	scatter = g_malloc0 (sizeof (rspamd_tensor_num_t) * m * m);
+	rspamd_tensor_scatter_matrix (data, tr->n, m, scatter);
+	g_free (data);
+
+	/* Scatter matrix is replaced with eigenvectors */
+	eigenvals = g_malloc0 (sizeof (rspamd_tensor_num_t) * m);
+
+	if (!kad_ssyev_simple (m, scatter, eigenvals)) {
+		g_free (eigenvals);
+		g_free (scatter);
+
+		return FALSE;
+	}
+
+	g_free (eigenvals);
+
+	/* Eigenvectors are ordered by eigenvalues ascending */
+	tr->pca = g_malloc (sizeof (float) * n_in * m);
+
+	for (int i = 0; i < n_in; i ++) {
+		memcpy (&tr->pca[i * m], &scatter[(m - i - 1) * m],
+				sizeof (float) * m);
+	}
+
+	g_free (scatter);
+
+	for (int s = 0; s < tr->n; s ++) {
+		/* kad_sgemm_simple accumulates results, so we need zeroed rows */
+		float *projected = g_malloc0 (sizeof (float) * n_in);
+
+		kad_sgemm_simple (0, 1, 1, n_in, m, tr->x[s], tr->pca, projected);
+		g_free (tr->x[s]);
+		tr->x[s] = projected;
+	}
+
+	return TRUE;
+}
+
+static gpointer
+lua_kann_async_train_thread (gpointer ud)
+{
+	struct rspamd_kann_async_train *tr = (struct rspamd_kann_async_train *)ud;
+
+	if (tr->raw_len > 0 && !lua_kann_async_train_pca (tr)) {
+		tr->niters = -1;
+		tr->err = "cannot learn pca: eigenvectors computation failed (no blas?)";
+		ev_async_send (tr->event_loop, &tr->async_ev);
+
+		return NULL;
+	}
+
+	if (tr->nthreads > 1) {
+		/* Minibatches are split between threads, kann_cost uses them */
+		kann_mt (tr->k, tr->nthreads, tr->mini_size);
+	}
+
+	tr->niters = kann_train_fnn1 (tr->k, tr->lr,
+			tr->mini_size, tr->max_epoch, tr->max_drop_streak,
+			tr->frac_val, tr->n, tr->x, tr->y,
+			lua_kann_async_train_epoch_cb, tr);
+
+	kann_mt (tr->k, 0, 0);
+	ev_async_send (tr->event_loop, &tr->async_ev);
+
+	return NULL;
+}
+
+static void
+lua_kann_async_train_fin (struct ev_loop *loop, ev_async *w, int revents)
+{
+	struct rspamd_kann_async_train *tr =
+			(struct rspamd_kann_async_train *)w->data;
+	lua_State *L = tr->L;
+	gint err_idx;
+
+	g_thread_join (tr->thread);
+	ev_async_stop (loop, w);
+
+	if (tr->cfg) {
+		rspamd_mempool_replace_destructor (tr->cfg->cfg_pool,
+				lua_kann_async_train_dtor, tr, NULL);
+	}
+
+	lua_pushcfunction (L, &rspamd_lua_traceback);
+	err_idx = lua_gettop (L);
+	lua_rawgeti (L, LUA_REGISTRYINDEX, tr->cbref);
+
+	if (tr->niters < 0) {
+		lua_pushstring (L, tr->err ? tr->err :
+				"cannot train network: invalid dimensions");
+		lua_pushnil (L);
+		lua_pushnil (L);
+		lua_pushnil (L);
+		lua_pushnil (L);
+	}
+	else {
+		int n_in = kann_dim_in (tr->k);
+
+		lua_pushnil (L);
+		lua_pushinteger (L, tr->niters);
+		/* Ownership of the trained network is passed to Lua */
+		PUSH_KAN_NETWORK (tr->k);
+		tr->k = NULL;
+
+		lua_createtable (L, tr->costs->len / 2, 0);
+
+		for (guint i = 0; i < tr->costs->len / 2; i ++) {
+			lua_createtable (L, 2, 0);
+			lua_pushnumber (L, g_array_index (tr->costs, float, i * 2));
+			lua_rawseti (L, -2, 1);
+			lua_pushnumber (L, g_array_index (tr->costs, float, i * 2 + 1));
+			lua_rawseti (L, -2, 2);
+			lua_rawseti (L, -2, i + 1);
+		}
+
+		if (tr->pca) {
+			struct rspamd_lua_tensor *pca;
+			int dims[2];
+
+			dims[0] = n_in;
+			dims[1] = tr->raw_len;
+			pca = lua_newtensor (L, 2, dims, false, true);
+			memcpy (pca->data, tr->pca, sizeof (float) * dims[0] * dims[1]);
+		}
+		else {
+			lua_pushnil (L);
+		}
+	}
+
+	if (lua_pcall (L, 5, 0, err_idx) != 0) {
+		msg_err ("cannot run lua async train callback: %s",
+				lua_tostring (L, -1));
+	}
+
+	lua_settop (L, err_idx - 1);
+	lua_kann_async_train_free (tr);
+}
+
+/***
+ * @method kann:train_async(inputs, outputs, params, callback)
+ * Trains a copy of the network in a separate thread using the same algorithm
+ * as `train1`. Params are the same as for `train1` (except `cb`) plus:
+ * - `ev_base` (required): event loop used to notify about the training end
+ * - `threads`: number of threads used to process minibatches
+ * - `learn_pca`: learn pca matrix from inputs in the training thread, inputs
+ *   are projected to the network inputs with this matrix
+ * Callback is called as `callback(err, niters, trained_ann, costs, pca)`, where
+ * `costs` is a table of `{train_cost, val_cost}` pairs for each epoch and
+ * `pca` is the learned pca matrix (if `learn_pca` is set).
+ * The original network is not modified. Unfinished training is waited for
+ * on config unload (e.g. worker termination) without calling the callback.
+ */
+static int
+lua_kann_train_async (lua_State *L)
+{
+	kann_t *k = lua_check_kann (L, 1);
+	struct rspamd_lua_tensor *pca = NULL;
+	struct ev_loop *event_loop = NULL;
+	struct rspamd_config **pcfg;
+
+	/* Default train params */
+	double lr = 0.001;
+	gint64 mini_size = 64;
+	gint64 max_epoch = 25;
+	gint64 max_drop_streak = 10;
+	double frac_val = 0.1;
+	gint64 nthreads = 1;
+	gboolean learn_pca = FALSE;
+
+	if (k && lua_istable (L, 2) && lua_istable (L, 3) && lua_istable (L, 4) &&
+			lua_isfunction (L, 5)) {
+		struct rspamd_kann_async_train *tr;
+		GError *err = NULL;
+		gchar err_buf[256];
+		float **x, **y;
+		int n, raw_len = 0;
+
+		if (!rspamd_lua_parse_table_arguments (L, 4, &err,
+				RSPAMD_LUA_PARSE_ARGUMENTS_IGNORE_MISSING,
+				"lr=N;mini_size=I;max_epoch=I;max_drop_streak=I;frac_val=N;"
+				"threads=I;pca=u{tensor};learn_pca=B;*ev_base=U{ev_base}",
+				&lr, &mini_size, &max_epoch, &max_drop_streak, &frac_val,
+				&nthreads, &pca, &learn_pca, &event_loop)) {
+			n = luaL_error (L, "invalid params: %s",
+					err ? err->message : "unknown error");
+			g_error_free (err);
+
+			return n;
+		}
+
+		if (mini_size <= 0 || nthreads <= 0) {
+			return luaL_error (L, "invalid params: mini_size and threads "
+						 "must be positive");
+		}
+
+		if (learn_pca) {
+			if (pca) {
+				return luaL_error (L, "invalid params: pca and learn_pca "
+						"are mutually exclusive");
+			}
+
+			lua_rawgeti (L, 2, 1);
+			raw_len = rspamd_lua_table_size (L, -1);
+			lua_pop (L, 1);
+
+			if (raw_len < kann_dim_in (k)) {
+				return luaL_error (L, "invalid params: cannot learn pca for "
+						"%d inputs from %d elements vectors",
+						kann_dim_in (k), raw_len);
+			}
+		}
+
+		n = lua_kann_load_train_vectors (L, k, 2, 3, pca, raw_len, &x, &y,
+				err_buf, sizeof (err_buf));
+
+		if (n == -1) {
+			return luaL_error (L, "%s", err_buf);
+		}
+
+		tr = g_malloc0 (sizeof (*tr));
+		tr->k = kann_clone (k, 1);
+		tr->x = x;
+		tr->y = y;
+		tr->n = n;
+		tr->raw_len = raw_len;
+		tr->lr = lr;
+		tr->mini_size = mini_size;
+		tr->max_epoch = max_epoch;
+		tr->max_drop_streak = max_drop_streak;
+		tr->frac_val = frac_val;
+		tr->nthreads = MIN (nthreads, mini_size);
+		tr->costs = g_array_sized_new (FALSE, FALSE, sizeof (float),
+				max_epoch * 2);
+		tr->event_loop = event_loop;
+		tr->L = L;
+		lua_pushvalue (L, 5);
+		tr->cbref = luaL_ref (L, LUA_REGISTRYINDEX);
+
+		/* Training thread must be joined before config is destroyed */
+		lua_getglobal (L, "rspamd_config");
+		pcfg = rspamd_lua_check_udata_maybe (L, -1, rspamd_config_classname);
+
+		if (pcfg) {
+			tr->cfg = *pcfg;
+			rspamd_mempool_add_destructor (tr->cfg->cfg_pool,
+					lua_kann_async_train_dtor, tr);
+		}
+
+		lua_pop (L, 1);
+
+		ev_async_init (&tr->async_ev, lua_kann_async_train_fin);
+		tr->async_ev.data = tr;
+		ev_async_start (event_loop, &tr->async_ev);
+
+		tr->thread = g_thread_new ("kann_train", lua_kann_async_train_thread, tr);
+	}
+	else {
+		return luaL_error (L, "invalid arguments: kann, inputs, outputs, "
+							  "params and callback are expected");
+	}
+
+	return 0;
+}
+
+/***
+ * @method kann:apply_batch(inputs[, pca])
+ * Applies the network to many input vectors at once, so the whole batch is
+ * processed by a single graph evaluation (and a single pca projection).
+ * @param {table|tensor} inputs table of input vectors or 2D tensor with a row per input
+ * @param {tensor} pca optional pca matrix
+ * @return {table|tensor} table of output vectors or 2D tensor if inputs are a tensor
+ */
+static int
+lua_kann_apply_batch (lua_State *L)
+{
+	kann_t *k = lua_check_kann (L, 1);
+	struct rspamd_lua_tensor *pca = NULL, *t = NULL;
+	float *in, *projected = NULL;
+	int n, vec_len, n_in, n_out, i_out;
+	gboolean tensor_input = FALSE;
+
+	if (!k) {
+		return luaL_error (L, "invalid arguments: rspamd{kann} expected");
+	}
+
+	n_in = kann_dim_in (k);
+
+	if (n_in <= 0) {
+		return luaL_error (L, "invalid inputs count: %d", n_in);
+	}
+
+	i_out = kann_find (k, KANN_F_OUT, 0);
+
+	if (i_out <= 0) {
+		return luaL_error (L, "invalid ANN: output layer is missing or is "
+							  "at the input pos");
+	}
+
+	if (lua_isuserdata (L, 3)) {
+		pca = lua_check_tensor (L, 3);
+
+		if (!pca) {
+			return luaL_error (L, "invalid params: pca matrix expected");
+		}
+
+		if (pca->ndims != 2 || pca->dim[0] != n_in) {
+			return luaL_error (L, "invalid pca tensor: "
+								  "matrix with %d rows expected", n_in);
+		}
+	}
+
+	vec_len = pca ? pca->dim[1] : n_in;
+
+	if (lua_istable (L, 2)) {
+		n = rspamd_lua_table_size (L, 2);
+
+		if (n == 0) {
+			lua_newtable (L);
+
+			return 1;
+		}
+
+		in = g_malloc (sizeof (float) * n * vec_len);
+
+		for (int s = 0; s < n; s ++) {
+			lua_rawgeti (L, 2, s + 1);
+
+			if (!lua_istable (L, -1) || rspamd_lua_table_size (L, -1) != vec_len) {
+				g_free (in);
+
+				return luaL_error (L, "invalid params at pos %d: "
+									  "bad input dimension; %d expected",
+						s + 1, vec_len);
+			}
+
+			for (int i = 0; i < vec_len; i ++) {
+				lua_rawgeti (L, -1, i + 1);
+				in[s * vec_len + i] = lua_tonumber (L, -1);
+				lua_pop (L, 1);
+			}
+
+			lua_pop (L, 1);
+		}
+	}
+	else if (lua_isuserdata (L, 2)) {
+		t = lua_check_tensor (L, 2);
+
+		if (!t || t->ndims != 2) {
+			return luaL_error (L, "invalid arguments: 2D rspamd{tensor} expected");
+		}
+
+		if (t->dim[1] != vec_len) {
+			return luaL_error (L, "invalid params: bad input dimension %d; %d expected",
+					t->dim[1], vec_len);
+		}
+
+		n = t->dim[0];
+		in = t->data;
+		tensor_input = TRUE;
+	}
+	else {
+		return luaL_error (L, "invalid arguments: table or 2D rspamd{tensor} expected");
+	}
+
+	if (pca) {
+		/* Project all rows at once: sgemm accumulates, so output must be zeroed */
+		projected = g_malloc0 (sizeof (float) * n * n_in);
+		kad_sgemm_simple (0, 1, n, n_in, vec_len, in, pca->data, projected);
+		kann_feed_bind (k, KANN_F_IN, 0, &projected);
+	}
+	else {
+		kann_feed_bind (k, KANN_F_IN, 0, &in);
+	}
+
+	kann_set_batch_size (k, n);
+	kad_eval_at (k->n, k->v, i_out);
+	n_out = kad_len (k->v[i_out]) / n;
+
+	if (tensor_input) {
+		struct rspamd_lua_tensor *out;
+		gint dims[2] = {n, n_out};
+
+		out = lua_newtensor (L, 2, dims, false, true);
+		G_STATIC_ASSERT (sizeof (float) == sizeof (rspamd_tensor_num_t));
+		memcpy (out->data, k->v[i_out]->x, n * n_out * sizeof (float));
+	}
+	else {
+		lua_createtable (L, n, 0);
+
+		for (int s = 0; s < n; s ++) {
+			lua_createtable (L, n_out, 0);
+
+			for (int i = 0; i < n_out; i ++) {
+				lua_pushnumber (L, k->v[i_out]->x[s * n_out + i]);
+				lua_rawseti (L, -2, i + 1);
+			}
+
+			lua_rawseti (L, -2, s + 1);
+		}
+
+		g_free (in);
+	}
+
+	g_free (projected);
+
+	return 1;
+}
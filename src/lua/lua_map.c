@@ -184,7 +184,7 @@ struct lua_map_callback_data {
 struct rspamd_lua_map  *
 lua_check_map (lua_State * L, gint pos)
 {
-	void *ud = rspamd_lua_check_udata (L, pos, "rspamd{map}");
+	void *ud = rspamd_lua_check_udata (L, pos, rspamd_map_classname);
 	luaL_argcheck (L, ud != NULL, pos, "'map' expected");
 	return ud ? *((struct rspamd_lua_map **)ud) : NULL;
 }
@@ -221,7 +221,7 @@ lua_config_add_radix_map (lua_State *L)
 		m->lua_map = map;
 		pmap = lua_newuserdata (L, sizeof (void *));
 		*pmap = map;
-		rspamd_lua_setclass (L, "rspamd{map}", -1);
+		rspamd_lua_setclass (L, rspamd_map_classname, -1);
 	}
 	else {
 		return luaL_error (L, "invalid arguments");
@@ -281,7 +281,7 @@ lua_config_radix_from_config (lua_State *L)
 			map->map = m;
 			m->lua_map = map;
 			*pmap = map;
-			rspamd_lua_setclass (L, "rspamd{map}", -1);
+			rspamd_lua_setclass (L, rspamd_map_classname, -1);
 		}
 		else {
 			msg_warn_config ("Couldnt find config option [%s][%s]", mname,
@@ -345,7 +345,7 @@ lua_config_radix_from_ucl (lua_State *L)
 		map->map = m;
 		m->lua_map = map;
 		*pmap = map;
-		rspamd_lua_setclass (L, "rspamd{map}", -1);
+		rspamd_lua_setclass (L, rspamd_map_classname, -1);
 
 	}
 	else {
@@ -386,7 +386,7 @@ lua_config_add_hash_map (lua_State *L)
 		m->lua_map = map;
 		pmap = lua_newuserdata (L, sizeof (void *));
 		*pmap = map;
-		rspamd_lua_setclass (L, "rspamd{map}", -1);
+		rspamd_lua_setclass (L, rspamd_map_classname, -1);
 	}
 	else {
 		return luaL_error (L, "invalid arguments");
@@ -428,7 +428,7 @@ lua_config_add_kv_map (lua_State *L)
 		m->lua_map = map;
 		pmap = lua_newuserdata (L, sizeof (void *));
 		*pmap = map;
-		rspamd_lua_setclass (L, "rspamd{map}", -1);
+		rspamd_lua_setclass (L, rspamd_map_classname, -1);
 	}
 	else {
 		return luaL_error (L, "invalid arguments");
@@ -517,7 +517,7 @@ lua_map_fin (struct map_cb_data *data, void **target)
 				struct rspamd_lua_text *t;
 
 				t = lua_newuserdata(cbdata->L, sizeof(*t));
-				rspamd_lua_setclass(cbdata->L, "rspamd{text}", -1);
+				rspamd_lua_setclass(cbdata->L, rspamd_text_classname, -1);
 				t->flags = 0;
 				t->len = cbdata->data->len;
 				t->start = cbdata->data->str;
@@ -525,7 +525,7 @@ lua_map_fin (struct map_cb_data *data, void **target)
 
 			pmap = lua_newuserdata(cbdata->L, sizeof(void *));
 			*pmap = cbdata->lua_map;
-			rspamd_lua_setclass(cbdata->L, "rspamd{map}", -1);
+			rspamd_lua_setclass(cbdata->L, rspamd_map_classname, -1);
 
 			gint ret = lua_pcall(cbdata->L, 2, 0, err_idx);
 
@@ -792,7 +792,7 @@ lua_config_add_map (lua_State *L)
 		map->map = m;
 		pmap = lua_newuserdata (L, sizeof (void *));
 		*pmap = map;
-		rspamd_lua_setclass (L, "rspamd{map}", -1);
+		rspamd_lua_setclass (L, rspamd_map_classname, -1);
 	}
 	else {
 		return luaL_error (L, "invalid arguments");
@@ -845,7 +845,7 @@ lua_config_get_maps (lua_State*L)
 
 			pmap = lua_newuserdata (L, sizeof (*pmap));
 			*pmap = map;
-			rspamd_lua_setclass (L, "rspamd{map}", -1);
+			rspamd_lua_setclass (L, rspamd_map_classname, -1);
 			lua_rawseti (L, -2, i);
 
 			cur = g_list_next (cur);
@@ -909,7 +909,7 @@ lua_map_get_key (lua_State * L)
 				}
 			}
 			else if (lua_type (L, 2) == LUA_TUSERDATA) {
-				ud = rspamd_lua_check_udata (L, 2, "rspamd{ip}");
+				ud = rspamd_lua_check_udata (L, 2, rspamd_ip_classname);
 				if (ud != NULL) {
 					addr = *((struct rspamd_lua_ip **)ud);
 
@@ -1428,7 +1428,7 @@ lua_map_on_load (lua_State *L)
 void
 luaopen_map (lua_State * L)
 {
-	rspamd_lua_new_class (L, "rspamd{map}", maplib_m);
+	rspamd_lua_new_class (L, rspamd_map_classname, maplib_m);
 
 	lua_pop (L, 1);
 }
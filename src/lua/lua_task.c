@@ -1150,11 +1150,13 @@ LUA_FUNCTION_DEF (task, get_newlines_type);
 
 /***
  * @method task:get_stat_tokens()
- * Returns list of tables the statistical tokens:
+ * Returns list of tables the statistical tokens. Duplicate tokens are merged,
+ * so each token is returned once and tokens are ordered by `data`:
  * - `data`: 64 bit number encoded as a string
  * - `t1`: the first token (if any)
  * - `t2`: the second token (if any)
  * - `win`: window index
+ * - `count`: number of occurrences of the token in a message
  * - `flag`: table of strings:
  *    - `text`: text token
  *    - `meta`: meta token
@@ -1386,7 +1388,7 @@ static const struct luaL_reg archivelib_m[] = {
 struct rspamd_task *
 lua_check_task (lua_State * L, gint pos)
 {
-	void *ud = rspamd_lua_check_udata (L, pos, "rspamd{task}");
+	void *ud = rspamd_lua_check_udata (L, pos, rspamd_task_classname);
 	luaL_argcheck (L, ud != NULL, pos, "'task' expected");
 	return ud ? *((struct rspamd_task **)ud) : NULL;
 }
@@ -1394,7 +1396,7 @@ lua_check_task (lua_State * L, gint pos)
 struct rspamd_task *
 lua_check_task_maybe (lua_State * L, gint pos)
 {
-	void *ud = rspamd_lua_check_udata_maybe (L, pos, "rspamd{task}");
+	void *ud = rspamd_lua_check_udata_maybe (L, pos, rspamd_task_classname);
 
 	return ud ? *((struct rspamd_task **)ud) : NULL;
 }
@@ -1402,7 +1404,7 @@ lua_check_task_maybe (lua_State * L, gint pos)
 static struct rspamd_image *
 lua_check_image (lua_State * L)
 {
-	void *ud = rspamd_lua_check_udata (L, 1, "rspamd{image}");
+	void *ud = rspamd_lua_check_udata (L, 1, rspamd_image_classname);
 	luaL_argcheck (L, ud != NULL, 1, "'image' expected");
 	return ud ? *((struct rspamd_image **)ud) : NULL;
 }
@@ -1410,7 +1412,7 @@ lua_check_image (lua_State * L)
 static struct rspamd_archive *
 lua_check_archive (lua_State * L)
 {
-	void *ud = rspamd_lua_check_udata (L, 1, "rspamd{archive}");
+	void *ud = rspamd_lua_check_udata (L, 1, rspamd_archive_classname);
 	luaL_argcheck (L, ud != NULL, 1, "'archive' expected");
 	return ud ? *((struct rspamd_archive **)ud) : NULL;
 }
@@ -1509,7 +1511,7 @@ lua_task_get_cfg (lua_State *L)
 
 	if (task) {
 		pcfg = lua_newuserdata (L, sizeof (gpointer));
-		rspamd_lua_setclass (L, "rspamd{config}", -1);
+		rspamd_lua_setclass (L, rspamd_config_classname, -1);
 		*pcfg = task->cfg;
 	}
 	else {
@@ -1524,7 +1526,7 @@ lua_task_set_cfg (lua_State *L)
 {
 	LUA_TRACE_POINT;
 	struct rspamd_task *task = lua_check_task (L, 1);
-	void *ud = rspamd_lua_check_udata (L, 2, "rspamd{config}");
+	void *ud = rspamd_lua_check_udata (L, 2, rspamd_config_classname);
 
 	if (task) {
 		luaL_argcheck (L, ud != NULL, 1, "'config' expected");
@@ -1559,7 +1561,7 @@ lua_task_get_message (lua_State * L)
 
 	if (task) {
 		t = lua_newuserdata (L, sizeof (*t));
-		rspamd_lua_setclass (L, "rspamd{text}", -1);
+		rspamd_lua_setclass (L, rspamd_text_classname, -1);
 		t->flags = 0;
 		t->start = task->msg.begin;
 		t->len = task->msg.len;
@@ -1724,7 +1726,7 @@ lua_task_load_from_file (lua_State * L)
 
 		if (lua_type (L, 2) == LUA_TUSERDATA) {
 			gpointer p;
-			p = rspamd_lua_check_udata_maybe (L, 2, "rspamd{config}");
+			p = rspamd_lua_check_udata_maybe (L, 2, rspamd_config_classname);
 
 			if (p) {
 				cfg = *(struct rspamd_config **)p;
@@ -1785,7 +1787,7 @@ lua_task_load_from_file (lua_State * L)
 	if (res) {
 		ptask = lua_newuserdata (L, sizeof (*ptask));
 		*ptask = task;
-		rspamd_lua_setclass (L, "rspamd{task}", -1);
+		rspamd_lua_setclass (L, rspamd_task_classname, -1);
 	}
 	else {
 		if (err) {
@@ -1814,7 +1816,7 @@ lua_task_load_from_string (lua_State * L)
 
 		if (lua_type (L, 2) == LUA_TUSERDATA) {
 			gpointer p;
-			p = rspamd_lua_check_udata_maybe (L, 2, "rspamd{config}");
+			p = rspamd_lua_check_udata_maybe (L, 2, rspamd_config_classname);
 
 			if (p) {
 				cfg = *(struct rspamd_config **)p;
@@ -1836,7 +1838,7 @@ lua_task_load_from_string (lua_State * L)
 
 	ptask = lua_newuserdata (L, sizeof (*ptask));
 	*ptask = task;
-	rspamd_lua_setclass (L, "rspamd{task}", -1);
+	rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 	return 2;
 }
@@ -1851,7 +1853,7 @@ lua_task_create (lua_State * L)
 
 	if (lua_type (L, 1) == LUA_TUSERDATA) {
 		gpointer p;
-		p = rspamd_lua_check_udata_maybe (L, 2, "rspamd{config}");
+		p = rspamd_lua_check_udata_maybe (L, 2, rspamd_config_classname);
 
 		if (p) {
 			cfg = *(struct rspamd_config **)p;
@@ -1860,7 +1862,7 @@ lua_task_create (lua_State * L)
 
 	if (lua_type (L, 2) == LUA_TUSERDATA) {
 		gpointer p;
-		p = rspamd_lua_check_udata_maybe (L, 2, "rspamd{ev_base}");
+		p = rspamd_lua_check_udata_maybe (L, 2, rspamd_ev_base_classname);
 
 		if (p) {
 			ev_base = *(struct ev_loop **)p;
@@ -1872,7 +1874,7 @@ lua_task_create (lua_State * L)
 
 	ptask = lua_newuserdata (L, sizeof (*ptask));
 	*ptask = task;
-	rspamd_lua_setclass (L, "rspamd{task}", -1);
+	rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 	return 1;
 }
@@ -1886,7 +1888,7 @@ lua_task_get_mempool (lua_State * L)
 
 	if (task != NULL) {
 		ppool = lua_newuserdata (L, sizeof (rspamd_mempool_t *));
-		rspamd_lua_setclass (L, "rspamd{mempool}", -1);
+		rspamd_lua_setclass (L, rspamd_mempool_classname, -1);
 		*ppool = task->task_pool;
 	}
 	else {
@@ -1905,7 +1907,7 @@ lua_task_get_session (lua_State * L)
 
 	if (task != NULL) {
 		psession = lua_newuserdata (L, sizeof (void *));
-		rspamd_lua_setclass (L, "rspamd{session}", -1);
+		rspamd_lua_setclass (L, rspamd_session_classname, -1);
 		*psession = task->s;
 	}
 	else {
@@ -1939,7 +1941,7 @@ lua_task_get_ev_base (lua_State * L)
 
 	if (task != NULL) {
 		pbase = lua_newuserdata (L, sizeof (struct ev_loop *));
-		rspamd_lua_setclass (L, "rspamd{ev_base}", -1);
+		rspamd_lua_setclass (L, rspamd_ev_base_classname, -1);
 		*pbase = task->event_loop;
 	}
 	else {
@@ -1958,7 +1960,7 @@ lua_task_get_worker (lua_State * L)
 	if (task != NULL) {
 		if (task->worker) {
 			pworker = lua_newuserdata (L, sizeof (struct rspamd_worker *));
-			rspamd_lua_setclass (L, "rspamd{worker}", -1);
+			rspamd_lua_setclass (L, rspamd_worker_classname, -1);
 			*pworker = task->worker;
 		}
 		else {
@@ -2651,7 +2653,7 @@ lua_task_inject_url (lua_State * L)
 	if (lua_isuserdata (L, 3)) {
 		/* We also have a mime part there */
 		mpart = *((struct rspamd_mime_part **)rspamd_lua_check_udata_maybe (L,
-				3, "rspamd{mimepart}"));
+				3, rspamd_mimepart_classname));
 	}
 
 	if (task && task->message && url && url->url) {
@@ -2678,7 +2680,7 @@ lua_task_get_content (lua_State * L)
 
 	if (task) {
 		t = lua_newuserdata (L, sizeof (*t));
-		rspamd_lua_setclass (L, "rspamd{text}", -1);
+		rspamd_lua_setclass (L, rspamd_text_classname, -1);
 		t->len = task->msg.len;
 		t->start = task->msg.begin;
 		t->flags = 0;
@@ -2816,7 +2818,7 @@ lua_task_get_text_parts (lua_State * L)
 				PTR_ARRAY_FOREACH (MESSAGE_FIELD (task, text_parts), i, part) {
 					ppart = lua_newuserdata (L, sizeof (struct rspamd_mime_text_part *));
 					*ppart = part;
-					rspamd_lua_setclass (L, "rspamd{textpart}", -1);
+					rspamd_lua_setclass (L, rspamd_textpart_classname, -1);
 					/* Make it array */
 					lua_rawseti (L, -2, i + 1);
 				}
@@ -2850,7 +2852,7 @@ lua_task_get_parts (lua_State * L)
 			PTR_ARRAY_FOREACH (MESSAGE_FIELD (task, parts), i, part) {
 				ppart = lua_newuserdata (L, sizeof (struct rspamd_mime_part *));
 				*ppart = part;
-				rspamd_lua_setclass (L, "rspamd{mimepart}", -1);
+				rspamd_lua_setclass (L, rspamd_mimepart_classname, -1);
 				/* Make it array */
 				lua_rawseti (L, -2, i + 1);
 			}
@@ -2882,7 +2884,7 @@ lua_task_get_request_header (lua_State *L)
 
 		if (hdr) {
 			t = lua_newuserdata (L, sizeof (*t));
-			rspamd_lua_setclass (L, "rspamd{text}", -1);
+			rspamd_lua_setclass (L, rspamd_text_classname, -1);
 			t->start = hdr->begin;
 			t->len = hdr->len;
 			t->flags = 0;
@@ -3193,7 +3195,7 @@ lua_task_get_raw_headers (lua_State *L)
 
 	if (task && task->message) {
 		t = lua_newuserdata (L, sizeof (*t));
-		rspamd_lua_setclass (L, "rspamd{text}", -1);
+		rspamd_lua_setclass (L, rspamd_text_classname, -1);
 		t->start = MESSAGE_FIELD (task, raw_headers_content).begin;
 		t->len = MESSAGE_FIELD (task, raw_headers_content).len;
 		t->flags = 0;
@@ -3284,7 +3286,7 @@ lua_task_get_resolver (lua_State *L)
 
 	if (task != NULL && task->resolver != NULL) {
 		presolver = lua_newuserdata (L, sizeof (void *));
-		rspamd_lua_setclass (L, "rspamd{resolver}", -1);
+		rspamd_lua_setclass (L, rspamd_resolver_classname, -1);
 		*presolver = task->resolver;
 	}
 	else {
@@ -4477,7 +4479,7 @@ lua_task_get_images (lua_State *L)
 				PTR_ARRAY_FOREACH (MESSAGE_FIELD (task, parts), i, part) {
 					if (part->part_type == RSPAMD_MIME_PART_IMAGE) {
 						pimg = lua_newuserdata (L, sizeof (struct rspamd_image *));
-						rspamd_lua_setclass (L, "rspamd{image}", -1);
+						rspamd_lua_setclass (L, rspamd_image_classname, -1);
 						*pimg = part->specific.img;
 						lua_rawseti (L, -2, ++nelt);
 					}
@@ -4514,7 +4516,7 @@ lua_task_get_archives (lua_State *L)
 				PTR_ARRAY_FOREACH (MESSAGE_FIELD (task, parts), i, part) {
 					if (part->part_type == RSPAMD_MIME_PART_ARCHIVE) {
 						parch = lua_newuserdata (L, sizeof (struct rspamd_archive *));
-						rspamd_lua_setclass (L, "rspamd{archive}", -1);
+						rspamd_lua_setclass (L, rspamd_archive_classname, -1);
 						*parch = part->specific.arch;
 						lua_rawseti (L, -2, ++nelt);
 					}
@@ -6471,6 +6473,7 @@ lua_push_stat_token (lua_State *L, rspamd_token_t *tok)
 	 * - `t1`: the first token (if any)
 	 * - `t2`: the second token (if any)
 	 * - `win`: window index
+	 * - `count`: number of occurrences
 	 * - `flag`: table of strings:
 	 *    - `text`: text token
 	 *    - `meta`: meta token
@@ -6479,7 +6482,7 @@ lua_push_stat_token (lua_State *L, rspamd_token_t *tok)
 	 *    - `subject`: subject token
 	 *    - `unigram`: unigram token
 	 */
-	lua_createtable (L, 0, 5);
+	lua_createtable (L, 0, 6);
 
 	rspamd_snprintf (numbuf, sizeof (numbuf), "%uL", tok->data);
 	lua_pushstring (L, "data");
@@ -6502,6 +6505,10 @@ lua_push_stat_token (lua_State *L, rspamd_token_t *tok)
 	lua_pushinteger (L, tok->window_idx);
 	lua_settable (L, -3);
 
+	lua_pushstring (L, "count");
+	lua_pushinteger (L, tok->count);
+	lua_settable (L, -3);
+
 	lua_pushstring (L, "flags");
 	lua_createtable (L, 0, 5);
 
@@ -6688,7 +6695,7 @@ lua_task_headers_foreach (lua_State *L)
 				lua_gettable (L, 3);
 
 				if (lua_isuserdata (L, -1)) {
-					RSPAMD_LUA_CHECK_UDATA_PTR_OR_RETURN(L, -1, "rspamd{regexp}",
+					RSPAMD_LUA_CHECK_UDATA_PTR_OR_RETURN(L, -1, rspamd_regexp_classname,
 							struct rspamd_lua_regexp, re);
 				}
 
@@ -7263,14 +7270,14 @@ lua_load_task (lua_State * L)
 static void
 luaopen_archive (lua_State * L)
 {
-	rspamd_lua_new_class (L, "rspamd{archive}", archivelib_m);
+	rspamd_lua_new_class (L, rspamd_archive_classname, archivelib_m);
 	lua_pop (L, 1);
 }
 
 void
 luaopen_task (lua_State * L)
 {
-	rspamd_lua_new_class (L, "rspamd{task}", tasklib_m);
+	rspamd_lua_new_class (L, rspamd_task_classname, tasklib_m);
 	lua_pop (L, 1);
 
 	rspamd_lua_add_preload (L, "rspamd_task", lua_load_task);
@@ -7281,7 +7288,7 @@ luaopen_task (lua_State * L)
 void
 luaopen_image (lua_State * L)
 {
-	rspamd_lua_new_class (L, "rspamd{image}", imagelib_m);
+	rspamd_lua_new_class (L, rspamd_image_classname, imagelib_m);
 	lua_pop (L, 1);
 }
 
@@ -7291,6 +7298,6 @@ rspamd_lua_task_push (lua_State *L, struct rspamd_task *task)
 	struct rspamd_task **ptask;
 
 	ptask = lua_newuserdata (L, sizeof (gpointer));
-	rspamd_lua_setclass (L, "rspamd{task}", -1);
+	rspamd_lua_setclass (L, rspamd_task_classname, -1);
 	*ptask = task;
 }
@@ -721,6 +721,58 @@ lua_tensor_has_blas (lua_State *L)
 	return 1;
 }
 
+void
+rspamd_tensor_scatter_matrix (const rspamd_tensor_num_t *data, int nrows,
+		int ncols, rspamd_tensor_num_t *res)
+{
+	/* Auxiliary vars */
+	rspamd_tensor_num_t *means, /* means vector */
+		*tmp_row, /* temp row for Kahan's algorithm */
+		*tmp_square /* temp matrix for multiplications */;
+	means = g_malloc0 (sizeof (rspamd_tensor_num_t) * ncols);
+	tmp_row = g_malloc0 (sizeof (rspamd_tensor_num_t) * ncols);
+	tmp_square = g_malloc (sizeof (rspamd_tensor_num_t) * ncols * ncols);
+
+	/*
+	 * Column based means
+	 * means will have s, tmp_row will have c
+	 */
+	for (int i = 0; i < nrows; i ++) {
+		/* Cycle by rows */
+		for (int j = 0; j < ncols; j ++) {
+			rspamd_tensor_num_t v = data[i * ncols + j];
+			rspamd_tensor_num_t y = v - tmp_row[j];
+			rspamd_tensor_num_t st = means[j] + y;
+			tmp_row[j] = (st - means[j]) - y;
+			means[j] = st;
+		}
+	}
+
+	for (int j = 0; j < ncols; j ++) {
+		means[j] /= nrows;
+	}
+
+	for (int i = 0; i < nrows; i ++) {
+		/* Update for each sample */
+		for (int j = 0; j < ncols; j ++) {
+			tmp_row[j] = data[i * ncols + j] - means[j];
+		}
+
+		memset (tmp_square, 0, ncols * ncols * sizeof (rspamd_tensor_num_t));
+		kad_sgemm_simple (1, 0, ncols, ncols, 1,
+				tmp_row, tmp_row, tmp_square);
+
+		for (int j = 0; j < ncols; j ++) {
+			kad_saxpy (ncols, 1.0, &tmp_square[j * ncols],
+					&res[j * ncols]);
+		}
+	}
+
+	g_free (tmp_row);
+	g_free (means);
+	g_free (tmp_square);
+}
+
 static gint
 lua_tensor_scatter_matrix (lua_State *L)
 {
@@ -736,53 +788,8 @@ lua_tensor_scatter_matrix (lua_State *L)
 		dims[0] = t->dim[1];
 		dims[1] = t->dim[1];
 		res = lua_newtensor (L, 2, dims, true, true);
-
-		/* Auxiliary vars */
-		rspamd_tensor_num_t *means, /* means vector */
-			*tmp_row, /* temp row for Kahan's algorithm */
-			*tmp_square /* temp matrix for multiplications */;
-		means = g_malloc0 (sizeof (rspamd_tensor_num_t) * t->dim[1]);
-		tmp_row = g_malloc0 (sizeof (rspamd_tensor_num_t) * t->dim[1]);
-		tmp_square = g_malloc (sizeof (rspamd_tensor_num_t) * t->dim[1] * t->dim[1]);
-
-		/*
-		 * Column based means
-		 * means will have s, tmp_row will have c
-		 */
-		for (int i = 0; i < t->dim[0]; i ++) {
-			/* Cycle by rows */
-			for (int j = 0; j < t->dim[1]; j ++) {
-				rspamd_tensor_num_t v = t->data[i * t->dim[1] + j];
-				rspamd_tensor_num_t y = v - tmp_row[j];
-				rspamd_tensor_num_t st = means[j] + y;
-				tmp_row[j] = (st - means[j]) - y;
-				means[j] = st;
-			}
-		}
-
-		for (int j = 0; j < t->dim[1]; j ++) {
-			means[j] /= t->dim[0];
-		}
-
-		for (int i = 0; i < t->dim[0]; i ++) {
-			/* Update for each sample */
-			for (int j = 0; j < t->dim[1]; j ++) {
-				tmp_row[j] = t->data[i * t->dim[1] + j] - means[j];
-			}
-
-			memset (tmp_square, 0, t->dim[1] * t->dim[1] * sizeof (rspamd_tensor_num_t));
-			kad_sgemm_simple (1, 0, t->dim[1], t->dim[1], 1,
-					tmp_row, tmp_row, tmp_square);
-
-			for (int j = 0; j < t->dim[1]; j ++) {
-				kad_saxpy (t->dim[1], 1.0, &tmp_square[j * t->dim[1]],
-						&res->data[j * t->dim[1]]);
-			}
-		}
-
-		g_free (tmp_row);
-		g_free (means);
-		g_free (tmp_square);
+		rspamd_tensor_scatter_matrix (t->data, t->dim[0], t->dim[1],
+				res->data);
 	}
 	else {
 		return luaL_error (L, "tensor required");
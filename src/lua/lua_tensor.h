@@ -16,7 +16,7 @@
 #ifndef RSPAMD_LUA_TENSOR_H
 #define RSPAMD_LUA_TENSOR_H
 
-#define TENSOR_CLASS "rspamd{tensor}"
+#define TENSOR_CLASS rspamd_tensor_classname
 
 typedef float rspamd_tensor_num_t;
 
@@ -31,4 +31,11 @@ struct rspamd_lua_tensor *lua_check_tensor (lua_State *L, int pos);
 struct rspamd_lua_tensor *lua_newtensor (lua_State *L, int ndims,
 		const int *dim, bool zero_fill, bool own);
 
+/**
+ * Computes scatter matrix for `nrows` x `ncols` matrix `data`,
+ * `res` must be a zero filled `ncols` x `ncols` matrix
+ */
+void rspamd_tensor_scatter_matrix (const rspamd_tensor_num_t *data, int nrows,
+		int ncols, rspamd_tensor_num_t *res);
+
 #endif
@@ -25,6 +25,7 @@
  * - round-robin: balance upstreams one by one selecting accordingly to their weight
  * - hash: use stable hashing algorithm to distribute values according to some static strings
  * - master-slave: always prefer upstream with higher priority unless it is not available
+ * - latency: pick the faster of two random upstreams based on the reported response times
  *
  * Here is an example of upstreams manipulations:
  * @example
@@ -56,6 +57,7 @@ LUA_FUNCTION_DEF (upstream_list, all_upstreams);
 LUA_FUNCTION_DEF (upstream_list, get_upstream_by_hash);
 LUA_FUNCTION_DEF (upstream_list, get_upstream_round_robin);
 LUA_FUNCTION_DEF (upstream_list, get_upstream_master_slave);
+LUA_FUNCTION_DEF (upstream_list, get_upstream_latency);
 LUA_FUNCTION_DEF (upstream_list, add_watcher);
 
 static const struct luaL_reg upstream_list_m[] = {
@@ -63,6 +65,7 @@ static const struct luaL_reg upstream_list_m[] = {
 	LUA_INTERFACE_DEF (upstream_list, get_upstream_by_hash),
 	LUA_INTERFACE_DEF (upstream_list, get_upstream_round_robin),
 	LUA_INTERFACE_DEF (upstream_list, get_upstream_master_slave),
+	LUA_INTERFACE_DEF (upstream_list, get_upstream_latency),
 	LUA_INTERFACE_DEF (upstream_list, all_upstreams),
 	LUA_INTERFACE_DEF (upstream_list, add_watcher),
 	{"__tostring", rspamd_lua_class_tostring},
@@ -80,6 +83,7 @@ LUA_FUNCTION_DEF (upstream, fail);
 LUA_FUNCTION_DEF (upstream, get_addr);
 LUA_FUNCTION_DEF (upstream, get_name);
 LUA_FUNCTION_DEF (upstream, get_port);
+LUA_FUNCTION_DEF (upstream, get_latency);
 LUA_FUNCTION_DEF (upstream, destroy);
 
 static const struct luaL_reg upstream_m[] = {
@@ -88,6 +92,7 @@ static const struct luaL_reg upstream_m[] = {
 	LUA_INTERFACE_DEF (upstream, get_addr),
 	LUA_INTERFACE_DEF (upstream, get_port),
 	LUA_INTERFACE_DEF (upstream, get_name),
+	LUA_INTERFACE_DEF (upstream, get_latency),
 	{"__tostring", rspamd_lua_class_tostring},
 	{"__gc", lua_upstream_destroy},
 	{NULL, NULL}
@@ -98,7 +103,7 @@ static const struct luaL_reg upstream_m[] = {
 struct rspamd_lua_upstream *
 lua_check_upstream(lua_State *L, int pos)
 {
-	void *ud = rspamd_lua_check_udata (L, pos, "rspamd{upstream}");
+	void *ud = rspamd_lua_check_udata (L, pos, rspamd_upstream_classname);
 
 	luaL_argcheck (L, ud != NULL, 1, "'upstream' expected");
 	return ud ? (struct rspamd_lua_upstream *)ud : NULL;
@@ -199,8 +204,9 @@ lua_upstream_fail (lua_State *L)
 }
 
 /***
- * @method upstream:ok()
+ * @method upstream:ok([latency])
  * Indicates upstream success. Resets errors count for an upstream.
+ * @param {number} latency optional response time in seconds used by the latency rotation
  */
 static gint
 lua_upstream_ok (lua_State *L)
@@ -209,12 +215,41 @@ lua_upstream_ok (lua_State *L)
 	struct rspamd_lua_upstream *up = lua_check_upstream(L, 1);
 
 	if (up) {
-		rspamd_upstream_ok (up->up);
+		if (lua_isnumber (L, 2)) {
+			rspamd_upstream_ok_latency (up->up, lua_tonumber (L, 2));
+		}
+		else {
+			rspamd_upstream_ok (up->up);
+		}
 	}
 
 	return 0;
 }
 
+/***
+ * @method upstream:get_latency()
+ * Get average response time of an upstream and the number of requests in flight
+ * @return {number,number} average latency in seconds (0 if unknown) and inflight requests count
+ */
+static gint
+lua_upstream_get_latency (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	struct rspamd_lua_upstream *up = lua_check_upstream(L, 1);
+	guint inflight = 0;
+
+	if (up) {
+		lua_pushnumber (L, rspamd_upstream_latency (up->up, &inflight));
+		lua_pushinteger (L, inflight);
+	}
+	else {
+		lua_pushnil (L);
+		lua_pushnil (L);
+	}
+
+	return 2;
+}
+
 static gint
 lua_upstream_destroy (lua_State *L)
 {
@@ -235,7 +270,7 @@ lua_upstream_destroy (lua_State *L)
 static struct upstream_list *
 lua_check_upstream_list (lua_State * L)
 {
-	void *ud = rspamd_lua_check_udata (L, 1, "rspamd{upstream_list}");
+	void *ud = rspamd_lua_check_udata (L, 1, rspamd_upstream_list_classname);
 
 	luaL_argcheck (L, ud != NULL, 1, "'upstream_list' expected");
 	return ud ? *((struct upstream_list **)ud) : NULL;
@@ -252,7 +287,7 @@ lua_push_upstream (lua_State * L, gint up_idx, struct upstream *up)
 
 	lua_ups = lua_newuserdata (L, sizeof (*lua_ups));
 	lua_ups->up = up;
-	rspamd_lua_setclass (L, "rspamd{upstream}", -1);
+	rspamd_lua_setclass (L, rspamd_upstream_classname, -1);
 	/* Store parent in the upstream to prevent gc */
 	lua_pushvalue (L, up_idx);
 	lua_ups->upref = luaL_ref (L, LUA_REGISTRYINDEX);
@@ -298,7 +333,7 @@ lua_upstream_list_create (lua_State *L)
 
 		if (rspamd_upstreams_parse_line (new, def, default_port, NULL)) {
 			pnew = lua_newuserdata (L, sizeof (struct upstream_list *));
-			rspamd_lua_setclass (L, "rspamd{upstream_list}", -1);
+			rspamd_lua_setclass (L, rspamd_upstream_list_classname, -1);
 			*pnew = new;
 		}
 		else {
@@ -309,7 +344,7 @@ lua_upstream_list_create (lua_State *L)
 	else if (lua_type (L, top) == LUA_TTABLE) {
 		new = rspamd_upstreams_create (cfg ? cfg->ups_ctx : NULL);
 		pnew = lua_newuserdata (L, sizeof (struct upstream_list *));
-		rspamd_lua_setclass (L, "rspamd{upstream_list}", -1);
+		rspamd_lua_setclass (L, rspamd_upstream_list_classname, -1);
 		*pnew = new;
 
 		lua_pushvalue (L, top);
@@ -449,6 +484,39 @@ lua_upstream_list_get_upstream_master_slave (lua_State *L)
 	return 1;
 }
 
+/***
+ * @method upstream_list:get_upstream_latency()
+ * Get upstream with the lowest expected latency out of two random choices.
+ * Response times should be reported by calling `upstream:ok(latency)`
+ * @return {upstream} upstream from a list selected by latency
+ */
+static gint
+lua_upstream_list_get_upstream_latency (lua_State *L)
+{
+	LUA_TRACE_POINT;
+	struct upstream_list *upl;
+	struct upstream *selected;
+
+	upl = lua_check_upstream_list (L);
+	if (upl) {
+
+		selected = rspamd_upstream_get (upl, RSPAMD_UPSTREAM_LATENCY,
+				NULL,
+				0);
+		if (selected) {
+			lua_push_upstream (L, 1, selected);
+		}
+		else {
+			lua_pushnil (L);
+		}
+	}
+	else {
+		return luaL_error (L, "invalid arguments");
+	}
+
+	return 1;
+}
+
 struct upstream_foreach_cbdata {
 	lua_State *L;
 	gint ups_pos;
@@ -566,7 +634,7 @@ lua_upstream_watch_func (struct upstream *up,
 
 	struct rspamd_lua_upstream *lua_ups = lua_newuserdata (L, sizeof (*lua_ups));
 	lua_ups->up = up;
-	rspamd_lua_setclass (L, "rspamd{upstream}", -1);
+	rspamd_lua_setclass (L, rspamd_upstream_classname, -1);
 	/* Store parent in the upstream to prevent gc */
 	lua_rawgeti (L, LUA_REGISTRYINDEX, cdata->parent_cbref);
 	lua_ups->upref = luaL_ref (L, LUA_REGISTRYINDEX);
@@ -667,10 +735,10 @@ lua_load_upstream_list (lua_State * L)
 void
 luaopen_upstream (lua_State * L)
 {
-	rspamd_lua_new_class (L, "rspamd{upstream_list}", upstream_list_m);
+	rspamd_lua_new_class (L, rspamd_upstream_list_classname, upstream_list_m);
 	lua_pop (L, 1);
 	rspamd_lua_add_preload (L, "rspamd_upstream_list", lua_load_upstream_list);
 
-	rspamd_lua_new_class (L, "rspamd{upstream}", upstream_m);
+	rspamd_lua_new_class (L, rspamd_upstream_classname, upstream_m);
 	lua_pop (L, 1);
 }
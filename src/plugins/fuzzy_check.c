@@ -88,6 +88,8 @@ struct fuzzy_rule {
 	gboolean skip_unknown;
 	gboolean no_share;
 	gboolean no_subject;
+	gboolean no_batch;
+	GHashTable *legacy_servers;
 	gint learn_condition_cb;
 	guint32 retransmits;
 	struct rspamd_hash_map_helper *skip_map;
@@ -137,9 +139,13 @@ struct fuzzy_client_session {
 	struct fuzzy_rule *rule;
 	struct ev_loop *event_loop;
 	struct rspamd_io_ev ev;
+	struct iovec *batches;
+	guint nbatches;
+	gdouble start_ts;
 	gint state;
 	gint fd;
 	guint retransmits;
+	gboolean replied;
 };
 
 struct fuzzy_learn_session {
@@ -164,6 +170,10 @@ struct fuzzy_learn_session {
 #define FUZZY_CMD_FLAG_SENT (1 << 1)
 #define FUZZY_CMD_FLAG_IMAGE (1 << 2)
 #define FUZZY_CMD_FLAG_CONTENT (1 << 3)
+#define FUZZY_CMD_FLAG_ENCRYPTED (1 << 4)
+
+/* How long to avoid batched requests to a server that has not replied to them */
+#define FUZZY_BATCH_LEGACY_TIMEOUT 3600.0
 
 #define FUZZY_CHECK_FLAG_NOIMAGES (1 << 0)
 #define FUZZY_CHECK_FLAG_NOATTACHMENTS (1 << 1)
@@ -319,6 +329,11 @@ fuzzy_rule_new (const char *default_symbol, rspamd_mempool_t *pool)
 	rspamd_mempool_add_destructor (pool,
 		(rspamd_mempool_destruct_t)g_hash_table_unref,
 		rule->mappings);
+	rule->legacy_servers = g_hash_table_new_full (rspamd_str_hash,
+			rspamd_str_equal, g_free, NULL);
+	rspamd_mempool_add_destructor (pool,
+		(rspamd_mempool_destruct_t)g_hash_table_unref,
+		rule->legacy_servers);
 	rule->read_only = FALSE;
 	rule->weight_threshold = NAN;
 
@@ -464,6 +479,10 @@ fuzzy_parse_rule (struct rspamd_config *cfg, const ucl_object_t *obj,
 		rule->no_subject = ucl_obj_toboolean (value);
 	}
 
+	if ((value = ucl_object_lookup (obj, "no_batch")) != NULL) {
+		rule->no_batch = ucl_obj_toboolean (value);
+	}
+
 	if ((value = ucl_object_lookup (obj, "algorithm")) != NULL) {
 		rule->algorithm_str = ucl_object_tostring (value);
 
@@ -987,6 +1006,15 @@ fuzzy_check_module_init (struct rspamd_config *cfg, struct module_ctx **ctx)
 			0,
 			"false",
 			0);
+	rspamd_rcl_add_doc_by_path (cfg,
+			"fuzzy_check.rule",
+			"Send each command in a separate datagram instead of a single batched request",
+			"no_batch",
+			UCL_BOOLEAN,
+			NULL,
+			0,
+			"false",
+			0);
 
 	return 0;
 }
@@ -1351,7 +1379,6 @@ fuzzy_cmd_stat (struct fuzzy_rule *rule,
 	memcpy (&io->cmd, cmd, sizeof (io->cmd));
 
 	if (rule->peer_key && enccmd) {
-		fuzzy_encrypt_cmd (rule, &enccmd->hdr, (guchar *)cmd, sizeof (*cmd));
 		io->io.iov_base = enccmd;
 		io->io.iov_len = sizeof (*enccmd);
 	}
@@ -1408,7 +1435,6 @@ fuzzy_cmd_hash (struct fuzzy_rule *rule,
 	memcpy (&io->cmd, cmd, sizeof (io->cmd));
 
 	if (rule->peer_key && enccmd) {
-		fuzzy_encrypt_cmd (rule, &enccmd->hdr, (guchar *)cmd, sizeof (*cmd));
 		io->io.iov_base = enccmd;
 		io->io.iov_len = sizeof (*enccmd);
 	}
@@ -1505,11 +1531,11 @@ fuzzy_rule_check_mimepart (struct rspamd_task *task,
 
 		ptask = lua_newuserdata (L, sizeof (*ptask));
 		*ptask = task;
-		rspamd_lua_setclass (L, "rspamd{task}", -1);
+		rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 		ppart = lua_newuserdata (L, sizeof (*ppart));
 		*ppart = part;
-		rspamd_lua_setclass (L, "rspamd{mimepart}", -1);
+		rspamd_lua_setclass (L, rspamd_mimepart_classname, -1);
 
 		lua_pushnumber (L, rule->lua_id);
 
@@ -1843,16 +1869,12 @@ fuzzy_cmd_from_text_part (struct rspamd_task *task,
 
 
 	if (rule->peer_key) {
-		/* Encrypt data */
+		/* Data is encrypted when sent */
 		if (!short_text) {
-			fuzzy_encrypt_cmd (rule, &encshcmd->hdr, (guchar *) shcmd,
-					sizeof (*shcmd) + additional_length);
 			io->io.iov_base = encshcmd;
 			io->io.iov_len = sizeof (*encshcmd) + additional_length;
 		}
 		else {
-			fuzzy_encrypt_cmd (rule, &enccmd->hdr, (guchar *)cmd,
-					sizeof (*cmd) + additional_length);
 			io->io.iov_base = enccmd;
 			io->io.iov_len = sizeof (*enccmd) + additional_length;
 		}
@@ -2023,8 +2045,6 @@ fuzzy_cmd_from_data_part (struct fuzzy_rule *rule,
 
 	if (rule->peer_key) {
 		g_assert (enccmd != NULL);
-		fuzzy_encrypt_cmd (rule, &enccmd->hdr, (guchar *)cmd,
-				sizeof (*cmd) + additional_length);
 		io->io.iov_base = enccmd;
 		io->io.iov_len = sizeof (*enccmd) + additional_length;
 	}
@@ -2055,8 +2075,22 @@ fuzzy_cmd_to_wire (gint fd, struct iovec *io)
 	return TRUE;
 }
 
+/* Encrypts command in place before it is sent for the first time */
+static void
+fuzzy_cmd_io_encrypt (struct fuzzy_rule *rule, struct fuzzy_cmd_io *io)
+{
+	struct rspamd_fuzzy_encrypted_req_hdr *hdr;
+
+	if (rule->peer_key && !(io->flags & FUZZY_CMD_FLAG_ENCRYPTED)) {
+		hdr = (struct rspamd_fuzzy_encrypted_req_hdr *)io->io.iov_base;
+		fuzzy_encrypt_cmd (rule, hdr, ((guchar *)hdr) + sizeof (*hdr),
+				io->io.iov_len - sizeof (*hdr));
+		io->flags |= FUZZY_CMD_FLAG_ENCRYPTED;
+	}
+}
+
 static gboolean
-fuzzy_cmd_vector_to_wire (gint fd, GPtrArray *v)
+fuzzy_cmd_vector_to_wire (gint fd, struct fuzzy_rule *rule, GPtrArray *v)
 {
 	guint i;
 	gboolean all_sent = TRUE, all_replied = TRUE;
@@ -2074,6 +2108,8 @@ fuzzy_cmd_vector_to_wire (gint fd, GPtrArray *v)
 		all_replied = FALSE;
 
 		if (!(io->flags & FUZZY_CMD_FLAG_SENT)) {
+			fuzzy_cmd_io_encrypt (rule, io);
+
 			if (!fuzzy_cmd_to_wire (fd, &io->io)) {
 				return FALSE;
 			}
@@ -2093,12 +2129,146 @@ fuzzy_cmd_vector_to_wire (gint fd, GPtrArray *v)
 			}
 		}
 
-		return fuzzy_cmd_vector_to_wire (fd, v);
+		return fuzzy_cmd_vector_to_wire (fd, rule, v);
 	}
 
 	return processed;
 }
 
+/*
+ * Packs unencrypted commands into batched requests (normally a single one),
+ * each batch is then encrypted at once. Returns NULL if commands cannot
+ * be batched.
+ */
+static struct iovec *
+fuzzy_cmd_vector_to_batches (struct fuzzy_rule *rule, GPtrArray *v,
+		rspamd_mempool_t *pool, guint *pnbatches)
+{
+	struct iovec *batches;
+	struct fuzzy_cmd_io *io;
+	struct rspamd_fuzzy_batch_hdr *bhdr = NULL;
+	guchar *cur = NULL, *payload;
+	gsize hdr_len = 0, len = 0, plen;
+	guint i, nbatches = 0;
+	guint16 cmdlen;
+
+	if (rule->peer_key) {
+		hdr_len = sizeof (struct rspamd_fuzzy_encrypted_req_hdr);
+	}
+
+	/* At most one batch per command */
+	batches = rspamd_mempool_alloc0 (pool, sizeof (*batches) * v->len);
+
+	PTR_ARRAY_FOREACH (v, i, io) {
+		g_assert (!(io->flags & FUZZY_CMD_FLAG_ENCRYPTED));
+		payload = ((guchar *)io->io.iov_base) + hdr_len;
+		plen = io->io.iov_len - hdr_len;
+
+		if (hdr_len + sizeof (*bhdr) + sizeof (cmdlen) + plen >
+				RSPAMD_FUZZY_BATCH_MAX_LEN) {
+			return NULL;
+		}
+
+		if (cur == NULL || bhdr->ncmds >= RSPAMD_FUZZY_BATCH_MAX_CMDS ||
+				len + sizeof (cmdlen) + plen > RSPAMD_FUZZY_BATCH_MAX_LEN) {
+			cur = rspamd_mempool_alloc0 (pool, RSPAMD_FUZZY_BATCH_MAX_LEN);
+			bhdr = (struct rspamd_fuzzy_batch_hdr *)(cur + hdr_len);
+			bhdr->version = RSPAMD_FUZZY_BATCH_VERSION;
+			len = hdr_len + sizeof (*bhdr);
+			batches[nbatches ++].iov_base = cur;
+		}
+
+		cmdlen = plen;
+		memcpy (cur + len, &cmdlen, sizeof (cmdlen));
+		len += sizeof (cmdlen);
+		memcpy (cur + len, payload, plen);
+		len += plen;
+		bhdr->ncmds ++;
+		batches[nbatches - 1].iov_len = len;
+	}
+
+	if (rule->peer_key) {
+		for (i = 0; i < nbatches; i ++) {
+			cur = batches[i].iov_base;
+			fuzzy_encrypt_cmd (rule,
+					(struct rspamd_fuzzy_encrypted_req_hdr *)cur,
+					cur + hdr_len, batches[i].iov_len - hdr_len);
+		}
+	}
+
+	*pnbatches = nbatches;
+
+	return batches;
+}
+
+static gboolean
+fuzzy_rule_can_batch (struct fuzzy_rule *rule, struct upstream *up,
+		gdouble now)
+{
+	gpointer expire;
+
+	if (rule->no_batch) {
+		return FALSE;
+	}
+
+	expire = g_hash_table_lookup (rule->legacy_servers,
+			rspamd_upstream_name (up));
+
+	if (expire != NULL && now < (gdouble)GPOINTER_TO_SIZE (expire)) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+fuzzy_rule_set_legacy (struct fuzzy_rule *rule, struct upstream *up,
+		gdouble now)
+{
+	msg_info ("server %s has not replied to a batched request, "
+			"use separate commands for it",
+			rspamd_upstream_name (up));
+	g_hash_table_replace (rule->legacy_servers,
+			g_strdup (rspamd_upstream_name (up)),
+			GSIZE_TO_POINTER ((gsize)(now + FUZZY_BATCH_LEGACY_TIMEOUT)));
+}
+
+static gboolean
+fuzzy_check_session_send (struct fuzzy_client_session *session)
+{
+	guint i;
+
+	if (session->batches) {
+		if (session->state == 0) {
+			for (i = 0; i < session->nbatches; i ++) {
+				if (!fuzzy_cmd_to_wire (session->fd, &session->batches[i])) {
+					return FALSE;
+				}
+			}
+
+			return TRUE;
+		}
+
+		/*
+		 * Retransmit: the server might be too old to understand batched
+		 * requests, so we send commands separately
+		 */
+		if (!session->replied) {
+			fuzzy_rule_set_legacy (session->rule, session->server,
+					ev_now (session->event_loop));
+		}
+
+		session->batches = NULL;
+	}
+
+	return fuzzy_cmd_vector_to_wire (session->fd, session->rule,
+			session->commands);
+}
+
+static gboolean fuzzy_reply_match_cmd (GPtrArray *req,
+		const struct rspamd_fuzzy_reply *rep,
+		struct rspamd_fuzzy_cmd **pcmd, struct fuzzy_cmd_io **pio);
+
 /*
  * Read replies one-by-one and remove them from req array
  */
@@ -2109,11 +2279,9 @@ fuzzy_process_reply (guchar **pos, gint *r, GPtrArray *req,
 {
 	guchar *p = *pos;
 	gint remain = *r;
-	guint i, required_size;
-	struct fuzzy_cmd_io *io;
+	guint required_size;
 	const struct rspamd_fuzzy_reply *rep;
 	struct rspamd_fuzzy_encrypted_reply encrep;
-	gboolean found = FALSE;
 
 	if (rule->peer_key) {
 		required_size = sizeof (encrep);
@@ -2155,6 +2323,72 @@ fuzzy_process_reply (guchar **pos, gint *r, GPtrArray *req,
 	}
 
 	rep = (const struct rspamd_fuzzy_reply *) p;
+
+	if (fuzzy_reply_match_cmd (req, rep, pcmd, pio)) {
+		return rep;
+	}
+
+	return NULL;
+}
+
+/*
+ * Decrypts and checks a batched reply, returns the first of replies
+ */
+static const struct rspamd_fuzzy_reply *
+fuzzy_process_batch_reply (guchar *p, gint r, struct fuzzy_rule *rule,
+		guint *pnreplies)
+{
+	struct rspamd_fuzzy_encrypted_rep_hdr ehdr;
+	struct rspamd_fuzzy_batch_reply_hdr bhdr;
+	gsize hdr_len = 0;
+
+	if (rule->peer_key) {
+		hdr_len = sizeof (ehdr);
+	}
+
+	if (r < 0 || (gsize)r < hdr_len + sizeof (bhdr) ||
+			(r - hdr_len - sizeof (bhdr)) % sizeof (struct rspamd_fuzzy_reply) != 0) {
+		return NULL;
+	}
+
+	if (rule->peer_key) {
+		memcpy (&ehdr, p, sizeof (ehdr));
+		rspamd_keypair_cache_process (rule->ctx->keypairs_cache,
+				rule->local_key, rule->peer_key);
+
+		if (!rspamd_cryptobox_decrypt_nm_inplace (p + hdr_len,
+				r - hdr_len,
+				ehdr.nonce,
+				rspamd_pubkey_get_nm (rule->peer_key, rule->local_key),
+				ehdr.mac,
+				rspamd_pubkey_alg (rule->peer_key))) {
+			msg_info ("cannot decrypt batched reply");
+			return NULL;
+		}
+	}
+
+	memcpy (&bhdr, p + hdr_len, sizeof (bhdr));
+
+	if (bhdr.version != RSPAMD_FUZZY_BATCH_VERSION ||
+			bhdr.nreplies * sizeof (struct rspamd_fuzzy_reply) !=
+			r - hdr_len - sizeof (bhdr)) {
+		msg_info ("invalid batched reply");
+		return NULL;
+	}
+
+	*pnreplies = bhdr.nreplies;
+
+	return (const struct rspamd_fuzzy_reply *)(p + hdr_len + sizeof (bhdr));
+}
+
+static gboolean
+fuzzy_reply_match_cmd (GPtrArray *req, const struct rspamd_fuzzy_reply *rep,
+		struct rspamd_fuzzy_cmd **pcmd, struct fuzzy_cmd_io **pio)
+{
+	struct fuzzy_cmd_io *io;
+	gboolean found = FALSE;
+	guint i;
+
 	/*
 	 * Search for tag
 	 */
@@ -2173,7 +2407,7 @@ fuzzy_process_reply (guchar **pos, gint *r, GPtrArray *req,
 					*pio = io;
 				}
 
-				return rep;
+				return TRUE;
 			}
 			found = TRUE;
 		}
@@ -2183,7 +2417,7 @@ fuzzy_process_reply (guchar **pos, gint *r, GPtrArray *req,
 		msg_info ("unexpected tag: %ud", rep->v1.tag);
 	}
 
-	return NULL;
+	return FALSE;
 }
 
 static void
@@ -2353,17 +2587,67 @@ fuzzy_insert_result (struct fuzzy_client_session *session,
 	}
 }
 
+static void
+fuzzy_check_process_rep (struct fuzzy_client_session *session,
+		const struct rspamd_fuzzy_reply *rep,
+		struct rspamd_fuzzy_cmd *cmd,
+		struct fuzzy_cmd_io *io)
+{
+	struct rspamd_task *task = session->task;
+
+	if (rep->v1.prob > 0.5) {
+		if (cmd->cmd == FUZZY_CHECK) {
+			fuzzy_insert_result (session, rep, cmd, io, rep->v1.flag);
+		}
+		else if (cmd->cmd == FUZZY_STAT) {
+			/* Just set pool variable to extract it in further */
+			struct rspamd_fuzzy_stat_entry *pval;
+			GList *res;
+
+			pval = rspamd_mempool_alloc (task->task_pool, sizeof (*pval));
+			pval->fuzzy_cnt = rep->v1.flag;
+			pval->name = session->rule->name;
+
+			res = rspamd_mempool_get_variable (task->task_pool, "fuzzy_stat");
+
+			if (res == NULL) {
+				res = g_list_append (NULL, pval);
+				rspamd_mempool_set_variable (task->task_pool, "fuzzy_stat",
+						res, (rspamd_mempool_destruct_t)g_list_free);
+			}
+			else {
+				res = g_list_append (res, pval);
+			}
+		}
+	}
+	else if (rep->v1.value == 403) {
+		rspamd_task_insert_result (task, "FUZZY_BLOCKED", 0.0,
+				session->rule->name);
+	}
+	else if (rep->v1.value == 401) {
+		if (cmd->cmd != FUZZY_CHECK) {
+			msg_info_task (
+					"fuzzy check error for %d: skipped by server",
+					rep->v1.flag);
+		}
+	}
+	else if (rep->v1.value != 0) {
+		msg_info_task (
+				"fuzzy check error for %d: unknown error (%d)",
+				rep->v1.flag,
+				rep->v1.value);
+	}
+}
+
 static gint
 fuzzy_check_try_read (struct fuzzy_client_session *session)
 {
-	struct rspamd_task *task;
 	const struct rspamd_fuzzy_reply *rep;
 	struct rspamd_fuzzy_cmd *cmd = NULL;
 	struct fuzzy_cmd_io *io = NULL;
 	gint r, ret;
-	guchar buf[2048], *p;
-
-	task = session->task;
+	guint i, nreplies;
+	guchar buf[RSPAMD_FUZZY_BATCH_MAX_LEN], *p;
 
 	if ((r = read (session->fd, buf, sizeof (buf) - 1)) == -1) {
 		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
@@ -2378,51 +2662,22 @@ fuzzy_check_try_read (struct fuzzy_client_session *session)
 
 		ret = 0;
 
-		while ((rep = fuzzy_process_reply (&p, &r,
-				session->commands, session->rule, &cmd, &io)) != NULL) {
-			if (rep->v1.prob > 0.5) {
-				if (cmd->cmd == FUZZY_CHECK) {
-					fuzzy_insert_result (session, rep, cmd, io, rep->v1.flag);
-				}
-				else if (cmd->cmd == FUZZY_STAT) {
-					/* Just set pool variable to extract it in further */
-					struct rspamd_fuzzy_stat_entry *pval;
-					GList *res;
-
-					pval = rspamd_mempool_alloc (task->task_pool, sizeof (*pval));
-					pval->fuzzy_cnt = rep->v1.flag;
-					pval->name = session->rule->name;
-
-					res = rspamd_mempool_get_variable (task->task_pool, "fuzzy_stat");
-
-					if (res == NULL) {
-						res = g_list_append (NULL, pval);
-						rspamd_mempool_set_variable (task->task_pool, "fuzzy_stat",
-								res, (rspamd_mempool_destruct_t)g_list_free);
-					}
-					else {
-						res = g_list_append (res, pval);
-					}
-				}
-			}
-			else if (rep->v1.value == 403) {
-				rspamd_task_insert_result (task, "FUZZY_BLOCKED", 0.0,
-						session->rule->name);
-			}
-			else if (rep->v1.value == 401) {
-				if (cmd->cmd != FUZZY_CHECK) {
-					msg_info_task (
-							"fuzzy check error for %d: skipped by server",
-							rep->v1.flag);
+		if ((rep = fuzzy_process_batch_reply (p, r, session->rule,
+				&nreplies)) != NULL) {
+			for (i = 0; i < nreplies; i ++) {
+				if (fuzzy_reply_match_cmd (session->commands, &rep[i],
+						&cmd, &io)) {
+					fuzzy_check_process_rep (session, &rep[i], cmd, io);
+					ret = 1;
 				}
 			}
-			else if (rep->v1.value != 0) {
-				msg_info_task (
-						"fuzzy check error for %d: unknown error (%d)",
-						rep->v1.flag,
-						rep->v1.value);
-			}
 
+			return ret;
+		}
+
+		while ((rep = fuzzy_process_reply (&p, &r,
+				session->commands, session->rule, &cmd, &io)) != NULL) {
+			fuzzy_check_process_rep (session, rep, cmd, io);
 			ret = 1;
 		}
 	}
@@ -2534,7 +2789,12 @@ fuzzy_check_session_is_completed (struct fuzzy_client_session *session)
 	struct fuzzy_cmd_io *io;
 	guint nreplied = 0, i;
 
-	rspamd_upstream_ok (session->server);
+	if (!session->replied) {
+		/* Feed the first reply time to the latency based rotation */
+		rspamd_upstream_ok_latency (session->server,
+				ev_now (session->event_loop) - session->start_ts);
+		session->replied = TRUE;
+	}
 
 	for (i = 0; i < session->commands->len; i++) {
 		io = g_ptr_array_index (session->commands, i);
@@ -2584,6 +2844,11 @@ fuzzy_check_timer_callback (gint fd, short what, void *arg)
 				session->rule->retransmits);
 		rspamd_upstream_fail (session->server, TRUE, "timeout");
 
+		if (session->batches && !session->replied) {
+			fuzzy_rule_set_legacy (session->rule, session->server,
+					ev_now (session->event_loop));
+		}
+
 		if (session->item) {
 			rspamd_symcache_item_async_dec_check (session->task, session->item, M);
 		}
@@ -2625,7 +2890,7 @@ fuzzy_check_io_callback (gint fd, short what, void *arg)
 			else {
 				if (what & EV_WRITE) {
 					/* Retransmit attempt */
-					if (!fuzzy_cmd_vector_to_wire (fd, session->commands)) {
+					if (!fuzzy_check_session_send (session)) {
 						ret = return_error;
 					}
 					else {
@@ -2649,7 +2914,7 @@ fuzzy_check_io_callback (gint fd, short what, void *arg)
 		}
 	}
 	else if (what & EV_WRITE) {
-		if (!fuzzy_cmd_vector_to_wire (fd, session->commands)) {
+		if (!fuzzy_check_session_send (session)) {
 			ret = return_error;
 		}
 		else {
@@ -2904,7 +3169,7 @@ fuzzy_controller_io_callback (gint fd, short what, void *arg)
 	}
 	else if (what & EV_WRITE) {
 			/* Send commands to storage */
-			if (!fuzzy_cmd_vector_to_wire (fd, session->commands)) {
+			if (!fuzzy_cmd_vector_to_wire (fd, session->rule, session->commands)) {
 				session->err.error_message = "write socket error";
 				session->err.error_code = errno;
 				ret = return_error;
@@ -3208,6 +3473,13 @@ register_fuzzy_client_call (struct rspamd_task *task,
 				session->rule = rule;
 				session->results = g_ptr_array_sized_new (32);
 				session->event_loop = task->event_loop;
+				session->start_ts = ev_now (session->event_loop);
+
+				if (commands->len > 1 && fuzzy_rule_can_batch (rule, selected,
+						session->start_ts)) {
+					session->batches = fuzzy_cmd_vector_to_batches (rule,
+							commands, task->task_pool, &session->nbatches);
+				}
 
 				rspamd_ev_watcher_init (&session->ev,
 						sock,
@@ -3418,7 +3690,7 @@ fuzzy_process_handler (struct rspamd_http_connection_entry *conn_ent,
 			lua_rawgeti (L, LUA_REGISTRYINDEX, rule->learn_condition_cb);
 			ptask = lua_newuserdata (L, sizeof (struct rspamd_task *));
 			*ptask = task;
-			rspamd_lua_setclass (L, "rspamd{task}", -1);
+			rspamd_lua_setclass (L, rspamd_task_classname, -1);
 
 			if (lua_pcall (L, 1, LUA_MULTRET, err_idx) != 0) {
 				msg_err_task ("call to fuzzy learn condition failed: %s",
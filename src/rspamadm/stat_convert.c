@@ -16,8 +16,12 @@
 #include "config.h"
 #include "rspamadm.h"
 #include "lua/lua_common.h"
+#include "libstat/backends/backends.h"
+#include "libstat/backends/mmaped_table.h"
 
 #include "contrib/uthash/utlist.h"
+#include "contrib/hiredis/hiredis.h"
+#include <sqlite3.h>
 
 /* Common */
 static gchar *config_file = NULL;
@@ -36,6 +40,9 @@ static gchar *redis_host = NULL;
 static gchar *redis_db = NULL;
 static gchar *redis_password = NULL;
 static gboolean reset_previous = FALSE;
+static gchar *redis_prefix = NULL;
+static gchar *output_spam = NULL;
+static gchar *output_ham = NULL;
 
 static void rspamadm_statconvert (gint argc, gchar **argv,
 								  const struct rspamadm_command *cmd);
@@ -74,6 +81,12 @@ static GOptionEntry entries[] = {
 				"Password to connect to redis", NULL},
 		{"redis-db", 'd', 0, G_OPTION_ARG_STRING, &redis_db,
 				"Redis database (should be numeric)", NULL},
+		{"redis-prefix", 0, 0, G_OPTION_ARG_STRING, &redis_prefix,
+				"Prefix of tokens in redis when it is used as input (default: RS)", NULL},
+		{"output-spam", 0, 0, G_OPTION_ARG_FILENAME, &output_spam,
+				"Output spam statfile for mmap_table backend", NULL},
+		{"output-ham", 0, 0, G_OPTION_ARG_FILENAME, &output_ham,
+				"Output ham statfile for mmap_table backend", NULL},
 		{NULL,     0,   0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
 };
 
@@ -99,15 +112,383 @@ rspamadm_statconvert_help (gboolean full_help, const struct rspamadm_command *cm
 				"--ham-db: sqlite3 input file for ham data\n"
 				"--symbol-spam: symbol in redis for spam (e.g. BAYES_SPAM)\n"
 				"--symbol-ham: symbol in redis for ham (e.g. BAYES_HAM)\n"
+				"** Or convert to mmap_table statfiles **\n"
+				"--output-spam: output spam statfile\n"
+				"--output-ham: output ham statfile\n"
+				"--spam-db, --ham-db: input sqlite3 or mmap statfiles\n"
+				"--redis-host: input redis server if no input files specified\n"
+				"--redis-prefix: prefix of tokens in redis (default: RS)\n"
 				;
 	}
 	else {
-		help_str = "Convert statistics from sqlite3 to redis";
+		help_str = "Convert statistics from sqlite3 to redis or mmap_table";
 	}
 
 	return help_str;
 }
 
+struct rspamadm_statconvert_out {
+	const gchar *path;
+	rspamd_mmaped_table_t *tbl;
+	guint64 ntokens;
+	guint64 learns;
+	gboolean error;
+};
+
+static void
+rspamadm_statconvert_add_token (guint64 token, gdouble value, gpointer ud)
+{
+	struct rspamadm_statconvert_out *out = ud;
+
+	if (out->error || value < 1.0) {
+		return;
+	}
+
+	if (!rspamd_mmaped_table_incr (out->tbl, token, (gint64)value)) {
+		out->error = TRUE;
+	}
+	else {
+		out->ntokens ++;
+	}
+}
+
+static gboolean
+rspamadm_statconvert_read_sqlite (const gchar *path,
+		struct rspamadm_statconvert_out *out)
+{
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_open_v2 (path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+		msg_err ("cannot open %s: %s", path, sqlite3_errmsg (db));
+		sqlite3_close (db);
+
+		return FALSE;
+	}
+
+	if (sqlite3_prepare_v2 (db, "SELECT SUM(MAX(0, learns)) FROM languages",
+			-1, &stmt, NULL) == SQLITE_OK) {
+		if (sqlite3_step (stmt) == SQLITE_ROW) {
+			out->learns += sqlite3_column_int64 (stmt, 0);
+		}
+
+		sqlite3_finalize (stmt);
+	}
+
+	/* Per user statistics cannot be represented, so take the default user */
+	if (sqlite3_prepare_v2 (db, "SELECT token,value FROM tokens WHERE user=0",
+			-1, &stmt, NULL) != SQLITE_OK) {
+		msg_err ("cannot read tokens from %s: %s", path, sqlite3_errmsg (db));
+		sqlite3_close (db);
+
+		return FALSE;
+	}
+
+	while (sqlite3_step (stmt) == SQLITE_ROW) {
+		rspamadm_statconvert_add_token (sqlite3_column_int64 (stmt, 0),
+				sqlite3_column_double (stmt, 1), out);
+	}
+
+	sqlite3_finalize (stmt);
+	sqlite3_close (db);
+
+	return !out->error;
+}
+
+/* Input file is either sqlite3 database or a legacy mmap statfile */
+static gboolean
+rspamadm_statconvert_read_file (const gchar *path,
+		struct rspamadm_statconvert_out *out)
+{
+	gchar magic[3];
+	guint64 learns = 0;
+	gint fd;
+
+	if ((fd = open (path, O_RDONLY)) == -1) {
+		msg_err ("cannot open %s: %s", path, strerror (errno));
+		return FALSE;
+	}
+
+	if (read (fd, magic, sizeof (magic)) == sizeof (magic) &&
+			memcmp (magic, "rsd", sizeof (magic)) == 0) {
+		close (fd);
+
+		if (!rspamd_mmaped_file_foreach_token (path,
+				rspamadm_statconvert_add_token, out, &learns)) {
+			return FALSE;
+		}
+
+		out->learns += learns;
+
+		return !out->error;
+	}
+
+	close (fd);
+
+	return rspamadm_statconvert_read_sqlite (path, out);
+}
+
+static redisReply *
+rspamadm_statconvert_redis_cmd (redisContext *ctx, const gchar *fmt, ...)
+{
+	redisReply *reply;
+	va_list ap;
+
+	va_start (ap, fmt);
+	reply = redisvCommand (ctx, fmt, ap);
+	va_end (ap);
+
+	if (reply == NULL) {
+		msg_err ("redis error: %s", ctx->errstr);
+	}
+	else if (reply->type == REDIS_REPLY_ERROR) {
+		msg_err ("redis error: %s", reply->str);
+		freeReplyObject (reply);
+		reply = NULL;
+	}
+
+	return reply;
+}
+
+static gboolean
+rspamadm_statconvert_parse_token (const gchar *str, gsize len, guint64 *token)
+{
+	gchar *end = NULL;
+
+	if (len == 0) {
+		return FALSE;
+	}
+
+	/* Tokens converted from sqlite are signed */
+	if (str[0] == '-') {
+		*token = (guint64)g_ascii_strtoll (str, &end, 10);
+	}
+	else {
+		*token = g_ascii_strtoull (str, &end, 10);
+	}
+
+	return end == str + len;
+}
+
+/*
+ * Reads tokens of the default user from redis (`<prefix>_<token>` hashes
+ * with `S` and `H` counters)
+ */
+static gboolean
+rspamadm_statconvert_read_redis (struct rspamadm_statconvert_out *spam,
+		struct rspamadm_statconvert_out *ham)
+{
+	redisContext *ctx;
+	redisReply *reply, *keys, *hreply, *key;
+	const gchar *prefix = redis_prefix ? redis_prefix : "RS";
+	gchar *host, *p, *cursor;
+	gsize prefix_len = strlen (prefix);
+	guint64 token;
+	gint port = 6379;
+	gboolean ret = FALSE;
+	guint i;
+
+	host = g_strdup (redis_host);
+	p = strrchr (host, ':');
+
+	if (p != NULL) {
+		*p = '\0';
+		port = atoi (p + 1);
+	}
+
+	ctx = redisConnect (host, port);
+	g_free (host);
+
+	if (ctx == NULL || ctx->err) {
+		msg_err ("cannot connect to redis %s: %s", redis_host,
+				ctx ? ctx->errstr : "out of memory");
+
+		if (ctx) {
+			redisFree (ctx);
+		}
+
+		return FALSE;
+	}
+
+	if (redis_password) {
+		if ((reply = rspamadm_statconvert_redis_cmd (ctx, "AUTH %s",
+				redis_password)) == NULL) {
+			goto end;
+		}
+
+		freeReplyObject (reply);
+	}
+
+	if (redis_db) {
+		if ((reply = rspamadm_statconvert_redis_cmd (ctx, "SELECT %s",
+				redis_db)) == NULL) {
+			goto end;
+		}
+
+		freeReplyObject (reply);
+	}
+
+	if ((reply = rspamadm_statconvert_redis_cmd (ctx,
+			"HMGET %s learns_spam learns_ham", prefix)) == NULL) {
+		goto end;
+	}
+
+	if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 2) {
+		if (reply->element[0]->type == REDIS_REPLY_STRING) {
+			spam->learns += strtoull (reply->element[0]->str, NULL, 10);
+		}
+		if (reply->element[1]->type == REDIS_REPLY_STRING) {
+			ham->learns += strtoull (reply->element[1]->str, NULL, 10);
+		}
+	}
+
+	freeReplyObject (reply);
+	cursor = g_strdup ("0");
+
+	do {
+		reply = rspamadm_statconvert_redis_cmd (ctx,
+				"SCAN %s MATCH %s_* COUNT 1000", cursor, prefix);
+		g_free (cursor);
+		cursor = NULL;
+
+		if (reply == NULL || reply->type != REDIS_REPLY_ARRAY ||
+				reply->elements != 2) {
+			if (reply) {
+				freeReplyObject (reply);
+			}
+
+			goto end;
+		}
+
+		cursor = g_strdup (reply->element[0]->str);
+		keys = reply->element[1];
+
+		/* Pipeline requests for all keys of a batch */
+		for (i = 0; i < keys->elements; i ++) {
+			key = keys->element[i];
+			redisAppendCommand (ctx, "HMGET %b S H", key->str, (size_t)key->len);
+		}
+
+		for (i = 0; i < keys->elements; i ++) {
+			key = keys->element[i];
+
+			if (redisGetReply (ctx, (void **)&hreply) != REDIS_OK) {
+				msg_err ("redis error: %s", ctx->errstr);
+				freeReplyObject (reply);
+				g_free (cursor);
+
+				goto end;
+			}
+
+			if (rspamadm_statconvert_parse_token (key->str + prefix_len + 1,
+					key->len - prefix_len - 1, &token) &&
+					hreply->type == REDIS_REPLY_ARRAY && hreply->elements == 2) {
+				if (hreply->element[0]->type == REDIS_REPLY_STRING) {
+					rspamadm_statconvert_add_token (token,
+							g_ascii_strtod (hreply->element[0]->str, NULL), spam);
+				}
+				if (hreply->element[1]->type == REDIS_REPLY_STRING) {
+					rspamadm_statconvert_add_token (token,
+							g_ascii_strtod (hreply->element[1]->str, NULL), ham);
+				}
+			}
+
+			freeReplyObject (hreply);
+		}
+
+		freeReplyObject (reply);
+
+		if (spam->error || ham->error) {
+			g_free (cursor);
+			goto end;
+		}
+	} while (strcmp (cursor, "0") != 0);
+
+	g_free (cursor);
+	ret = TRUE;
+
+end:
+	redisFree (ctx);
+
+	return ret;
+}
+
+static gboolean
+rspamadm_statconvert_open_output (struct rspamadm_statconvert_out *out,
+		const gchar *path)
+{
+	GError *err = NULL;
+
+	out->path = path;
+
+	if (reset_previous) {
+		unlink (path);
+	}
+
+	out->tbl = rspamd_mmaped_table_open (path, 0, NULL, 0, &err);
+
+	if (out->tbl == NULL) {
+		msg_err ("cannot open output statfile: %e", err);
+		g_error_free (err);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+rspamadm_statconvert_mmap (void)
+{
+	struct rspamadm_statconvert_out spam, ham;
+	gboolean ret;
+
+	if (output_spam == NULL || output_ham == NULL) {
+		msg_err ("Both output-spam and output-ham should be specified");
+		exit (EXIT_FAILURE);
+	}
+
+	if ((spam_db == NULL || ham_db == NULL) && redis_host == NULL) {
+		msg_err ("No spam-db and ham-db or redis-host specified");
+		exit (EXIT_FAILURE);
+	}
+
+	memset (&spam, 0, sizeof (spam));
+	memset (&ham, 0, sizeof (ham));
+
+	if (!rspamadm_statconvert_open_output (&spam, output_spam)) {
+		exit (EXIT_FAILURE);
+	}
+
+	if (!rspamadm_statconvert_open_output (&ham, output_ham)) {
+		rspamd_mmaped_table_close_file (spam.tbl);
+		exit (EXIT_FAILURE);
+	}
+
+	if (spam_db != NULL && ham_db != NULL) {
+		ret = rspamadm_statconvert_read_file (spam_db, &spam) &&
+				rspamadm_statconvert_read_file (ham_db, &ham);
+	}
+	else {
+		ret = rspamadm_statconvert_read_redis (&spam, &ham);
+	}
+
+	rspamd_mmaped_table_incr_learns (spam.tbl, spam.learns);
+	rspamd_mmaped_table_incr_learns (ham.tbl, ham.learns);
+	rspamd_mmaped_table_close_file (spam.tbl);
+	rspamd_mmaped_table_close_file (ham.tbl);
+
+	if (!ret) {
+		msg_err ("conversion failed");
+		exit (EXIT_FAILURE);
+	}
+
+	rspamd_printf ("converted %uL spam tokens (%uL learns) to %s\n"
+			"converted %uL ham tokens (%uL learns) to %s\n",
+			spam.ntokens, spam.learns, output_spam,
+			ham.ntokens, ham.learns, output_ham);
+}
+
 static void
 rspamadm_statconvert (gint argc, gchar **argv, const struct rspamadm_command *cmd)
 {
@@ -134,6 +515,12 @@ rspamadm_statconvert (gint argc, gchar **argv, const struct rspamadm_command *cm
 
 	g_option_context_free (context);
 
+	if (output_spam || output_ham) {
+		rspamadm_statconvert_mmap ();
+
+		return;
+	}
+
 	if (config_file) {
 		/* Load config file, assuming that it has all information required */
 		struct ucl_parser *parser;
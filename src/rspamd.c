@@ -20,6 +20,7 @@
 #include "lua/lua_common.h"
 #include "libserver/worker_util.h"
 #include "libserver/rspamd_control.h"
+#include "libserver/latency_hist.h"
 #include "ottery.h"
 #include "cryptobox.h"
 #include "utlist.h"
@@ -1428,6 +1429,7 @@ main (gint argc, gchar **argv, gchar **env)
 	for (i = 0; i < MAX_AVG_TIME_SLOTS; i ++) {
 		rspamd_main->stat->avg_time.avg_time[i] = NAN;
 	}
+	rspamd_main->stat->latency = rspamd_latency_stat_new (rspamd_main->server_pool);
 
 	rspamd_main->cfg = rspamd_config_new (RSPAMD_CONFIG_INIT_DEFAULT);
 	rspamd_main->spairs = g_hash_table_new_full (rspamd_spair_hash,
@@ -1544,9 +1546,11 @@ main (gint argc, gchar **argv, gchar **env)
 	msg_info_main ("cpu features: %s",
 			rspamd_main->cfg->libs_ctx->crypto_ctx->cpu_extensions);
 	msg_info_main ("cryptobox configuration: curve25519(libsodium), "
-			"chacha20(%s), poly1305(libsodium), siphash(libsodium), blake2(libsodium), base64(%s)",
+			"chacha20(%s), poly1305(libsodium), siphash(libsodium), blake2(libsodium), base64(%s), "
+			"multihash(%s)",
 			rspamd_main->cfg->libs_ctx->crypto_ctx->chacha20_impl,
-			rspamd_main->cfg->libs_ctx->crypto_ctx->base64_impl);
+			rspamd_main->cfg->libs_ctx->crypto_ctx->base64_impl,
+			rspamd_main->cfg->libs_ctx->crypto_ctx->multihash_impl);
 	msg_info_main ("libottery prf: %s", ottery_get_impl_name ());
 
 	/* Daemonize */
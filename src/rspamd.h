@@ -278,6 +278,7 @@ struct rspamd_mime_part;
 struct rspamd_dns_resolver;
 struct rspamd_task;
 struct rspamd_cryptobox_library_ctx;
+struct rspamd_latency_stat;
 
 #define MAX_AVG_TIME_SLOTS 31
 struct RSPAMD_ALIGNED(64) rspamd_avg_time {
@@ -293,7 +294,11 @@ struct RSPAMD_ALIGNED(64) rspamd_stat {
 	guint connections_count;                            /**< total connections count						*/
 	guint control_connections_count;                    /**< connections count to control interface			*/
 	guint messages_learned;                             /**< messages learned								*/
+	guint dns_cache_hits;                               /**< dns replies served from the answers cache		*/
+	guint dns_cache_misses;                             /**< dns requests sent to the resolver				*/
+	guint dns_coalesced;                                /**< dns requests joined to identical pending ones	*/
 	struct rspamd_avg_time avg_time;                    /**< average time stats								*/
+	struct rspamd_latency_stat *latency;                /**< per worker stages latency histograms			*/
 };
 
 /**
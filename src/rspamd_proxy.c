@@ -52,6 +52,7 @@
 /* Rotate keys each minute by default */
 #define DEFAULT_ROTATION_TIME 60.0
 #define DEFAULT_RETRIES 5
+#define DEFAULT_SHMEM_THRESHOLD (1 * 1024 * 1024)
 
 #define msg_err_session(...) rspamd_default_log_function (G_LOG_LEVEL_CRITICAL, \
         session->pool->tag.tagname, session->pool->tag.uid, \
@@ -138,6 +139,8 @@ struct rspamd_proxy_ctx {
 	GArray *cmp_refs;
 	/* Maximum count for retries */
 	guint max_retries;
+	/* Client messages larger than this are read to shared memory */
+	gsize shmem_threshold;
 	/* If we have self_scanning backends, we need to work as a normal worker */
 	gboolean has_self_scan;
 	/* It is not HTTP but milter proxy */
@@ -771,6 +774,7 @@ init_rspamd_proxy (struct rspamd_config *cfg)
 	rspamd_mempool_add_destructor (cfg->cfg_pool,
 			(rspamd_mempool_destruct_t)rspamd_array_free_hard, ctx->cmp_refs);
 	ctx->max_retries = DEFAULT_RETRIES;
+	ctx->shmem_threshold = DEFAULT_SHMEM_THRESHOLD;
 	ctx->spam_header = RSPAMD_MILTER_SPAM_HEADER;
 
 	rspamd_rcl_register_worker_option (cfg,
@@ -822,6 +826,14 @@ init_rspamd_proxy (struct rspamd_config *cfg)
 			G_STRUCT_OFFSET (struct rspamd_proxy_ctx, max_retries),
 			RSPAMD_CL_FLAG_UINT,
 			"Maximum number of retries for master connection");
+	rspamd_rcl_register_worker_option (cfg,
+			type,
+			"shmem_threshold",
+			rspamd_rcl_parse_struct_integer,
+			ctx,
+			G_STRUCT_OFFSET (struct rspamd_proxy_ctx, shmem_threshold),
+			RSPAMD_CL_FLAG_INT_SIZE,
+			"Read client messages larger than this to shared memory (1Mb by default, 0 to disable)");
 	rspamd_rcl_register_worker_option (cfg,
 			type,
 			"milter",
@@ -1469,7 +1481,14 @@ proxy_open_mirror_connections (struct rspamd_proxy_session *session)
 				rspamd_http_message_add_header (msg, "File", session->fname);
 			}
 
-			msg->method = HTTP_GET;
+			/* Messages below shmem threshold are not shared, so post their body */
+			if (!(msg->flags & RSPAMD_HTTP_FLAG_SHMEM) && msg->body_buf.len > 0) {
+				msg->method = HTTP_POST;
+			}
+			else {
+				msg->method = HTTP_GET;
+			}
+
 			rspamd_http_connection_write_message_shared (bk_conn->backend_conn,
 					msg, rspamd_upstream_name(bk_conn->up), NULL, bk_conn,
 					bk_conn->timeout);
@@ -2031,7 +2050,12 @@ retry:
 				rspamd_http_message_add_header (msg, "File", session->fname);
 			}
 
-			msg->method = HTTP_GET;
+			if (!(msg->flags & RSPAMD_HTTP_FLAG_SHMEM) && msg->body_buf.len > 0) {
+				msg->method = HTTP_POST;
+			}
+			else {
+				msg->method = HTTP_GET;
+			}
 
 			rspamd_http_connection_write_message_shared (
 					session->master_conn->backend_conn,
@@ -2279,11 +2303,19 @@ proxy_accept_socket (EV_P_ ev_io *w, int revents)
 			rspamd_http_connection_set_key (session->client_conn, ctx->key);
 		}
 
+		/*
+		 * Large messages are read to shared memory, so local backends and
+		 * self scan could use them without copying, small ones are cheaper
+		 * to keep in memory (and they could be compressed for remote backends)
+		 */
+		rspamd_http_connection_set_shmem_threshold (session->client_conn,
+				ctx->shmem_threshold);
+
 		msg_info_session ("accepted http connection from %s port %d",
 				rspamd_inet_address_to_string (addr),
 				rspamd_inet_address_get_port (addr));
 
-		rspamd_http_connection_read_message_shared (session->client_conn,
+		rspamd_http_connection_read_message (session->client_conn,
 				session,
 				session->ctx->timeout);
 	}
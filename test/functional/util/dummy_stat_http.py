@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+
+# Stub of a central statistics token service for the http stat backend:
+# keeps tokens in memory and speaks the msgpack protocol used by rspamd
+
+import argparse
+import asyncio
+import os
+import struct
+import tornado.httpserver
+import tornado.web
+
+tokens = {}
+learns = {}
+
+
+def unpack(data, pos=0):
+    b = data[pos]
+    pos += 1
+    if b <= 0x7f:
+        return b, pos
+    if b >= 0xe0:
+        return b - 0x100, pos
+    if 0x80 <= b <= 0x8f or b in (0xde, 0xdf):
+        if b <= 0x8f:
+            n = b & 0x0f
+        elif b == 0xde:
+            n, = struct.unpack_from('>H', data, pos)
+            pos += 2
+        else:
+            n, = struct.unpack_from('>I', data, pos)
+            pos += 4
+        res = {}
+        for _ in range(n):
+            k, pos = unpack(data, pos)
+            v, pos = unpack(data, pos)
+            res[k] = v
+        return res, pos
+    if 0x90 <= b <= 0x9f or b in (0xdc, 0xdd):
+        if b <= 0x9f:
+            n = b & 0x0f
+        elif b == 0xdc:
+            n, = struct.unpack_from('>H', data, pos)
+            pos += 2
+        else:
+            n, = struct.unpack_from('>I', data, pos)
+            pos += 4
+        res = []
+        for _ in range(n):
+            v, pos = unpack(data, pos)
+            res.append(v)
+        return res, pos
+    if 0xa0 <= b <= 0xbf or b in (0xd9, 0xda, 0xdb):
+        if b <= 0xbf:
+            n = b & 0x1f
+        else:
+            fmt, sz = {0xd9: ('>B', 1), 0xda: ('>H', 2), 0xdb: ('>I', 4)}[b]
+            n, = struct.unpack_from(fmt, data, pos)
+            pos += sz
+        return data[pos:pos + n].decode(), pos + n
+    fixed = {
+        0xca: ('>f', 4), 0xcb: ('>d', 8),
+        0xcc: ('>B', 1), 0xcd: ('>H', 2), 0xce: ('>I', 4), 0xcf: ('>Q', 8),
+        0xd0: ('>b', 1), 0xd1: ('>h', 2), 0xd2: ('>i', 4), 0xd3: ('>q', 8),
+    }
+    if b in fixed:
+        fmt, sz = fixed[b]
+        v, = struct.unpack_from(fmt, data, pos)
+        return v, pos + sz
+    if b == 0xc0:
+        return None, pos
+    if b in (0xc2, 0xc3):
+        return b == 0xc3, pos
+    raise ValueError('unsupported msgpack type: 0x%x' % b)
+
+
+def pack(obj):
+    if isinstance(obj, dict):
+        res = struct.pack('>BI', 0xdf, len(obj))
+        for k, v in obj.items():
+            res += pack(k) + pack(v)
+        return res
+    if isinstance(obj, list):
+        res = struct.pack('>BI', 0xdd, len(obj))
+        for v in obj:
+            res += pack(v)
+        return res
+    if isinstance(obj, str):
+        raw = obj.encode()
+        return struct.pack('>BI', 0xdb, len(raw)) + raw
+    if isinstance(obj, float):
+        return struct.pack('>Bd', 0xcb, obj)
+    return struct.pack('>Bq', 0xd3, int(obj))
+
+
+class MainHandler(tornado.web.RequestHandler):
+    def post(self, path):
+        req, _ = unpack(self.request.body)
+        statfiles = req['statfiles']
+        toks = req['tokens']
+
+        if path == '/learn':
+            for i, st in enumerate(statfiles):
+                st_tokens = tokens.setdefault(st, {})
+                for tok, val in zip(toks, req['values'][i]):
+                    st_tokens[tok] = st_tokens.get(tok, 0) + val
+                learns[st] = learns.get(st, 0) + req['learns'][i]
+            reply = {'learns': [learns.get(st, 0) for st in statfiles]}
+        elif path == '/classify':
+            reply = {
+                'learns': [learns.get(st, 0) for st in statfiles],
+                'values': [[float(tokens.get(st, {}).get(tok, 0)) for tok in toks]
+                           for st in statfiles],
+            }
+        else:
+            raise tornado.web.HTTPError(404)
+
+        self.set_header("Content-Type", "application/msgpack")
+        self.write(pack(reply))
+
+
+def make_app():
+    return tornado.web.Application([
+        (r"(/[^/]+)", MainHandler),
+    ])
+
+
+async def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--bind", "-b", default="localhost", help="bind address")
+    parser.add_argument("--port", "-p", type=int, default=18085, help="bind port")
+    parser.add_argument("--pidfile", "-pf", help="path to the PID file")
+    args = parser.parse_args()
+
+    server = tornado.httpserver.HTTPServer(make_app())
+
+    if args.pidfile:
+        with open(args.pidfile, "w") as f:
+            f.write(str(os.getpid()))
+
+    server.bind(args.port, args.bind)
+    server.start(1)
+
+    await asyncio.Event().wait()
+
+if __name__ == "__main__":
+    asyncio.run(main())
@@ -42,5 +42,82 @@ context("Kann test", function()
         end)
   end
 
+  test("Batch apply matches single apply", function()
+    local batch = k:apply_batch(inputs)
+    assert_equal(#inputs, #batch)
+
+    for i,inp in ipairs(inputs) do
+      assert_true(math.abs(k:apply1(inp)[1] - batch[i][1]) < 1e-5)
+    end
+  end)
+
+  local function train_async(ann, train_inputs, params)
+    local rspamd_util = require "rspamd_util"
+    local ev_base = rspamd_util.create_event_base()
+    local res
+
+    params.ev_base = ev_base
+    ann:train_async(train_inputs, outputs, params,
+        function(err, niter, trained, costs, pca)
+          res = {err = err, niter = niter, ann = trained, costs = costs, pca = pca}
+        end)
+    -- Loop ends when the training thread notifies about its end
+    ev_base:loop()
+
+    return res
+  end
+
+  test("Async train", function()
+    local res = train_async(k, inputs, {
+      lr = 0.01,
+      max_epoch = 10,
+      mini_size = 80,
+    })
+
+    assert_not_nil(res)
+    assert_nil(res.err)
+    assert_true(res.niter > 0)
+    assert_equal(res.niter, #res.costs)
+    assert_nil(res.pca)
+    assert_equal(1, #res.ann:apply1(inputs[1]))
+  end)
+
+  test("Async train with pca", function()
+    local rspamd_tensor = require "rspamd_tensor"
+    -- Third column is redundant, so pca reduces inputs to 2 dimensions
+    local raw_inputs = {}
+    for i,inp in ipairs(inputs) do
+      raw_inputs[i] = {inp[1], inp[2], inp[1] + inp[2]}
+    end
+
+    local res = train_async(k, raw_inputs, {
+      lr = 0.01,
+      max_epoch = 10,
+      mini_size = 80,
+      learn_pca = true,
+    })
+
+    assert_not_nil(res)
+
+    if not rspamd_tensor.has_blas() then
+      assert_not_nil(res.err)
+      return
+    end
+
+    assert_nil(res.err)
+    assert_equal(2, #res.pca)
+    assert_equal(3, #res.pca[1])
+
+    -- Must be the same as pca learned in Lua
+    local scatter = rspamd_tensor.scatter_matrix(rspamd_tensor.fromtable(raw_inputs))
+    scatter:eigen()
+    for i=1,2 do
+      for j=1,3 do
+        assert_true(math.abs(res.pca[i][j] - scatter[#scatter - i + 1][j]) < 1e-5)
+      end
+    end
+
+    assert_equal(1, #res.ann:apply1(raw_inputs[1], res.pca))
+  end)
 
 end)
\ No newline at end of file
@@ -0,0 +1,55 @@
+-- Lua classes checks and methods call overhead
+
+context("Lua classes", function()
+  local rspamd_text = require "rspamd_text"
+  local rspamd_ip = require "rspamd_ip"
+  local rspamd_util = require "rspamd_util"
+  local logger = require "rspamd_logger"
+
+  test("Class names", function()
+    local t = rspamd_text.fromstring('test')
+    local ip = rspamd_ip.from_string('127.0.0.1')
+
+    assert_equal(tostring(getmetatable(t).class), 'rspamd{text}')
+    assert_equal(tostring(getmetatable(ip).class), 'rspamd{ip}')
+  end)
+
+  test("Class mismatch", function()
+    local t = rspamd_text.fromstring('test')
+    local ip = rspamd_ip.from_string('127.0.0.1')
+
+    assert_equal(t:len(), 4)
+    -- Methods of one class must reject objects of another class
+    local ret = pcall(t.len, ip)
+    assert_false(ret)
+    ret = pcall(ip.to_string, t)
+    assert_false(ret)
+  end)
+
+  local speed_iters = 1000000
+
+  test("Method call overhead", function()
+    local t = rspamd_text.fromstring('test')
+    local len = t.len
+    local function lua_len(s)
+      return #s
+    end
+    local s = 'test'
+
+    local ts = rspamd_util.get_ticks()
+    for _ = 1, speed_iters do
+      lua_len(s)
+    end
+    local lua_ticks = rspamd_util.get_ticks() - ts
+
+    ts = rspamd_util.get_ticks()
+    for _ = 1, speed_iters do
+      len(t)
+    end
+    local c_ticks = rspamd_util.get_ticks() - ts
+
+    logger.messagex("lua function: %s ns per call, C method with class check: %s ns per call",
+        lua_ticks / speed_iters * 1e9, c_ticks / speed_iters * 1e9)
+    assert_equal(len(t), 4)
+  end)
+end)
@@ -0,0 +1,265 @@
+/*-
+ * Copyright 2023 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rspamd.h"
+#include "dns.h"
+#include "task.h"
+#include "cfg_file.h"
+#include "async_session.h"
+#include "tests.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define TEST_DNS_TTL 100
+
+extern struct ev_loop *event_loop;
+extern struct rspamd_main *rspamd_main;
+
+/* Fake nameserver: replies with A record or NXDOMAIN for names starting with `nx` */
+struct dns_cache_test_server {
+	gint fd;
+	guint queries;
+	ev_io io;
+};
+
+struct dns_cache_test_reply {
+	enum dns_rcode code;
+	gint32 ttl;
+	guint nentries;
+};
+
+static guint dns_cache_test_pending = 0;
+
+static void
+dns_cache_test_server_cb (EV_P_ ev_io *w, int revents)
+{
+	struct dns_cache_test_server *srv = (struct dns_cache_test_server *)w->data;
+	guchar in[512], out[512];
+	struct sockaddr_storage sa;
+	socklen_t salen = sizeof (sa);
+	gssize r, sent;
+	gsize pos, olen;
+	gboolean nx;
+	static const guchar answer[] = {
+		0xc0, 0x0c, /* name pointer to the question */
+		0x00, 0x01, 0x00, 0x01, /* A IN */
+		0x00, 0x00, 0x00, TEST_DNS_TTL,
+		0x00, 0x04, 127, 0, 0, 2
+	};
+
+	while ((r = recvfrom (srv->fd, in, sizeof (in), 0,
+			(struct sockaddr *)&sa, &salen)) > 12) {
+		/* Skip qname, qtype and qclass */
+		pos = 12;
+
+		while (pos < (gsize)r && in[pos] != 0) {
+			pos += in[pos] + 1;
+		}
+
+		pos += 5;
+		g_assert_cmpuint (pos, <=, r);
+		nx = in[12] == 2 && g_ascii_strncasecmp ((const gchar *)&in[13], "nx", 2) == 0;
+		srv->queries ++;
+
+		/* Header id and the question section are copied as is */
+		memcpy (out, in, pos);
+		out[2] = 0x81;
+		out[3] = nx ? 0x83 : 0x80;
+		out[6] = 0;
+		out[7] = nx ? 0 : 1;
+		memset (&out[8], 0, 4);
+		olen = pos;
+
+		if (!nx) {
+			memcpy (&out[olen], answer, sizeof (answer));
+			olen += sizeof (answer);
+		}
+
+		sent = sendto (srv->fd, out, olen, 0, (struct sockaddr *)&sa, salen);
+		g_assert (sent == (gssize)olen);
+		salen = sizeof (sa);
+	}
+}
+
+static void
+dns_cache_test_cb (struct rdns_reply *reply, gpointer ud)
+{
+	struct dns_cache_test_reply *res = (struct dns_cache_test_reply *)ud;
+	struct rdns_reply_entry *elt;
+
+	res->code = reply->code;
+	res->nentries = 0;
+	res->ttl = -1;
+
+	DL_FOREACH (reply->entries, elt) {
+		res->nentries ++;
+		res->ttl = elt->ttl;
+	}
+
+	if (-- dns_cache_test_pending == 0) {
+		ev_break (event_loop, EVBREAK_ALL);
+	}
+}
+
+static struct rspamd_task *
+dns_cache_test_task (struct rspamd_dns_resolver *resolver,
+		struct rspamd_worker *worker)
+{
+	struct rspamd_task *task;
+
+	task = rspamd_task_new (NULL, rspamd_main->cfg, NULL, NULL, event_loop,
+			FALSE);
+	task->resolver = resolver;
+	task->worker = worker;
+	task->s = rspamd_session_create (task->task_pool, NULL, NULL, NULL, task);
+
+	return task;
+}
+
+static void
+dns_cache_test_request (struct rspamd_task *task, const gchar *name,
+		struct dns_cache_test_reply *res)
+{
+	gboolean ret;
+
+	memset (res, 0, sizeof (*res));
+	ret = rspamd_dns_resolver_request_task (task, dns_cache_test_cb, res,
+			RDNS_REQUEST_A, name);
+	g_assert (ret);
+	dns_cache_test_pending ++;
+}
+
+void
+rspamd_dns_cache_test_func (void)
+{
+	struct dns_cache_test_server srv;
+	struct dns_cache_test_reply res[3];
+	struct rspamd_task *tasks[3];
+	struct rspamd_config *cfg;
+	struct rspamd_dns_resolver *resolver;
+	struct rspamd_worker worker;
+	struct rspamd_main fake_main;
+	struct rspamd_stat stat;
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof (sin);
+	struct ucl_parser *parser;
+	gchar ns[64];
+	gint ret;
+	guint i;
+
+	memset (&srv, 0, sizeof (srv));
+	srv.fd = socket (AF_INET, SOCK_DGRAM, 0);
+	g_assert (srv.fd != -1);
+	memset (&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	ret = bind (srv.fd, (struct sockaddr *)&sin, sizeof (sin));
+	g_assert_cmpint (ret, ==, 0);
+	ret = getsockname (srv.fd, (struct sockaddr *)&sin, &slen);
+	g_assert_cmpint (ret, ==, 0);
+	rspamd_socket_nonblocking (srv.fd);
+	srv.io.data = &srv;
+	ev_io_init (&srv.io, dns_cache_test_server_cb, srv.fd, EV_READ);
+	ev_io_start (event_loop, &srv.io);
+
+	cfg = rspamd_config_new (RSPAMD_CONFIG_INIT_SKIP_LUA);
+	rspamd_snprintf (ns, sizeof (ns), "127.0.0.1:%d", (gint)ntohs (sin.sin_port));
+	cfg->nameservers = ucl_object_fromstring (ns);
+	cfg->dns_timeout = 1.0;
+	cfg->dns_retransmits = 1;
+	parser = ucl_parser_new (0);
+	ret = ucl_parser_add_string (parser,
+			"options { dns { cache_size = 16; hosts = null; } }", 0);
+	g_assert (ret);
+	cfg->rcl_obj = ucl_parser_get_object (parser);
+	ucl_parser_free (parser);
+
+	resolver = rspamd_dns_resolver_init (NULL, event_loop, cfg);
+	g_assert (resolver != NULL && resolver->cache != NULL);
+	rspamd_upstreams_library_config (cfg, cfg->ups_ctx, event_loop,
+			resolver->r);
+
+	memset (&stat, 0, sizeof (stat));
+	memset (&fake_main, 0, sizeof (fake_main));
+	memset (&worker, 0, sizeof (worker));
+	fake_main.stat = &stat;
+	worker.srv = &fake_main;
+
+	/* Identical requests in flight share a single query */
+	for (i = 0; i < 2; i ++) {
+		tasks[i] = dns_cache_test_task (resolver, &worker);
+		dns_cache_test_request (tasks[i], "cached.test", &res[i]);
+	}
+
+	ev_run (event_loop, 0);
+
+	for (i = 0; i < 2; i ++) {
+		g_assert_cmpint (res[i].code, ==, RDNS_RC_NOERROR);
+		g_assert_cmpuint (res[i].nentries, ==, 1);
+		g_assert_cmpint (res[i].ttl, ==, TEST_DNS_TTL);
+		rspamd_task_free (tasks[i]);
+	}
+
+	g_assert_cmpuint (srv.queries, ==, 1);
+	g_assert_cmpuint (stat.dns_cache_misses, ==, 1);
+	g_assert_cmpuint (stat.dns_coalesced, ==, 1);
+	g_assert_cmpuint (stat.dns_cache_hits, ==, 0);
+
+	/* Cached reply is served with the remaining TTL */
+	g_usleep (1100000);
+	ev_now_update (event_loop);
+
+	for (i = 0; i < 2; i ++) {
+		tasks[i] = dns_cache_test_task (resolver, &worker);
+		dns_cache_test_request (tasks[i], "cached.test", &res[i]);
+	}
+
+	ev_run (event_loop, 0);
+
+	for (i = 0; i < 2; i ++) {
+		g_assert_cmpint (res[i].code, ==, RDNS_RC_NOERROR);
+		g_assert_cmpuint (res[i].nentries, ==, 1);
+		g_assert_cmpint (res[i].ttl, <, TEST_DNS_TTL);
+		g_assert_cmpint (res[i].ttl, >, TEST_DNS_TTL - 10);
+		rspamd_task_free (tasks[i]);
+	}
+
+	/* Shared reply is not modified by the previous hit */
+	g_assert_cmpint (res[0].ttl, ==, res[1].ttl);
+	g_assert_cmpuint (srv.queries, ==, 1);
+	g_assert_cmpuint (stat.dns_cache_hits, ==, 2);
+
+	/* Negative replies are cached as well */
+	for (i = 0; i < 3; i ++) {
+		tasks[i] = dns_cache_test_task (resolver, &worker);
+		dns_cache_test_request (tasks[i], "nx.test", &res[i]);
+		ev_run (event_loop, 0);
+		g_assert_cmpint (res[i].code, ==, RDNS_RC_NXDOMAIN);
+		g_assert_cmpuint (res[i].nentries, ==, 0);
+		rspamd_task_free (tasks[i]);
+	}
+
+	g_assert_cmpuint (srv.queries, ==, 2);
+	g_assert_cmpuint (stat.dns_cache_misses, ==, 2);
+	g_assert_cmpuint (stat.dns_cache_hits, ==, 4);
+
+	ev_io_stop (event_loop, &srv.io);
+	close (srv.fd);
+	rspamd_dns_resolver_deinit (resolver);
+	cfg->dns_resolver = NULL;
+	REF_RELEASE (cfg);
+}
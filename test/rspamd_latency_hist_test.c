@@ -0,0 +1,176 @@
+/*-
+ * Copyright 2023 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rspamd.h"
+#include "libserver/latency_hist.h"
+#include "tests.h"
+
+#include <math.h>
+
+/* Merged histogram of a stage over all slots */
+static void
+rspamd_latency_test_merge (struct rspamd_latency_stat *st,
+		enum rspamd_latency_stage stage, struct rspamd_latency_hist *hist)
+{
+	guint i;
+
+	memset (hist, 0, sizeof (*hist));
+
+	for (i = 0; i < RSPAMD_LATENCY_MAX_SLOTS; i ++) {
+		rspamd_latency_hist_merge (hist, &st->slots[i].stages[stage]);
+	}
+}
+
+/* Records a single sample and returns its bucket */
+static guint
+rspamd_latency_test_bucket (struct rspamd_latency_stat *st,
+		struct rspamd_worker *worker, gdouble seconds)
+{
+	struct rspamd_latency_hist hist;
+	guint i, found = G_MAXUINT;
+
+	rspamd_latency_stat_reset (st);
+	rspamd_latency_stat_record (st, worker, RSPAMD_LATENCY_STAGE_TOTAL, seconds);
+	rspamd_latency_test_merge (st, RSPAMD_LATENCY_STAGE_TOTAL, &hist);
+	g_assert_cmpuint (hist.count, ==, 1);
+
+	for (i = 0; i < RSPAMD_LATENCY_BUCKETS; i ++) {
+		if (hist.buckets[i] != 0) {
+			g_assert_cmpuint (hist.buckets[i], ==, 1);
+			g_assert_cmpuint (found, ==, G_MAXUINT);
+			found = i;
+		}
+	}
+
+	g_assert_cmpuint (found, !=, G_MAXUINT);
+
+	return found;
+}
+
+static void
+rspamd_latency_buckets_test (struct rspamd_latency_stat *st,
+		struct rspamd_worker *worker)
+{
+	guint64 us;
+	guint idx, prev_idx = 0;
+	gdouble lower, upper;
+
+	/* Bucket bounds are strictly increasing */
+	for (idx = 1; idx < RSPAMD_LATENCY_BUCKETS; idx ++) {
+		g_assert (rspamd_latency_bucket_upper (idx) >
+				rspamd_latency_bucket_upper (idx - 1));
+	}
+
+	g_assert_cmpfloat (rspamd_latency_bucket_upper (0), ==, 1e-6);
+	g_assert_cmpfloat (rspamd_latency_bucket_upper (4), ==, 5e-6);
+	g_assert_cmpfloat (rspamd_latency_bucket_upper (8), ==, 10e-6);
+
+	/* Every value is between bounds of its bucket, buckets are monotonic */
+	for (us = 0; us < ((guint64)1 << 28); us = us < 64 ? us + 1 : us + us / 7) {
+		idx = rspamd_latency_test_bucket (st, worker, (us + 0.5) / 1e6);
+		g_assert_cmpuint (idx, <, RSPAMD_LATENCY_BUCKETS - 1);
+		g_assert_cmpuint (idx, >=, prev_idx);
+		prev_idx = idx;
+		lower = idx > 0 ? rspamd_latency_bucket_upper (idx - 1) : 0;
+		upper = rspamd_latency_bucket_upper (idx);
+
+		if (us / 1e6 < lower - 1e-9 || us / 1e6 >= upper - 1e-9) {
+			g_error ("%uL us is put in bucket %ud: [%.6f, %.6f)",
+					us, idx, lower, upper);
+		}
+	}
+
+	/* Overflows */
+	g_assert_cmpuint (rspamd_latency_test_bucket (st, worker, 1e6), ==,
+			RSPAMD_LATENCY_BUCKETS - 1);
+
+	/* Invalid samples are ignored */
+	rspamd_latency_stat_reset (st);
+	rspamd_latency_stat_record (st, worker, RSPAMD_LATENCY_STAGE_TOTAL, -1.0);
+	rspamd_latency_stat_record (st, worker, RSPAMD_LATENCY_STAGE_TOTAL, NAN);
+	rspamd_latency_stat_record (st, worker, RSPAMD_LATENCY_STAGE_MAX, 1.0);
+	rspamd_latency_stat_record (NULL, worker, RSPAMD_LATENCY_STAGE_TOTAL, 1.0);
+	g_assert_cmpuint (st->slots[0].stages[RSPAMD_LATENCY_STAGE_TOTAL].count, ==, 0);
+}
+
+static void
+rspamd_latency_quantiles_test (struct rspamd_latency_stat *st,
+		struct rspamd_worker *worker)
+{
+	struct rspamd_latency_hist hist;
+	gdouble q;
+	guint i;
+
+	memset (&hist, 0, sizeof (hist));
+	g_assert_cmpfloat (rspamd_latency_hist_quantile (&hist, 0.5), ==, 0.0);
+
+	/* 90% of samples are 100us and 10% are 10ms */
+	rspamd_latency_stat_reset (st);
+
+	for (i = 0; i < 1000; i ++) {
+		rspamd_latency_stat_record (st, worker, RSPAMD_LATENCY_STAGE_FILTERS,
+				i % 10 == 0 ? 0.01 : 0.0001);
+	}
+
+	rspamd_latency_test_merge (st, RSPAMD_LATENCY_STAGE_FILTERS, &hist);
+	g_assert_cmpuint (hist.count, ==, 1000);
+	/* Samples are truncated to microseconds */
+	g_assert_cmpuint (hist.sum_us, <=, 100 * 10000 + 900 * 100);
+	g_assert_cmpuint (hist.sum_us, >=, 100 * 10000 + 900 * 100 - 1000);
+
+	/* Estimation error is bounded by the sub-bucket width */
+	q = rspamd_latency_hist_quantile (&hist, 0.0);
+	g_assert (fabs (q - 0.0001) <= 0.0001 * 0.25);
+	q = rspamd_latency_hist_quantile (&hist, 0.5);
+	g_assert (fabs (q - 0.0001) <= 0.0001 * 0.25);
+	q = rspamd_latency_hist_quantile (&hist, 0.9);
+	g_assert (fabs (q - 0.0001) <= 0.0001 * 0.25);
+	q = rspamd_latency_hist_quantile (&hist, 0.91);
+	g_assert (fabs (q - 0.01) <= 0.01 * 0.25);
+	q = rspamd_latency_hist_quantile (&hist, 1.0);
+	g_assert (fabs (q - 0.01) <= 0.01 * 0.25);
+
+	/* Other stages are not affected */
+	rspamd_latency_test_merge (st, RSPAMD_LATENCY_STAGE_TOTAL, &hist);
+	g_assert_cmpuint (hist.count, ==, 0);
+
+	/* Overflows are reported as the upper bound of the histogram */
+	rspamd_latency_stat_reset (st);
+	rspamd_latency_stat_record (st, worker, RSPAMD_LATENCY_STAGE_TOTAL, 1e6);
+	rspamd_latency_test_merge (st, RSPAMD_LATENCY_STAGE_TOTAL, &hist);
+	q = rspamd_latency_hist_quantile (&hist, 0.5);
+	g_assert_cmpfloat (q, >, rspamd_latency_bucket_upper (RSPAMD_LATENCY_BUCKETS - 2));
+	g_assert_cmpfloat (q, <=, rspamd_latency_bucket_upper (RSPAMD_LATENCY_BUCKETS - 1));
+}
+
+void
+rspamd_latency_hist_test_func (void)
+{
+	rspamd_mempool_t *pool;
+	struct rspamd_latency_stat *st;
+	struct rspamd_worker worker;
+
+	pool = rspamd_mempool_new (rspamd_mempool_suggest_size (), "latency", 0);
+	st = rspamd_latency_stat_new (pool);
+	memset (&worker, 0, sizeof (worker));
+	worker.pid = getpid ();
+	worker.type = g_quark_from_static_string ("normal");
+
+	rspamd_latency_buckets_test (st, &worker);
+	rspamd_latency_quantiles_test (st, &worker);
+
+	rspamd_mempool_delete (pool);
+}
@@ -0,0 +1,200 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rspamd.h"
+#include "libserver/maps/map.h"
+#include "libserver/maps/map_private.h"
+#include "libserver/maps/map_helpers.h"
+#include "tests.h"
+
+extern struct rspamd_main *rspamd_main;
+
+/* Nested and edge prefixes that must be flattened to disjoint ranges */
+static const gchar radix_map_data[] =
+		"10.0.0.0/8 net8\n"
+		"10.1.0.0/16 net16\n"
+		"10.1.2.0/24 net24\n"
+		"10.1.2.3 host\n"
+		"10.255.255.255 last8\n"
+		"0.0.0.0/32 zero\n"
+		"192.168.0.0/16 private\n"
+		"255.255.255.255 broadcast\n"
+		"::1 loopback\n"
+		"2001:db8::/32 doc32\n"
+		"2001:db8::/64 doc64\n"
+		"ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff last6\n";
+
+struct radix_map_check {
+	const gchar *addr;
+	const gchar *expected; /* NULL if address is not in map */
+};
+
+static const struct radix_map_check radix_map_checks[] = {
+	{"0.0.0.0", "zero"},
+	{"0.0.0.1", NULL},
+	{"9.255.255.255", NULL},
+	{"10.0.0.0", "net8"},
+	{"10.0.255.255", "net8"},
+	{"10.1.0.0", "net16"},
+	{"10.1.1.255", "net16"},
+	{"10.1.2.0", "net24"},
+	{"10.1.2.2", "net24"},
+	{"10.1.2.3", "host"},
+	{"10.1.2.4", "net24"},
+	{"10.1.2.255", "net24"},
+	{"10.1.3.0", "net16"},
+	{"10.1.255.255", "net16"},
+	{"10.2.0.0", "net8"},
+	{"10.255.255.254", "net8"},
+	{"10.255.255.255", "last8"},
+	{"11.0.0.0", NULL},
+	{"192.167.255.255", NULL},
+	{"192.168.0.0", "private"},
+	{"192.168.255.255", "private"},
+	{"192.169.0.0", NULL},
+	{"255.255.255.254", NULL},
+	{"255.255.255.255", "broadcast"},
+	{"::", NULL},
+	{"::1", "loopback"},
+	{"::2", NULL},
+	{"2001:db7:ffff:ffff:ffff:ffff:ffff:ffff", NULL},
+	{"2001:db8::", "doc64"},
+	{"2001:db8::ffff:ffff:ffff:ffff", "doc64"},
+	{"2001:db8:0:1::", "doc32"},
+	{"2001:db8:ffff:ffff:ffff:ffff:ffff:ffff", "doc32"},
+	{"2001:db9::", NULL},
+	{"ffff:ffff:ffff:ffff:ffff:ffff:ffff:fffe", NULL},
+	{"ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff", "last6"},
+};
+
+static struct rspamd_radix_map_helper *
+rspamd_map_snapshot_test_load (struct rspamd_map *map, guint64 key)
+{
+	struct map_cb_data cbd;
+	struct rspamd_radix_map_helper *r = NULL;
+	gchar *chunk;
+
+	memset (&cbd, 0, sizeof (cbd));
+	cbd.map = map;
+	cbd.snapshot_key = key;
+	chunk = g_strdup (radix_map_data);
+	rspamd_radix_read (chunk, sizeof (radix_map_data) - 1, &cbd, TRUE);
+	g_assert (!cbd.errored);
+	rspamd_radix_fin (&cbd, (void **)&r);
+	g_assert (r != NULL);
+	g_free (chunk);
+
+	return r;
+}
+
+static void
+rspamd_map_snapshot_test_match (struct rspamd_radix_map_helper *r)
+{
+	const struct radix_map_check *check;
+	rspamd_inet_addr_t *addr;
+	const gchar *found;
+	gboolean ret;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (radix_map_checks); i ++) {
+		check = &radix_map_checks[i];
+		ret = rspamd_parse_inet_address (&addr, check->addr,
+				strlen (check->addr), RSPAMD_INET_ADDRESS_PARSE_DEFAULT);
+		g_assert (ret);
+		found = rspamd_match_radix_map_addr (r, addr);
+
+		if (check->expected == NULL) {
+			if (found != NULL) {
+				g_error ("%s: expected no match, got %s", check->addr, found);
+			}
+		}
+		else if (found == NULL || strcmp (found, check->expected) != 0) {
+			g_error ("%s: expected %s, got %s", check->addr, check->expected,
+					found ? found : "nothing");
+		}
+
+		rspamd_inet_address_free (addr);
+	}
+}
+
+void
+rspamd_map_snapshot_test_func (void)
+{
+	struct rspamd_config *cfg = rspamd_main->cfg;
+	struct rspamd_map map;
+	struct rspamd_radix_map_helper *trie, *snap;
+	gchar *old_cache_dir, *tmpdir, *sep, *unrelated;
+	gchar path[PATH_MAX], next_path[PATH_MAX], stale_path[PATH_MAX];
+	GError *err = NULL;
+	gboolean ret;
+	gint fd;
+
+	tmpdir = g_dir_make_tmp ("rspamd-maps-XXXXXX", &err);
+	g_assert_no_error (err);
+	old_cache_dir = cfg->maps_cache_dir;
+	cfg->maps_cache_dir = tmpdir;
+
+	memset (&map, 0, sizeof (map));
+	map.name = "test radix";
+	map.tag = "test";
+	map.cfg = cfg;
+	map.read_callback = rspamd_radix_read;
+
+	/* Private trie is the reference for the flattened ranges */
+	trie = rspamd_map_snapshot_test_load (&map, 0);
+	rspamd_map_snapshot_test_match (trie);
+
+	ret = rspamd_map_get_snapshot_path (&map, 0xdeadbeef, path, sizeof (path));
+	g_assert (ret);
+	snap = rspamd_map_snapshot_test_load (&map, 0xdeadbeef);
+	g_assert (access (path, R_OK) == 0);
+	rspamd_map_snapshot_test_match (snap);
+	rspamd_map_helper_destroy_radix (snap);
+
+	/* Outdated snapshots of the same map are removed on the next save */
+	rspamd_strlcpy (stale_path, path, sizeof (stale_path));
+	sep = strrchr (stale_path, '-');
+	g_assert (sep != NULL);
+	rspamd_strlcpy (sep, "-0000000000000001.snap",
+			sizeof (stale_path) - (sep - stale_path));
+	fd = open (stale_path, O_WRONLY | O_CREAT | O_EXCL, 00644);
+	g_assert (fd != -1);
+	close (fd);
+	unrelated = g_build_filename (tmpdir, "0000000000000001-0000000000000001.snap",
+			NULL);
+	fd = open (unrelated, O_WRONLY | O_CREAT | O_EXCL, 00644);
+	g_assert (fd != -1);
+	close (fd);
+
+	ret = rspamd_map_get_snapshot_path (&map, 0xcafebabe, next_path,
+			sizeof (next_path));
+	g_assert (ret);
+	snap = rspamd_map_snapshot_test_load (&map, 0xcafebabe);
+	g_assert (access (next_path, R_OK) == 0);
+	g_assert (access (path, F_OK) == -1);
+	g_assert (access (stale_path, F_OK) == -1);
+	g_assert (access (unrelated, F_OK) == 0);
+	rspamd_map_snapshot_test_match (snap);
+
+	rspamd_map_helper_destroy_radix (snap);
+	rspamd_map_helper_destroy_radix (trie);
+	unlink (next_path);
+	unlink (unrelated);
+	rmdir (tmpdir);
+	cfg->maps_cache_dir = old_cache_dir;
+	g_free (unrelated);
+	g_free (tmpdir);
+}
@@ -36,4 +36,20 @@ rspamd_mem_pool_test_func (void)
 	rspamd_mempool_delete (pool);
 	rspamd_mempool_stat (&st);
 
+	/* Chunks of the deleted pools should be reused */
+	guint hits = st.cache_hits;
+
+	pool = rspamd_mempool_new (8192, NULL, 0);
+	tmp = rspamd_mempool_alloc (pool, 16384);
+	memset (tmp, 0, 16384);
+	rspamd_mempool_delete (pool);
+
+	pool = rspamd_mempool_new (8192, NULL, 0);
+	tmp = rspamd_mempool_alloc (pool, 16384);
+	memset (tmp, 0, 16384);
+	rspamd_mempool_delete (pool);
+
+	rspamd_mempool_stat (&st);
+	g_assert (st.cache_hits >= hits + 2);
+	rspamd_mempool_cache_trim (TRUE);
 }
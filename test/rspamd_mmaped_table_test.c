@@ -0,0 +1,109 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rspamd.h"
+#include "libstat/backends/mmaped_table.h"
+#include "tests.h"
+
+/* More than the minimal table can hold, so it is grown a few times */
+#define NTOKENS 20000
+#define TOKEN(i) ((guint64)(i) * 0x9E3779B97F4A7C15ULL + 1)
+#define VALUE(i) ((i) % 7 + 1)
+
+static gsize
+rspamd_mmaped_table_test_size (const gchar *path)
+{
+	struct stat st;
+
+	g_assert (stat (path, &st) == 0);
+
+	return st.st_size;
+}
+
+void
+rspamd_mmaped_table_test_func (void)
+{
+	rspamd_mmaped_table_t *tbl, *other;
+	GError *err = NULL;
+	gchar *tmpdir, *path;
+	gsize initial_size;
+	gboolean ret;
+	guint i;
+
+	tmpdir = g_dir_make_tmp ("rspamd-stat-XXXXXX", &err);
+	g_assert_no_error (err);
+	path = g_build_filename (tmpdir, "bayes.spam", NULL);
+
+	tbl = rspamd_mmaped_table_open (path, 0, "osb", 3, &err);
+	g_assert_no_error (err);
+	g_assert (tbl != NULL);
+	/* This one maps the initial file and must follow growth */
+	other = rspamd_mmaped_table_open (path, 0, NULL, 0, &err);
+	g_assert_no_error (err);
+	g_assert (other != NULL);
+	initial_size = rspamd_mmaped_table_test_size (path);
+
+	for (i = 0; i < NTOKENS; i ++) {
+		ret = rspamd_mmaped_table_incr (tbl, TOKEN (i), VALUE (i));
+		g_assert (ret);
+	}
+
+	g_assert_cmpuint (rspamd_mmaped_table_test_size (path), >, initial_size);
+
+	for (i = 0; i < NTOKENS; i ++) {
+		g_assert_cmpuint (rspamd_mmaped_table_get (tbl, TOKEN (i)), ==, VALUE (i));
+	}
+
+	/* Counters are saturated on unlearning */
+	ret = rspamd_mmaped_table_incr (tbl, TOKEN (0), -100);
+	g_assert (ret);
+	g_assert_cmpuint (rspamd_mmaped_table_get (tbl, TOKEN (0)), ==, 0);
+	/* Unknown tokens are not inserted to be unlearned */
+	ret = rspamd_mmaped_table_incr (tbl, TOKEN (NTOKENS), -1);
+	g_assert (ret);
+	g_assert_cmpuint (rspamd_mmaped_table_get (tbl, TOKEN (NTOKENS)), ==, 0);
+	g_assert_cmpint (rspamd_mmaped_table_incr_learns (tbl, 5), ==, 5);
+
+	/* Obsolete mapping is replaced on the next learn */
+	ret = rspamd_mmaped_table_incr (other, TOKEN (1), 1);
+	g_assert (ret);
+	g_assert_cmpuint (rspamd_mmaped_table_get (other, TOKEN (1)), ==,
+			VALUE (1) + 1);
+	g_assert_cmpuint (rspamd_mmaped_table_get (tbl, TOKEN (1)), ==,
+			VALUE (1) + 1);
+	g_assert_cmpuint (rspamd_mmaped_table_get (other, TOKEN (2)), ==, VALUE (2));
+	g_assert_cmpint (rspamd_mmaped_table_incr_learns (other, 1), ==, 6);
+
+	rspamd_mmaped_table_close_file (other);
+	rspamd_mmaped_table_close_file (tbl);
+
+	/* Everything is stored in the file */
+	tbl = rspamd_mmaped_table_open (path, 0, NULL, 0, &err);
+	g_assert_no_error (err);
+	g_assert (tbl != NULL);
+
+	for (i = 2; i < NTOKENS; i ++) {
+		g_assert_cmpuint (rspamd_mmaped_table_get (tbl, TOKEN (i)), ==, VALUE (i));
+	}
+
+	g_assert_cmpint (rspamd_mmaped_table_incr_learns (tbl, 0), ==, 6);
+	rspamd_mmaped_table_close_file (tbl);
+
+	unlink (path);
+	rmdir (tmpdir);
+	g_free (path);
+	g_free (tmpdir);
+}
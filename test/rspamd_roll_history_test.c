@@ -0,0 +1,344 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rspamd.h"
+#include "libserver/roll_history.h"
+#include "tests.h"
+
+extern struct rspamd_main *rspamd_main;
+
+/*
+ * Writes legacy json history of `nrows` rows starting from `first`, rows are
+ * written from the newest to the oldest as the ring order is arbitrary
+ */
+static void
+rspamd_roll_history_test_write (const gchar *path, guint first, guint nrows)
+{
+	GString *out;
+	guint i, n;
+	gboolean ret;
+
+	out = g_string_new ("[");
+
+	for (n = nrows; n > 0; n --) {
+		i = first + n - 1;
+		rspamd_printf_gstring (out, "%s{\"time\":%d.5,\"id\":\"msg%d\","
+				"\"symbols\":\"COMMON, %s%s\",\"user\":\"user\","
+				"\"from\":\"127.0.0.1\",\"len\":%d,\"scan_time\":0.5,"
+				"\"score\":%d.0,\"required_score\":15.0,\"action\":%d}",
+				n == nrows ? "" : ",", 1000 + i, i,
+				i % 2 ? "ODD" : "EVEN", i == first + nrows - 1 ? ", LAST" : "",
+				100 + i, i, i % 2);
+	}
+
+	g_string_append_c (out, ']');
+	ret = g_file_set_contents (path, out->str, out->len, NULL);
+	g_assert (ret);
+	g_string_free (out, TRUE);
+}
+
+static void
+rspamd_roll_history_test_collect (struct roll_history *history,
+		const struct roll_history_row *row, gpointer ud)
+{
+	GArray *rows = ud;
+
+	g_array_append_val (rows, *row);
+}
+
+static guint
+rspamd_roll_history_test_query (struct roll_history *history,
+		const struct roll_history_query *query, GArray *rows)
+{
+	g_array_set_size (rows, 0);
+
+	return rspamd_roll_history_query (history, query,
+			rspamd_roll_history_test_collect, rows);
+}
+
+static gboolean
+rspamd_roll_history_test_has_symbol (struct roll_history *history,
+		const struct roll_history_row *row, const gchar *symbol)
+{
+	const gchar *name;
+	guint i;
+
+	for (i = 0; i < row->nsymbols; i ++) {
+		name = rspamd_roll_history_symbol_name (history, row->symbols[i]);
+
+		if (name && strcmp (name, symbol) == 0) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+#define ROW(rows, i) (&g_array_index ((rows), struct roll_history_row, (i)))
+
+static void
+rspamd_roll_history_query_test (rspamd_mempool_t *pool, const gchar *tmpdir)
+{
+	struct roll_history *history;
+	struct roll_history_query query;
+	GArray *rows;
+	gchar *path;
+	guint i;
+	gboolean ret;
+
+	rows = g_array_new (FALSE, FALSE, sizeof (struct roll_history_row));
+	path = g_build_filename (tmpdir, "legacy.json", NULL);
+	history = rspamd_roll_history_new (pool, 16, rspamd_main->cfg);
+	g_assert (history != NULL && !history->disabled);
+
+	rspamd_roll_history_test_write (path, 0, 10);
+	ret = rspamd_roll_history_load (history, path);
+	g_assert (ret);
+
+	/* All rows from the newest to the oldest */
+	rspamd_roll_history_query_init (&query);
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 10);
+	g_assert_cmpuint (rows->len, ==, 10);
+
+	for (i = 0; i < rows->len; i ++) {
+		g_assert_cmpfloat (ROW (rows, i)->timestamp, ==, 1009.5 - i);
+		g_assert_cmpint (ROW (rows, i)->action, ==, (9 - i) % 2);
+		g_assert_cmpuint (ROW (rows, i)->len, ==, 109 - i);
+		g_assert (rspamd_roll_history_test_has_symbol (history, ROW (rows, i),
+				"COMMON"));
+	}
+
+	g_assert_cmpstr (ROW (rows, 0)->message_id, ==, "msg9");
+	g_assert_cmpstr (ROW (rows, 0)->user, ==, "user");
+	g_assert_cmpstr (ROW (rows, 0)->from_addr, ==, "127.0.0.1");
+	g_assert (rspamd_roll_history_test_has_symbol (history, ROW (rows, 0), "LAST"));
+
+	/* Filters */
+	rspamd_roll_history_query_init (&query);
+	query.since = 1005;
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 5);
+	g_assert_cmpstr (ROW (rows, 4)->message_id, ==, "msg5");
+
+	rspamd_roll_history_query_init (&query);
+	query.until = 1002;
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 2);
+	g_assert_cmpstr (ROW (rows, 0)->message_id, ==, "msg1");
+
+	rspamd_roll_history_query_init (&query);
+	query.min_score = 3;
+	query.max_score = 6;
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 4);
+
+	rspamd_roll_history_query_init (&query);
+	query.action = 1;
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 5);
+
+	rspamd_roll_history_query_init (&query);
+	query.symbol = "ODD";
+	query.since = 1004;
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 3);
+
+	for (i = 0; i < rows->len; i ++) {
+		g_assert (rspamd_roll_history_test_has_symbol (history, ROW (rows, i),
+				"ODD"));
+	}
+
+	rspamd_roll_history_query_init (&query);
+	query.symbol = "UNKNOWN";
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 0);
+
+	/* Pagination returns total number of matched rows */
+	rspamd_roll_history_query_init (&query);
+	query.offset = 2;
+	query.limit = 3;
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 10);
+	g_assert_cmpuint (rows->len, ==, 3);
+	g_assert_cmpstr (ROW (rows, 0)->message_id, ==, "msg7");
+	g_assert_cmpstr (ROW (rows, 2)->message_id, ==, "msg5");
+
+	/* Only the newest rows of a larger legacy dump are imported */
+	g_assert_cmpuint (rspamd_roll_history_reset (history), ==, 10);
+	rspamd_roll_history_query_init (&query);
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 0);
+
+	rspamd_roll_history_test_write (path, 0, 20);
+	ret = rspamd_roll_history_load (history, path);
+	g_assert (ret);
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 16);
+	g_assert_cmpstr (ROW (rows, 0)->message_id, ==, "msg19");
+	g_assert_cmpstr (ROW (rows, 15)->message_id, ==, "msg4");
+
+	unlink (path);
+	g_free (path);
+	g_array_free (rows, TRUE);
+}
+
+static struct roll_history *
+rspamd_roll_history_test_map (rspamd_mempool_t *pool, guint nrows,
+		const gchar *path)
+{
+	struct roll_history *history;
+	struct rspamd_config *cfg = rspamd_main->cfg;
+	gchar *old_file;
+
+	old_file = cfg->history_file;
+	cfg->history_file = (gchar *)path;
+	history = rspamd_roll_history_new (pool, nrows, cfg);
+	cfg->history_file = old_file;
+
+	g_assert (history != NULL);
+	g_assert (history->map != NULL);
+
+	return history;
+}
+
+static void
+rspamd_roll_history_file_test (rspamd_mempool_t *pool, const gchar *tmpdir)
+{
+	struct roll_history *history;
+	struct roll_history_query query;
+	GArray *rows;
+	gchar *path, magic[4];
+	guint32 nsymbols = G_MAXUINT32;
+	gssize r;
+	gboolean ret;
+	gint fd;
+
+	rows = g_array_new (FALSE, FALSE, sizeof (struct roll_history_row));
+	path = g_build_filename (tmpdir, "history", NULL);
+	rspamd_roll_history_query_init (&query);
+
+	/* Legacy json is converted on start */
+	rspamd_roll_history_test_write (path, 0, 10);
+	history = rspamd_roll_history_test_map (pool, 16, path);
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 10);
+	ret = rspamd_roll_history_save (history, path);
+	g_assert (ret);
+	munmap (history->map, history->map_len);
+
+	fd = open (path, O_RDWR);
+	g_assert (fd != -1);
+	r = read (fd, magic, sizeof (magic));
+	g_assert (r == sizeof (magic));
+	g_assert (memcmp (magic, "rsh2", sizeof (magic)) == 0);
+	close (fd);
+
+	/* Smaller ring keeps the newest rows and their symbols */
+	history = rspamd_roll_history_test_map (pool, 4, path);
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 4);
+	g_assert_cmpstr (ROW (rows, 0)->message_id, ==, "msg9");
+	g_assert_cmpstr (ROW (rows, 3)->message_id, ==, "msg6");
+	g_assert (rspamd_roll_history_test_has_symbol (history, ROW (rows, 0), "LAST"));
+	munmap (history->map, history->map_len);
+
+	/* Corrupted symbols counter must not let lookups out of the table */
+	fd = open (path, O_RDWR);
+	g_assert (fd != -1);
+	r = pwrite (fd, &nsymbols, sizeof (nsymbols), 16);
+	g_assert (r == sizeof (nsymbols));
+	close (fd);
+
+	history = rspamd_roll_history_test_map (pool, 4, path);
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 4);
+	g_assert (rspamd_roll_history_test_has_symbol (history, ROW (rows, 0), "LAST"));
+	g_assert (rspamd_roll_history_symbol_name (history,
+			HISTORY_MAX_SYMBOL_NAMES - 1) == NULL);
+	g_assert (rspamd_roll_history_symbol_name (history,
+			HISTORY_MAX_SYMBOL_NAMES) == NULL);
+	query.symbol = "LAST";
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 1);
+	munmap (history->map, history->map_len);
+
+	unlink (path);
+	g_free (path);
+	g_array_free (rows, TRUE);
+}
+
+/* Unique symbols of overwritten rows are reclaimed once the table is full */
+static void
+rspamd_roll_history_reclaim_test (rspamd_mempool_t *pool, const gchar *tmpdir)
+{
+	struct roll_history *history;
+	struct roll_history_query query;
+	GArray *rows;
+	GString *out;
+	gchar *path, name[32];
+	guint i, j, nrows;
+	gboolean ret;
+
+	rows = g_array_new (FALSE, FALSE, sizeof (struct roll_history_row));
+	path = g_build_filename (tmpdir, "symbols.json", NULL);
+	history = rspamd_roll_history_new (pool, 4, rspamd_main->cfg);
+	nrows = HISTORY_MAX_SYMBOL_NAMES / HISTORY_MAX_ROW_SYMBOLS * 2;
+
+	for (i = 0; i < nrows; i ++) {
+		out = g_string_new (NULL);
+		rspamd_printf_gstring (out, "[{\"time\":%d.5,\"id\":\"msg%d\",\"symbols\":\"",
+				1000 + i, i);
+
+		for (j = 0; j < HISTORY_MAX_ROW_SYMBOLS; j ++) {
+			rspamd_printf_gstring (out, "%sS%d_%d", j > 0 ? ", " : "", i, j);
+		}
+
+		g_string_append (out, "\"}]");
+		ret = g_file_set_contents (path, out->str, out->len, NULL);
+		g_assert (ret);
+		g_string_free (out, TRUE);
+		ret = rspamd_roll_history_load (history, path);
+		g_assert (ret);
+	}
+
+	rspamd_roll_history_query_init (&query);
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 4);
+
+	for (i = 0; i < rows->len; i ++) {
+		g_assert_cmpuint (ROW (rows, i)->nsymbols, ==, HISTORY_MAX_ROW_SYMBOLS);
+
+		for (j = 0; j < HISTORY_MAX_ROW_SYMBOLS; j ++) {
+			rspamd_snprintf (name, sizeof (name), "S%d_%d", nrows - 1 - i, j);
+			g_assert_cmpstr (rspamd_roll_history_symbol_name (history,
+					ROW (rows, i)->symbols[j]), ==, name);
+		}
+	}
+
+	rspamd_snprintf (name, sizeof (name), "S%d_0", nrows - 1);
+	query.symbol = name;
+	g_assert_cmpuint (rspamd_roll_history_test_query (history, &query, rows), ==, 1);
+
+	unlink (path);
+	g_free (path);
+	g_array_free (rows, TRUE);
+}
+
+void
+rspamd_roll_history_test_func (void)
+{
+	rspamd_mempool_t *pool;
+	GError *err = NULL;
+	gchar *tmpdir;
+
+	pool = rspamd_mempool_new (rspamd_mempool_suggest_size (), "history", 0);
+	tmpdir = g_dir_make_tmp ("rspamd-history-XXXXXX", &err);
+	g_assert_no_error (err);
+
+	rspamd_roll_history_query_test (pool, tmpdir);
+	rspamd_roll_history_file_test (pool, tmpdir);
+	rspamd_roll_history_reclaim_test (pool, tmpdir);
+
+	rmdir (tmpdir);
+	g_free (tmpdir);
+	rspamd_mempool_delete (pool);
+}
@@ -16,6 +16,7 @@
 #include "config.h"
 #include "rspamd.h"
 #include "shingles.h"
+#include "cryptobox.h"
 #include "ottery.h"
 #include <math.h>
 
@@ -136,6 +137,68 @@ test_case (gsize cnt, gsize max_len, gdouble perm_factor,
 	g_free (sgl_permuted);
 }
 
+static void
+test_multihash (enum rspamd_cryptobox_fast_hash_type ht, const gchar *name,
+		gsize max_len, gsize niters)
+{
+	guint64 seeds[RSPAMD_SHINGLE_SIZE], out_ref[RSPAMD_SHINGLE_SIZE],
+			out[RSPAMD_SHINGLE_SIZE];
+	GArray *input;
+	rspamd_ftok_t *w;
+	gdouble ts1, ts2, ts3;
+	gsize i, n;
+	guint j;
+
+	ottery_rand_bytes (seeds, sizeof (seeds));
+	input = generate_fuzzy_words (1000, max_len);
+
+	/* Check that optimized code produces the same output */
+	for (i = 0; i < input->len; i ++) {
+		w = &g_array_index (input, rspamd_ftok_t, i);
+
+		for (j = 0; j < RSPAMD_SHINGLE_SIZE; j ++) {
+			out_ref[j] = rspamd_cryptobox_fast_hash_specific (ht,
+					w->begin, w->len, seeds[j]);
+		}
+
+		rspamd_cryptobox_fast_hash_multi (ht, w->begin, w->len,
+				seeds, out, RSPAMD_SHINGLE_SIZE);
+		g_assert (memcmp (out, out_ref, sizeof (out)) == 0);
+	}
+
+	ts1 = rspamd_get_virtual_ticks ();
+
+	for (n = 0; n < niters; n ++) {
+		for (i = 0; i < input->len; i ++) {
+			w = &g_array_index (input, rspamd_ftok_t, i);
+
+			for (j = 0; j < RSPAMD_SHINGLE_SIZE; j ++) {
+				out_ref[j] = rspamd_cryptobox_fast_hash_specific (ht,
+						w->begin, w->len, seeds[j]);
+			}
+		}
+	}
+
+	ts2 = rspamd_get_virtual_ticks ();
+
+	for (n = 0; n < niters; n ++) {
+		for (i = 0; i < input->len; i ++) {
+			w = &g_array_index (input, rspamd_ftok_t, i);
+			rspamd_cryptobox_fast_hash_multi (ht, w->begin, w->len,
+					seeds, out, RSPAMD_SHINGLE_SIZE);
+		}
+	}
+
+	ts3 = rspamd_get_virtual_ticks ();
+
+	msg_info ("%s multihash (%z words of %z max len, %z iterations): "
+			"scalar time: %.4f sec, multihash time: %.4f sec",
+			name, (gsize)input->len, max_len, niters, ts2 - ts1, ts3 - ts2);
+
+	free_fuzzy_words (input);
+	g_array_free (input, TRUE);
+}
+
 static const guint64 expected_old[RSPAMD_SHINGLE_SIZE] = {
 	0x2a97e024235cedc5, 0x46238acbcc55e9e0, 0x2378ff151af075b3, 0xde1f29a95cad109,
 	0x5d3bbbdb5db5d19f, 0x4d75a0ec52af10a6, 0x215ecd6372e755b5, 0x7b52295758295350,
@@ -231,6 +294,12 @@ rspamd_shingles_test_func (void)
 	}
 	g_free (sgl);
 
+	test_multihash (RSPAMD_CRYPTOBOX_XXHASH64, "xxhash", 8, 100);
+	test_multihash (RSPAMD_CRYPTOBOX_XXHASH64, "xxhash", 40, 100);
+	test_multihash (RSPAMD_CRYPTOBOX_HASHFAST_INDEPENDENT, "fasthash", 8, 100);
+	test_multihash (RSPAMD_CRYPTOBOX_HASHFAST_INDEPENDENT, "fasthash", 16, 100);
+	test_multihash (RSPAMD_CRYPTOBOX_HASHFAST_INDEPENDENT, "fasthash", 40, 100);
+
 	for (alg = RSPAMD_SHINGLES_OLD; alg <= RSPAMD_SHINGLES_FAST; alg ++) {
 		test_case (200, 10, 0.1, alg);
 		test_case (500, 20, 0.01, alg);
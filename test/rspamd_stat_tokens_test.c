@@ -0,0 +1,294 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rspamd.h"
+#include "stat_internal.h"
+#include "lua/lua_common.h"
+#include "tests.h"
+#include <math.h>
+
+#define NSTATFILES 2
+#define TOKEN_SIZE (sizeof (rspamd_token_t) + sizeof (float) * NSTATFILES)
+
+struct test_token {
+	guint64 data;
+	guint window_idx;
+	gfloat spam;
+	gfloat ham;
+	guint count;
+};
+
+static const struct test_token bayes_tokens[] = {
+	{0xdeadbeefULL, 1, 40, 2, 3},
+	{0xcafebabeULL, 2, 3, 30, 2},
+	{0x1ULL, 1, 25, 5, 1},
+	{0xffffffffffffffffULL, 3, 7, 12, 4},
+};
+
+extern struct rspamd_main *rspamd_main;
+
+static rspamd_token_t *
+new_token (rspamd_mempool_t *pool, const struct test_token *tt)
+{
+	rspamd_token_t *tok;
+
+	tok = rspamd_mempool_alloc0 (pool, TOKEN_SIZE);
+	tok->data = tt->data;
+	tok->window_idx = tt->window_idx;
+	tok->flags = RSPAMD_STAT_TOKEN_FLAG_TEXT;
+	tok->count = 1;
+	tok->values[0] = tt->spam;
+	tok->values[1] = tt->ham;
+
+	return tok;
+}
+
+static void
+rspamd_stat_tokens_merge_test (rspamd_mempool_t *pool)
+{
+	static const guint64 hashes[] = {7, 3, 7, 1, 3, 7, 0xffffffffffffffffULL, 1};
+	static const guint64 expected_data[] = {1, 3, 7, 0xffffffffffffffffULL};
+	static const guint expected_count[] = {2, 2, 3, 1};
+	struct test_token tt;
+	GPtrArray *tokens;
+	rspamd_token_t *tok;
+	guint i, nunique, total = 0;
+
+	tokens = g_ptr_array_new ();
+	memset (&tt, 0, sizeof (tt));
+
+	for (i = 0; i < G_N_ELEMENTS (hashes); i ++) {
+		tt.data = hashes[i];
+		tt.window_idx = i;
+		g_ptr_array_add (tokens, new_token (pool, &tt));
+	}
+
+	nunique = rspamd_stat_tokens_merge (tokens, pool, TOKEN_SIZE);
+	g_assert_cmpuint (nunique, ==, G_N_ELEMENTS (expected_data));
+	g_assert_cmpuint (tokens->len, ==, nunique);
+
+	for (i = 0; i < tokens->len; i ++) {
+		tok = g_ptr_array_index (tokens, i);
+		g_assert_cmpuint (tok->data, ==, expected_data[i]);
+		g_assert_cmpuint (tok->count, ==, expected_count[i]);
+		total += tok->count;
+
+		/* Unique tokens are stored in a single flat chunk */
+		if (i > 0) {
+			g_assert ((guchar *)tok ==
+					(guchar *)g_ptr_array_index (tokens, i - 1) + TOKEN_SIZE);
+		}
+	}
+
+	g_assert_cmpuint (total, ==, G_N_ELEMENTS (hashes));
+
+	/* Empty array must be kept as is */
+	g_ptr_array_set_size (tokens, 0);
+	g_assert_cmpuint (rspamd_stat_tokens_merge (tokens, pool, TOKEN_SIZE), ==, 0);
+
+	g_ptr_array_free (tokens, TRUE);
+}
+
+static gdouble
+rspamd_stat_bayes_prob (struct rspamd_classifier *cl, GPtrArray *tokens)
+{
+	struct rspamd_task *task;
+	gdouble *pprob, ret = NAN;
+	gboolean res;
+
+	task = rspamd_task_new (NULL, rspamd_main->cfg, NULL, NULL, NULL, FALSE);
+	res = bayes_classify (cl, tokens, task);
+	g_assert (res);
+	pprob = rspamd_mempool_get_variable (task->task_pool, "bayes_prob");
+
+	if (pprob) {
+		ret = *pprob;
+	}
+
+	rspamd_task_free (task);
+
+	return ret;
+}
+
+/*
+ * Merged tokens must produce the same bayes probability as the same tokens
+ * repeated as many times as they occur in a message
+ */
+static void
+rspamd_stat_bayes_count_test (rspamd_mempool_t *pool)
+{
+	struct rspamd_stat_ctx st_ctx;
+	struct rspamd_classifier cl;
+	struct rspamd_classifier_config *clcf;
+	struct rspamd_statfile *st;
+	struct rspamd_statfile_config *stcf;
+	GPtrArray *merged, *repeated;
+	rspamd_token_t *tok;
+	gdouble merged_prob, repeated_prob;
+	guint i, j;
+	gint id;
+
+	memset (&st_ctx, 0, sizeof (st_ctx));
+	memset (&cl, 0, sizeof (cl));
+	st_ctx.statfiles = g_ptr_array_new ();
+	clcf = rspamd_mempool_alloc0 (pool, sizeof (*clcf));
+	clcf->name = "bayes";
+	clcf->min_token_hits = 2;
+	cl.ctx = &st_ctx;
+	cl.cfg = clcf;
+	cl.spam_learns = 100;
+	cl.ham_learns = 100;
+	cl.statfiles_ids = g_array_new (FALSE, FALSE, sizeof (gint));
+
+	for (id = 0; id < NSTATFILES; id ++) {
+		stcf = rspamd_mempool_alloc0 (pool, sizeof (*stcf));
+		stcf->is_spam = (id == 0);
+		stcf->symbol = id == 0 ? "BAYES_SPAM" : "BAYES_HAM";
+		stcf->clcf = clcf;
+		st = rspamd_mempool_alloc0 (pool, sizeof (*st));
+		st->id = id;
+		st->stcf = stcf;
+		st->classifier = &cl;
+		g_ptr_array_add (st_ctx.statfiles, st);
+		g_array_append_val (cl.statfiles_ids, id);
+	}
+
+	merged = g_ptr_array_new ();
+	repeated = g_ptr_array_new ();
+
+	for (i = 0; i < G_N_ELEMENTS (bayes_tokens); i ++) {
+		for (j = 0; j < bayes_tokens[i].count; j ++) {
+			tok = new_token (pool, &bayes_tokens[i]);
+			g_ptr_array_add (repeated, tok);
+			g_ptr_array_add (merged, new_token (pool, &bayes_tokens[i]));
+		}
+	}
+
+	rspamd_stat_tokens_merge (merged, pool, TOKEN_SIZE);
+	g_assert_cmpuint (merged->len, ==, G_N_ELEMENTS (bayes_tokens));
+
+	repeated_prob = rspamd_stat_bayes_prob (&cl, repeated);
+	merged_prob = rspamd_stat_bayes_prob (&cl, merged);
+
+	g_assert (isfinite (repeated_prob));
+	g_assert (fabs (merged_prob - repeated_prob) < 1e-9);
+
+	g_ptr_array_free (merged, TRUE);
+	g_ptr_array_free (repeated, TRUE);
+	g_array_free (cl.statfiles_ids, TRUE);
+	g_ptr_array_free (st_ctx.statfiles, TRUE);
+}
+
+/* Counts occurrences of tokens passed to a lua classifier */
+static const gchar lua_classifier_script[] =
+		"local function count_tokens(tokens)\n"
+		"  local n = 0\n"
+		"  for _,t in ipairs(tokens) do n = n + t[4] end\n"
+		"  return n\n"
+		"end\n"
+		"rspamd_classifiers = rspamd_classifiers or {}\n"
+		"rspamd_classifiers['test_count'] = {\n"
+		"  classify = function(task, cfg, tokens)\n"
+		"    test_classify_tokens = count_tokens(tokens)\n"
+		"  end,\n"
+		"  learn = function(task, cfg, tokens, is_spam, unlearn)\n"
+		"    test_learn_tokens = count_tokens(tokens)\n"
+		"  end,\n"
+		"}\n";
+
+static guint
+rspamd_stat_lua_seen (lua_State *L, const gchar *global)
+{
+	guint ret;
+
+	lua_getglobal (L, global);
+	g_assert (lua_isnumber (L, -1));
+	ret = lua_tointeger (L, -1);
+	lua_pop (L, 1);
+
+	return ret;
+}
+
+/*
+ * Lua classifiers must see every occurrence of merged tokens as they did
+ * when duplicates were passed separately
+ */
+static void
+rspamd_stat_lua_count_test (rspamd_mempool_t *pool)
+{
+	struct rspamd_config *cfg = rspamd_main->cfg;
+	lua_State *L = cfg->lua_state;
+	struct rspamd_stat_ctx st_ctx;
+	struct rspamd_stat_classifier subrs;
+	struct rspamd_classifier cl;
+	struct rspamd_task *task;
+	GPtrArray *merged;
+	guint i, j, total = 0;
+	gboolean res;
+	gint ret;
+
+	ret = luaL_dostring (L, lua_classifier_script);
+	g_assert_cmpint (ret, ==, 0);
+
+	memset (&st_ctx, 0, sizeof (st_ctx));
+	memset (&subrs, 0, sizeof (subrs));
+	memset (&cl, 0, sizeof (cl));
+	st_ctx.cfg = cfg;
+	subrs.name = "test_count";
+	cl.ctx = &st_ctx;
+	cl.subrs = &subrs;
+	cl.cfg = rspamd_mempool_alloc0 (pool, sizeof (*cl.cfg));
+	cl.cfg->name = "test_count";
+	res = lua_classifier_init (cfg, NULL, &cl);
+	g_assert (res);
+
+	merged = g_ptr_array_new ();
+
+	for (i = 0; i < G_N_ELEMENTS (bayes_tokens); i ++) {
+		for (j = 0; j < bayes_tokens[i].count; j ++) {
+			g_ptr_array_add (merged, new_token (pool, &bayes_tokens[i]));
+			total ++;
+		}
+	}
+
+	rspamd_stat_tokens_merge (merged, pool, TOKEN_SIZE);
+	g_assert_cmpuint (merged->len, <, total);
+
+	task = rspamd_task_new (NULL, cfg, NULL, NULL, NULL, FALSE);
+	res = lua_classifier_classify (&cl, merged, task);
+	g_assert (res);
+	g_assert_cmpuint (rspamd_stat_lua_seen (L, "test_classify_tokens"), ==, total);
+	res = lua_classifier_learn_spam (&cl, merged, task, TRUE, FALSE, NULL);
+	g_assert (res);
+	g_assert_cmpuint (rspamd_stat_lua_seen (L, "test_learn_tokens"), ==, total);
+	rspamd_task_free (task);
+
+	g_ptr_array_free (merged, TRUE);
+}
+
+void
+rspamd_stat_tokens_test_func (void)
+{
+	rspamd_mempool_t *pool;
+
+	pool = rspamd_mempool_new (rspamd_mempool_suggest_size (), "stat", 0);
+
+	rspamd_stat_tokens_merge_test (pool);
+	rspamd_stat_bayes_count_test (pool);
+	rspamd_stat_lua_count_test (pool);
+
+	rspamd_mempool_delete (pool);
+}
@@ -84,10 +84,16 @@ main (int argc, char **argv)
 	g_test_add_func ("/rspamd/cryptobox", rspamd_cryptobox_test_func);
 	g_test_add_func ("/rspamd/heap", rspamd_heap_test_func);
 	g_test_add_func ("/rspamd/lua_pcall", rspamd_lua_lua_pcall_vs_resume_test_func);
+	g_test_add_func ("/rspamd/url", rspamd_url_test_func);
+	g_test_add_func ("/rspamd/stat_tokens", rspamd_stat_tokens_test_func);
+	g_test_add_func ("/rspamd/mmaped_table", rspamd_mmaped_table_test_func);
+	g_test_add_func ("/rspamd/map_snapshot", rspamd_map_snapshot_test_func);
+	g_test_add_func ("/rspamd/roll_history", rspamd_roll_history_test_func);
+	g_test_add_func ("/rspamd/latency_hist", rspamd_latency_hist_test_func);
+	g_test_add_func ("/rspamd/dns_cache", rspamd_dns_cache_test_func);
 
 #if 0
 	g_test_add_func ("/rspamd/http", rspamd_http_test_func);
-	g_test_add_func ("/rspamd/url", rspamd_url_test_func);
 	g_test_add_func ("/rspamd/statfile", rspamd_statfile_test_func);
 	g_test_add_func ("/rspamd/aio", rspamd_async_test_func);
 #endif
@@ -59,7 +59,8 @@ rspamd_upstream_test_func (void)
 	struct upstream *up, *upn;
 	struct rspamd_dns_resolver *resolver;
 	struct rspamd_config *cfg;
-	gint i, success = 0;
+	gint i, idx, success = 0, latency_hits[3] = {0, 0, 0};
+	guint inflight;
 	const gint assumptions = 100500;
 	gdouble p;
 	static ev_timer ev;
@@ -162,6 +163,67 @@ rspamd_upstream_test_func (void)
 
 	rspamd_upstreams_destroy (nls);
 
+	/* Test latency rotation: the slowest upstream should get the least traffic */
+	nls = rspamd_upstreams_create (cfg->ups_ctx);
+	g_assert (rspamd_upstreams_parse_line (nls,
+			"latency:127.0.0.1,127.0.0.2,127.0.0.3", 443, NULL));
+
+	for (i = 0; i < 3000; i ++) {
+		up = rspamd_upstream_get (nls, RSPAMD_UPSTREAM_ROUND_ROBIN, NULL, 0);
+		g_assert (up != NULL);
+		idx = rspamd_upstream_name (up)[strlen ("127.0.0.")] - '1';
+		latency_hits[idx] ++;
+		rspamd_upstream_ok_latency (up, 0.01 * (idx + 1));
+	}
+
+	msg_debug ("latency rotation hits: %d, %d, %d", latency_hits[0],
+			latency_hits[1], latency_hits[2]);
+	g_assert (latency_hits[0] > latency_hits[1]);
+	g_assert (latency_hits[1] > latency_hits[2]);
+
+	/* Requests are balanced by completions */
+	for (i = 0; i < 3; i ++) {
+		up = rspamd_upstream_get (nls, RSPAMD_UPSTREAM_ROUND_ROBIN, NULL, 0);
+		rspamd_upstream_latency (up, &inflight);
+		g_assert_cmpuint (inflight, ==, 1);
+		rspamd_upstream_ok_latency (up, 0.01);
+		rspamd_upstream_latency (up, &inflight);
+		g_assert_cmpuint (inflight, ==, 0);
+	}
+
+	rspamd_upstreams_destroy (nls);
+
+	/* Single upstream takes the fast path but still counts requests */
+	nls = rspamd_upstreams_create (cfg->ups_ctx);
+	g_assert (rspamd_upstreams_parse_line (nls, "latency:127.0.0.1", 443, NULL));
+	up = rspamd_upstream_get (nls, RSPAMD_UPSTREAM_ROUND_ROBIN, NULL, 0);
+	g_assert (up != NULL);
+	rspamd_upstream_latency (up, &inflight);
+	g_assert_cmpuint (inflight, ==, 1);
+	rspamd_upstream_ok (up);
+	rspamd_upstream_latency (up, &inflight);
+	g_assert_cmpuint (inflight, ==, 0);
+	rspamd_upstreams_destroy (nls);
+
+	/* Failure of an upstream without samples must make it look slow */
+	nls = rspamd_upstreams_create (cfg->ups_ctx);
+	g_assert (rspamd_upstreams_parse_line (nls,
+			"latency:127.0.0.1,127.0.0.2", 443, NULL));
+	up = rspamd_upstream_get (nls, RSPAMD_UPSTREAM_ROUND_ROBIN, NULL, 0);
+	g_assert (up != NULL);
+	g_assert_cmpfloat (rspamd_upstream_latency (up, NULL), ==, 0);
+	rspamd_upstream_fail (up, FALSE, "test");
+	rspamd_upstream_latency (up, &inflight);
+	g_assert_cmpuint (inflight, ==, 0);
+	g_assert_cmpfloat (rspamd_upstream_latency (up, NULL), >, 0);
+
+	for (i = 0; i < 10; i ++) {
+		upn = rspamd_upstream_get (nls, RSPAMD_UPSTREAM_ROUND_ROBIN, NULL, 0);
+		g_assert (upn != up);
+		rspamd_upstream_ok (upn);
+	}
+
+	rspamd_upstreams_destroy (nls);
 
 	/* Upstream fail test */
 	ev.data = resolver;
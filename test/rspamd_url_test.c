@@ -53,9 +53,163 @@ const char *test_text =
 "http://vsem.ru?action;\n";
 const char *test_html = "<some_tag>This is test file with <a href=\"http://microsoft.com\">http://TesT.com/././?%45%46%20 url</a></some_tag>";
 
+static const gchar *filler_words[] = {
+	"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+	"elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+	"et", "dolore", "magna", "aliqua"
+};
+
+static gboolean
+test_url_collect_cb (struct rspamd_url *url, gsize start_offset,
+		gsize end_offset, gpointer ud)
+{
+	GPtrArray *res = ud;
+
+	g_ptr_array_add (res, g_strdup_printf ("%" G_GSIZE_FORMAT "-%" G_GSIZE_FORMAT
+			" %.*s", start_offset, end_offset, (gint)url->urllen, url->string));
+
+	return TRUE;
+}
+
+/*
+ * Appends each line of `test_text` followed by a paragraph of words without
+ * urls, that is the part of a text skipped by prefilter
+ */
+static void
+test_url_add_text (GString *res, guint nwords, guint ncopies)
+{
+	gchar **lines = g_strsplit (test_text, "\n", -1), **cur;
+	guint i, j;
+
+	for (i = 0; i < ncopies; i ++) {
+		for (cur = lines; *cur != NULL; cur ++) {
+			g_string_append (res, *cur);
+			g_string_append_c (res, '\n');
+
+			for (j = 0; j < nwords; j ++) {
+				g_string_append (res,
+						filler_words[j % G_N_ELEMENTS (filler_words)]);
+				g_string_append_c (res, ' ');
+			}
+
+			g_string_append_c (res, '\n');
+		}
+	}
+
+	g_strfreev (lines);
+}
+
+/* Appends all test messages */
+static void
+test_url_add_messages (GString *res, const gchar *dir)
+{
+	GDir *d;
+	const gchar *name;
+	gchar *path, *content;
+	gsize len;
+
+	d = g_dir_open (dir, 0, NULL);
+	g_assert (d != NULL);
+
+	while ((name = g_dir_read_name (d)) != NULL) {
+		if (!g_str_has_suffix (name, ".eml")) {
+			continue;
+		}
+
+		path = g_build_filename (dir, name, NULL);
+
+		if (g_file_get_contents (path, &content, &len, NULL)) {
+			g_string_append_len (res, content, len);
+			g_free (content);
+		}
+
+		g_free (path);
+	}
+
+	g_dir_close (d);
+}
+
+static GPtrArray *
+test_url_extract (rspamd_mempool_t *pool, GString *text,
+		enum rspamd_url_find_type how)
+{
+	GPtrArray *res = g_ptr_array_new_with_free_func (g_free);
+
+	rspamd_url_find_multiple (pool, text->str, text->len,
+			how, NULL, test_url_collect_cb, res);
+
+	return res;
+}
+
+static gdouble
+test_url_throughput (rspamd_mempool_t *pool, GString *text, guint niters,
+		gboolean prefilter)
+{
+	gdouble ts1, ts2;
+	guint i;
+
+	rspamd_url_set_prefilter (prefilter);
+	ts1 = rspamd_get_virtual_ticks ();
+
+	for (i = 0; i < niters; i ++) {
+		g_ptr_array_free (test_url_extract (pool, text, RSPAMD_URL_FIND_ALL),
+				TRUE);
+	}
+
+	ts2 = rspamd_get_virtual_ticks ();
+	rspamd_url_set_prefilter (TRUE);
+
+	return text->len * niters / (ts2 - ts1) / 1e6;
+}
+
 /* Function for using in glib test suite */
 void
 rspamd_url_test_func (void)
 {
-	/* XXX: maybe write test for this */
+	static const enum rspamd_url_find_type types[] = {
+		RSPAMD_URL_FIND_ALL,
+		RSPAMD_URL_FIND_STRICT,
+	};
+	rspamd_mempool_t *pool;
+	GString *corpus;
+	GPtrArray *whole_urls, *prefiltered_urls;
+	gdouble whole_speed, prefiltered_speed;
+	guint i, j, niters = 10;
+
+	/* TLD patterns are used for schemeless urls */
+	rspamd_url_init (RSPAMD_TEST_DIR "/lua/unit/test_tld.dat");
+	pool = rspamd_mempool_new (rspamd_mempool_suggest_size (), "url", 0);
+	corpus = g_string_new (NULL);
+	test_url_add_text (corpus, 200, 10);
+	test_url_add_messages (corpus, RSPAMD_TEST_DIR "/functional/messages");
+
+	/* Prefiltered scan must produce the same urls as the whole text scan */
+	for (i = 0; i < G_N_ELEMENTS (types); i ++) {
+		rspamd_url_set_prefilter (FALSE);
+		whole_urls = test_url_extract (pool, corpus, types[i]);
+		rspamd_url_set_prefilter (TRUE);
+		prefiltered_urls = test_url_extract (pool, corpus, types[i]);
+
+		g_assert_cmpuint (whole_urls->len, >, 0);
+		g_assert_cmpuint (whole_urls->len, ==, prefiltered_urls->len);
+
+		for (j = 0; j < whole_urls->len; j ++) {
+			g_assert_cmpstr (g_ptr_array_index (whole_urls, j), ==,
+					g_ptr_array_index (prefiltered_urls, j));
+		}
+
+		g_ptr_array_free (whole_urls, TRUE);
+		g_ptr_array_free (prefiltered_urls, TRUE);
+	}
+
+	whole_speed = test_url_throughput (pool, corpus, niters, FALSE);
+	prefiltered_speed = test_url_throughput (pool, corpus, niters, TRUE);
+
+	msg_info ("url find (%z bytes, %ud iterations): whole text scan: %.2f MB/s, "
+			"prefiltered scan: %.2f MB/s",
+			corpus->len, niters, whole_speed, prefiltered_speed);
+
+	g_string_free (corpus, TRUE);
+	rspamd_mempool_delete (pool);
+	rspamd_url_init (NULL);
 }
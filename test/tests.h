@@ -42,6 +42,24 @@ void rspamd_cryptobox_test_func (void);
 
 void rspamd_heap_test_func (void);
 
+/* Statistics tokens merging */
+void rspamd_stat_tokens_test_func (void);
+
+/* Statistics mmap_table backend */
+void rspamd_mmaped_table_test_func (void);
+
+/* Shared snapshots of map helpers */
+void rspamd_map_snapshot_test_func (void);
+
+/* Columnar roll history */
+void rspamd_roll_history_test_func (void);
+
+/* Latency histograms */
+void rspamd_latency_hist_test_func (void);
+
+/* DNS answers cache and requests coalescing */
+void rspamd_dns_cache_test_func (void);
+
 void rspamd_lua_lua_pcall_vs_resume_test_func (void);
 
 #ifdef  __cplusplus